@@ -0,0 +1,78 @@
+#include "binaural.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+// Renders moving mono sources through the binaural renderer offline and reports the cost per block,
+// the directions that needed filtering and how many sources one core could keep up with.
+// Usage: binauralBench [sample rate] [seconds of audio per count]
+
+namespace {
+    volatile float sink;
+}
+
+int main(int argc, char** argv) {
+    int sampleRate = argc > 1 ? std::atoi(argv[1]) : 48000;
+    float seconds = argc > 2 ? static_cast<float>(std::atof(argv[2])) : 5.0f;
+
+    constexpr unsigned int Length = 1024; // FMOD's default mix block
+    constexpr int Channels = 2;
+
+    auto hrirs = HRIRSet::synthesize(sampleRate);
+
+    std::mt19937 random{ 1 };
+    std::uniform_real_distribution<float> noise{ -1.0f, 1.0f };
+    std::vector<float> mono(Length);
+    for (auto& sample : mono) {
+        sample = noise(random);
+    }
+    std::vector<float> bus(Length * Channels, 0.0f);
+    std::vector<float> outbuffer(Length * Channels);
+
+    std::cout << hrirs->getDirectionCount() << " directions, " << hrirs->taps << " taps, " << dsp::simdLevelName(dsp::simdLevel()) << ", "
+              << sampleRate << " Hz, " << seconds << " s per count" << std::endl;
+    std::cout << std::right << std::setw(8) << "sources" << std::setw(12) << "us/block" << std::setw(12) << "directions" << std::setw(10)
+              << "% core" << std::setw(14) << "sources/core" << std::endl;
+    std::cout << std::fixed;
+
+    for (uint32_t count : { 1u, 8u, 16u, 32u, 64u, 128u }) {
+        BinauralRenderer renderer{ nullptr, hrirs, Length };
+
+        std::vector<uint32_t> sources;
+        std::vector<float> speeds;
+        for (uint32_t i = 0; i < count; i++) {
+            sources.push_back(renderer.addSource());
+            speeds.push_back(noise(random));
+        }
+
+        int blocks = static_cast<int>(seconds * sampleRate / Length);
+        double directions = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (int block = 0; block < blocks; block++) {
+            // Sources circle the listener at different heights, as moving emitters do in game
+            float time = static_cast<float>(block) * Length / sampleRate;
+            for (uint32_t i = 0; i < count; i++) {
+                float angle = speeds[i] * time + static_cast<float>(i);
+                renderer.setSourcePosition(sources[i], { 5.0f * std::cos(angle), std::sin(angle * 0.5f) * 2.0f, 5.0f * std::sin(angle) });
+                renderer.send(sources[i], mono.data(), Length, 1);
+            }
+            renderer.render(bus.data(), outbuffer.data(), Length, Channels, Channels);
+            directions += renderer.getActiveDirections();
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double audio = static_cast<double>(blocks) * Length / sampleRate;
+        double share = elapsed / audio;
+        std::cout << std::setw(8) << count << std::setw(12) << std::setprecision(1) << elapsed * 1e6 / blocks << std::setw(12)
+                  << std::setprecision(1) << directions / blocks << std::setw(10) << std::setprecision(2) << 100.0 * share << std::setw(14)
+                  << std::setprecision(0) << count / share << std::endl;
+        sink = outbuffer[Length / 2];
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#include "convolution.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+// Runs the partitioned convolution reverb on stereo noise for a range of impulse response lengths
+// and reports the cost per block and the share of one core it needs to keep up in real time.
+// Usage: convolutionBench [sample rate] [seconds of audio per length]
+
+namespace {
+    volatile float sink;
+}
+
+int main(int argc, char** argv) {
+    int sampleRate = argc > 1 ? std::atoi(argv[1]) : 48000;
+    float seconds = argc > 2 ? static_cast<float>(std::atof(argv[2])) : 10.0f;
+
+    constexpr unsigned int Length = 1024; // FMOD's default mix block
+    constexpr int Channels = 2;
+
+    std::mt19937 random{ 1 };
+    std::uniform_real_distribution<float> noise{ -1.0f, 1.0f };
+    std::vector<float> inbuffer(Length * Channels);
+    std::vector<float> outbuffer(Length * Channels);
+    for (auto& sample : inbuffer) {
+        sample = noise(random);
+    }
+
+    std::cout << "Partition " << ConvolutionReverb::BlockSize << ", FFT " << ConvolutionReverb::FFTSize << ", " << sampleRate << " Hz, "
+              << seconds << " s per length" << std::endl;
+    std::cout << std::left << std::setw(10) << "IR s" << std::right << std::setw(12) << "partitions" << std::setw(14) << "us/block"
+              << std::setw(12) << "x realtime" << std::setw(10) << "% core" << std::endl;
+    std::cout << std::fixed;
+
+    for (float length : { 0.1f, 0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f }) {
+        std::vector<float> samples(static_cast<size_t>(length * sampleRate));
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] = noise(random) * std::exp(-6.9f * static_cast<float>(i) / samples.size());
+        }
+        auto impulse = ImpulseResponse::fromSamples("bench", samples, sampleRate);
+
+        ConvolutionReverb reverb{ sampleRate, length };
+        reverb.setZones({ { impulse, 1.0f } });
+
+        // Warm up until the fade in is done, every block then convolves the full response once
+        int blocks = static_cast<int>(seconds * sampleRate / Length);
+        for (int i = 0; i < 64; i++) {
+            reverb.process(inbuffer.data(), outbuffer.data(), Length, Channels, Channels);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < blocks; i++) {
+            reverb.process(inbuffer.data(), outbuffer.data(), Length, Channels, Channels);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double audio = static_cast<double>(blocks) * Length / sampleRate;
+        std::cout << std::left << std::setw(10) << std::setprecision(2) << length << std::right << std::setw(12) << impulse->getPartitionCount()
+                  << std::setw(14) << std::setprecision(1) << elapsed * 1e6 / blocks << std::setw(12) << std::setprecision(1) << audio / elapsed
+                  << std::setw(10) << std::setprecision(2) << 100.0 * elapsed / audio << std::endl;
+        sink = outbuffer[Length / 2];
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+#include "dspgain.hpp"
+
+#include <fmod_errors.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+// Runs the custom gain DSP on synthetic buffers and reports ns/sample (one sample = one frame across all channels)
+// Usage: dspGainBench [block length] [iterations]
+
+#define FMOD_CHECK(result) if (result != FMOD_OK) { std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << FMOD_ErrorString(result) << std::endl; return EXIT_FAILURE; }
+
+namespace {
+    volatile float sink;
+
+    // The loop DSPCallback used before the kernels, kept as the baseline
+    void gainReference(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, const int* outchannels, const float* volume) {
+        for (unsigned int samp = 0; samp < length; samp++) {
+            for (int chan = 0; chan < *outchannels; chan++) {
+                outbuffer[(samp * *outchannels) + chan] = inbuffer[(samp * inchannels) + chan] * *volume;
+            }
+        }
+    }
+
+    /// @brief False and the first differing sample reported when a kernel strays from the reference
+    bool matches(const std::vector<float>& outbuffer, const std::vector<float>& expected, const std::string& name, int channels) {
+        for (size_t i = 0; i < expected.size(); i++) {
+            if (std::abs(outbuffer[i] - expected[i]) > 1e-6f) {
+                std::cerr << "***ERROR*** " << name << " at " << channels << " ch differs at sample " << i << ": " << outbuffer[i] << " vs " << expected[i] << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename Function>
+    double measure(unsigned int length, int iterations, Function function) {
+        function(); // warm up caches and the kernel selection
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            function();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        return ns / (static_cast<double>(length) * iterations);
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned int length = argc > 1 ? static_cast<unsigned int>(std::atoi(argv[1])) : 1024;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+    // A real DSP instance is needed so the callback can fetch its userdata
+    FMOD::System* system;
+    auto result = FMOD::System_Create(&system);
+    FMOD_CHECK(result);
+    result = system->setOutput(FMOD_OUTPUTTYPE_NOSOUND_NRT);
+    FMOD_CHECK(result);
+    result = system->init(32, FMOD_INIT_NORMAL, nullptr);
+    FMOD_CHECK(result);
+
+    float volume = 0.5f;
+    DSPUserdata data{ volume };
+
+    FMOD_DSP_DESCRIPTION dspdesc;
+    memset(&dspdesc, 0, sizeof(dspdesc));
+    std::strcpy(dspdesc.name, "DSP Custom Filter");
+    dspdesc.numinputbuffers = 1;
+    dspdesc.numoutputbuffers = 1;
+    dspdesc.create = DSPCreateCallback;
+    dspdesc.release = DSPReleaseCallback;
+    dspdesc.read = DSPCallback;
+    dspdesc.userdata = &data;
+
+    FMOD::DSP* dsp;
+    result = system->createDSP(&dspdesc, &dsp);
+    FMOD_CHECK(result);
+
+    DSPGainState gainState{ volume };
+    FMOD_DSP_STATE state;
+    memset(&state, 0, sizeof(state));
+    state.instance = dsp;
+    state.plugindata = &gainState;
+
+    auto detected = dsp::simdLevel();
+    std::cout << "Detected: " << dsp::simdLevelName(detected) << ", block " << length << ", " << iterations << " iterations" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    for (int channels : { 1, 2, 6, 8 }) {
+        std::vector<float> inbuffer(length * channels);
+        std::vector<float> outbuffer(length * channels);
+        for (size_t i = 0; i < inbuffer.size(); i++) {
+            inbuffer[i] = static_cast<float>(std::rand()) / RAND_MAX * 2.0f - 1.0f;
+        }
+
+        std::cout << channels << " ch:" << std::endl;
+
+        // Every kernel has to reproduce the reference before its timing means anything
+        std::vector<float> expected(length * channels);
+        gainReference(inbuffer.data(), expected.data(), length, channels, &channels, &volume);
+
+        double ns = measure(length, iterations, [&] {
+            gainReference(inbuffer.data(), outbuffer.data(), length, channels, &channels, &volume);
+        });
+        std::cout << "  reference  " << ns << " ns/sample" << std::endl;
+
+        for (auto level : { dsp::SimdLevel::Scalar, dsp::SimdLevel::SSE, dsp::SimdLevel::AVX2 }) {
+            if (level > detected)
+                break;
+            auto kernel = dsp::gainKernel(channels, channels, level);
+            std::fill(outbuffer.begin(), outbuffer.end(), 0.0f);
+            kernel(inbuffer.data(), outbuffer.data(), length, channels, channels, volume);
+            if (!matches(outbuffer, expected, dsp::simdLevelName(level), channels))
+                return EXIT_FAILURE;
+            ns = measure(length, iterations, [&] {
+                kernel(inbuffer.data(), outbuffer.data(), length, channels, channels, volume);
+            });
+            std::cout << "  " << std::left << std::setw(10) << dsp::simdLevelName(level) << std::right << " " << ns << " ns/sample" << std::endl;
+
+            // A ramp that starts and ends at the volume is the plain gain
+            auto ramp = dsp::rampKernel(channels, channels, level);
+            std::fill(outbuffer.begin(), outbuffer.end(), 0.0f);
+            ramp(inbuffer.data(), outbuffer.data(), length, channels, channels, volume, volume);
+            if (!matches(outbuffer, expected, std::string{ dsp::simdLevelName(level) } + " ramp", channels))
+                return EXIT_FAILURE;
+            ns = measure(length, iterations, [&] {
+                ramp(inbuffer.data(), outbuffer.data(), length, channels, channels, volume, 1.0f);
+            });
+            std::cout << "  " << std::left << std::setw(10) << (std::string{ dsp::simdLevelName(level) } + " ramp") << std::right << " " << ns << " ns/sample" << std::endl;
+        }
+
+        int outchannels = channels;
+        data.volume.store(volume, std::memory_order_relaxed);
+        gainState.current = volume;
+        std::fill(outbuffer.begin(), outbuffer.end(), 0.0f);
+        DSPCallback(&state, inbuffer.data(), outbuffer.data(), length, channels, &outchannels);
+        if (!matches(outbuffer, expected, "callback", channels))
+            return EXIT_FAILURE;
+        ns = measure(length, iterations, [&] {
+            DSPCallback(&state, inbuffer.data(), outbuffer.data(), length, channels, &outchannels);
+        });
+        std::cout << "  callback   " << ns << " ns/sample" << std::endl;
+
+        // Publish a new target every block so each callback takes the ramp path
+        float target = 0.0f;
+        ns = measure(length, iterations, [&] {
+            target = target > 1.0f ? 0.0f : target + 0.01f;
+            data.volume.store(target, std::memory_order_relaxed);
+            DSPCallback(&state, inbuffer.data(), outbuffer.data(), length, channels, &outchannels);
+        });
+        std::cout << "  cb ramp    " << ns << " ns/sample" << std::endl;
+
+        sink = outbuffer[length / 2];
+    }
+
+    dsp->release();
+    system->release();
+
+    return EXIT_SUCCESS;
+}
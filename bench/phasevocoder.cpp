@@ -0,0 +1,63 @@
+#include "phasevocoder.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+// Runs the phase vocoder on stereo noise at a range of pitch shifts and reports the cost per block
+// and per channel, the budget quoted in phasevocoder.hpp comes from here.
+// Usage: phaseVocoderBench [sample rate] [seconds of audio per shift]
+
+namespace {
+    volatile float sink;
+}
+
+int main(int argc, char** argv) {
+    int sampleRate = argc > 1 ? std::atoi(argv[1]) : 48000;
+    float seconds = argc > 2 ? static_cast<float>(std::atof(argv[2])) : 10.0f;
+
+    constexpr unsigned int Length = 1024; // FMOD's default mix block
+    constexpr int Channels = 2;
+
+    std::mt19937 random{ 1 };
+    std::uniform_real_distribution<float> noise{ -1.0f, 1.0f };
+    std::vector<float> inbuffer(Length * Channels);
+    std::vector<float> outbuffer(Length * Channels);
+    for (auto& sample : inbuffer) {
+        sample = noise(random);
+    }
+
+    std::cout << "FFT " << PhaseVocoder::FFTSize << ", hop " << PhaseVocoder::Hop << ", " << sampleRate << " Hz, " << seconds << " s per shift" << std::endl;
+    std::cout << std::left << std::setw(10) << "semitones" << std::right << std::setw(12) << "us/block" << std::setw(12) << "x realtime"
+              << std::setw(16) << "% core/channel" << std::endl;
+    std::cout << std::fixed;
+
+    for (float semitones : { 0.0f, -12.0f, -5.0f, -1.0f, 1.0f, 5.0f, 12.0f }) {
+        PhaseVocoder vocoder{ sampleRate };
+        vocoder.setPitch(semitones);
+
+        // Past the glide, every hop then shifts at the requested pitch
+        int blocks = static_cast<int>(seconds * sampleRate / Length);
+        for (int i = 0; i < 64; i++) {
+            vocoder.process(inbuffer.data(), outbuffer.data(), Length, Channels, Channels);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < blocks; i++) {
+            vocoder.process(inbuffer.data(), outbuffer.data(), Length, Channels, Channels);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double audio = static_cast<double>(blocks) * Length / sampleRate;
+        std::cout << std::left << std::setw(10) << std::setprecision(0) << semitones << std::right << std::setw(12) << std::setprecision(1)
+                  << elapsed * 1e6 / blocks << std::setw(12) << std::setprecision(1) << audio / elapsed << std::setw(16) << std::setprecision(2)
+                  << 100.0 * elapsed / audio / Channels << std::endl;
+        sink = outbuffer[Length / 2];
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#include "synth.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+// Renders every waveform with noise and the lowpass through each kernel level the CPU supports and
+// reports the cost per stream block, the dispatch in synth.cpp picks the fastest of these.
+// Usage: synthBench [sample rate] [seconds of audio per case]
+
+namespace {
+    volatile float sink;
+
+    const char* name(dsp::Waveform waveform) {
+        switch (waveform) {
+            case dsp::Waveform::Sine: return "sine";
+            case dsp::Waveform::Saw: return "saw";
+            case dsp::Waveform::Square: return "square";
+            case dsp::Waveform::Triangle: return "triangle";
+        }
+        return "";
+    }
+
+    const char* name(dsp::SimdLevel level) {
+        switch (level) {
+            case dsp::SimdLevel::Scalar: return "scalar";
+            case dsp::SimdLevel::SSE: return "sse";
+            case dsp::SimdLevel::AVX2: return "avx2";
+        }
+        return "";
+    }
+}
+
+int main(int argc, char** argv) {
+    int sampleRate = argc > 1 ? std::atoi(argv[1]) : 48000;
+    float seconds = argc > 2 ? static_cast<float>(std::atof(argv[2])) : 10.0f;
+
+    constexpr unsigned int Length = Synth::BlockLength;
+    std::vector<float> buffer(Length);
+    int blocks = static_cast<int>(seconds * sampleRate / Length);
+
+    std::cout << "Block " << Length << ", " << sampleRate << " Hz, " << seconds << " s per case" << std::endl;
+    std::cout << std::left << std::setw(10) << "waveform" << std::setw(8) << "kernel" << std::right << std::setw(12) << "ns/block"
+              << std::setw(14) << "x realtime" << std::endl;
+    std::cout << std::fixed;
+
+    for (auto waveform : { dsp::Waveform::Sine, dsp::Waveform::Saw, dsp::Waveform::Square, dsp::Waveform::Triangle }) {
+        for (auto level : { dsp::SimdLevel::Scalar, dsp::SimdLevel::SSE, dsp::SimdLevel::AVX2 }) {
+            if (level > dsp::simdLevel())
+                continue;
+
+            // Oscillator and noise through the kernels alone, the envelope and lowpass are the same for every level
+            auto oscillator = dsp::oscillatorKernel(waveform, level);
+            auto noise = dsp::noiseKernel(level);
+            alignas(32) uint32_t state[8]{ 1, 2, 3, 4, 5, 6, 7, 8 };
+            float phase = 0.0f;
+
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < blocks; i++) {
+                phase = oscillator(buffer.data(), Length, phase, 440.0f / sampleRate, 0.5f);
+                noise(buffer.data(), Length, state, 0.1f);
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            sink = buffer[Length / 2];
+
+            double audio = static_cast<double>(blocks) * Length / sampleRate;
+            std::cout << std::left << std::setw(10) << name(waveform) << std::setw(8) << name(level) << std::right << std::setw(12)
+                      << std::setprecision(0) << elapsed * 1e9 / blocks << std::setw(14) << std::setprecision(0) << audio / elapsed << std::endl;
+        }
+    }
+
+    // A whole gated synth, what the stream thread pays per voice
+    SynthPatch patch;
+    patch.waveform = dsp::Waveform::Saw;
+    patch.noise = 0.1f;
+    patch.cutoff = 3000.0f;
+    patch.gated = true;
+    patch.sustain = 0.5f;
+    Synth synth{ patch, sampleRate };
+    synth.trigger();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < blocks; i++) {
+        synth.render(buffer.data(), Length);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sink = buffer[Length / 2];
+
+    double audio = static_cast<double>(blocks) * Length / sampleRate;
+    std::cout << std::left << std::setw(10) << "synth" << std::setw(8) << name(dsp::simdLevel()) << std::right << std::setw(12)
+              << std::setprecision(0) << elapsed * 1e9 / blocks << std::setw(14) << std::setprecision(0) << audio / elapsed << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,77 @@
+#include "variation.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+// Mixes one variation engine offline at a range of trigger rates and reports the cost per mix block,
+// the time a trigger takes on the game thread, and how many grains were dropped at full polyphony.
+// Usage: variationBench [sample rate] [seconds of audio per rate]
+
+namespace {
+    volatile float sink;
+}
+
+int main(int argc, char** argv) {
+    int sampleRate = argc > 1 ? std::atoi(argv[1]) : 48000;
+    float seconds = argc > 2 ? static_cast<float>(std::atof(argv[2])) : 10.0f;
+
+    constexpr unsigned int Length = 1024; // FMOD's default mix block
+
+    // Six 200 ms noise bursts stand in for impacts, recorded at a rate other than the mixer's
+    std::mt19937 random{ 1 };
+    std::uniform_real_distribution<float> noise{ -1.0f, 1.0f };
+    std::vector<float> burst(8820);
+    SamplePool pool{ 1u << 20 };
+    VariationSet set;
+    set.offset = 0.5f;
+    set.minLength = 0.05f;
+    set.maxLength = 0.2f;
+    for (int i = 0; i < 6; i++) {
+        for (auto& sample : burst) {
+            sample = noise(random);
+        }
+        set.samples.push_back(pool.add(burst.data(), static_cast<uint32_t>(burst.size()), 44100.0f));
+    }
+
+    std::vector<float> output(Length);
+    int blocks = static_cast<int>(seconds * sampleRate / Length);
+    float blockSeconds = static_cast<float>(Length) / static_cast<float>(sampleRate);
+
+    std::cout << "Block " << Length << ", " << sampleRate << " Hz, " << seconds << " s per rate, " << VariationEngine::MaxGrains << " grains" << std::endl;
+    std::cout << std::right << std::setw(10) << "triggers/s" << std::setw(12) << "us/block" << std::setw(12) << "ns/trigger"
+              << std::setw(12) << "x realtime" << std::setw(10) << "dropped" << std::endl;
+    std::cout << std::fixed;
+
+    for (float rate : { 10.0f, 100.0f, 250.0f, 500.0f, 1000.0f }) {
+        VariationEngine engine{ nullptr, pool, set, sampleRate };
+
+        double triggerTime = 0.0;
+        double mixTime = 0.0;
+        float pending = 0.0f;
+        for (int i = 0; i < blocks; i++) {
+            auto start = std::chrono::steady_clock::now();
+            for (pending += rate * blockSeconds; pending >= 1.0f; pending -= 1.0f) {
+                engine.trigger();
+            }
+            auto triggered = std::chrono::steady_clock::now();
+            engine.process(output.data(), Length);
+            auto mixed = std::chrono::steady_clock::now();
+
+            triggerTime += std::chrono::duration<double>(triggered - start).count();
+            mixTime += std::chrono::duration<double>(mixed - triggered).count();
+            sink = output[Length / 2];
+        }
+
+        auto stats = engine.getStats();
+        double audio = static_cast<double>(blocks) * Length / sampleRate;
+        std::cout << std::setw(10) << std::setprecision(0) << rate << std::setw(12) << std::setprecision(1) << mixTime * 1e6 / blocks
+                  << std::setw(12) << std::setprecision(0) << (stats.triggers ? triggerTime * 1e9 / static_cast<double>(stats.triggers) : 0.0)
+                  << std::setw(12) << std::setprecision(0) << audio / mixTime << std::setw(10) << stats.dropped << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
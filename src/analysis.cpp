@@ -0,0 +1,193 @@
+#include "analysis.hpp"
+#include "fmoderror.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    float decibels(float amplitude) {
+        return amplitude > 0.0f ? std::max(AnalysisTap::Floor, 20.0f * std::log10(amplitude)) : AnalysisTap::Floor;
+    }
+
+    constexpr float LowestBand = 30.0f; // Hz
+}
+
+AnalysisTap::AnalysisTap(FMOD::System* system, const std::string& name, int sampleRate, bool spectrum)
+    : system{system}, name{name}, sampleRate{sampleRate}, spectrum{spectrum}, fft{FFTSize} {
+    ring = std::make_unique<SPSCQueue<float, RingFrames * 2>>();
+    drained.resize(RingFrames * 2);
+    meter.peak.fill(Floor);
+    meter.rms.fill(Floor);
+    meter.hold.fill(Floor);
+    bands.fill(Floor);
+
+    if (spectrum) {
+        window.resize(FFTSize);
+        for (size_t n = 0; n < FFTSize; n++) {
+            window[n] = 0.5f - 0.5f * std::cos(2.0f * static_cast<float>(M_PI) * static_cast<float>(n) / static_cast<float>(FFTSize));
+        }
+        history.assign(FFTSize, 0.0f);
+        re.resize(FFTSize);
+        im.resize(FFTSize);
+
+        // Equal ratios from LowestBand to Nyquist, every band at least one bin wide
+        float nyquist = 0.5f * static_cast<float>(sampleRate);
+        for (size_t band = 0; band <= Bands; band++) {
+            float frequency = LowestBand * std::pow(nyquist / LowestBand, static_cast<float>(band) / Bands);
+            size_t bin = static_cast<size_t>(frequency * FFTSize / static_cast<float>(sampleRate));
+            bandEdges[band] = std::min(band > 0 ? std::max(bin, bandEdges[band - 1] + 1) : bin, FFTSize / 2);
+        }
+    }
+
+    if (system) {
+        FMOD_DSP_DESCRIPTION dspdesc;
+        memset(&dspdesc, 0, sizeof(dspdesc));
+        std::strcpy(dspdesc.name, "DSP Analysis Tap");
+        dspdesc.numinputbuffers = 1;
+        dspdesc.numoutputbuffers = 1;
+        dspdesc.read = readCallback;
+        dspdesc.userdata = this;
+
+        auto result = system->createDSP(&dspdesc, &dsp);
+        FMOD_ERROR_(result);
+    }
+}
+
+AnalysisTap::~AnalysisTap() {
+    detach();
+    if (dsp)
+        dsp->release();
+}
+
+bool AnalysisTap::attach(FMOD::ChannelGroup* target) {
+    if (!dsp)
+        return false;
+
+    detach();
+
+    auto result = target->addDSP(FMOD_CHANNELCONTROL_DSP_HEAD, dsp);
+    FMOD_ERROR(result);
+    group = target;
+
+    return true;
+}
+
+void AnalysisTap::detach() {
+    if (group)
+        group->removeDSP(dsp);
+    group = nullptr;
+}
+
+float AnalysisTap::getBandFrequency(size_t band) const {
+    return static_cast<float>(bandEdges[std::min(band, Bands)]) * static_cast<float>(sampleRate) / FFTSize;
+}
+
+void AnalysisTap::process(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels) {
+    if (inchannels == outchannels) {
+        std::memcpy(outbuffer, inbuffer, sizeof(float) * length * inchannels);
+    } else {
+        for (unsigned int i = 0; i < length; i++) {
+            for (int channel = 0; channel < outchannels; channel++) {
+                outbuffer[i * outchannels + channel] = channel < inchannels ? inbuffer[i * inchannels + channel] : 0.0f;
+            }
+        }
+    }
+
+    // Stereo goes in as it is, anything else is cut down to two channels through the scratch first
+    size_t queued = 0;
+    if (inchannels == 2) {
+        queued = ring->push(inbuffer, static_cast<size_t>(length) * 2) / 2;
+    } else {
+        constexpr size_t Chunk = std::tuple_size<decltype(fold)>::value / 2;
+        for (size_t start = 0; start < length; start += Chunk) {
+            size_t count = std::min<size_t>(Chunk, length - start);
+            for (size_t i = 0; i < count; i++) {
+                const float* in = inbuffer + (start + i) * inchannels;
+                fold[i * 2] = in[0];
+                fold[i * 2 + 1] = inchannels > 1 ? in[1] : in[0];
+            }
+            size_t pushed = ring->push(fold.data(), count * 2) / 2;
+            queued += pushed;
+            if (pushed < count)
+                break;
+        }
+    }
+
+    if (queued < length)
+        overruns.fetch_add(length - queued, std::memory_order_relaxed);
+}
+
+void AnalysisTap::update(float dt) {
+    size_t frames = ring->pop(drained.data(), drained.size()) / 2;
+
+    std::array<float, 2> peak{ 0.0f, 0.0f };
+    std::array<float, 2> energy{ 0.0f, 0.0f };
+    for (size_t i = 0; i < frames; i++) {
+        for (int channel = 0; channel < 2; channel++) {
+            float sample = drained[i * 2 + channel];
+            peak[channel] = std::max(peak[channel], std::abs(sample));
+            energy[channel] += sample * sample;
+        }
+    }
+
+    // Peaks jump up and fall back slowly, RMS integrates over the audio time drained
+    float seconds = static_cast<float>(frames) / static_cast<float>(sampleRate);
+    float integration = 1.0f - std::exp(-seconds / RmsTime);
+    for (int channel = 0; channel < 2; channel++) {
+        meter.peak[channel] = std::max(decibels(peak[channel]), meter.peak[channel] - PeakFall * dt);
+        if (frames > 0)
+            meanSquare[channel] += (energy[channel] / static_cast<float>(frames) - meanSquare[channel]) * integration;
+        meter.rms[channel] = decibels(std::sqrt(meanSquare[channel]));
+
+        holdAge[channel] += dt;
+        if (meter.peak[channel] >= meter.hold[channel] || holdAge[channel] > HoldTime) {
+            meter.hold[channel] = meter.peak[channel];
+            holdAge[channel] = 0.0f;
+        }
+    }
+
+    if (!spectrum)
+        return;
+
+    // Mono history of the newest FFTSize samples
+    size_t keep = frames < FFTSize ? FFTSize - frames : 0;
+    std::copy(history.end() - keep, history.end(), history.begin());
+    for (size_t i = frames - (FFTSize - keep); i < frames; i++) {
+        history[keep++] = 0.5f * (drained[i * 2] + drained[i * 2 + 1]);
+    }
+
+    elapsed += dt;
+    fresh += frames;
+    if (fresh >= FFTSize / 4) {
+        analyse(elapsed);
+        fresh = 0;
+        elapsed = 0.0f;
+    }
+}
+
+void AnalysisTap::analyse(float dt) {
+    for (size_t n = 0; n < FFTSize; n++) {
+        re[n] = history[n] * window[n];
+        im[n] = 0.0f;
+    }
+    fft.forward(re.data(), im.data());
+
+    // A full scale sine reads 0 dB in its band: the Hann window sums to FFTSize / 2, one side holds half
+    const float scale = 4.0f / static_cast<float>(FFTSize);
+    for (size_t band = 0; band < Bands; band++) {
+        float loudest = 0.0f;
+        for (size_t bin = bandEdges[band]; bin < std::max(bandEdges[band + 1], bandEdges[band] + 1); bin++) {
+            loudest = std::max(loudest, re[bin] * re[bin] + im[bin] * im[bin]);
+        }
+        bands[band] = std::max(decibels(std::sqrt(loudest) * scale), bands[band] - PeakFall * dt);
+    }
+}
+
+FMOD_RESULT F_CALLBACK AnalysisTap::readCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels) {
+    void* userdata;
+    static_cast<FMOD::DSP*>(dsp_state->instance)->getUserData(&userdata);
+    static_cast<AnalysisTap*>(userdata)->process(inbuffer, outbuffer, length, inchannels, *outchannels);
+    return FMOD_OK;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "fft.hpp"
+#include "spscqueue.hpp"
+
+/// @brief Levels of the two channels of a tap in dBFS, down to AnalysisTap::Floor
+struct MeterReading {
+    std::array<float, 2> peak; // falls back at AnalysisTap::PeakFall dB per second
+    std::array<float, 2> rms; // AnalysisTap::RmsTime integration
+    std::array<float, 2> hold; // highest peak of the last AnalysisTap::HoldTime seconds
+};
+
+/// @brief Pass through DSP that copies a bus's output into a lock-free ring for the game thread
+/// The mixer side is one bulk copy per block and never waits: when the game thread falls behind the
+/// block is cut short and counted as overrun. update() drains the ring on the game thread into peak
+/// and RMS meters and, when enabled, a Hann windowed spectrum decimated into log spaced bands.
+class AnalysisTap {
+public:
+    static constexpr size_t RingFrames = 8192; // 170 ms at 48 kHz
+    static constexpr size_t FFTSize = 2048;
+    static constexpr size_t Bands = 32;
+    static constexpr float Floor = -80.0f;
+    static constexpr float PeakFall = 24.0f;
+    static constexpr float RmsTime = 0.3f;
+    static constexpr float HoldTime = 1.5f;
+
+    /// @brief system may be nullptr for offline use through process() and update()
+    AnalysisTap(FMOD::System* system, const std::string& name, int sampleRate, bool spectrum);
+    ~AnalysisTap();
+
+    AnalysisTap(const AnalysisTap&) = delete;
+    AnalysisTap& operator=(const AnalysisTap&) = delete;
+
+    /// @brief Insert at the output end of a group, after its effects and fader
+    bool attach(FMOD::ChannelGroup* group);
+    void detach();
+
+    /// @brief Mixer thread: pass the block through and queue its first two channels
+    void process(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels);
+    /// @brief Game thread: drain the ring and refresh the meters and the spectrum
+    void update(float dt);
+
+    const std::string& getName() const { return name; }
+    const MeterReading& getMeter() const { return meter; }
+    bool hasSpectrum() const { return spectrum; }
+    const std::array<float, Bands>& getSpectrum() const { return bands; } // dBFS per band, low to high
+    float getBandFrequency(size_t band) const; // lower edge in Hz
+    uint64_t getOverruns() const { return overruns.load(std::memory_order_relaxed); } // frames dropped
+
+private:
+    FMOD::System* system;
+    std::string name;
+    int sampleRate;
+    bool spectrum;
+
+    FMOD::DSP* dsp{ nullptr };
+    FMOD::ChannelGroup* group{ nullptr };
+
+    // Mixer thread
+    std::unique_ptr<SPSCQueue<float, RingFrames * 2>> ring; // interleaved stereo
+    std::array<float, 512> fold; // stereo scratch for other channel counts
+    std::atomic<uint64_t> overruns{ 0 };
+
+    // Game thread
+    std::vector<float> drained;
+    MeterReading meter;
+    std::array<float, 2> meanSquare{ 0.0f, 0.0f };
+    std::array<float, 2> holdAge{ 0.0f, 0.0f };
+    dsp::FFT fft;
+    std::vector<float> window;
+    std::vector<float> history; // last FFTSize mono samples, oldest first
+    std::vector<float> re, im;
+    std::array<size_t, Bands + 1> bandEdges; // bins
+    std::array<float, Bands> bands;
+    size_t fresh{ 0 }; // samples since the last spectrum
+    float elapsed{ 0.0f }; // seconds since the last spectrum
+
+    void analyse(float dt);
+
+    static FMOD_RESULT F_CALLBACK readCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels);
+};
@@ -1,564 +1,1223 @@
 #include "audio.hpp"
 #include "common.hpp"
 #include "input.hpp"
+#include "fmoderror.hpp"
 
-#define FMOD_ERROR_(result) if (result != FMOD_OK) { std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << FMOD_ErrorString(result) << std::endl; return; }
-#define FMOD_ERROR(result) if (result != FMOD_OK) { std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << FMOD_ErrorString(result) << std::endl; return false; }
+#include <chrono>
 
-Audio::Audio() {
+namespace {
+    uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// @brief What a command sets, a later command to the same target makes it obsolete
+    uint64_t commandTarget(const AudioCommand& command) {
+        switch (command.type) {
+            case AudioCommand::Type::Emitter:
+                return reinterpret_cast<uintptr_t>(command.channel);
+            case AudioCommand::Type::DSPParameter:
+                // Pointers use the low 48 bits, the parameter goes above them
+                return reinterpret_cast<uintptr_t>(command.dsp) | static_cast<uint64_t>(command.index + 1) << 48;
+            default:
+                return 0; // the listener
+        }
+    }
+}
+
+Audio::Audio(const AudioSettings& settings) : settings{settings} {
     // Create an FMOD system
     auto result = FMOD::System_Create(&system);
     FMOD_ERROR_(result);
 
-    // Initialise the system
-    result = system->init(32, FMOD_INIT_NORMAL, nullptr);
+    // Non-realtime outputs mix one block per System::update, as fast as the CPU allows
+    result = system->setOutput(settings.output);
     FMOD_ERROR_(result);
 
+    // Mix the 32 most audible voices for real, FMOD virtualizes the rest
+    result = system->setSoftwareChannels(32);
+    FMOD_ERROR_(result);
+
+    // A replay mixes in the blocks the trace was recorded with
+    if (settings.sampleRate > 0) {
+        result = system->setSoftwareFormat(settings.sampleRate, FMOD_SPEAKERMODE_DEFAULT, 0);
+        FMOD_ERROR_(result);
+    }
+    if (settings.blockLength > 0) {
+        result = system->setDSPBufferSize(settings.blockLength, 4);
+        FMOD_ERROR_(result);
+    }
+
+    FMOD_ADVANCEDSETTINGS advanced;
+    memset(&advanced, 0, sizeof(advanced));
+    advanced.cbSize = sizeof(advanced);
+    advanced.vol0virtualvol = 0.001f;
+    result = system->setAdvancedSettings(&advanced);
+    FMOD_ERROR_(result);
+
+    // Serve file reads from our reader thread with read-ahead
+    if (settings.readAhead) {
+        io = std::make_unique<StreamIO>(settings.readAhead);
+        if (!io->attach(system))
+            io.reset();
+    }
+
+    // Initialise the system, the pool owns the voices, the rest is headroom for music and unpooled channels
+    FMOD_INITFLAGS flags = FMOD_INIT_NORMAL | FMOD_INIT_VOL0_BECOMES_VIRTUAL;
+    if (settings.profile)
+        flags |= FMOD_INIT_PROFILE_ENABLE;
+    // Our occlusion only sets the level, let FMOD turn it into volume and a lowpass
+    if (settings.engineOcclusion)
+        flags |= FMOD_INIT_CHANNEL_LOWPASS;
+    // Non-realtime output mixes as fast as update() is called, the stream thread cannot keep up with that
+    if (settings.output == FMOD_OUTPUTTYPE_NOSOUND_NRT || settings.output == FMOD_OUTPUTTYPE_WAVWRITER_NRT)
+        flags |= FMOD_INIT_STREAM_FROM_UPDATE;
+    void* driverdata = settings.outputFile.empty() ? nullptr : const_cast<char*>(settings.outputFile.c_str());
+    result = system->init(VoicePool::MaxVoices + 16, flags, driverdata);
+    FMOD_ERROR_(result);
+    profiling = settings.profile;
+
     // Set 3D settings
     result = system->set3DSettings(1.0f, 1.0f, 1.0f);
     FMOD_ERROR_(result);
+
+    // Bus tree with per bus effects, the custom gain filter is ours, FMOD makes the rest
+    int sampleRate;
+    result = system->getSoftwareFormat(&sampleRate, nullptr, nullptr);
+    FMOD_ERROR_(result);
+    impulses = std::make_unique<ImpulseResponseCache>(system, sampleRate);
+
+    mixer = std::make_unique<Mixer>(system, [this, sampleRate](const std::string& type) -> FMOD::DSP* {
+        if (type == "convolution") {
+            reverbs.push_back(std::make_unique<ConvolutionReverb>(sampleRate));
+            return reverbs.back()->createDSP(system);
+        }
+        if (type == "phasevocoder") {
+            vocoders.push_back(std::make_unique<PhaseVocoder>(sampleRate));
+            return vocoders.back()->createDSP(system);
+        }
+        if (type != "custom")
+            return nullptr;
+
+        FMOD_DSP_DESCRIPTION dspdesc;
+        memset(&dspdesc, 0, sizeof(dspdesc));
+        std::strcpy(dspdesc.name, "DSP Custom Filter");
+
+        dspdesc.numinputbuffers = 1;
+        dspdesc.numoutputbuffers = 1;
+        dspdesc.create = DSPCreateCallback;
+        dspdesc.release = DSPReleaseCallback;
+        dspdesc.read = DSPCallback;
+        dspdesc.userdata = &data; // the shared target, each instance ramps on its own
+
+        FMOD::DSP* dsp;
+        auto result = system->createDSP(&dspdesc, &dsp);
+        FMOD_ERROR_RETURN(result, nullptr);
+        return dsp;
+    });
+    mixer->load("resources/effects/buses.mix");
+    musicBus = mixer->getGroup("music");
+    sfxBus = mixer->getGroup("sfx/world"); // positioned sounds, through the zone reverb
+    if (auto effects = mixer->getEffects("sfx/world"))
+        reverb = ConvolutionReverb::fromDSP(effects->get("reverb"));
+    musicEffects = mixer->getEffects("music");
+
+    geometry = std::make_unique<GeometryManager>(system);
+    if (settings.engineOcclusion) {
+        geometry->setStaticActive(false); // moving occluders stay on FMOD's raycasts
+        occlusion = std::make_unique<OcclusionRaycaster>();
+    }
+    sounds = std::make_unique<SoundCache>(system, settings.soundBudget);
+    voices = std::make_unique<VoicePool>(system);
+    samples = std::make_unique<SamplePool>(settings.samplePool);
+    music = std::make_unique<MusicScheduler>(system, *sounds, musicBus ? musicBus : mixer->getGroup("master"));
+    if (settings.lod)
+        lod = std::make_unique<AudioLOD>(settings.lodSettings);
+
+    // Bus output taps for the HUD, a spectrum only for the final mix
+    if (settings.meters) {
+        for (const char* bus : { "master", "music", "sfx" }) {
+            auto tap = std::make_unique<AnalysisTap>(system, bus, sampleRate, std::strcmp(bus, "master") == 0);
+            if (tap->attach(mixer->getGroup(bus)))
+                meters.push_back(std::move(tap));
+        }
+    }
+
+    // Headphone rendering of the world bus, one filter pair per direction in use instead of per voice
+    if (settings.binaural && sfxBus) {
+        auto hrirs = settings.hrirFile.empty() ? HRIRSet::synthesize(sampleRate) : HRIRSet::load(settings.hrirFile, sampleRate);
+        unsigned int blockLength;
+        result = system->getDSPBufferSize(&blockLength, nullptr);
+        FMOD_ERROR_(result);
+        if (hrirs) {
+            binaural = std::make_unique<BinauralRenderer>(system, std::move(hrirs), blockLength);
+            if (!binaural->attach(sfxBus))
+                binaural.reset();
+        }
+    }
+
+    if (!settings.profileLog.empty())
+        profiler.startLog(settings.profileLog);
 }
 
 Audio::~Audio() {
+    stopThread();
+    if (geometry)
+        geometry->setTrace(nullptr);
+    trace.reset();
+
+    // Voices hold sound references, sounds must go before the cache
+    voices.reset();
+    synths.clear(); // streams close with their last reference, before the cache
+    capture.reset(); // so does the loopback
+    variations.clear(); // their channels stop before the buses go, the pool after them
+    samples.reset();
+    lod.reset();
+    music.reset();
+    binaural.reset(); // sends leave with their channels, the renderer before its bus
+    meters.clear();
+    mixer.reset(); // releases the convolution and vocoder DSPs before their state
+    reverbs.clear();
+    vocoders.clear();
+    occlusion.reset();
+    geometry.reset();
+    spatialSound = {};
+    sounds.reset();
+
+    if (system)
+        system->release();
 }
 
 void Audio::update(const glm::vec3& position, const glm::vec3& velocity, const glm::vec3& forward, const glm::vec3& up) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::Update;
+        record.vectors[0] = position;
+        record.vectors[1] = velocity;
+        record.vectors[2] = forward;
+        record.vectors[3] = up;
+        trace->write(record);
+    }
+
     changeMusicFilter();
 
+    // Finish non-blocking loads, callbacks may start voices
+    sounds->update();
+
+    // Whatever the record device got since the last frame, the consumer thread takes it from there
+    if (capture)
+        capture->update();
+
+    // Open the upcoming tracks and put the next boundary on the DSP clock
+    music->update();
+
+    // The vocoder delays the music by its FFT size, drop it once the pitch is back at no shift
+    if (musicEffects && musicEffects->isEnabled("pitch")) {
+        auto vocoder = PhaseVocoder::fromDSP(musicEffects->get("pitch"));
+        bool unshifted = std::abs(musicPitch - 12.0f * std::log2(musicTempo)) < 1e-3f;
+        if (vocoder && unshifted && vocoder->getPitch() == 0.0f && vocoder->getCurrent() == 0.0f)
+            musicEffects->setEnabled("pitch", false);
+    }
+
+    // Build the chunks that gained polygons this frame
+    geometry->commit();
+
+    // Reclaim finished voices and refresh the steal order
+    voices->update();
+
+    if (occlusion) {
+        if (geometry->getVersion() != occlusionVersion) {
+            occlusion->build(*geometry);
+            occlusionVersion = geometry->getVersion();
+        }
+        occlusion->update(position, *voices);
+    }
+
+    // After occlusion, it is part of the audibility
+    if (lod)
+        lod->update(position, *voices);
+
+    // Drain the taps, whatever the mixer produced since the last frame
+    uint64_t time = now();
+    float elapsed = meterTime ? static_cast<float>(time - meterTime) * 1e-9f : 0.0f;
+    meterTime = time;
+    for (auto& meter : meters) {
+        meter->update(elapsed);
+    }
+
+    // Counters of the last blocks, only while someone looks at or logs them
+    if (profiler.due(elapsed))
+        profiler.sample(system, profiling ? getDSPs() : std::vector<FMOD::DSP*>{});
+
+    if (binaural) {
+        binaural->setListener(position, forward, up);
+        for (uint32_t source = 0; source < BinauralRenderer::MaxSources; source++) {
+            if (!binauralVoices[source])
+                continue;
+            auto channel = voices->get(binauralVoices[source]);
+            if (!channel) {
+                binaural->removeSource(source);
+                binauralVoices[source] = {};
+                continue;
+            }
+            // Far voices go back to FMOD's panner, the send and its share of the HRIR filtering are dropped
+            if (lod && lod->getLevel(binauralVoices[source]) != VoiceLOD::Full) {
+                binaural->removeSource(source);
+                channel->set3DLevel(1.0f);
+                binauralFar.push_back(binauralVoices[source]);
+                binauralVoices[source] = {};
+                continue;
+            }
+            binaural->setSourcePosition(source, voices->getPosition(binauralVoices[source]));
+        }
+
+        for (size_t i = 0; i < binauralFar.size();) {
+            auto voice = binauralFar[i];
+            auto channel = voices->get(voice);
+            if (channel && lod->getLevel(voice) != VoiceLOD::Full) {
+                i++;
+                continue;
+            }
+            if (channel) {
+                uint32_t source = binaural->addSource(channel);
+                if (source == UINT32_MAX) {
+                    i++;
+                    continue;
+                }
+                binauralVoices[source] = voice;
+                binaural->setSourcePosition(source, voices->getPosition(voice));
+            }
+            binauralFar[i] = binauralFar.back();
+            binauralFar.pop_back();
+        }
+    }
+
+    if (running) {
+        // The audio thread applies it and updates fmod at its own rate
+        AudioCommand command;
+        command.type = AudioCommand::Type::Listener;
+        command.position = position;
+        command.velocity = velocity;
+        command.forward = forward;
+        command.up = up;
+        submit(command);
+        return;
+    }
+
     // Update listener position in the world
     auto result = system->set3DListenerAttributes(0, glm::fmod_vector(position), glm::fmod_vector(velocity), glm::fmod_vector(forward), glm::fmod_vector(up));
     FMOD_ERROR_(result);
+
     // Update fmod system
     result = system->update();
     FMOD_ERROR_(result);
 }
 
-bool Audio::loadSound(const std::string& filename) {
-    // Load an event sound
-    auto result = system->createSound(filename.c_str(), FMOD_3D | FMOD_LOOP_NORMAL, nullptr, &spatialSound);
-    FMOD_ERROR(result);
+bool Audio::startThread(float rate) {
+    if (running)
+        return false;
+
+    if (!commands)
+        commands = std::make_unique<SPSCQueue<AudioCommand, CommandCapacity>>();
+
+    tickRate = rate > 0.0f ? rate : 60.0f;
+    resetCommandLatency();
+
+    running = true;
+    thread = std::thread{ &Audio::threadLoop, this };
     return true;
 }
 
-bool Audio::playSound(const glm::vec3& position, float volume) {
-    // Play an event sound
-    auto result = system->playSound(spatialSound, nullptr, false, &soundChannel);
-    FMOD_ERROR(result);
-    result = soundChannel->setVolumeRamp(false);
-    FMOD_ERROR(result);
-    result = soundChannel->set3DAttributes(glm::fmod_vector(position), glm::fmod_vector(glm::vec3{0}));
-    FMOD_ERROR(result);
-    result = soundChannel->setPaused(true);
-    FMOD_ERROR(result);
-    result = soundChannel->setVolume(volume);
-    FMOD_ERROR(result);
+void Audio::stopThread() {
+    if (!running)
+        return;
+
+    running = false;
+    thread.join();
+
+    // Anything pushed after the last tick still has to reach fmod, the coalesced overflow is newer
+    AudioCommand command;
+    while (commands->pop(command)) {
+        execute(command);
+    }
+    for (const auto& pending : overflow) {
+        execute(pending);
+    }
+    overflow.clear();
+    overflowIndex.clear();
+}
 
+bool Audio::submit(AudioCommand& command) {
+    command.timestamp = now();
+    if (flushOverflow() && commands->push(command))
+        return true;
+
+    // Ring is full, keep only the latest command per target until it has room. Everything queued is
+    // older than what waits here, so nothing lands out of order and the game thread never blocks
+    overflowCount.fetch_add(1, std::memory_order_relaxed);
+    auto [it, added] = overflowIndex.try_emplace(commandTarget(command), overflow.size());
+    if (added)
+        overflow.push_back(command);
+    else
+        overflow[it->second] = command;
     return true;
 }
 
-bool Audio::toggleSound() {
-    bool paused;
+bool Audio::flushOverflow() {
+    if (overflow.empty())
+        return true;
 
-    auto result = soundChannel->getPaused(&paused);
-    FMOD_ERROR(result);
+    size_t pushed = commands->push(overflow.data(), overflow.size());
+    if (pushed == overflow.size()) {
+        overflow.clear();
+        overflowIndex.clear();
+        return true;
+    }
 
-    paused = !paused;
+    overflow.erase(overflow.begin(), overflow.begin() + static_cast<std::ptrdiff_t>(pushed));
+    overflowIndex.clear();
+    for (size_t i = 0; i < overflow.size(); i++) {
+        overflowIndex[commandTarget(overflow[i])] = i;
+    }
+    return false;
+}
 
-    result = soundChannel->setPaused(paused);
-    FMOD_ERROR(result);
+void Audio::execute(const AudioCommand& command) {
+    FMOD_RESULT result;
 
-    return true;
+    switch (command.type) {
+        case AudioCommand::Type::Listener:
+            result = system->set3DListenerAttributes(0, glm::fmod_vector(command.position), glm::fmod_vector(command.velocity), glm::fmod_vector(command.forward), glm::fmod_vector(command.up));
+            break;
+        case AudioCommand::Type::Emitter:
+            result = command.channel->set3DAttributes(glm::fmod_vector(command.position), glm::fmod_vector(command.velocity));
+            // The voice may have ended between the push and now
+            if (result == FMOD_ERR_INVALID_HANDLE || result == FMOD_ERR_CHANNEL_STOLEN)
+                return;
+            break;
+        case AudioCommand::Type::DSPParameter:
+            result = command.dsp->setParameterFloat(command.index, command.value);
+            break;
+    }
+
+    FMOD_ERROR_(result);
 }
 
-bool Audio::setSoundPositionAndVelocity(const glm::vec3& position, const glm::vec3& velocity) {
-    auto result = soundChannel->set3DAttributes(glm::fmod_vector(position), glm::fmod_vector(velocity));
-    FMOD_ERROR(result);
+void Audio::threadLoop() {
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / tickRate));
+    auto next = std::chrono::steady_clock::now();
 
-    return true;
-}
+    while (running) {
+        next += period;
 
-FMOD_RESULT F_CALLBACK DSPCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels) {
-    auto thisdsp = (FMOD::DSP *)dsp_state->instance;
+        uint64_t drained = 0;
+        uint64_t stamps = 0;
+        uint64_t oldest = UINT64_MAX;
 
-    void* ud;
-    thisdsp->getUserData(&ud);
+        AudioCommand command;
+        while (commands->pop(command)) {
+            execute(command);
+            drained++;
+            stamps += command.timestamp;
+            oldest = std::min(oldest, command.timestamp);
+        }
 
-    auto dud = static_cast<DSPUserdata*>(ud);
+        auto result = system->update();
+        if (result != FMOD_OK) {
+            std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << FMOD_ErrorString(result) << std::endl;
+        }
 
-    for (unsigned int samp = 0; samp < length; samp++) {
-        /*
-            Feel free to unroll this.
-        */
-        for (int chan = 0; chan < *outchannels; chan++) {
-            /*
-                This DSP filter just halves the volume!
-                Input is modified by filter value, and sent to output.
-            */
-            outbuffer[(samp * *outchannels) + chan] = inbuffer[(samp * inchannels) + chan] * dud->volume;
+        // Latency runs until the update that hands the commands to the mixer
+        if (drained > 0) {
+            uint64_t time = now();
+            latencyCount.fetch_add(drained, std::memory_order_relaxed);
+            latencySum.fetch_add(drained * time - stamps, std::memory_order_relaxed);
+            uint64_t max = time - oldest;
+            uint64_t previous = latencyMax.load(std::memory_order_relaxed);
+            while (max > previous && !latencyMax.compare_exchange_weak(previous, max, std::memory_order_relaxed)) {}
         }
+
+        // Fall behind rather than burst if a tick overruns
+        auto current = std::chrono::steady_clock::now();
+        if (next < current)
+            next = current;
+        std::this_thread::sleep_until(next);
     }
+}
 
-    return FMOD_OK;
+CommandLatency Audio::getCommandLatency() const {
+    uint64_t count = latencyCount.load(std::memory_order_relaxed);
+    uint64_t sum = latencySum.load(std::memory_order_relaxed);
+    uint64_t max = latencyMax.load(std::memory_order_relaxed);
+
+    CommandLatency latency;
+    latency.commands = count;
+    latency.overflows = overflowCount.load(std::memory_order_relaxed);
+    latency.averageMs = count > 0 ? static_cast<double>(sum) / static_cast<double>(count) * 1e-6 : 0.0;
+    latency.maxMs = static_cast<double>(max) * 1e-6;
+    return latency;
 }
 
-bool Audio::loadMusicStream(const std::string& filename) {
-    // Load a music sound
-    auto result = system->createStream(filename.c_str(), FMOD_LOOP_NORMAL, nullptr, &musicSound);
-    FMOD_ERROR(result);
+void Audio::resetCommandLatency() {
+    latencyCount = 0;
+    latencySum = 0;
+    latencyMax = 0;
+    overflowCount = 0;
+}
 
-    //Create the DSP effects.
-    result = system->createDSPByType(FMOD_DSP_TYPE_PITCHSHIFT, &dsppitch);
-    FMOD_ERROR(result);
-    result = system->createDSPByType(FMOD_DSP_TYPE_LOWPASS, &dsplowpass);
-    FMOD_ERROR(result);
-    result = system->createDSPByType(FMOD_DSP_TYPE_HIGHPASS, &dsphighpass);
-    FMOD_ERROR(result);
-    result = system->createDSPByType(FMOD_DSP_TYPE_ECHO, &dspecho);
-    FMOD_ERROR(result);
-    result = system->createDSPByType(FMOD_DSP_TYPE_FLANGE, &dspflange);
-    FMOD_ERROR(result);
-    result = system->createDSPByType(FMOD_DSP_TYPE_DISTORTION, &dspdistortion);
-    FMOD_ERROR(result);
-    result = system->createDSPByType(FMOD_DSP_TYPE_CHORUS, &dspchorus);
-    FMOD_ERROR(result);
-    result = system->createDSPByType(FMOD_DSP_TYPE_PARAMEQ, &dspparameq);
+bool Audio::setDSPParameter(FMOD::DSP* dsp, int index, float value) {
+    if (!dsp)
+        return false;
+
+    // Pointers differ between runs, the position among getDSPs() does not
+    if (tracing()) {
+        auto dsps = getDSPs();
+        TraceRecord record;
+        record.op = TraceOp::SetDSPParameter;
+        record.value = static_cast<uint32_t>(std::find(dsps.begin(), dsps.end(), dsp) - dsps.begin());
+        record.index = index;
+        record.scalar = value;
+        if (record.value < dsps.size())
+            trace->write(record);
+    }
+
+    if (running) {
+        AudioCommand command;
+        command.type = AudioCommand::Type::DSPParameter;
+        command.dsp = dsp;
+        command.index = index;
+        command.value = value;
+        return submit(command);
+    }
+
+    auto result = dsp->setParameterFloat(index, value);
     FMOD_ERROR(result);
+    return true;
+}
 
-    // Create the Custom DSP effect
-    FMOD_DSP_DESCRIPTION dspdesc;
-    memset(&dspdesc, 0, sizeof(dspdesc));
-    std::strcpy(dspdesc.name, "DSP Custom Filter");
+Synth* Audio::createSynth(const SynthPatch& patch) {
+    int sampleRate;
+    auto result = system->getSoftwareFormat(&sampleRate, nullptr, nullptr);
+    FMOD_ERROR_RETURN(result, nullptr);
 
-    dspdesc.numinputbuffers = 1;
-    dspdesc.numoutputbuffers = 1;
-    dspdesc.read = DSPCallback;
-    dspdesc.userdata = &data;
+    // Rendered at the mixer rate so FMOD does not resample it
+    auto synth = std::make_unique<Synth>(patch, sampleRate);
+    if (!synth->createSound(system, *sounds, "synth:" + std::to_string(synths.size())))
+        return nullptr;
 
-    result = system->createDSP(&dspdesc, &dspcustom);
-    FMOD_ERROR(result);
+    synths.push_back(std::move(synth));
+    return synths.back().get();
+}
 
-    return true;
+VoiceHandle Audio::playSynth(const Synth& synth, const glm::vec3& position, float volume, FMOD::ChannelGroup* bus) {
+    if (!synth.getSound().isReady())
+        return {};
+
+    // Kept by the caller, the last played voice stays the game's
+    return playVoice(synth.getSound(), position, volume, VoicePool::DefaultPriority, false, bus);
 }
 
-bool Audio::playMusicStream() {
-    // Play a music sound
-    auto result = system->playSound(musicSound, nullptr, false, &musicChannel);
-    FMOD_ERROR(result);
+uint32_t Audio::loadVariationSample(const std::string& filename) {
+    // Through the cache so banks apply, the reference is dropped once the PCM is copied out
+    auto sound = sounds->load(filename, FMOD_2D | FMOD_LOOP_OFF | FMOD_CREATESAMPLE);
+    if (!sound.isReady())
+        return UINT32_MAX;
+    return samples->add(sound.get());
+}
+
+VariationEngine* Audio::createVariations(const VariationSet& set, const glm::vec3& position) {
+    int sampleRate;
+    auto result = system->getSoftwareFormat(&sampleRate, nullptr, nullptr);
+    FMOD_ERROR_RETURN(result, nullptr);
+
+    // Seeded by creation order, the same scene varies the same way every run
+    auto engine = std::make_unique<VariationEngine>(system, *samples, set, sampleRate, static_cast<uint32_t>(variations.size() + 1));
+    if (!engine->play(sfxBus, position))
+        return nullptr;
 
+    variations.push_back(std::move(engine));
+    return variations.back().get();
+}
+
+bool Audio::startTrace(const std::string& filename) {
+    TraceHeader header;
+    auto result = system->getSoftwareFormat(&header.sampleRate, nullptr, nullptr);
+    FMOD_ERROR(result);
+    result = system->getDSPBufferSize(&header.blockLength, nullptr);
+    FMOD_ERROR(result);
+    header.engineOcclusion = settings.engineOcclusion;
+    header.binaural = settings.binaural;
+    header.meters = settings.meters;
+    header.lod = settings.lod;
+    header.soundBudget = settings.soundBudget;
+    header.readAhead = settings.readAhead;
+    header.samplePool = settings.samplePool;
+    header.hrirFile = settings.hrirFile;
+
+    geometry->setTrace(nullptr);
+    trace = std::make_unique<AudioTrace>(system);
+    if (!trace->open(filename, header)) {
+        trace.reset();
+        return false;
+    }
+    // Occluders registered from the scene go straight to the manager, it logs them itself
+    geometry->setTrace(trace.get());
     return true;
 }
 
-bool Audio::toggleMusicStream() {
-    bool paused;
+void Audio::stopTrace() {
+    geometry->setTrace(nullptr);
+    trace.reset();
+}
 
-    auto result = musicChannel->getPaused(&paused);
-    FMOD_ERROR(result);
+bool Audio::startCapture(std::unique_ptr<CaptureDevice> device, const CaptureSettings& settings) {
+    stopCapture();
 
-    paused = !paused;
+    capture = std::make_unique<AudioCapture>(system, std::move(device), settings);
+    if (!capture->start()) {
+        capture.reset();
+        return false;
+    }
+    return true;
+}
 
-    result = musicChannel->setPaused(paused);
+bool Audio::startCapture(int driver, const CaptureSettings& settings) {
+    int drivers = 0;
+    auto result = system->getRecordNumDrivers(nullptr, &drivers);
     FMOD_ERROR(result);
+    if (driver >= drivers)
+        return false;
 
-    return true;
+    return startCapture(std::make_unique<RecordDevice>(system, driver), settings);
 }
 
-bool Audio::changeMusicFilter() {
-    FMOD_RESULT result;
-    
-    if (Input::GetKeyDown(GLFW_KEY_Q)) {
-        bool paused;
+void Audio::stopCapture() {
+    // The voice goes first, the stream reads from the capture
+    voices->stop(captureVoice);
+    captureVoice = {};
+    capture.reset();
+}
 
-        musicChannel->getPaused(&paused);
-        FMOD_ERROR(result);
+VoiceHandle Audio::playCaptureLoopback(const glm::vec3& position, float volume) {
+    if (!capture)
+        return {};
 
-        paused = !paused;
+    voices->stop(captureVoice);
+    auto sound = capture->createLoopback(*sounds, "capture:loopback");
+    if (!sound)
+        return {};
 
-        result = musicChannel->setPaused(paused);
-        FMOD_ERROR(result);
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_1)) {
-        //	Play Sound From Left Speakers
-        result = musicChannel->getVolume(&volume);
-        FMOD_ERROR(result);
-        result = musicChannel->setMixLevelsOutput(1, 0, 0, 0, 0, 0, 0, 0);
-        FMOD_ERROR(result);
+    // Not the last played voice, the game's own keep the key and no-handle calls
+    captureVoice = playVoice(sound, position, volume, VoicePool::DefaultPriority, false, sfxBus);
+    return captureVoice;
+}
+
+bool Audio::mountBank(const std::string& filename) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::MountBank;
+        record.name = filename;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_2)) {
-        //	Play Sound From Right Speakers
-        result = musicChannel->getVolume(&volume);
-        FMOD_ERROR(result);
-        std::cout << "Volume: " << volume << std::endl;
-        result = musicChannel->setMixLevelsOutput(0, 1, 0, 0, 0, 0, 0, 0);
-        FMOD_ERROR(result);
+
+    return sounds->mount(filename);
+}
+
+SoundRef Audio::loadSound(const std::string& filename, FMOD_MODE mode) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::LoadSound;
+        record.name = filename;
+        record.value = mode;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_3)) {
-        //	Play Sound From Both Speakers
-        result = musicChannel->getVolume(&volume);
-        FMOD_ERROR(result);
-        result = musicChannel->setMixLevelsOutput(1, 1, 0, 0, 0, 0, 0, 0);
-        FMOD_ERROR(result);
+
+    // Load an event sound, repeated loads are a cache lookup
+    spatialSound = sounds->load(filename, mode | FMOD_CREATESAMPLE);
+    return spatialSound;
+}
+
+SoundRef Audio::loadSoundAsync(const std::string& filename, SoundCache::Callback onReady, FMOD_MODE mode) {
+    // What the callback does is traced as it happens
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::LoadSoundAsync;
+        record.name = filename;
+        record.value = mode;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_4)) {
-        //	Decrmenent Tempo
-        //if(frequencyCount > -12){
-        //if (tempoChange + pitchCount > -12 && std::abs(pitchCount) < 12 && tempoChange > -12) {
-        if (pitchf < 1.98f) {
-            frequencyCount--;
-            tempoChange++;
-            std::cout << "Pitch Count: " << pitchCount << std::endl;
-            std::cout << "Tempo Count: " << tempoChange << std::endl;
-
-            result = musicChannel->getFrequency(&frequency);
-            FMOD_ERROR(result);
-            std::cout << "Z Initial Frequency: " << frequency << std::endl;
 
-            float base = 2.0f;
+    // Decodes on FMOD's async thread, unlike loadSound it leaves the last loaded sound alone
+    return sounds->loadAsync(filename, mode | FMOD_CREATESAMPLE, std::move(onReady));
+}
 
-            std::cout << "inc by: " << std::pow(base,(-1.0f/12.0f)) << std::endl;
-            float newTempo = frequency * std::pow(base, (-1.0f / 12.0f));
+VoiceHandle Audio::playSound(const glm::vec3& position, float volume, int priority, bool paused) {
+    return playSound(spatialSound, position, volume, priority, paused);
+}
 
-            //float pitchf = 1.0f;
+VoiceHandle Audio::playSound(const SoundRef& sound, const glm::vec3& position, float volume, int priority, bool paused, FMOD::ChannelGroup* bus) {
+    if (!sound.isReady())
+        return {};
 
-            //if (pitchCount == 0 && tempoChange == 0) {
-            //	pitchf = 1.0f;
-            //}
-            if (pitchf == 1.0f) {
-                pitchf = std::pow(1.059f, std::abs(tempoChange + pitchCount));
-            } else if (pitchf > 1.0f) {
-                pitchf = std::pow(1.059f, std::abs(tempoChange + pitchCount));
-            } else if (pitchf < 1.0f) {
-                pitchf = std::pow(0.9438f, std::abs(tempoChange + pitchCount));
-            }
+    soundVoice = playVoice(sound, position, volume, priority, paused, bus);
+    return soundVoice;
+}
 
-            std::cout << "Pitch: " << pitchf << std::endl;
-            std::cout << "Frequency: " << newTempo << std::endl;
+VoiceHandle Audio::playVoice(const SoundRef& sound, const glm::vec3& position, float volume, int priority, bool paused, FMOD::ChannelGroup* bus) {
+    // Play an event sound
+    auto voice = voices->play(sound, bus ? bus : sfxBus, glm::fmod_vector(position), volume, priority, paused);
+
+    // By cache key and bus name, the replay opens its own and maps the handle it gets to this one
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::PlaySound;
+        record.name = sound.getKey();
+        if (bus) {
+            char name[64];
+            if (bus->getName(name, sizeof(name)) == FMOD_OK)
+                record.bus = name;
+        }
+        record.vectors[0] = position;
+        record.scalar = volume;
+        record.index = priority;
+        record.flag = paused;
+        record.voice = voice;
+        trace->write(record);
+    }
 
-            result = musicChannel->removeDSP(dsppitch);
-            FMOD_ERROR(result);
+    // Voices on the world bus are placed by the renderer, others keep FMOD's panning
+    if (binaural && (!bus || bus == sfxBus)) {
+        FMOD_MODE mode = 0;
+        auto channel = voices->get(voice);
+        if (channel && channel->getMode(&mode) == FMOD_OK && (mode & FMOD_3D)) {
+            uint32_t source = binaural->addSource(channel);
+            if (source != UINT32_MAX) {
+                binauralVoices[source] = voice;
+                binaural->setSourcePosition(source, position);
+            }
+        }
+    }
 
-            result = musicChannel->addDSP(0, dsppitch);
-            FMOD_ERROR(result);
+    return voice;
+}
 
-            musicChannel->setFrequency(newTempo);
+bool Audio::stopSound(VoiceHandle voice) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::StopSound;
+        record.voice = voice;
+        trace->write(record);
+    }
 
-            result = dsppitch->setParameterFloat(FMOD_DSP_PITCHSHIFT_PITCH, pitchf);
-            FMOD_ERROR(result);
+    voices->stop(voice);
+    return true;
+}
 
-        } else {
-            std::cout << "Reached Min Tempo" << std::endl;
-        }
+bool Audio::toggleSound() {
+    return toggleSound(soundVoice);
+}
+
+bool Audio::toggleSound(VoiceHandle voice) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::ToggleSound;
+        record.voice = voice;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_5)) {
-        //	Incrmenent Tempo
-        if (pitchf > 0.52f) {
-            frequencyCount++;
-            tempoChange--;
-            std::cout << "Pitch Count: " << pitchCount << std::endl;
-            std::cout << "Tempo Count: " << tempoChange << std::endl;
 
-            result = musicChannel->getFrequency(&frequency);
-            FMOD_ERROR(result);
-            std::cout << "Z Initial Frequency: " << frequency << std::endl;
-
-            float base = 2.0f;
-            float newTempo = frequency * std::pow(base, (1.0f / 12.0f));
-
-            if (pitchf == 1.0f) {
-                std::cout << "tempo one" << std::endl;
-                pitchf = std::pow(.9438f, std::abs(tempoChange + pitchCount));
-            } else if (pitchf > 1.0f) {
-                std::cout << "tempo inc" << std::endl;
-                pitchf = std::pow(1.059f, std::abs(tempoChange + pitchCount));
-            } else if (pitchf < 1.0f) {
-                std::cout << "tempo dec" << std::endl;
-                pitchf = std::pow(0.9438f, std::abs(tempoChange + pitchCount));
-            }
+    auto channel = voices->get(voice);
+    if (!channel)
+        return false;
 
-            std::cout << "Pitch: " << pitchf << std::endl;
-            std::cout << "Frequency: " << newTempo << std::endl;
+    bool paused;
 
-            result = musicChannel->removeDSP(dsppitch);
-            FMOD_ERROR(result);
+    auto result = channel->getPaused(&paused);
+    FMOD_ERROR(result);
 
-            result = musicChannel->addDSP(0, dsppitch);
-            FMOD_ERROR(result);
+    paused = !paused;
 
-            result = musicChannel->setFrequency(newTempo);
-            FMOD_ERROR(result);
+    result = channel->setPaused(paused);
+    FMOD_ERROR(result);
 
-            result = dsppitch->setParameterFloat(FMOD_DSP_PITCHSHIFT_PITCH, pitchf);
-            FMOD_ERROR(result);
+    return true;
+}
 
-        } else {
-            std::cout << "Reached Max Tempo" << std::endl;
-        }
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_6)) {
-        toggleMusicStream();
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_7)) {
-        toggleSound();
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_KP_ADD)) {
-        data.volume += 0.1f;
-        if (data.volume > 2) {
-            data.volume = 2;
-        }
-        std::cout << "Filter Power: " << data.volume << std::endl;
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_KP_SUBTRACT)) {
-        data.volume -= 0.1f;
-        if (data.volume < 0) {
-            data.volume = 0;
-        }
-        std::cout << "Filter Power: " << data.volume << std::endl;
+bool Audio::setSoundPositionAndVelocity(const glm::vec3& position, const glm::vec3& velocity) {
+    return setSoundPositionAndVelocity(soundVoice, position, velocity);
+}
+
+bool Audio::setSoundPositionAndVelocity(VoiceHandle voice, const glm::vec3& position, const glm::vec3& velocity) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::SetEmitter;
+        record.voice = voice;
+        record.vectors[0] = position;
+        record.vectors[1] = velocity;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_EQUAL)) {
-        //	Increment Volume
-        result = musicChannel->getVolume(&volume);
-        FMOD_ERROR(result);
-        volume += 0.1f;
-        if (volume > 1) {
-            volume = 1;
-        }
-        std::cout << "Volume: " << volume << std::endl;
-        result = musicChannel->setVolume(volume);
-        FMOD_ERROR(result);
+
+    auto channel = voices->get(voice);
+    if (!channel)
+        return false;
+    voices->setPosition(voice, position);
+
+    // Muted by the LOD, it is placed again when it becomes audible
+    if (lod && lod->isSilent(voice))
+        return true;
+
+    if (running) {
+        // Handles are resolved here, the pool belongs to the game thread
+        AudioCommand command;
+        command.type = AudioCommand::Type::Emitter;
+        command.channel = channel;
+        command.position = position;
+        command.velocity = velocity;
+        return submit(command);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_MINUS)) {
-        //	Decrement Volume
-        result = musicChannel->getVolume(&volume);
-        FMOD_ERROR(result);
-        volume -= 0.1f;
-        if (volume < 0) {
-            volume = 0;
-        }
-        std::cout << "Volume: " << volume << std::endl;
-        result = musicChannel->setVolume(volume);
-        FMOD_ERROR(result);
+
+    auto result = channel->set3DAttributes(glm::fmod_vector(position), glm::fmod_vector(velocity));
+    FMOD_ERROR(result);
+
+    return true;
+}
+
+bool Audio::setSoundPositionsAndVelocities(const std::vector<EmitterUpdate>& updates) {
+    if (tracing() && !updates.empty()) {
+        TraceRecord record;
+        record.op = TraceOp::SetEmitters;
+        record.emitters = updates;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_LEFT_BRACKET)) {
-        // Pan Left
-        pan -= 0.1f;
-        if (pan < -1) {
-            pan = -1;
+
+    // One tight pass over the dirty emitters collected for this frame
+    for (const auto& update : updates) {
+        auto channel = voices->get(update.voice);
+        if (!channel)
+            continue;
+        voices->setPosition(update.voice, update.position);
+        if (lod && lod->isSilent(update.voice))
+            continue;
+
+        if (running) {
+            AudioCommand command;
+            command.type = AudioCommand::Type::Emitter;
+            command.channel = channel;
+            command.position = update.position;
+            command.velocity = update.velocity;
+            submit(command);
+            continue;
         }
-        std::cout << "Pan: " << pan << std::endl;
-        result = musicChannel->setPan(pan);
+
+        auto result = channel->set3DAttributes(glm::fmod_vector(update.position), glm::fmod_vector(update.velocity));
         FMOD_ERROR(result);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_RIGHT_BRACKET)) {
-        //	Pan Right
-        pan += 0.1f;
-        if (pan > 1) {
-            pan = 1;
-        }
-        std::cout << "Pan: " << pan << std::endl;
-        result = musicChannel->setPan(pan);
-        FMOD_ERROR(result);
+
+    return true;
+}
+
+bool Audio::loadMusicStream(const std::string& filename) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::LoadMusicStream;
+        record.name = filename;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_N)) {
-        //	Decremental Pitch
-        if (pitchf > 0.52f) {
-            frequencyCount--;
-            pitchCount--;
-            std::cout << "Pitch Count: " << pitchCount << std::endl;
-            std::cout << "Tempo Count: " << tempoChange << std::endl;
-
-            if (pitchf == 1.0f) {
-                pitchf = std::pow(.9438f, std::abs(tempoChange + pitchCount));
-            } else if (pitchf > 1.0f) {
-                pitchf = std::pow(1.059f, tempoChange + pitchCount);
-            } else if (pitchf < 1.0f) {
-                pitchf = std::pow(0.9438f, std::abs(tempoChange + pitchCount));
-            }
 
-            std::cout << "Pitch: " << pitchf << std::endl;
+    // Open it now, the scheduler finds it in the cache
+    auto sound = sounds->load(filename, MusicScheduler::Mode);
+    if (!sound)
+        return false;
 
-            result = musicChannel->removeDSP(dsppitch);
-            FMOD_ERROR(result);
+    music->setPlaylist({ { filename } });
+    return true;
+}
 
-            result = musicChannel->addDSP(0, dsppitch);
-            FMOD_ERROR(result);
+bool Audio::loadMusicStreamAsync(const std::string& filename, SoundCache::Callback onReady) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::LoadMusicStreamAsync;
+        record.name = filename;
+        trace->write(record);
+    }
 
-            result = dsppitch->setParameterFloat(FMOD_DSP_PITCHSHIFT_PITCH, pitchf);
-            FMOD_ERROR(result);
-        } else {
-            std::cout << "Reached Min Pitch" << std::endl;
-        }
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_M)) {
-        //	Incremental Pitch
-        if (pitchf < 1.98f) {
-            frequencyCount++;
-            pitchCount++;
-            std::cout << "Pitch Count: " << pitchCount << std::endl;
-            std::cout << "Tempo Count: " << tempoChange << std::endl;
-
-            if (pitchf == 1.0f) {
-                pitchf = std::pow(1.059f, std::abs(tempoChange + pitchCount));
-            } else if (pitchf > 1.0f) {
-                pitchf = std::pow(1.059f, tempoChange + pitchCount);
-            } else if (pitchf < 1.0f) {
-                pitchf = std::pow(0.9438f, std::abs(tempoChange + pitchCount));
-            }
+    // Opening a stream still reads headers and seek tables, keep that off the game thread too
+    auto sound = sounds->loadAsync(filename, MusicScheduler::Mode, std::move(onReady));
+    if (!sound)
+        return false;
 
-            std::cout << "Pitch: " << pitchf << std::endl;
+    music->setPlaylist({ { filename } });
+    return true;
+}
 
-            result = musicChannel->removeDSP(dsppitch);
-            FMOD_ERROR(result);
+void Audio::applyMusicPitch() {
+    if (!musicEffects)
+        return;
+
+    // Resampling for tempo also moves the pitch, the vocoder takes that back out
+    float shift = musicPitch - 12.0f * std::log2(musicTempo);
+    if (std::abs(shift) < 1e-3f)
+        shift = 0.0f;
+
+    // Bypassed at no shift, update() bypasses it again once a glide back to 0 has landed
+    auto dsp = musicEffects->get("pitch");
+    if (!musicEffects->isEnabled("pitch")) {
+        if (shift == 0.0f)
+            return;
+        // Still bypassed, so nothing reads what it held when it was switched off
+        if (dsp)
+            dsp->reset();
+        musicEffects->setEnabled("pitch", true);
+    }
+    setDSPParameter(dsp, PhaseVocoder::Pitch, shift);
+}
 
-            result = musicChannel->addDSP(0, dsppitch);
-            FMOD_ERROR(result);
+bool Audio::setMusicTempo(float tempo) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::SetMusicTempo;
+        record.scalar = tempo;
+        trace->write(record);
+    }
+    TraceScope scope{ traceDepth };
 
-            result = dsppitch->setParameterFloat(FMOD_DSP_PITCHSHIFT_PITCH, pitchf);
-            FMOD_ERROR(result);
-        } else {
-            std::cout << "Reached Max Pitch" << std::endl;
-        }
+    musicTempo = std::clamp(tempo, 0.5f, 2.0f);
+    applyMusicPitch();
+
+    // Resampled per track, the scheduler moves its boundaries to match
+    music->setTempo(musicTempo);
+    return music->getChannel() != nullptr;
+}
+
+bool Audio::setMusicPitch(float semitones) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::SetMusicPitch;
+        record.scalar = semitones;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_R)) {
-        lowpassActive = !lowpassActive;
+    TraceScope scope{ traceDepth };
 
-        if (!lowpassActive) {
-            result = musicChannel->removeDSP(dsplowpass);
-            FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dsplowpass);
-            FMOD_ERROR(result);
-        }
+    musicPitch = std::clamp(semitones, -12.0f, 12.0f);
+    applyMusicPitch();
+    return musicEffects != nullptr;
+}
 
-        std::cout << "Lowpass Filter: " << (lowpassActive ? "ON" : "OFF") << std::endl;
+bool Audio::playMusicStream() {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::PlayMusicStream;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_T)) {
-        highpassActive = !highpassActive;
 
-        if (!highpassActive) {
-            result = musicChannel->removeDSP(dsphighpass);
-            FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dsphighpass);
-            FMOD_ERROR(result);
-        }
+    // Play the playlist, at the tempo already chosen
+    music->setTempo(musicTempo);
+    return music->play();
+}
 
-        std::cout << "Highpass Filter: " << (highpassActive ? "ON" : "OFF") << std::endl;
+bool Audio::toggleMusicStream() {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::ToggleMusicStream;
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_Y)) {
-        echoActive = !echoActive;
 
-        if (!echoActive) {
-            result = musicChannel->removeDSP(dspecho);
-            FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dspecho);
-            FMOD_ERROR(result);
+    if (!music->getChannel())
+        return false;
 
-            result = dspecho->setParameterFloat(FMOD_DSP_ECHO_DELAY, 50.0f);
-            FMOD_ERROR(result);
-        }
+    music->setPaused(!music->isPaused());
+    return true;
+}
 
-        std::cout << "Echo Filter: " << (echoActive ? "ON" : "OFF") << std::endl;
+bool Audio::changeMusicFilter() {
+    // Music may still be loading
+    if (!music->getChannel())
+        return false;
+
+    static constexpr std::array<int, 24> keys{
+        GLFW_KEY_Q, GLFW_KEY_1, GLFW_KEY_2, GLFW_KEY_3, GLFW_KEY_4, GLFW_KEY_5,
+        GLFW_KEY_6, GLFW_KEY_7, GLFW_KEY_KP_ADD, GLFW_KEY_KP_SUBTRACT, GLFW_KEY_EQUAL, GLFW_KEY_MINUS,
+        GLFW_KEY_LEFT_BRACKET, GLFW_KEY_RIGHT_BRACKET, GLFW_KEY_N, GLFW_KEY_M, GLFW_KEY_R, GLFW_KEY_T,
+        GLFW_KEY_Y, GLFW_KEY_U, GLFW_KEY_I, GLFW_KEY_O, GLFW_KEY_P, GLFW_KEY_C
+    };
+    for (int key : keys) {
+        if (Input::GetKeyDown(key))
+            return applyMusicKey(key);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_U)) {
-        flangeActive = !flangeActive;
 
-        if (!flangeActive) {
-            result = musicChannel->removeDSP(dspflange);
-            FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dspflange);
-            FMOD_ERROR(result);
-        }
+    return true;
+}
+
+bool Audio::applyMusicKey(int key) {
+    if (!music->getChannel())
+        return false;
 
-        std::cout << "Flange Filter: " << (flangeActive ? "ON" : "OFF") << std::endl;
+    // The key is traced rather than what it does, the calls below are not traced again
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::MusicKey;
+        record.value = static_cast<uint32_t>(key);
+        trace->write(record);
     }
-    else if (Input::GetKeyDown(GLFW_KEY_I)) {
-        distortionActive = !distortionActive;
+    TraceScope scope{ traceDepth };
 
-        if (!distortionActive) {
-            result = musicChannel->removeDSP(dspdistortion);
+    // Levels go on the bus, the tracks under it come and go
+    auto musicGroup = musicBus ? musicBus : mixer->getGroup("master");
+    FMOD_RESULT result;
+
+    switch (key) {
+        case GLFW_KEY_Q: {
+            toggleMusicStream();
+            break;
+        }
+        case GLFW_KEY_1: {
+            //	Play Sound From Left Speakers
+            result = musicGroup->getVolume(&volume);
             FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dspdistortion);
+            result = musicGroup->setMixLevelsOutput(1, 0, 0, 0, 0, 0, 0, 0);
             FMOD_ERROR(result);
-
-            result = dspdistortion->setParameterFloat(FMOD_DSP_DISTORTION_LEVEL, 0.8f);
+            break;
+        }
+        case GLFW_KEY_2: {
+            //	Play Sound From Right Speakers
+            result = musicGroup->getVolume(&volume);
+            FMOD_ERROR(result);
+            std::cout << "Volume: " << volume << std::endl;
+            result = musicGroup->setMixLevelsOutput(0, 1, 0, 0, 0, 0, 0, 0);
             FMOD_ERROR(result);
+            break;
         }
-
-        std::cout << "Distortion Filter: " << (distortionActive ? "ON" : "OFF") << std::endl;
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_O)) {
-        chorusActive = !chorusActive;
-
-        if (!chorusActive) {
-            result = musicChannel->removeDSP(dspchorus);
+        case GLFW_KEY_3: {
+            //	Play Sound From Both Speakers
+            result = musicGroup->getVolume(&volume);
             FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dspchorus);
+            result = musicGroup->setMixLevelsOutput(1, 1, 0, 0, 0, 0, 0, 0);
             FMOD_ERROR(result);
+            break;
         }
-
-        std::cout << "Chorus Filter: " << (chorusActive ? "ON" : "OFF") << std::endl;
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_P)) {
-        parameqActive = !parameqActive;
-
-        if (!parameqActive) {
-            result = musicChannel->removeDSP(dspparameq);
+        case GLFW_KEY_4: {
+            // Slower by a semitone's worth of speed, the vocoder keeps the pitch
+            tempoSteps = std::max(tempoSteps - 1, -12);
+            setMusicTempo(std::exp2(static_cast<float>(tempoSteps) / 12.0f));
+            std::cout << "Tempo: " << musicTempo << std::endl;
+            break;
+        }
+        case GLFW_KEY_5: {
+            // Faster
+            tempoSteps = std::min(tempoSteps + 1, 12);
+            setMusicTempo(std::exp2(static_cast<float>(tempoSteps) / 12.0f));
+            std::cout << "Tempo: " << musicTempo << std::endl;
+            break;
+        }
+        case GLFW_KEY_6: {
+            toggleMusicStream();
+            break;
+        }
+        case GLFW_KEY_7: {
+            toggleSound();
+            break;
+        }
+        case GLFW_KEY_KP_ADD: {
+            // Only the game thread writes the target, the DSP ramps to it on the next block
+            float filter = data.volume.load(std::memory_order_relaxed) + 0.1f;
+            if (filter > 2) {
+                filter = 2;
+            }
+            data.volume.store(filter, std::memory_order_relaxed);
+            std::cout << "Filter Power: " << filter << std::endl;
+            break;
+        }
+        case GLFW_KEY_KP_SUBTRACT: {
+            float filter = data.volume.load(std::memory_order_relaxed) - 0.1f;
+            if (filter < 0) {
+                filter = 0;
+            }
+            data.volume.store(filter, std::memory_order_relaxed);
+            std::cout << "Filter Power: " << filter << std::endl;
+            break;
+        }
+        case GLFW_KEY_EQUAL: {
+            //	Increment Volume
+            result = musicGroup->getVolume(&volume);
             FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dspparameq);
+            volume += 0.1f;
+            if (volume > 1) {
+                volume = 1;
+            }
+            std::cout << "Volume: " << volume << std::endl;
+            result = musicGroup->setVolume(volume);
             FMOD_ERROR(result);
-
-            result = dspparameq->setParameterFloat(FMOD_DSP_PARAMEQ_CENTER, 5000.0f);
+            break;
+        }
+        case GLFW_KEY_MINUS: {
+            //	Decrement Volume
+            result = musicGroup->getVolume(&volume);
             FMOD_ERROR(result);
-            result = dspparameq->setParameterFloat(FMOD_DSP_PARAMEQ_GAIN, 0.0f);
+            volume -= 0.1f;
+            if (volume < 0) {
+                volume = 0;
+            }
+            std::cout << "Volume: " << volume << std::endl;
+            result = musicGroup->setVolume(volume);
             FMOD_ERROR(result);
+            break;
         }
-
-        std::cout << "Parameq Filter: " << (parameqActive ? "ON" : "OFF") << std::endl;
-    }
-    else if (Input::GetKeyDown(GLFW_KEY_C)) {
-        customActive = !customActive;
-
-        if (!customActive) {
-            result = musicChannel->removeDSP(dspcustom);
+        case GLFW_KEY_LEFT_BRACKET: {
+            // Pan Left
+            pan -= 0.1f;
+            if (pan < -1) {
+                pan = -1;
+            }
+            std::cout << "Pan: " << pan << std::endl;
+            result = musicGroup->setPan(pan);
             FMOD_ERROR(result);
-        } else {
-            result = musicChannel->addDSP(0, dspcustom);
+            break;
+        }
+        case GLFW_KEY_RIGHT_BRACKET: {
+            //	Pan Right
+            pan += 0.1f;
+            if (pan > 1) {
+                pan = 1;
+            }
+            std::cout << "Pan: " << pan << std::endl;
+            result = musicGroup->setPan(pan);
             FMOD_ERROR(result);
+            break;
+        }
+        case GLFW_KEY_N: {
+            // Pitch down a semitone, the tempo stays
+            pitchSteps = std::max(pitchSteps - 1, -12);
+            setMusicPitch(static_cast<float>(pitchSteps));
+            std::cout << "Pitch: " << musicPitch << " semitones" << std::endl;
+            break;
+        }
+        case GLFW_KEY_M: {
+            // Pitch up a semitone
+            pitchSteps = std::min(pitchSteps + 1, 12);
+            setMusicPitch(static_cast<float>(pitchSteps));
+            std::cout << "Pitch: " << musicPitch << " semitones" << std::endl;
+            break;
+        }
+        case GLFW_KEY_R: {
+            toggleFilter(AudioFilter::Lowpass);
+            break;
         }
+        case GLFW_KEY_T: {
+            toggleFilter(AudioFilter::Highpass);
+            break;
+        }
+        case GLFW_KEY_Y: {
+            toggleFilter(AudioFilter::Echo);
+            break;
+        }
+        case GLFW_KEY_U: {
+            toggleFilter(AudioFilter::Flange);
+            break;
+        }
+        case GLFW_KEY_I: {
+            toggleFilter(AudioFilter::Distortion);
+            break;
+        }
+        case GLFW_KEY_O: {
+            toggleFilter(AudioFilter::Chorus);
+            break;
+        }
+        case GLFW_KEY_P: {
+            toggleFilter(AudioFilter::Parameq);
+            break;
+        }
+        case GLFW_KEY_C: {
+            toggleFilter(AudioFilter::Custom);
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool Audio::toggleFilter(AudioFilter filter) {
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::ToggleFilter;
+        record.value = static_cast<uint32_t>(filter);
+        trace->write(record);
+    }
 
-        std::cout << "Custom Filter: " << (customActive ? "ON" : "OFF") << std::endl;
+    if (!musicEffects)
+        return false;
+
+    const char* name;
+    switch (filter) {
+        case AudioFilter::Lowpass: name = "lowpass"; break;
+        case AudioFilter::Highpass: name = "highpass"; break;
+        case AudioFilter::Echo: name = "echo"; break;
+        case AudioFilter::Flange: name = "flange"; break;
+        case AudioFilter::Distortion: name = "distortion"; break;
+        case AudioFilter::Chorus: name = "chorus"; break;
+        case AudioFilter::Parameq: name = "parameq"; break;
+        case AudioFilter::Custom: name = "custom"; break;
+        default: return false;
     }
 
+    if (!musicEffects->toggle(name))
+        return false;
+
+    std::cout << name << " filter: " << (musicEffects->isEnabled(name) ? "ON" : "OFF") << std::endl;
+
     return true;
 }
 
+std::vector<FMOD::DSP*> Audio::getDSPs() const {
+    // Every bus chain, in bus order
+    std::vector<FMOD::DSP*> dsps;
+    for (const auto& bus : mixer->getBuses()) {
+        if (bus->effects) {
+            auto effects = bus->effects->getDSPs();
+            dsps.insert(dsps.end(), effects.begin(), effects.end());
+        }
+    }
+    if (binaural)
+        dsps.push_back(binaural->getDSP());
+    for (const auto& engine : variations) {
+        dsps.push_back(engine->getDSP());
+    }
+    return dsps;
+}
+
 bool Audio::createGeometry(const glm::vec2& extent, const glm::vec3& position, const glm::quat& rotation) {
-    // Create geometry to occlusion
-    auto result = system->createGeometry(2, 6, &geometry);
-    FMOD_ERROR(result);
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::CreateGeometry;
+        record.vectors[0] = position;
+        record.vectors[1] = glm::vec3{ extent, 0.0f };
+        record.rotation = rotation;
+        trace->write(record);
+    }
 
-    FMOD_VECTOR quad[4] = {
-        { -extent.x, -extent.y, 0 },
-        { -extent.x,  extent.y, 0 },
-        { extent.x,  extent.y, 0 },
-        { extent.x, -extent.y, 0 }
+    // Occluding quad, merged into the static chunk it lands in on the next update
+    std::array<glm::vec3, 4> quad{
+        position + rotation * glm::vec3{ -extent.x, -extent.y, 0.0f },
+        position + rotation * glm::vec3{ -extent.x,  extent.y, 0.0f },
+        position + rotation * glm::vec3{ extent.x,  extent.y, 0.0f },
+        position + rotation * glm::vec3{ extent.x, -extent.y, 0.0f }
     };
+    geometry->addStaticPolygon(quad.data(), static_cast<int>(quad.size()));
 
-    // Add polygon to object geometry
-    int index = 0;
-    result = geometry->addPolygon(1, 1, true, 4, quad, &index);
-    FMOD_ERROR(result);
+    return true;
+}
 
-    // Using to position object geometry
-    result = geometry->setPosition(glm::fmod_vector(position));
-    FMOD_ERROR(result);
-    // Using to rotation object geometry
-    result = geometry->setRotation(glm::fmod_vector(rotation * vec3::forward), glm::fmod_vector(rotation * vec3::up));
-    FMOD_ERROR(result);
+bool Audio::setReverbZones(const std::vector<ConvolutionReverb::Zone>& zones) {
+    if (!reverb)
+        return false;
+
+    if (tracing()) {
+        TraceRecord record;
+        record.op = TraceOp::SetReverbZones;
+        for (const auto& zone : zones) {
+            if (zone.impulse)
+                record.zones.push_back({ zone.impulse->name, zone.impulse->rt60, zone.impulse->seed, zone.weight });
+        }
+        trace->write(record);
+    }
 
+    reverb->setZones(zones);
     return true;
 }
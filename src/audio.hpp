@@ -3,67 +3,249 @@
 #include <fmod.hpp>
 #include <fmod_errors.h>
 
-struct DSPUserdata {
-    float volume;
+#include "dspgain.hpp"
+#include "voicepool.hpp"
+#include "spscqueue.hpp"
+#include "streamio.hpp"
+#include "mixer.hpp"
+#include "geometrymanager.hpp"
+#include "occlusion.hpp"
+#include "convolution.hpp"
+#include "binaural.hpp"
+#include "phasevocoder.hpp"
+#include "analysis.hpp"
+#include "audioprofiler.hpp"
+#include "musicscheduler.hpp"
+#include "audiolod.hpp"
+#include "synth.hpp"
+#include "variation.hpp"
+#include "capture.hpp"
+#include "audiotrace.hpp"
+
+struct EmitterUpdate {
+    VoiceHandle voice;
+    glm::vec3 position;
+    glm::vec3 velocity;
+};
+
+/// @brief Game thread -> audio thread message, stamped when pushed
+struct AudioCommand {
+    enum class Type : uint8_t { Listener, Emitter, DSPParameter };
+
+    Type type;
+    uint64_t timestamp; // steady clock, ns
+    union {
+        FMOD::Channel* channel;
+        FMOD::DSP* dsp;
+    };
+    int index; // dsp parameter
+    float value; // dsp parameter
+    glm::vec3 position;
+    glm::vec3 velocity;
+    glm::vec3 forward;
+    glm::vec3 up;
+};
+
+/// @brief Push to FMOD update latency of threaded commands
+struct CommandLatency {
+    uint64_t commands;
+    uint64_t overflows; // ring was full, coalesced with later commands to the same target until it had room
+    double averageMs;
+    double maxMs;
+};
+
+struct AudioSettings {
+    FMOD_OUTPUTTYPE output{ FMOD_OUTPUTTYPE_AUTODETECT };
+    std::string outputFile; // FMOD_OUTPUTTYPE_WAVWRITER(_NRT) target
+    bool profile{ false }; // per DSP cpu usage
+    uint64_t soundBudget{ 64ull << 20 }; // decoded sample bytes kept by the sound cache
+    size_t readAhead{ StreamIO::DefaultBufferSize }; // per open file and buffer, 0 keeps FMOD's own file I/O
+    bool engineOcclusion{ false }; // our cached raycaster instead of FMOD's per update geometry raycasts
+    bool binaural{ false }; // HRTF render the world bus for headphones
+    std::string hrirFile; // .hrir set for binaural, empty synthesizes a spherical head
+    bool meters{ true }; // analysis taps on master (with spectrum), music and sfx
+    std::string profileLog; // rolling JSON lines log of the profiler samples, empty logs nothing
+    bool lod{ true }; // virtualize, strip and cluster voices by audibility
+    AudioLODSettings lodSettings;
+    size_t samplePool{ SamplePool::DefaultCapacity }; // samples of pre-decoded PCM for the variation engines
+    int sampleRate{ 0 }; // mixer rate, 0 keeps the output's own
+    unsigned int blockLength{ 0 }; // samples per mix block, 0 keeps FMOD's default
 };
 
+enum class AudioFilter { Lowpass, Highpass, Echo, Flange, Distortion, Chorus, Parameq, Custom };
+
 class Audio {
 public:
-    Audio();
+    Audio(const AudioSettings& settings = {});
     ~Audio();
 
-    bool loadSound(const std::string& filename);
-    bool playSound(const glm::vec3& position, float volume = 1.0f);
-    bool toggleSound();
-    bool setSoundPositionAndVelocity(const glm::vec3& position, const glm::vec3& velocity);
+    /// @brief Serve later loads from a packed bank built by the soundPack tool
+    bool mountBank(const std::string& filename);
+    SoundRef loadSound(const std::string& filename, FMOD_MODE mode = FMOD_3D | FMOD_LOOP_NORMAL);
+    VoiceHandle playSound(const glm::vec3& position, float volume = 1.0f, int priority = VoicePool::DefaultPriority, bool paused = false); // last loaded sound
+    /// @brief Start decoding without blocking, onReady runs from update() once the sound can play
+    SoundRef loadSoundAsync(const std::string& filename, SoundCache::Callback onReady, FMOD_MODE mode = FMOD_3D | FMOD_LOOP_NORMAL);
+    /// @brief Play on a bus group, the world sfx bus by default
+    VoiceHandle playSound(const SoundRef& sound, const glm::vec3& position, float volume = 1.0f, int priority = VoicePool::DefaultPriority, bool paused = false, FMOD::ChannelGroup* bus = nullptr);
+    bool stopSound(VoiceHandle voice);
+    bool isPlaying(VoiceHandle voice) const { return voices->get(voice) != nullptr; } // false once stolen or finished
+    bool toggleSound(); // last played voice
+    bool toggleSound(VoiceHandle voice);
+    bool setSoundPositionAndVelocity(const glm::vec3& position, const glm::vec3& velocity); // last played voice
+    bool setSoundPositionAndVelocity(VoiceHandle voice, const glm::vec3& position, const glm::vec3& velocity);
+    bool setSoundPositionsAndVelocities(const std::vector<EmitterUpdate>& updates);
 
+    /// @brief Make the stream a one track, repeating playlist of the music scheduler
     bool loadMusicStream(const std::string& filename);
+    bool loadMusicStreamAsync(const std::string& filename, SoundCache::Callback onReady);
     bool playMusicStream();
     bool toggleMusicStream();
+    /// @brief Playback speed of the music, the pitch stays where setMusicPitch put it
+    bool setMusicTempo(float tempo);
+    /// @brief Music pitch in semitones, independent of the tempo
+    bool setMusicPitch(float semitones);
+    float getMusicTempo() const { return musicTempo; }
+    float getMusicPitch() const { return musicPitch; }
 
     bool changeMusicFilter();
+    /// @brief What changeMusicFilter does for a GLFW key press, replays call it directly
+    bool applyMusicKey(int key);
+    bool toggleFilter(AudioFilter filter);
     bool createGeometry(const glm::vec2& extent, const glm::vec3& position, const glm::quat& rotation);
+    /// @brief Hand the weighted responses to the zone reverb, false without one
+    bool setReverbZones(const std::vector<ConvolutionReverb::Zone>& zones);
+
+    bool setDSPParameter(FMOD::DSP* dsp, int index, float value);
+
+    /// @brief Procedural sound owned by the engine, start it with playSynth
+    Synth* createSynth(const SynthPatch& patch);
+    /// @brief Play the synth's stream, unlike playSound the voice does not become the last played one
+    VoiceHandle playSynth(const Synth& synth, const glm::vec3& position, float volume = 1.0f, FMOD::ChannelGroup* bus = nullptr);
+
+    /// @brief Decode a short sample into the variation pool, returns its pool index or UINT32_MAX
+    uint32_t loadVariationSample(const std::string& filename);
+    /// @brief Variation engine playing on the world sfx bus at position, owned by the engine
+    VariationEngine* createVariations(const VariationSet& set, const glm::vec3& position);
+
+    /// @brief Start capturing from device, update() feeds its ring from here on
+    bool startCapture(std::unique_ptr<CaptureDevice> device, const CaptureSettings& settings = {});
+    /// @brief Capture from an FMOD record driver, false when the machine has none
+    bool startCapture(int driver = 0, const CaptureSettings& settings = {});
+    void stopCapture();
+    /// @brief Play the captured voice back as an emitter on the world sfx bus
+    VoiceHandle playCaptureLoopback(const glm::vec3& position, float volume = 1.0f);
 
     void update(const glm::vec3& position, const glm::vec3& velocity, const glm::vec3& forward, const glm::vec3& up);
 
+    /// @brief Log every call that shapes the mix from here on, runReplay plays the log back offline
+    bool startTrace(const std::string& filename);
+    void stopTrace();
+    const AudioTrace* getTrace() const { return trace.get(); } // nullptr unless tracing
+
+    /// @brief Threaded mode: a fixed rate thread drains the command ring and runs System::update, so the
+    /// mix keeps its pace through render hitches. Listener, emitter and DSP parameter calls are queued for
+    /// it; the rest of update() (cache polling, music scheduling, voice reaping, occlusion, LOD, meters)
+    /// still runs on the game thread at frame rate through FMOD's thread safe API. Music boundaries are
+    /// committed Lookahead ahead on the DSP clock, shorter hitches do not move them.
+    bool startThread(float tickRate = 60.0f);
+    void stopThread();
+    bool isThreaded() const { return running; }
+    CommandLatency getCommandLatency() const;
+    void resetCommandLatency();
+
+    FMOD::System* getSystem() const { return system; }
+    SoundCache& getSoundCache() const { return *sounds; }
+    MusicScheduler& getMusic() const { return *music; } // playlist of the music bus
+    const SamplePool& getSamplePool() const { return *samples; }
+    const std::vector<std::unique_ptr<VariationEngine>>& getVariations() const { return variations; }
+    AudioCapture* getCapture() const { return capture.get(); } // nullptr unless capturing
+    std::vector<StreamIOStats> getStreamStats() const { return io ? io->getStats() : std::vector<StreamIOStats>{}; }
+    std::vector<FMOD::DSP*> getDSPs() const;
+    EffectChain* getMusicEffects() const { return musicEffects; }
+    Mixer& getMixer() const { return *mixer; }
+    GeometryManager& getGeometry() const { return *geometry; }
+    ImpulseResponseCache& getImpulseResponses() const { return *impulses; }
+    ConvolutionReverb* getReverb() const { return reverb; } // zone reverb of the world bus, nullptr without one
+    OcclusionRaycaster* getOcclusion() const { return occlusion.get(); } // nullptr unless engineOcclusion
+    BinauralRenderer* getBinaural() const { return binaural.get(); } // nullptr unless binaural
+    AudioLOD* getLOD() const { return lod.get(); } // nullptr unless lod
+    const std::vector<std::unique_ptr<AnalysisTap>>& getMeters() const { return meters; } // refreshed by update()
+    AudioProfiler& getProfiler() { return profiler; } // sampled by update() while visible or logging
+
 private:
-    FMOD::System* system;
-
-    FMOD::Sound* musicSound;
-    FMOD::Channel* musicChannel;
-
-    FMOD::Sound* spatialSound;
-    FMOD::Channel* soundChannel;
-
-    FMOD::DSP* dsppitch;
-    FMOD::DSP* dsplowpass;
-    FMOD::DSP* dsphighpass;
-    FMOD::DSP* dspecho;
-    FMOD::DSP* dspflange;
-    FMOD::DSP* dspdistortion;
-    FMOD::DSP* dspchorus;
-    FMOD::DSP* dspparameq;
-    FMOD::DSP* dspcustom;
-
-    FMOD::Geometry* geometry;
-
-    bool lowpassActive{ false };
-    bool highpassActive{ false };
-    bool echoActive{ false };
-    bool flangeActive{ false };
-    bool distortionActive{ false };
-    bool chorusActive{ false };
-    bool parameqActive{ false };
-    bool customActive{ false };
+    FMOD::System* system{ nullptr };
+    AudioSettings settings;
+
+    std::unique_ptr<StreamIO> io; // outlives the system, FMOD closes its files on release
+    std::unique_ptr<SoundCache> sounds;
+
+    std::unique_ptr<MusicScheduler> music;
+    float musicTempo{ 1.0f };
+    float musicPitch{ 0.0f }; // semitones
+    int tempoSteps{ 0 }; // semitone steps of the tempo keys, tempo and pitch derive from these so nothing drifts
+    int pitchSteps{ 0 };
+
+    SoundRef spatialSound;
+    std::unique_ptr<VoicePool> voices;
+    VoiceHandle soundVoice; // last voice the game played, what the key and the no-handle overloads act on
+
+    std::unique_ptr<ImpulseResponseCache> impulses;
+    std::vector<std::unique_ptr<ConvolutionReverb>> reverbs; // userdata of the convolution DSPs in bus chains
+    std::vector<std::unique_ptr<PhaseVocoder>> vocoders; // userdata of the phase vocoder DSPs in bus chains
+    std::vector<std::unique_ptr<Synth>> synths; // userdata of their streams, outlive the voices playing them
+    std::unique_ptr<SamplePool> samples;
+    std::vector<std::unique_ptr<VariationEngine>> variations;
+    std::unique_ptr<AudioCapture> capture; // userdata of the loopback stream
+    VoiceHandle captureVoice;
+    ConvolutionReverb* reverb{ nullptr };
+
+    std::unique_ptr<Mixer> mixer;
+    FMOD::ChannelGroup* musicBus{ nullptr };
+    FMOD::ChannelGroup* sfxBus{ nullptr };
+    EffectChain* musicEffects{ nullptr }; // owned by the music bus
+
+    std::unique_ptr<GeometryManager> geometry;
+    std::unique_ptr<OcclusionRaycaster> occlusion;
+    uint32_t occlusionVersion{ 0 }; // geometry version the BVH was built from
+
+    std::vector<std::unique_ptr<AnalysisTap>> meters;
+    uint64_t meterTime{ 0 }; // last meter refresh, steady clock ns
+
+    AudioProfiler profiler;
+    bool profiling{ false }; // FMOD_INIT_PROFILE_ENABLE, per DSP timings are only valid with it
+
+    std::unique_ptr<BinauralRenderer> binaural;
+    std::array<VoiceHandle, BinauralRenderer::MaxSources> binauralVoices; // voice of each renderer source
+    std::vector<VoiceHandle> binauralFar; // world voices the LOD took off the renderer, back once they are near
+
+    std::unique_ptr<AudioLOD> lod;
 
     DSPUserdata data{ 0.5f };
     float pan{ 0.0f };
     float volume;
-    float frequency;
-    float pitchf{ 1.0f };
-    int frequencyCount{ 0 };
-    int pitchCount{ 0 };
-    int tempoChange{ 0 };
-    float speed;
-    float pitch{ 1 };
+
+    static constexpr size_t CommandCapacity = 8192;
+
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    float tickRate{ 60.0f };
+    std::unique_ptr<SPSCQueue<AudioCommand, CommandCapacity>> commands;
+    std::atomic<uint64_t> latencyCount{ 0 };
+    std::atomic<uint64_t> latencySum{ 0 };
+    std::atomic<uint64_t> latencyMax{ 0 };
+    std::atomic<uint64_t> overflowCount{ 0 };
+    std::vector<AudioCommand> overflow; // game thread, latest command per target while the ring is full
+    std::unordered_map<uint64_t, size_t> overflowIndex; // target -> its command in overflow
+
+    std::unique_ptr<AudioTrace> trace;
+    uint32_t traceDepth{ 0 }; // traced calls in progress, what they call is not traced again
+
+    bool tracing() const { return trace && traceDepth == 0; }
+    /// @brief playSound without making the voice the last played one, for voices the engine starts itself
+    VoiceHandle playVoice(const SoundRef& sound, const glm::vec3& position, float volume, int priority, bool paused, FMOD::ChannelGroup* bus);
+    bool submit(AudioCommand& command);
+    bool flushOverflow();
+    void execute(const AudioCommand& command);
+    void threadLoop();
+    void applyMusicPitch();
 };
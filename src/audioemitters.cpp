@@ -0,0 +1,30 @@
+#include "audioemitters.hpp"
+#include "audio.hpp"
+#include "components.hpp"
+#include "common.hpp"
+
+void AudioEmitterSystem::update(entt::registry& registry, Audio& audio, float dt) {
+    float invDt = dt > 0.0f ? 1.0f / dt : 0.0f;
+
+    batch.clear();
+
+    auto group = registry.group<AudioEmitterComponent>(entt::get<TransformComponent>);
+    for (auto entity : group) {
+        auto [emitter, transform] = group.get<AudioEmitterComponent, TransformComponent>(entity);
+
+        bool moved = transform.translation != emitter.position;
+        glm::vec3 velocity = moved && !emitter.dirty ? (transform.translation - emitter.position) * invDt : vec3::zero;
+
+        if (!emitter.dirty && !moved && velocity == emitter.velocity)
+            continue;
+
+        emitter.position = transform.translation;
+        emitter.velocity = velocity;
+        emitter.dirty = false;
+
+        batch.push_back({ emitter.voice, emitter.position, emitter.velocity });
+    }
+
+    if (!batch.empty())
+        audio.setSoundPositionsAndVelocities(batch);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <entt/entity/registry.hpp>
+
+class Audio;
+struct EmitterUpdate;
+
+/// @brief Pushes moved emitters to FMOD once per frame
+/// Velocity is derived from the previous transform, static emitters cost a compare and no FMOD call
+class AudioEmitterSystem {
+public:
+    void update(entt::registry& registry, Audio& audio, float dt);
+
+private:
+    std::vector<EmitterUpdate> batch;
+};
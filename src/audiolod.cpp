@@ -0,0 +1,179 @@
+#include "audiolod.hpp"
+#include "common.hpp"
+
+#include <chrono>
+
+namespace {
+    // Margins a voice has to clear to go back up a level
+    constexpr float AudibleHysteresis = 1.5f; // +3.5 dB
+    constexpr float DistanceHysteresis = 0.9f;
+
+    bool silent(VoiceLOD level) {
+        return level == VoiceLOD::Clustered || level == VoiceLOD::Virtual;
+    }
+}
+
+AudioLOD::AudioLOD(const AudioLODSettings& settings) : settings{settings} {
+}
+
+void AudioLOD::update(const glm::vec3& listener, VoicePool& voices) {
+    auto start = std::chrono::steady_clock::now();
+
+    candidates.clear();
+
+    for (uint32_t index = 0; index < VoicePool::MaxVoices; index++) {
+        auto handle = voices.handleAt(index);
+        auto channel = voices.get(handle);
+        if (!channel)
+            continue;
+
+        // Rolloff settings are read once per voice, they do not change while it plays
+        auto& entry = entries[index];
+        if (entry.generation != handle.generation) {
+            entry = {};
+            entry.generation = handle.generation;
+            FMOD_MODE mode = 0;
+            channel->getMode(&mode);
+            entry.spatial = (mode & FMOD_3D) != 0;
+            entry.rolloff = mode & (FMOD_3D_INVERSEROLLOFF | FMOD_3D_LINEARROLLOFF | FMOD_3D_LINEARSQUAREROLLOFF | FMOD_3D_INVERSETAPEREDROLLOFF | FMOD_3D_CUSTOMROLLOFF);
+            channel->get3DMinMaxDistance(&entry.minDistance, &entry.maxDistance);
+        }
+
+        // 2D voices have no distance to fade over
+        if (!entry.spatial) {
+            entry.target = VoiceLOD::Full;
+            entry.targetGain = 1.0f;
+            continue;
+        }
+
+        float direct = 0.0f;
+        channel->get3DOcclusion(&direct, nullptr);
+
+        auto position = voices.getPosition(handle);
+        entry.distance = glm::distance(listener, position);
+        entry.audibility = voices.getVolume(handle) * attenuation(entry, entry.distance) * (1.0f - direct);
+        entry.targetGain = 1.0f;
+
+        float threshold = settings.virtualAudibility * (silent(entry.level) ? AudibleHysteresis : 1.0f);
+        float far = settings.farDistance * (entry.level == VoiceLOD::Full ? 1.0f : DistanceHysteresis);
+        if (entry.audibility < threshold)
+            entry.target = VoiceLOD::Virtual;
+        else
+            entry.target = entry.distance > far ? VoiceLOD::Far : VoiceLOD::Full;
+
+        if (entry.target != VoiceLOD::Virtual && entry.distance > settings.clusterDistance)
+            candidates.push_back({ voices.getSound(handle), glm::ivec3{ glm::floor(position / settings.clusterCell) }, index });
+    }
+
+    cluster();
+
+    // Only changes reach FMOD, a voice that keeps its level costs nothing here
+    stats = {};
+    for (uint32_t index = 0; index < VoicePool::MaxVoices; index++) {
+        auto handle = voices.handleAt(index);
+        auto channel = voices.get(handle);
+        if (!channel)
+            continue;
+
+        auto& entry = entries[index];
+        if (entry.target != entry.level) {
+            if (silent(entry.target) && !silent(entry.level)) {
+                channel->setMute(true);
+            } else if (!silent(entry.target) && silent(entry.level)) {
+                // Positions were held back while it was muted
+                FMOD_VECTOR velocity{ 0.0f, 0.0f, 0.0f };
+                auto position = voices.getPosition(handle);
+                channel->set3DAttributes(glm::fmod_vector(position), &velocity);
+                channel->setMute(false);
+            }
+            entry.level = entry.target;
+        }
+        if (entry.targetGain != entry.gain) {
+            voices.setGain(handle, entry.targetGain);
+            entry.gain = entry.targetGain;
+        }
+
+        switch (entry.level) {
+            case VoiceLOD::Full: stats.full++; break;
+            case VoiceLOD::Far: stats.far++; break;
+            case VoiceLOD::Clustered: stats.clustered++; break;
+            case VoiceLOD::Virtual: stats.virtualized++; break;
+        }
+    }
+
+    stats.lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+VoiceLOD AudioLOD::getLevel(VoiceHandle handle) const {
+    if (handle.index >= VoicePool::MaxVoices || entries[handle.index].generation != handle.generation)
+        return VoiceLOD::Full;
+    return entries[handle.index].level;
+}
+
+bool AudioLOD::isSilent(VoiceHandle handle) const {
+    return silent(getLevel(handle));
+}
+
+float AudioLOD::attenuation(const Entry& entry, float distance) const {
+    // FMOD's built in curves, custom rolloff is treated as inverse
+    float minDistance = entry.minDistance;
+    float maxDistance = std::max(entry.maxDistance, minDistance);
+    float d = std::clamp(distance, minDistance, maxDistance);
+
+    switch (entry.rolloff) {
+        case FMOD_3D_LINEARROLLOFF:
+            return maxDistance > minDistance ? (maxDistance - d) / (maxDistance - minDistance) : 1.0f;
+        case FMOD_3D_LINEARSQUAREROLLOFF: {
+            float linear = maxDistance > minDistance ? (maxDistance - d) / (maxDistance - minDistance) : 1.0f;
+            return linear * linear;
+        }
+        case FMOD_3D_INVERSETAPEREDROLLOFF: {
+            float linear = maxDistance > minDistance ? (maxDistance - d) / (maxDistance - minDistance) : 1.0f;
+            return minDistance / d * linear;
+        }
+        default:
+            return minDistance / d;
+    }
+}
+
+void AudioLOD::cluster() {
+    if (candidates.size() < settings.clusterSize)
+        return;
+
+    // Group by sound and cell, loudest first within a group
+    std::sort(candidates.begin(), candidates.end(), [this](const Candidate& a, const Candidate& b) {
+        if (a.sound != b.sound)
+            return a.sound < b.sound;
+        if (a.cell.x != b.cell.x)
+            return a.cell.x < b.cell.x;
+        if (a.cell.y != b.cell.y)
+            return a.cell.y < b.cell.y;
+        if (a.cell.z != b.cell.z)
+            return a.cell.z < b.cell.z;
+        return entries[a.index].audibility > entries[b.index].audibility;
+    });
+
+    for (size_t first = 0; first < candidates.size();) {
+        size_t last = first + 1;
+        while (last < candidates.size() && candidates[last].sound == candidates[first].sound && candidates[last].cell == candidates[first].cell) {
+            last++;
+        }
+
+        if (last - first >= settings.clusterSize) {
+            // Uncorrelated sources add in power, the representative carries the whole group
+            float power = 0.0f;
+            for (size_t i = first; i < last; i++) {
+                float audibility = entries[candidates[i].index].audibility;
+                power += audibility * audibility;
+                entries[candidates[i].index].target = VoiceLOD::Clustered;
+            }
+
+            auto& representative = entries[candidates[first].index];
+            representative.target = VoiceLOD::Far;
+            if (representative.audibility > 0.0f)
+                representative.targetGain = std::min(std::sqrt(power) / representative.audibility, MaxClusterGain);
+        }
+
+        first = last;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include "voicepool.hpp"
+
+enum class VoiceLOD : uint8_t {
+    Full, // every per voice insert
+    Far, // FMOD panning only, no binaural send
+    Clustered, // muted, heard through the representative of its cluster
+    Virtual // muted, FMOD virtualizes it
+};
+
+struct AudioLODSettings {
+    float farDistance{ 40.0f }; // metres, voices beyond lose their per voice inserts
+    float virtualAudibility{ 0.01f }; // -40 dB, quieter voices are virtualized
+    float clusterDistance{ 60.0f }; // metres, clusters only form beyond this
+    float clusterCell{ 8.0f }; // metres, voices of one sound sharing a cell form a cluster
+    uint32_t clusterSize{ 3 }; // voices a cell needs before they collapse into one
+};
+
+struct AudioLODStats {
+    uint32_t full;
+    uint32_t far;
+    uint32_t clustered;
+    uint32_t virtualized;
+    double lastUpdateMs;
+};
+
+/// @brief Distance based level of detail for the pooled voices
+/// Audibility is estimated engine side from the voice volume, the channel's rolloff curve and its
+/// occlusion, so it is known before FMOD mixes anything. Inaudible voices are muted, which with
+/// FMOD_INIT_VOL0_BECOMES_VIRTUAL takes them out of the mix, and their position updates are held back
+/// until they return. Beyond the cluster distance, voices of the same sound in one grid cell collapse
+/// into the loudest of them, played with the power sum of the group. Levels have hysteresis so voices
+/// near a threshold do not flap. The mixer then pays for what can be heard, not for every emitter.
+class AudioLOD {
+public:
+    static constexpr float MaxClusterGain = 4.0f; // +12 dB
+
+    explicit AudioLOD(const AudioLODSettings& settings = {});
+
+    void update(const glm::vec3& listener, VoicePool& voices);
+
+    VoiceLOD getLevel(VoiceHandle handle) const;
+    /// @brief Muted by the LOD, its FMOD position can wait until it is heard again
+    bool isSilent(VoiceHandle handle) const;
+
+    const AudioLODSettings& getSettings() const { return settings; }
+    AudioLODStats getStats() const { return stats; }
+
+private:
+    struct Entry {
+        uint32_t generation{ UINT32_MAX }; // voice the entry belongs to
+        VoiceLOD level{ VoiceLOD::Full };
+        float gain{ 1.0f };
+        float minDistance{ 1.0f };
+        float maxDistance{ 10000.0f };
+        FMOD_MODE rolloff{ FMOD_3D_INVERSEROLLOFF };
+        bool spatial{ false };
+
+        // This update
+        float audibility{ 0.0f };
+        float distance{ 0.0f };
+        VoiceLOD target{ VoiceLOD::Full };
+        float targetGain{ 1.0f };
+    };
+
+    struct Candidate {
+        FMOD::Sound* sound;
+        glm::ivec3 cell;
+        uint32_t index;
+    };
+
+    AudioLODSettings settings;
+    std::array<Entry, VoicePool::MaxVoices> entries;
+    std::vector<Candidate> candidates; // scratch for clustering
+
+    AudioLODStats stats{};
+
+    float attenuation(const Entry& entry, float distance) const;
+    void cluster();
+};
@@ -0,0 +1,114 @@
+#include "audioprofiler.hpp"
+#include "fmoderror.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+    // DSP names are short ASCII, quotes and backslashes are all that needs escaping
+    void writeString(std::ostream& out, const std::string& text) {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            out << (static_cast<unsigned char>(c) < 0x20 ? ' ' : c);
+        }
+        out << '"';
+    }
+}
+
+AudioProfiler::AudioProfiler(float interval) : interval{interval} {
+}
+
+bool AudioProfiler::startLog(const std::string& path, size_t maxLines) {
+    stopLog();
+
+    log.open(path, std::ios::trunc);
+    if (!log) {
+        std::cerr << "Failed to open profile log " << path << std::endl;
+        return false;
+    }
+    logPath = path;
+    logLines = 0;
+    maxLogLines = std::max<size_t>(maxLines, 1);
+
+    return true;
+}
+
+void AudioProfiler::stopLog() {
+    if (log.is_open())
+        log.close();
+}
+
+bool AudioProfiler::due(float dt) {
+    clock += dt;
+    if (!visible && !log.is_open())
+        return false;
+
+    sinceSample += dt;
+    if (sinceSample < interval)
+        return false;
+
+    sinceSample = 0.0f;
+    return true;
+}
+
+void AudioProfiler::sample(FMOD::System* system, const std::vector<FMOD::DSP*>& dsps) {
+    latest.time = clock;
+
+    auto result = system->getCPUUsage(&latest.cpu);
+    FMOD_ERROR_(result);
+    result = system->getChannelsPlaying(&latest.channels, &latest.realChannels);
+    FMOD_ERROR_(result);
+    // Non blocking, a counter a block behind is fine for a readout
+    result = FMOD::Memory_GetStats(&latest.memoryCurrent, &latest.memoryPeak, false);
+    FMOD_ERROR_(result);
+
+    latest.dsps.resize(dsps.size());
+    for (size_t i = 0; i < dsps.size(); i++) {
+        auto& cost = latest.dsps[i];
+        char name[32] = {};
+        dsps[i]->getInfo(name, nullptr, nullptr, nullptr, nullptr);
+        cost.name = name;
+        cost.exclusive = 0;
+        cost.inclusive = 0;
+        dsps[i]->getCPUUsage(&cost.exclusive, &cost.inclusive);
+    }
+
+    if (log.is_open())
+        write();
+}
+
+void AudioProfiler::write() {
+    // Keep the finished file as path.1 and start over, bounding the disk use of a long session
+    if (logLines >= maxLogLines) {
+        log.close();
+        std::error_code error;
+        std::filesystem::rename(logPath, logPath + ".1", error);
+        log.open(logPath, std::ios::trunc);
+        logLines = 0;
+        if (!log) {
+            std::cerr << "Failed to reopen profile log " << logPath << std::endl;
+            return;
+        }
+    }
+
+    char fields[256];
+    std::snprintf(fields, sizeof(fields),
+                  "{\"time\":%.3f,\"dsp\":%.2f,\"stream\":%.2f,\"geometry\":%.2f,\"update\":%.2f,\"convolution\":%.2f,"
+                  "\"channels\":%d,\"real\":%d,\"memory\":%d,\"memoryPeak\":%d,\"dsps\":[",
+                  latest.time, latest.cpu.dsp, latest.cpu.stream, latest.cpu.geometry, latest.cpu.update,
+                  latest.cpu.convolution1 + latest.cpu.convolution2, latest.channels, latest.realChannels,
+                  latest.memoryCurrent, latest.memoryPeak);
+    log << fields;
+    for (size_t i = 0; i < latest.dsps.size(); i++) {
+        const auto& cost = latest.dsps[i];
+        log << (i > 0 ? ",{\"name\":" : "{\"name\":");
+        writeString(log, cost.name);
+        log << ",\"exclusive\":" << cost.exclusive << ",\"inclusive\":" << cost.inclusive << '}';
+    }
+    log << "]}\n";
+    log.flush();
+    logLines++;
+}
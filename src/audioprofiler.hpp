@@ -0,0 +1,69 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+/// @brief Time spent in one DSP per mix block, microseconds
+struct DSPCost {
+    std::string name;
+    unsigned int exclusive;
+    unsigned int inclusive; // with its inputs
+};
+
+/// @brief One reading of the system's audio cost
+struct AudioProfileSample {
+    double time{ 0.0 }; // seconds since the profiler started
+    FMOD_CPU_USAGE cpu{}; // percent of a core
+    int channels{ 0 }; // playing, virtual included
+    int realChannels{ 0 }; // actually mixed
+    int memoryCurrent{ 0 }; // bytes allocated by FMOD
+    int memoryPeak{ 0 };
+    std::vector<DSPCost> dsps; // empty unless the system was initialised with profiling
+};
+
+/// @brief Samples FMOD's CPU, channel and memory counters at a fixed rate for the overlay and an
+/// offline log. Nothing is queried while it is hidden and not logging, update() is then one branch.
+/// The log is JSON lines, one sample per line; after maxLines it rolls over to path.1 so a long
+/// session keeps between one and two files' worth of history.
+class AudioProfiler {
+public:
+    static constexpr float DefaultInterval = 0.25f; // seconds
+    static constexpr size_t DefaultLogLines = 14400; // an hour at the default interval
+
+    explicit AudioProfiler(float interval = DefaultInterval);
+
+    AudioProfiler(const AudioProfiler&) = delete;
+    AudioProfiler& operator=(const AudioProfiler&) = delete;
+
+    void setVisible(bool show) { visible = show; }
+    bool isVisible() const { return visible; }
+
+    bool startLog(const std::string& path, size_t maxLines = DefaultLogLines);
+    void stopLog();
+    bool isLogging() const { return log.is_open(); }
+
+    /// @brief Advance the clock, true when a sample is wanted now
+    bool due(float dt);
+    /// @brief Read the counters, dsps are timed only when profiling is enabled on the system
+    void sample(FMOD::System* system, const std::vector<FMOD::DSP*>& dsps);
+
+    const AudioProfileSample& getLatest() const { return latest; }
+
+private:
+    float interval;
+    float sinceSample{ 0.0f };
+    double clock{ 0.0 };
+    bool visible{ false };
+
+    AudioProfileSample latest;
+
+    std::ofstream log;
+    std::string logPath;
+    size_t logLines{ 0 };
+    size_t maxLogLines{ 0 };
+
+    void write();
+};
@@ -0,0 +1,478 @@
+#include "audiotrace.hpp"
+#include "audio.hpp"
+#include "fmoderror.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    void putSigned(std::vector<uint8_t>& out, int64_t value) {
+        // Zigzag, small negatives stay one byte
+        putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void putFloat(std::vector<uint8_t>& out, float value) {
+        uint8_t raw[sizeof(float)];
+        std::memcpy(raw, &value, sizeof(float));
+        out.insert(out.end(), raw, raw + sizeof(float));
+    }
+
+    void putVector(std::vector<uint8_t>& out, const glm::vec3& value) {
+        putFloat(out, value.x);
+        putFloat(out, value.y);
+        putFloat(out, value.z);
+    }
+
+    void putString(std::vector<uint8_t>& out, const std::string& value) {
+        putVarint(out, value.size());
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    void putVoice(std::vector<uint8_t>& out, VoiceHandle voice) {
+        // Empty handles are the common miss, index + 1 makes them a zero byte
+        putVarint(out, voice.index == UINT32_MAX ? 0 : static_cast<uint64_t>(voice.index) + 1);
+        putVarint(out, voice.generation);
+    }
+
+    bool getVarint(std::istream& in, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = in.get();
+            if (byte == std::char_traits<char>::eof())
+                return false;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool getSigned(std::istream& in, int64_t& value) {
+        uint64_t raw;
+        if (!getVarint(in, raw))
+            return false;
+        value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+        return true;
+    }
+
+    bool getFloat(std::istream& in, float& value) {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(float)));
+    }
+
+    bool getVector(std::istream& in, glm::vec3& value) {
+        return getFloat(in, value.x) && getFloat(in, value.y) && getFloat(in, value.z);
+    }
+
+    bool getString(std::istream& in, std::string& value) {
+        uint64_t length;
+        if (!getVarint(in, length) || length > 4096)
+            return false;
+        value.resize(length);
+        return static_cast<bool>(in.read(value.data(), static_cast<std::streamsize>(length)));
+    }
+
+    void putPolygons(std::vector<uint8_t>& out, const std::vector<OccluderPolygon>& polygons) {
+        putVarint(out, polygons.size());
+        for (const auto& polygon : polygons) {
+            putVarint(out, static_cast<uint64_t>(polygon.count));
+            for (int i = 0; i < polygon.count; i++)
+                putVector(out, polygon.vertices[i]);
+            putFloat(out, polygon.material.direct);
+            putFloat(out, polygon.material.reverb);
+            out.push_back(polygon.material.doubleSided ? 1 : 0);
+        }
+    }
+
+    bool getVoice(std::istream& in, VoiceHandle& voice) {
+        uint64_t index;
+        uint64_t generation;
+        if (!getVarint(in, index) || !getVarint(in, generation))
+            return false;
+        voice.index = index == 0 ? UINT32_MAX : static_cast<uint32_t>(index - 1);
+        voice.generation = static_cast<uint32_t>(generation);
+        return true;
+    }
+
+    template<typename T>
+    bool getUnsigned(std::istream& in, T& value) {
+        uint64_t raw;
+        if (!getVarint(in, raw))
+            return false;
+        value = static_cast<T>(raw);
+        return true;
+    }
+
+    bool getPolygons(std::istream& in, std::vector<OccluderPolygon>& polygons) {
+        uint64_t count;
+        if (!getVarint(in, count) || count > (1u << 20))
+            return false;
+        polygons.resize(count);
+        for (auto& polygon : polygons) {
+            if (!getUnsigned(in, polygon.count) || polygon.count < 3 || polygon.count > 4)
+                return false;
+            for (int i = 0; i < polygon.count; i++) {
+                if (!getVector(in, polygon.vertices[i]))
+                    return false;
+            }
+            // Triangles repeat their last vertex, as GeometryManager stores them
+            for (int i = polygon.count; i < 4; i++)
+                polygon.vertices[i] = polygon.vertices[polygon.count - 1];
+            if (!getFloat(in, polygon.material.direct) || !getFloat(in, polygon.material.reverb))
+                return false;
+            polygon.material.doubleSided = in.get() == 1;
+            polygon.owner = 0;
+        }
+        return static_cast<bool>(in);
+    }
+}
+
+const char* toString(TraceOp op) {
+    switch (op) {
+        case TraceOp::Update: return "update";
+        case TraceOp::MountBank: return "mountBank";
+        case TraceOp::LoadSound: return "loadSound";
+        case TraceOp::LoadSoundAsync: return "loadSoundAsync";
+        case TraceOp::PlaySound: return "playSound";
+        case TraceOp::StopSound: return "stopSound";
+        case TraceOp::ToggleSound: return "toggleSound";
+        case TraceOp::SetEmitter: return "setEmitter";
+        case TraceOp::SetEmitters: return "setEmitters";
+        case TraceOp::LoadMusicStream: return "loadMusicStream";
+        case TraceOp::LoadMusicStreamAsync: return "loadMusicStreamAsync";
+        case TraceOp::PlayMusicStream: return "playMusicStream";
+        case TraceOp::ToggleMusicStream: return "toggleMusicStream";
+        case TraceOp::SetMusicTempo: return "setMusicTempo";
+        case TraceOp::SetMusicPitch: return "setMusicPitch";
+        case TraceOp::MusicKey: return "musicKey";
+        case TraceOp::ToggleFilter: return "toggleFilter";
+        case TraceOp::CreateGeometry: return "createGeometry";
+        case TraceOp::SetDSPParameter: return "setDSPParameter";
+        case TraceOp::AddStaticGeometry: return "addStaticGeometry";
+        case TraceOp::AddDynamicGeometry: return "addDynamicGeometry";
+        case TraceOp::SetGeometryTransform: return "setGeometryTransform";
+        case TraceOp::RemoveStaticGeometry: return "removeStaticGeometry";
+        case TraceOp::RemoveDynamicGeometry: return "removeDynamicGeometry";
+        case TraceOp::SetReverbZones: return "setReverbZones";
+        default: return "unknown";
+    }
+}
+
+AudioTrace::AudioTrace(FMOD::System* system) : system{system} {
+    auto result = system->getMasterChannelGroup(&master);
+    FMOD_ERROR_(result);
+    buffer.reserve(FlushSize + 4096);
+}
+
+AudioTrace::~AudioTrace() {
+    close();
+}
+
+bool AudioTrace::open(const std::string& filename, const TraceHeader& header) {
+    close();
+
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") cannot open " << filename << std::endl;
+        return false;
+    }
+
+    buffer.resize(sizeof(Magic));
+    std::memcpy(buffer.data(), &Magic, sizeof(Magic));
+    putVarint(buffer, Version);
+    putVarint(buffer, static_cast<uint64_t>(header.sampleRate));
+    putVarint(buffer, header.blockLength);
+    putVarint(buffer, (header.engineOcclusion ? 1u : 0u) | (header.binaural ? 2u : 0u) | (header.meters ? 4u : 0u) | (header.lod ? 8u : 0u));
+    putVarint(buffer, header.soundBudget);
+    putVarint(buffer, header.readAhead);
+    putVarint(buffer, header.samplePool);
+    putString(buffer, header.hrirFile);
+
+    // Deltas start from the clocks at open, the first record is as small as the rest
+    unsigned long long clock = 0;
+    if (master)
+        master->getDSPClock(&clock, nullptr);
+    lastClock = clock;
+    start = now();
+    lastTime = 0;
+    records = 0;
+    bytes = 0;
+    return true;
+}
+
+void AudioTrace::close() {
+    if (!file.is_open())
+        return;
+    flush();
+    file.close();
+}
+
+void AudioTrace::write(TraceRecord& record) {
+    if (!file.is_open())
+        return;
+
+    unsigned long long clock = lastClock;
+    if (master)
+        master->getDSPClock(&clock, nullptr);
+    record.clock = std::max<uint64_t>(clock, lastClock);
+    record.time = std::max<uint64_t>((now() - start) / 1000, lastTime);
+
+    buffer.push_back(static_cast<uint8_t>(record.op));
+    putVarint(buffer, record.clock - lastClock);
+    putVarint(buffer, record.time - lastTime);
+    lastClock = record.clock;
+    lastTime = record.time;
+
+    switch (record.op) {
+        case TraceOp::Update:
+            for (const auto& vector : record.vectors)
+                putVector(buffer, vector);
+            break;
+        case TraceOp::MountBank:
+        case TraceOp::LoadMusicStream:
+        case TraceOp::LoadMusicStreamAsync:
+            putString(buffer, record.name);
+            break;
+        case TraceOp::LoadSound:
+        case TraceOp::LoadSoundAsync:
+            putString(buffer, record.name);
+            putVarint(buffer, record.value);
+            break;
+        case TraceOp::PlaySound:
+            putString(buffer, record.name);
+            putString(buffer, record.bus);
+            putVector(buffer, record.vectors[0]);
+            putFloat(buffer, record.scalar);
+            putSigned(buffer, record.index);
+            buffer.push_back(record.flag ? 1 : 0);
+            putVoice(buffer, record.voice);
+            break;
+        case TraceOp::StopSound:
+        case TraceOp::ToggleSound:
+            putVoice(buffer, record.voice);
+            break;
+        case TraceOp::SetEmitter:
+            putVoice(buffer, record.voice);
+            putVector(buffer, record.vectors[0]);
+            putVector(buffer, record.vectors[1]);
+            break;
+        case TraceOp::SetEmitters:
+            putVarint(buffer, record.emitters.size());
+            for (const auto& emitter : record.emitters) {
+                putVoice(buffer, emitter.voice);
+                putVector(buffer, emitter.position);
+                putVector(buffer, emitter.velocity);
+            }
+            break;
+        case TraceOp::SetMusicTempo:
+        case TraceOp::SetMusicPitch:
+            putFloat(buffer, record.scalar);
+            break;
+        case TraceOp::MusicKey:
+        case TraceOp::ToggleFilter:
+            putVarint(buffer, record.value);
+            break;
+        case TraceOp::CreateGeometry:
+            putVector(buffer, record.vectors[0]);
+            putVector(buffer, record.vectors[1]);
+            putFloat(buffer, record.rotation.w);
+            putFloat(buffer, record.rotation.x);
+            putFloat(buffer, record.rotation.y);
+            putFloat(buffer, record.rotation.z);
+            break;
+        case TraceOp::SetDSPParameter:
+            putVarint(buffer, record.value);
+            putSigned(buffer, record.index);
+            putFloat(buffer, record.scalar);
+            break;
+        case TraceOp::AddStaticGeometry:
+        case TraceOp::AddDynamicGeometry:
+            putVarint(buffer, record.value);
+            putPolygons(buffer, record.polygons);
+            break;
+        case TraceOp::SetGeometryTransform:
+            putVarint(buffer, record.value);
+            putVector(buffer, record.vectors[0]);
+            putVector(buffer, record.vectors[1]);
+            putFloat(buffer, record.rotation.w);
+            putFloat(buffer, record.rotation.x);
+            putFloat(buffer, record.rotation.y);
+            putFloat(buffer, record.rotation.z);
+            break;
+        case TraceOp::RemoveStaticGeometry:
+        case TraceOp::RemoveDynamicGeometry:
+            putVarint(buffer, record.value);
+            break;
+        case TraceOp::SetReverbZones:
+            putVarint(buffer, record.zones.size());
+            for (const auto& zone : record.zones) {
+                putString(buffer, zone.name);
+                putFloat(buffer, zone.rt60);
+                putVarint(buffer, zone.seed);
+                putFloat(buffer, zone.weight);
+            }
+            break;
+        default:
+            break;
+    }
+
+    records++;
+    if (buffer.size() >= FlushSize)
+        flush();
+}
+
+void AudioTrace::flush() {
+    if (buffer.empty())
+        return;
+    file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+    bytes += buffer.size();
+    buffer.clear();
+}
+
+bool AudioTraceReader::open(const std::string& filename, TraceHeader& header) {
+    file.open(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") cannot open " << filename << std::endl;
+        return false;
+    }
+
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t flags = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    if (!file || magic != AudioTrace::Magic || !getUnsigned(file, version) || version != AudioTrace::Version) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << filename << " is not a version " << AudioTrace::Version << " audio trace" << std::endl;
+        return false;
+    }
+
+    bool read = getUnsigned(file, header.sampleRate) && getUnsigned(file, header.blockLength) && getUnsigned(file, flags)
+                && getUnsigned(file, header.soundBudget) && getUnsigned(file, header.readAhead) && getUnsigned(file, header.samplePool)
+                && getString(file, header.hrirFile);
+    if (!read) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << filename << ": truncated header" << std::endl;
+        return false;
+    }
+    header.engineOcclusion = flags & 1;
+    header.binaural = flags & 2;
+    header.meters = flags & 4;
+    header.lod = flags & 8;
+
+    clock = 0;
+    time = 0;
+    damaged = false;
+    return true;
+}
+
+bool AudioTraceReader::next(TraceRecord& record) {
+    int op = file.get();
+    if (op == std::char_traits<char>::eof())
+        return false;
+
+    uint64_t clockDelta;
+    uint64_t timeDelta;
+    bool read = op > 0 && op < static_cast<int>(TraceOp::Count) && getVarint(file, clockDelta) && getVarint(file, timeDelta);
+    if (read) {
+        record.op = static_cast<TraceOp>(op);
+        clock += clockDelta;
+        time += timeDelta;
+        record.clock = clock;
+        record.time = time;
+
+        int64_t signedValue = 0;
+        switch (record.op) {
+            case TraceOp::Update:
+                for (auto& vector : record.vectors)
+                    read = read && getVector(file, vector);
+                break;
+            case TraceOp::MountBank:
+            case TraceOp::LoadMusicStream:
+            case TraceOp::LoadMusicStreamAsync:
+                read = getString(file, record.name);
+                break;
+            case TraceOp::LoadSound:
+            case TraceOp::LoadSoundAsync:
+                read = getString(file, record.name) && getUnsigned(file, record.value);
+                break;
+            case TraceOp::PlaySound:
+                read = getString(file, record.name) && getString(file, record.bus) && getVector(file, record.vectors[0])
+                       && getFloat(file, record.scalar) && getSigned(file, signedValue);
+                record.index = static_cast<int32_t>(signedValue);
+                record.flag = file.get() == 1;
+                read = read && getVoice(file, record.voice);
+                break;
+            case TraceOp::StopSound:
+            case TraceOp::ToggleSound:
+                read = getVoice(file, record.voice);
+                break;
+            case TraceOp::SetEmitter:
+                read = getVoice(file, record.voice) && getVector(file, record.vectors[0]) && getVector(file, record.vectors[1]);
+                break;
+            case TraceOp::SetEmitters: {
+                uint64_t count;
+                read = getVarint(file, count) && count <= VoicePool::MaxVoices * 16ull;
+                record.emitters.resize(read ? count : 0);
+                for (auto& emitter : record.emitters)
+                    read = read && getVoice(file, emitter.voice) && getVector(file, emitter.position) && getVector(file, emitter.velocity);
+                break;
+            }
+            case TraceOp::SetMusicTempo:
+            case TraceOp::SetMusicPitch:
+                read = getFloat(file, record.scalar);
+                break;
+            case TraceOp::MusicKey:
+            case TraceOp::ToggleFilter:
+                read = getUnsigned(file, record.value);
+                break;
+            case TraceOp::CreateGeometry:
+                read = getVector(file, record.vectors[0]) && getVector(file, record.vectors[1]) && getFloat(file, record.rotation.w)
+                       && getFloat(file, record.rotation.x) && getFloat(file, record.rotation.y) && getFloat(file, record.rotation.z);
+                break;
+            case TraceOp::SetDSPParameter:
+                read = getUnsigned(file, record.value) && getSigned(file, signedValue) && getFloat(file, record.scalar);
+                record.index = static_cast<int32_t>(signedValue);
+                break;
+            case TraceOp::AddStaticGeometry:
+            case TraceOp::AddDynamicGeometry:
+                read = getUnsigned(file, record.value) && getPolygons(file, record.polygons);
+                break;
+            case TraceOp::SetGeometryTransform:
+                read = getUnsigned(file, record.value) && getVector(file, record.vectors[0]) && getVector(file, record.vectors[1])
+                       && getFloat(file, record.rotation.w) && getFloat(file, record.rotation.x) && getFloat(file, record.rotation.y)
+                       && getFloat(file, record.rotation.z);
+                break;
+            case TraceOp::RemoveStaticGeometry:
+            case TraceOp::RemoveDynamicGeometry:
+                read = getUnsigned(file, record.value);
+                break;
+            case TraceOp::SetReverbZones: {
+                uint64_t count;
+                read = getVarint(file, count) && count <= 64;
+                record.zones.resize(read ? count : 0);
+                for (auto& zone : record.zones)
+                    read = read && getString(file, zone.name) && getFloat(file, zone.rt60) && getUnsigned(file, zone.seed) && getFloat(file, zone.weight);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    if (!read) {
+        // A trace cut short by a crash ends in a partial record, everything before it still replays
+        damaged = true;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "voicepool.hpp"
+
+struct EmitterUpdate;
+struct OccluderPolygon;
+
+/// @brief Traced Audio calls, the values are the on-disk encoding and never change meaning
+enum class TraceOp : uint8_t {
+    Update = 1, // listener
+    MountBank,
+    LoadSound,
+    LoadSoundAsync,
+    PlaySound,
+    StopSound,
+    ToggleSound,
+    SetEmitter,
+    SetEmitters,
+    LoadMusicStream,
+    LoadMusicStreamAsync,
+    PlayMusicStream,
+    ToggleMusicStream,
+    SetMusicTempo,
+    SetMusicPitch,
+    MusicKey, // a music control key, its effects replay through the same code
+    ToggleFilter,
+    CreateGeometry,
+    SetDSPParameter,
+    AddStaticGeometry, // an occluder registered by GeometryManager, world space
+    AddDynamicGeometry, // local space
+    SetGeometryTransform,
+    RemoveStaticGeometry,
+    RemoveDynamicGeometry,
+    SetReverbZones,
+    Count
+};
+
+const char* toString(TraceOp op);
+
+/// @brief The settings a replay has to match to rebuild the recorded graph
+struct TraceHeader {
+    int sampleRate{ 0 };
+    unsigned int blockLength{ 0 };
+    bool engineOcclusion{ false };
+    bool binaural{ false };
+    bool meters{ true };
+    bool lod{ true };
+    uint64_t soundBudget{ 0 };
+    uint64_t readAhead{ 0 };
+    uint64_t samplePool{ 0 };
+    std::string hrirFile;
+};
+
+/// @brief A reverb zone as handed to the convolution reverb, the response is rebuilt from it
+struct TraceZone {
+    std::string name; // file, or the cache key of a generated response
+    float rt60{ 0.0f }; // seconds, 0 when the response was loaded from name
+    uint32_t seed{ 0 };
+    float weight{ 0.0f };
+};
+
+/// @brief One call, only the fields its op uses are written
+struct TraceRecord {
+    TraceOp op{ TraceOp::Update };
+    uint64_t clock{ 0 }; // master DSP clock when called, samples
+    uint64_t time{ 0 }; // microseconds since the trace started
+    std::string name; // file, or the cache key of the sound played
+    std::string bus; // channel group name, empty for the default
+    uint32_t value{ 0 }; // FMOD_MODE, key, filter, DSP index, occluder owner or id
+    int32_t index{ 0 }; // priority or DSP parameter
+    float scalar{ 0.0f }; // volume, tempo, semitones or parameter value
+    bool flag{ false }; // paused
+    VoiceHandle voice; // as returned while recording, the replay maps it to its own
+    glm::vec3 vectors[4]{}; // listener position, velocity, forward, up; emitter position, velocity; geometry position, extent or scale
+    glm::quat rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+    std::vector<EmitterUpdate> emitters;
+    std::vector<OccluderPolygon> polygons;
+    std::vector<TraceZone> zones;
+};
+
+/// @brief Binary log of Audio calls for offline replay
+/// Records are a one byte op, varint deltas of the DSP clock and of the wall clock, then the op's
+/// fields: varints for integers, raw little endian floats, length prefixed strings. A frame of emitter
+/// updates costs about 26 bytes per emitter. Writes are buffered and go to disk in large chunks.
+class AudioTrace {
+public:
+    static constexpr uint32_t Magic = 0x43525441; // "ATRC"
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t FlushSize = 64u << 10;
+
+    explicit AudioTrace(FMOD::System* system);
+    ~AudioTrace();
+
+    AudioTrace(const AudioTrace&) = delete;
+    AudioTrace& operator=(const AudioTrace&) = delete;
+
+    bool open(const std::string& filename, const TraceHeader& header);
+    void close();
+    bool isOpen() const { return file.is_open(); }
+
+    /// @brief Stamp the record with the clocks and append it
+    void write(TraceRecord& record);
+
+    uint64_t getRecords() const { return records; }
+    uint64_t getBytes() const { return bytes + buffer.size(); }
+
+private:
+    FMOD::System* system;
+    FMOD::ChannelGroup* master{ nullptr };
+    std::ofstream file;
+    std::vector<uint8_t> buffer;
+    uint64_t start{ 0 }; // steady clock, ns
+    uint64_t lastClock{ 0 };
+    uint64_t lastTime{ 0 };
+    uint64_t records{ 0 };
+    uint64_t bytes{ 0 };
+
+    void flush();
+};
+
+/// @brief Reads back what AudioTrace wrote, record by record
+class AudioTraceReader {
+public:
+    bool open(const std::string& filename, TraceHeader& header);
+    /// @brief False at the end of the trace or on a damaged record, failed() tells them apart
+    bool next(TraceRecord& record);
+    bool failed() const { return damaged; }
+
+private:
+    std::ifstream file;
+    uint64_t clock{ 0 };
+    uint64_t time{ 0 };
+    bool damaged{ false };
+};
+
+/// @brief Held while a traced call runs, the Audio calls it makes on its own are not traced again
+class TraceScope {
+public:
+    explicit TraceScope(uint32_t& depth) : depth{depth} { depth++; }
+    ~TraceScope() { depth--; }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    uint32_t& depth;
+};
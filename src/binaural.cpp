@@ -0,0 +1,481 @@
+#include "binaural.hpp"
+#include "fmoderror.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DSP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define DSP_TARGET_AVX2
+#else
+#define DSP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    void firScalar(const float* input, const float* taps, float* output, unsigned int length, int count) {
+        for (unsigned int n = 0; n < length; n++) {
+            float sum = 0.0f;
+            for (int j = 0; j < count; j++) {
+                sum += taps[j] * input[n + j];
+            }
+            output[n] += sum;
+        }
+    }
+
+#ifdef DSP_X86
+    // Four output vectors stay in registers across all taps, every tap is one broadcast and four loads
+
+    void firSSE(const float* input, const float* taps, float* output, unsigned int length, int count) {
+        unsigned int n = 0;
+        for (; n + 16 <= length; n += 16) {
+            __m128 a0 = _mm_loadu_ps(output + n);
+            __m128 a1 = _mm_loadu_ps(output + n + 4);
+            __m128 a2 = _mm_loadu_ps(output + n + 8);
+            __m128 a3 = _mm_loadu_ps(output + n + 12);
+            const float* x = input + n;
+            for (int j = 0; j < count; j++) {
+                __m128 h = _mm_set1_ps(taps[j]);
+                a0 = _mm_add_ps(a0, _mm_mul_ps(h, _mm_loadu_ps(x + j)));
+                a1 = _mm_add_ps(a1, _mm_mul_ps(h, _mm_loadu_ps(x + j + 4)));
+                a2 = _mm_add_ps(a2, _mm_mul_ps(h, _mm_loadu_ps(x + j + 8)));
+                a3 = _mm_add_ps(a3, _mm_mul_ps(h, _mm_loadu_ps(x + j + 12)));
+            }
+            _mm_storeu_ps(output + n, a0);
+            _mm_storeu_ps(output + n + 4, a1);
+            _mm_storeu_ps(output + n + 8, a2);
+            _mm_storeu_ps(output + n + 12, a3);
+        }
+        firScalar(input + n, taps, output + n, length - n, count);
+    }
+
+    DSP_TARGET_AVX2 void firAVX2(const float* input, const float* taps, float* output, unsigned int length, int count) {
+        unsigned int n = 0;
+        for (; n + 32 <= length; n += 32) {
+            __m256 a0 = _mm256_loadu_ps(output + n);
+            __m256 a1 = _mm256_loadu_ps(output + n + 8);
+            __m256 a2 = _mm256_loadu_ps(output + n + 16);
+            __m256 a3 = _mm256_loadu_ps(output + n + 24);
+            const float* x = input + n;
+            for (int j = 0; j < count; j++) {
+                __m256 h = _mm256_set1_ps(taps[j]);
+                a0 = _mm256_add_ps(a0, _mm256_mul_ps(h, _mm256_loadu_ps(x + j)));
+                a1 = _mm256_add_ps(a1, _mm256_mul_ps(h, _mm256_loadu_ps(x + j + 8)));
+                a2 = _mm256_add_ps(a2, _mm256_mul_ps(h, _mm256_loadu_ps(x + j + 16)));
+                a3 = _mm256_add_ps(a3, _mm256_mul_ps(h, _mm256_loadu_ps(x + j + 24)));
+            }
+            _mm256_storeu_ps(output + n, a0);
+            _mm256_storeu_ps(output + n + 8, a1);
+            _mm256_storeu_ps(output + n + 16, a2);
+            _mm256_storeu_ps(output + n + 24, a3);
+        }
+        _mm256_zeroupper();
+        firScalar(input + n, taps, output + n, length - n, count);
+    }
+#endif
+
+    constexpr float Degrees = 57.2957795f;
+}
+
+namespace dsp {
+    FirKernel firKernel(SimdLevel level) {
+#ifdef DSP_X86
+        switch (level) {
+            case SimdLevel::AVX2:
+                return firAVX2;
+            case SimdLevel::SSE:
+                return firSSE;
+            default:
+                break;
+        }
+#endif
+        return firScalar;
+    }
+}
+
+BinauralRenderer::BinauralRenderer(FMOD::System* system, std::shared_ptr<const HRIRSet> hrirs, unsigned int maxBlock)
+    : system{system}, hrirs{std::move(hrirs)}, maxBlock{maxBlock}, fir{dsp::firKernel()} {
+    int directions = this->hrirs->getDirectionCount();
+    size_t span = static_cast<size_t>(this->hrirs->taps - 1 + maxBlock);
+
+    // Everything the mixer thread touches is sized here
+    directionInput.assign(static_cast<size_t>(directions) * 2 * span, 0.0f);
+    directionStamp.assign(directions, UINT64_MAX);
+    listed.assign(directions, 0);
+    active.reserve(directions);
+    for (int ear = 0; ear < 2; ear++) {
+        delayed[ear].resize(maxBlock);
+        wet[ear].resize(maxBlock);
+    }
+
+    for (uint32_t i = 0; i < MaxSources; i++) {
+        sources[i].renderer = this;
+        sources[i].index = i;
+        sources[i].signal.assign(MaxDelay + maxBlock + 1, 0.0f); // one guard sample past the block for the interpolation
+    }
+}
+
+BinauralRenderer::~BinauralRenderer() {
+    detach();
+    if (dsp)
+        dsp->release();
+
+    for (auto& source : sources) {
+        if (source.channel)
+            source.channel->removeDSP(source.send);
+        if (source.send)
+            source.send->release();
+    }
+}
+
+bool BinauralRenderer::attach(FMOD::ChannelGroup* target) {
+    if (!system)
+        return false;
+
+    if (!dsp) {
+        FMOD_DSP_DESCRIPTION dspdesc;
+        memset(&dspdesc, 0, sizeof(dspdesc));
+        std::strcpy(dspdesc.name, "DSP Binaural");
+        dspdesc.numinputbuffers = 1;
+        dspdesc.numoutputbuffers = 1;
+        dspdesc.read = renderCallback;
+        dspdesc.userdata = this;
+
+        auto result = system->createDSP(&dspdesc, &dsp);
+        FMOD_ERROR(result);
+    }
+
+    detach();
+
+    // Tail is the input end, the group's own effects then see the rendered mix
+    auto result = target->addDSP(FMOD_CHANNELCONTROL_DSP_TAIL, dsp);
+    FMOD_ERROR(result);
+    group = target;
+
+    return true;
+}
+
+void BinauralRenderer::detach() {
+    if (group)
+        group->removeDSP(dsp);
+    group = nullptr;
+}
+
+uint32_t BinauralRenderer::addSource(FMOD::Channel* channel) {
+    auto found = std::find_if(sources.begin(), sources.end(), [](const Source& source) { return !source.used; });
+    if (found == sources.end())
+        return UINT32_MAX;
+
+    auto& source = *found;
+    if (channel && system) {
+        if (!source.send) {
+            FMOD_DSP_DESCRIPTION dspdesc;
+            memset(&dspdesc, 0, sizeof(dspdesc));
+            std::strcpy(dspdesc.name, "DSP Binaural Send");
+            dspdesc.numinputbuffers = 1;
+            dspdesc.numoutputbuffers = 1;
+            dspdesc.read = sendCallback;
+            dspdesc.userdata = &source;
+
+            auto result = system->createDSP(&dspdesc, &source.send);
+            FMOD_ERROR_RETURN(result, UINT32_MAX);
+        }
+
+        // Level 0 turns off FMOD's panning and its distance rolloff, we do both
+        auto result = channel->get3DMinMaxDistance(&source.minDistance, &source.maxDistance);
+        if (result == FMOD_OK)
+            result = channel->set3DLevel(0.0f);
+        if (result == FMOD_OK)
+            result = channel->addDSP(FMOD_CHANNELCONTROL_DSP_HEAD, source.send);
+        FMOD_ERROR_RETURN(result, UINT32_MAX);
+    }
+
+    source.channel = channel;
+    source.used = true;
+    source.gain.store(0.0f, std::memory_order_relaxed);
+    source.generation.fetch_add(1, std::memory_order_relaxed);
+    source.active.store(true, std::memory_order_release);
+    sourceCount++;
+
+    return source.index;
+}
+
+void BinauralRenderer::removeSource(uint32_t index) {
+    if (index >= MaxSources || !sources[index].used)
+        return;
+
+    // A channel that already ended has dropped the send on its own
+    auto& source = sources[index];
+    source.active.store(false, std::memory_order_release);
+    if (source.channel)
+        source.channel->removeDSP(source.send);
+    source.channel = nullptr;
+    source.used = false;
+    sourceCount--;
+}
+
+void BinauralRenderer::setListener(const glm::vec3& position, const glm::vec3& forward, const glm::vec3& up) {
+    listenerPosition = position;
+    listenerForward = forward;
+    listenerUp = up;
+}
+
+void BinauralRenderer::setSourcePosition(uint32_t index, const glm::vec3& position) {
+    if (index >= MaxSources || !sources[index].used)
+        return;
+
+    auto& source = sources[index];
+    glm::vec3 offset = position - listenerPosition;
+    float distance = glm::length(offset);
+
+    // Listener space as FMOD sees it, left handed with x to the right
+    float azimuth = 0.0f;
+    float elevation = 0.0f;
+    if (distance > 1e-4f) {
+        glm::vec3 right = glm::cross(listenerUp, listenerForward);
+        float x = glm::dot(offset, right);
+        float y = glm::dot(offset, listenerUp);
+        float z = glm::dot(offset, listenerForward);
+        azimuth = std::atan2(x, z) * Degrees;
+        elevation = std::asin(std::clamp(y / distance, -1.0f, 1.0f)) * Degrees;
+    }
+
+    float gain = source.minDistance / std::clamp(distance, source.minDistance, std::max(source.minDistance, source.maxDistance));
+
+    source.azimuth.store(azimuth, std::memory_order_relaxed);
+    source.elevation.store(elevation, std::memory_order_relaxed);
+    source.gain.store(gain, std::memory_order_relaxed);
+}
+
+void BinauralRenderer::send(uint32_t index, const float* inbuffer, unsigned int length, int channels) {
+    if (index >= MaxSources || length > maxBlock)
+        return;
+
+    auto& source = sources[index];
+    uint32_t generation = source.generation.load(std::memory_order_relaxed);
+    if (generation != source.mixGeneration) {
+        source.mixGeneration = generation;
+        source.started = false;
+        source.taps = {};
+        source.stamp = UINT64_MAX;
+    }
+
+    // Keep the end of the previous block for the delay line, unless the voice was virtual in between
+    if (source.stamp + 1 == mixCount && source.length >= static_cast<unsigned int>(MaxDelay))
+        std::copy(source.signal.begin() + source.length, source.signal.begin() + source.length + MaxDelay, source.signal.begin());
+    else
+        std::fill(source.signal.begin(), source.signal.begin() + MaxDelay, 0.0f);
+
+    float* signal = source.signal.data() + MaxDelay;
+    float scale = 1.0f / static_cast<float>(channels);
+    for (unsigned int i = 0; i < length; i++) {
+        float sum = 0.0f;
+        for (int channel = 0; channel < channels; channel++) {
+            sum += inbuffer[i * channels + channel];
+        }
+        signal[i] = sum * scale;
+    }
+
+    source.length = length;
+    source.stamp = mixCount;
+}
+
+void BinauralRenderer::render(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels) {
+    for (unsigned int i = 0; i < length; i++) {
+        for (int channel = 0; channel < outchannels; channel++) {
+            outbuffer[i * outchannels + channel] = channel < inchannels ? inbuffer[i * inchannels + channel] : 0.0f;
+        }
+    }
+
+    if (length > maxBlock) {
+        mixCount++;
+        return;
+    }
+
+    for (auto& source : sources) {
+        if (source.active.load(std::memory_order_acquire) && source.stamp == mixCount && source.length == length)
+            place(source, length);
+    }
+
+    // One filter pair per direction in use, directions that got nothing this block flush their tail and drop out
+    const int taps = hrirs->taps;
+    std::fill(wet[0].begin(), wet[0].begin() + length, 0.0f);
+    std::fill(wet[1].begin(), wet[1].begin() + length, 0.0f);
+    for (int direction : active) {
+        for (int ear = 0; ear < 2; ear++) {
+            float* buffer = input(direction, ear);
+            fir(buffer, hrirs->filter(direction, ear), wet[ear].data(), length, taps);
+            std::copy(buffer + length, buffer + length + taps - 1, buffer);
+            std::fill(buffer + taps - 1, buffer + taps - 1 + length, 0.0f);
+        }
+    }
+    activeDirections.store(static_cast<uint32_t>(active.size()), std::memory_order_relaxed);
+    active.erase(std::remove_if(active.begin(), active.end(), [&](int direction) {
+        bool flushed = directionStamp[direction] != mixCount;
+        if (flushed)
+            listed[direction] = 0;
+        return flushed;
+    }), active.end());
+
+    for (unsigned int i = 0; i < length; i++) {
+        float* out = outbuffer + i * outchannels;
+        if (outchannels == 1) {
+            out[0] += (wet[0][i] + wet[1][i]) * 0.5f;
+        } else {
+            out[0] += wet[0][i];
+            out[1] += wet[1][i];
+        }
+    }
+
+    mixCount++;
+}
+
+float* BinauralRenderer::input(int direction, int ear) {
+    size_t span = static_cast<size_t>(hrirs->taps - 1 + maxBlock);
+    return directionInput.data() + (static_cast<size_t>(direction) * 2 + ear) * span;
+}
+
+void BinauralRenderer::lookup(float azimuth, float elevation, std::array<Tap, 4>& taps) const {
+    float e = std::clamp((elevation - hrirs->minElevation) / hrirs->elevationStep, 0.0f, static_cast<float>(hrirs->elevationCount - 1));
+    int e0 = static_cast<int>(e);
+    int e1 = std::min(e0 + 1, hrirs->elevationCount - 1);
+    float te = e - e0;
+
+    float a = azimuth / 360.0f * hrirs->azimuthCount;
+    a -= std::floor(a / hrirs->azimuthCount) * hrirs->azimuthCount;
+    int a0 = static_cast<int>(a) % hrirs->azimuthCount;
+    int a1 = (a0 + 1) % hrirs->azimuthCount;
+    float ta = a - std::floor(a);
+
+    int count = hrirs->azimuthCount;
+    taps = { Tap{ e0 * count + a0, (1.0f - te) * (1.0f - ta) }, Tap{ e0 * count + a1, (1.0f - te) * ta },
+             Tap{ e1 * count + a0, te * (1.0f - ta) }, Tap{ e1 * count + a1, te * ta } };
+
+    // The top ring and clamped elevations repeat directions, fold them together
+    for (int i = 0; i < 4; i++) {
+        for (int j = i + 1; j < 4; j++) {
+            if (taps[j].direction == taps[i].direction && taps[i].direction >= 0) {
+                taps[i].weight += taps[j].weight;
+                taps[j] = {};
+            }
+        }
+    }
+}
+
+void BinauralRenderer::place(Source& source, unsigned int length) {
+    std::array<Tap, 4> next;
+    lookup(source.azimuth.load(std::memory_order_relaxed), source.elevation.load(std::memory_order_relaxed), next);
+
+    std::array<float, 2> delays{ 0.0f, 0.0f };
+    for (const auto& tap : next) {
+        if (tap.direction < 0)
+            continue;
+        for (int ear = 0; ear < 2; ear++) {
+            delays[ear] += tap.weight * hrirs->delay(tap.direction, ear);
+        }
+    }
+    // The near ear's synthesized delay reaches 0 at +-90 degrees, at least one sample keeps the
+    // interpolation's second read inside the block
+    for (auto& delay : delays) {
+        delay = std::clamp(delay, 1.0f, static_cast<float>(MaxDelay - 1));
+    }
+
+    float gain = source.gain.load(std::memory_order_relaxed);
+    for (auto& tap : next) {
+        tap.weight *= gain;
+    }
+
+    if (!source.started) {
+        source.delays = delays;
+        source.started = true;
+    }
+
+    // Delays glide across the block, a moving source bends pitch slightly instead of clicking
+    const float* signal = source.signal.data();
+    const int count = static_cast<int>(length); // signed indices, unsigned to float does not vectorize
+    float step = 1.0f / static_cast<float>(length);
+    for (int ear = 0; ear < 2; ear++) {
+        float from = source.delays[ear];
+        float slope = (delays[ear] - from) * step;
+        float* out = delayed[ear].data();
+        if (slope == 0.0f) {
+            // Steady delay, one fractional offset for the whole block
+            float position = static_cast<float>(MaxDelay) - from;
+            int whole = static_cast<int>(position);
+            float fraction = position - static_cast<float>(whole);
+            const float* at = signal + whole;
+            for (int i = 0; i < count; i++) {
+                out[i] = at[i] + (at[i + 1] - at[i]) * fraction;
+            }
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            // Never less than one sample into the history, truncation is the floor
+            float position = static_cast<float>(MaxDelay + i) - (from + slope * static_cast<float>(i + 1));
+            int whole = static_cast<int>(position);
+            float fraction = position - static_cast<float>(whole);
+            out[i] = signal[whole] + (signal[whole + 1] - signal[whole]) * fraction;
+        }
+    }
+
+    // Old and new directions ramp from their previous to their new weight, so panning never steps
+    auto accumulate = [&](int direction, float from, float to) {
+        if (direction < 0 || (from == 0.0f && to == 0.0f))
+            return;
+
+        float slope = (to - from) * step;
+        for (int ear = 0; ear < 2; ear++) {
+            float* __restrict buffer = input(direction, ear) + hrirs->taps - 1;
+            const float* __restrict in = delayed[ear].data();
+            for (int i = 0; i < count; i++) {
+                buffer[i] += in[i] * (from + slope * static_cast<float>(i + 1));
+            }
+        }
+
+        directionStamp[direction] = mixCount;
+        if (!listed[direction]) {
+            listed[direction] = 1;
+            active.push_back(direction);
+        }
+    };
+
+    for (const auto& previous : source.taps) {
+        float to = 0.0f;
+        for (const auto& tap : next) {
+            if (tap.direction == previous.direction)
+                to = tap.weight;
+        }
+        accumulate(previous.direction, previous.weight, to);
+    }
+    for (const auto& tap : next) {
+        bool seen = std::any_of(source.taps.begin(), source.taps.end(), [&](const Tap& previous) { return previous.direction == tap.direction; });
+        if (!seen)
+            accumulate(tap.direction, 0.0f, tap.weight);
+    }
+
+    source.taps = next;
+    source.delays = delays;
+}
+
+FMOD_RESULT F_CALLBACK BinauralRenderer::sendCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels) {
+    void* userdata;
+    static_cast<FMOD::DSP*>(dsp_state->instance)->getUserData(&userdata);
+    auto source = static_cast<Source*>(userdata);
+
+    source->renderer->send(source->index, inbuffer, length, inchannels);
+
+    // The renderer places the voice, nothing goes down the normal path
+    std::memset(outbuffer, 0, sizeof(float) * length * *outchannels);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK BinauralRenderer::renderCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels) {
+    void* userdata;
+    static_cast<FMOD::DSP*>(dsp_state->instance)->getUserData(&userdata);
+    static_cast<BinauralRenderer*>(userdata)->render(inbuffer, outbuffer, length, inchannels, *outchannels);
+    return FMOD_OK;
+}
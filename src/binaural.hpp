@@ -0,0 +1,126 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "dspgain.hpp"
+#include "hrir.hpp"
+
+namespace dsp {
+    /// @brief output[n] += sum over j of taps[j] * input[n + j], taps time reversed and input
+    /// starting with count - 1 samples of history
+    using FirKernel = void (*)(const float* input, const float* taps, float* output, unsigned int length, int count);
+
+    FirKernel firKernel(SimdLevel level = simdLevel());
+}
+
+/// @brief Batched binaural renderer for headphones
+/// Every spatialized voice gets a small send DSP at the head of its channel that hands the mono signal
+/// over and outputs silence. One renderer DSP on the bus then places all of them: each source is delayed
+/// per ear by the interaural delay and panned onto the four grid directions around it, which is the
+/// bilinear HRIR interpolation done on the signal instead of the filters, and every direction that
+/// received anything is filtered once per ear. Filter cost is bounded by the directions in use, not
+/// by the source count. Voices are switched to 3D level 0 so FMOD does not pan them again, distance
+/// attenuation (inverse, from the channel's min distance) is applied here instead.
+class BinauralRenderer {
+public:
+    static constexpr uint32_t MaxSources = 128;
+    static constexpr int MaxDelay = 64; // samples of per ear delay the sources keep
+
+    /// @brief system may be nullptr for offline use through send() and render()
+    BinauralRenderer(FMOD::System* system, std::shared_ptr<const HRIRSet> hrirs, unsigned int maxBlock);
+    ~BinauralRenderer();
+
+    BinauralRenderer(const BinauralRenderer&) = delete;
+    BinauralRenderer& operator=(const BinauralRenderer&) = delete;
+
+    /// @brief Insert the renderer at the input end of a group, before its effects
+    bool attach(FMOD::ChannelGroup* group);
+    void detach();
+
+    /// @brief Route a channel through the renderer, UINT32_MAX when every source is taken
+    uint32_t addSource(FMOD::Channel* channel = nullptr);
+    void removeSource(uint32_t source);
+
+    void setListener(const glm::vec3& position, const glm::vec3& forward, const glm::vec3& up);
+    void setSourcePosition(uint32_t source, const glm::vec3& position);
+
+    /// @brief Mixer thread: hand over one block of a source, any channel count is folded to mono
+    void send(uint32_t source, const float* inbuffer, unsigned int length, int channels);
+    /// @brief Mixer thread: pass the input through and add every source sent this block
+    void render(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels);
+
+    FMOD::DSP* getDSP() const { return dsp; }
+    uint32_t getSourceCount() const { return sourceCount; }
+    uint32_t getActiveDirections() const { return activeDirections.load(std::memory_order_relaxed); }
+
+private:
+    struct Tap {
+        int direction{ -1 };
+        float weight{ 0.0f };
+    };
+
+    struct Source {
+        BinauralRenderer* renderer;
+        uint32_t index;
+        FMOD::DSP* send{ nullptr };
+        FMOD::Channel* channel{ nullptr };
+        float minDistance{ 1.0f };
+        float maxDistance{ 10000.0f };
+        bool used{ false }; // game thread
+
+        // Published by the game thread
+        std::atomic<bool> active{ false };
+        std::atomic<uint32_t> generation{ 0 }; // bumped on reuse, the mixer then starts the source afresh
+        std::atomic<float> azimuth{ 0.0f }; // degrees, clockwise from ahead
+        std::atomic<float> elevation{ 0.0f };
+        std::atomic<float> gain{ 0.0f };
+
+        // Mixer thread
+        std::vector<float> signal; // MaxDelay samples of history, then the block and a guard sample
+        unsigned int length{ 0 };
+        uint64_t stamp{ UINT64_MAX }; // mix the block was sent in
+        std::array<Tap, 4> taps;
+        std::array<float, 2> delays{ 0.0f, 0.0f };
+        uint32_t mixGeneration{ 0 };
+        bool started{ false };
+    };
+
+    FMOD::System* system;
+    std::shared_ptr<const HRIRSet> hrirs;
+    unsigned int maxBlock;
+    dsp::FirKernel fir;
+
+    FMOD::DSP* dsp{ nullptr };
+    FMOD::ChannelGroup* group{ nullptr };
+
+    std::array<Source, MaxSources> sources;
+    uint32_t sourceCount{ 0 };
+
+    glm::vec3 listenerPosition{ 0.0f };
+    glm::vec3 listenerForward{ 0.0f, 0.0f, 1.0f };
+    glm::vec3 listenerUp{ 0.0f, 1.0f, 0.0f };
+
+    // Mixer thread
+    uint64_t mixCount{ 0 };
+    std::vector<float> directionInput; // [direction][ear][taps - 1 + maxBlock]
+    std::vector<uint64_t> directionStamp; // last mix a direction received input
+    std::vector<int> active; // directions to filter this block
+    std::vector<uint8_t> listed; // direction is in active
+    std::vector<float> delayed[2];
+    std::vector<float> wet[2];
+    std::atomic<uint32_t> activeDirections{ 0 };
+
+    float* input(int direction, int ear);
+    void lookup(float azimuth, float elevation, std::array<Tap, 4>& taps) const;
+    void place(Source& source, unsigned int length);
+
+    static FMOD_RESULT F_CALLBACK sendCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels);
+    static FMOD_RESULT F_CALLBACK renderCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels);
+};
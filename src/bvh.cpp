@@ -0,0 +1,173 @@
+#include "bvh.hpp"
+
+#include <limits>
+#include <numeric>
+
+namespace {
+    // Slab test against the segment from + t * direction, t in [0, 1]
+    bool segmentHitsBox(const glm::vec3& from, const glm::vec3& direction, const glm::vec3& inverse, const glm::vec3& min, const glm::vec3& max) {
+        float enter = 0.0f;
+        float exit = 1.0f;
+        for (int axis = 0; axis < 3; axis++) {
+            // Parallel to the slab, (min - from) * inf is NaN when from lies on its plane
+            if (direction[axis] == 0.0f) {
+                if (from[axis] < min[axis] || from[axis] > max[axis])
+                    return false;
+                continue;
+            }
+            float t0 = (min[axis] - from[axis]) * inverse[axis];
+            float t1 = (max[axis] - from[axis]) * inverse[axis];
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        return enter <= exit;
+    }
+
+    // Plane crossing inside the open segment, then inside every edge, so polygons touching either end do not count
+    bool segmentHitsPolygon(const glm::vec3& from, const glm::vec3& direction, const PolygonBVH::Polygon& polygon) {
+        const auto& v = polygon.vertices;
+        glm::vec3 normal = glm::cross(v[1] - v[0], v[2] - v[0]);
+        float facing = glm::dot(direction, normal);
+
+        // Single sided polygons only block from the front
+        if (polygon.doubleSided ? facing == 0.0f : facing >= 0.0f)
+            return false;
+
+        float t = glm::dot(v[0] - from, normal) / facing;
+        if (t <= 1e-4f || t >= 1.0f - 1e-4f)
+            return false;
+
+        glm::vec3 point = from + direction * t;
+        for (int i = 0; i < polygon.count; i++) {
+            const auto& a = v[i];
+            const auto& b = v[(i + 1) % polygon.count];
+            if (glm::dot(glm::cross(b - a, point - a), normal) < 0.0f)
+                return false;
+        }
+        return true;
+    }
+}
+
+void PolygonBVH::build(std::vector<Polygon>&& source) {
+    polygons = std::move(source);
+    nodes.clear();
+    if (polygons.empty())
+        return;
+
+    std::vector<glm::vec3> centres;
+    centres.reserve(polygons.size());
+    for (const auto& polygon : polygons) {
+        glm::vec3 centre{ 0.0f };
+        for (int i = 0; i < polygon.count; i++) {
+            centre += polygon.vertices[i];
+        }
+        centres.push_back(centre / static_cast<float>(polygon.count));
+    }
+
+    nodes.reserve(polygons.size() * 2 / LeafSize + 1);
+    buildNode(centres, 0, static_cast<uint32_t>(polygons.size()));
+}
+
+void PolygonBVH::clear() {
+    polygons.clear();
+    nodes.clear();
+}
+
+uint32_t PolygonBVH::buildNode(std::vector<glm::vec3>& centres, uint32_t first, uint32_t count) {
+    uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({});
+
+    glm::vec3 min{ std::numeric_limits<float>::max() };
+    glm::vec3 max{ std::numeric_limits<float>::lowest() };
+    glm::vec3 centreMin = min;
+    glm::vec3 centreMax = max;
+    for (uint32_t i = first; i < first + count; i++) {
+        const auto& polygon = polygons[i];
+        for (int j = 0; j < polygon.count; j++) {
+            min = glm::min(min, polygon.vertices[j]);
+            max = glm::max(max, polygon.vertices[j]);
+        }
+        centreMin = glm::min(centreMin, centres[i]);
+        centreMax = glm::max(centreMax, centres[i]);
+    }
+    nodes[index].min = min;
+    nodes[index].max = max;
+
+    if (count <= LeafSize) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    // Median split along the widest axis of the centres keeps the tree balanced
+    glm::vec3 size = centreMax - centreMin;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    uint32_t half = count / 2;
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), first);
+    std::nth_element(order.begin(), order.begin() + half, order.end(), [&](uint32_t a, uint32_t b) { return centres[a][axis] < centres[b][axis]; });
+
+    std::vector<Polygon> sortedPolygons;
+    std::vector<glm::vec3> sortedCentres;
+    sortedPolygons.reserve(count);
+    sortedCentres.reserve(count);
+    for (auto i : order) {
+        sortedPolygons.push_back(polygons[i]);
+        sortedCentres.push_back(centres[i]);
+    }
+    std::copy(sortedPolygons.begin(), sortedPolygons.end(), polygons.begin() + first);
+    std::copy(sortedCentres.begin(), sortedCentres.end(), centres.begin() + first);
+
+    buildNode(centres, first, half);
+    uint32_t right = buildNode(centres, first + half, count - half);
+    nodes[index].right = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+PolygonBVH::Occlusion PolygonBVH::occlusion(const glm::vec3& from, const glm::vec3& to) const {
+    Occlusion result;
+    if (nodes.empty())
+        return result;
+
+    glm::vec3 direction = to - from;
+    glm::vec3 inverse = 1.0f / direction; // axes with a zero component are not divided by
+
+    float direct = 1.0f; // transmitted fractions
+    float reverb = 1.0f;
+
+    std::array<uint32_t, 64> stack;
+    uint32_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const auto& node = nodes[stack[--top]];
+        if (!segmentHitsBox(from, direction, inverse, node.min, node.max))
+            continue;
+
+        if (node.count == 0) {
+            uint32_t index = static_cast<uint32_t>(&node - nodes.data());
+            stack[top++] = node.right;
+            stack[top++] = index + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            const auto& polygon = polygons[i];
+            if (!segmentHitsPolygon(from, direction, polygon))
+                continue;
+
+            direct *= 1.0f - polygon.direct;
+            reverb *= 1.0f - polygon.reverb;
+        }
+
+        // Nothing gets through any more, the remaining hits cannot change the answer
+        if (direct <= 0.0f && reverb <= 0.0f)
+            break;
+    }
+
+    result.direct = 1.0f - direct;
+    result.reverb = 1.0f - reverb;
+    return result;
+}
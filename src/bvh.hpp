@@ -0,0 +1,46 @@
+#pragma once
+
+/// @brief Bounding volume hierarchy over static occluder polygons for segment queries
+/// Polygons are convex and planar with 3 or 4 vertices, as FMOD geometry takes them, so a ray
+/// crossing the diagonal of a quad counts once. Nodes are stored depth first in one array,
+/// a node's left child follows it directly.
+class PolygonBVH {
+public:
+    struct Polygon {
+        std::array<glm::vec3, 4> vertices;
+        int count;
+        float direct;
+        float reverb;
+        bool doubleSided;
+    };
+
+    struct Occlusion {
+        float direct{ 0.0f };
+        float reverb{ 0.0f };
+    };
+
+    void build(std::vector<Polygon>&& polygons);
+    void clear();
+
+    /// @brief Combined occlusion of every polygon crossing the segment, each hit lets (1 - occlusion) through
+    Occlusion occlusion(const glm::vec3& from, const glm::vec3& to) const;
+
+    size_t getPolygonCount() const { return polygons.size(); }
+    size_t getNodeCount() const { return nodes.size(); }
+
+private:
+    static constexpr uint32_t LeafSize = 4;
+
+    struct Node {
+        glm::vec3 min;
+        glm::vec3 max;
+        uint32_t right; // second child, interior nodes
+        uint32_t first; // first polygon, leaves
+        uint32_t count; // 0 for interior nodes
+    };
+
+    std::vector<Polygon> polygons;
+    std::vector<Node> nodes;
+
+    uint32_t buildNode(std::vector<glm::vec3>& centres, uint32_t first, uint32_t count);
+};
@@ -0,0 +1,483 @@
+#include "capture.hpp"
+#include "fmoderror.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    unsigned long long masterClock(FMOD::System* system) {
+        FMOD::ChannelGroup* master = nullptr;
+        unsigned long long clock = 0;
+        if (system->getMasterChannelGroup(&master) == FMOD_OK)
+            master->getDSPClock(&clock, nullptr);
+        return clock;
+    }
+
+    template<typename T>
+    void put(std::ofstream& file, T value) {
+        // WAV is little endian, so is everything this builds for
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+}
+
+RecordDevice::RecordDevice(FMOD::System* system, int driver) : system{system}, driver{driver} {
+    auto result = system->getRecordDriverInfo(driver, nullptr, 0, nullptr, &sampleRate, nullptr, &channels, nullptr);
+    FMOD_ERROR_(result);
+
+    // One second of the driver's native format, recorded into round and round
+    FMOD_CREATESOUNDEXINFO exinfo;
+    memset(&exinfo, 0, sizeof(FMOD_CREATESOUNDEXINFO));
+    exinfo.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
+    exinfo.numchannels = channels;
+    exinfo.format = FMOD_SOUND_FORMAT_PCM16;
+    exinfo.defaultfrequency = sampleRate;
+    exinfo.length = static_cast<unsigned int>(sampleRate * sizeof(int16_t) * channels);
+
+    result = system->createSound(nullptr, FMOD_2D | FMOD_LOOP_NORMAL | FMOD_OPENUSER, &exinfo, &sound);
+    FMOD_ERROR_(result);
+    length = static_cast<unsigned int>(sampleRate);
+}
+
+RecordDevice::~RecordDevice() {
+    stop();
+    if (sound)
+        sound->release();
+}
+
+bool RecordDevice::start() {
+    if (!sound)
+        return false;
+
+    auto result = system->recordStart(driver, sound, true);
+    FMOD_ERROR(result);
+    position = 0;
+    recording = true;
+    return true;
+}
+
+void RecordDevice::stop() {
+    if (recording)
+        system->recordStop(driver);
+    recording = false;
+}
+
+size_t RecordDevice::poll(float* output, size_t capacity) {
+    if (!recording)
+        return 0;
+
+    unsigned int current = 0;
+    auto result = system->getRecordPosition(driver, &current);
+    if (result == FMOD_ERR_RECORD_DISCONNECTED) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") record driver " << driver << " disconnected" << std::endl;
+        recording = false;
+        return 0;
+    }
+    FMOD_ERROR_RETURN(result, 0);
+
+    // Anything older than capacity would be overwritten before we got to it anyway, keep the newest
+    unsigned int frames = (current + length - position) % length;
+    if (frames > capacity) {
+        position = (position + frames - static_cast<unsigned int>(capacity)) % length;
+        frames = static_cast<unsigned int>(capacity);
+    }
+    if (frames == 0)
+        return 0;
+
+    auto stride = static_cast<unsigned int>(sizeof(int16_t) * channels);
+    void* data;
+    void* wrapped;
+    unsigned int dataLength;
+    unsigned int wrappedLength;
+    result = sound->lock(position * stride, frames * stride, &data, &wrapped, &dataLength, &wrappedLength);
+    FMOD_ERROR_RETURN(result, 0);
+
+    float scale = 1.0f / (32768.0f * static_cast<float>(channels));
+    auto convert = [&](const void* part, unsigned int bytes, float* out) {
+        auto samples = static_cast<const int16_t*>(part);
+        unsigned int count = bytes / stride;
+        for (unsigned int frame = 0; frame < count; frame++) {
+            int sum = 0;
+            for (int channel = 0; channel < channels; channel++)
+                sum += samples[frame * channels + channel];
+            out[frame] = static_cast<float>(sum) * scale;
+        }
+        return count;
+    };
+    unsigned int first = convert(data, dataLength, output);
+    if (wrapped)
+        convert(wrapped, wrappedLength, output + first);
+    sound->unlock(data, wrapped, dataLength, wrappedLength);
+
+    position = current;
+    return frames;
+}
+
+FakeRecordDevice::FakeRecordDevice(FMOD::System* system, int sampleRate, float drift) : system{system}, sampleRate{sampleRate}, drift{drift} {
+}
+
+bool FakeRecordDevice::start() {
+    auto result = system->getSoftwareFormat(&outputRate, nullptr, nullptr);
+    FMOD_ERROR(result);
+    startClock = masterClock(system);
+    produced = 0;
+    recording = true;
+    return true;
+}
+
+size_t FakeRecordDevice::poll(float* output, size_t capacity) {
+    if (!recording)
+        return 0;
+
+    // As many frames as a device with a slightly wrong crystal would have recorded by now
+    auto elapsed = static_cast<double>(masterClock(system) - startClock);
+    auto due = static_cast<uint64_t>(elapsed * sampleRate / outputRate * (1.0 + drift * 1e-6));
+    auto frames = static_cast<size_t>(std::min<uint64_t>(due > produced ? due - produced : 0, capacity));
+
+    constexpr float Pitch = 140.0f;
+    constexpr float Pi = 3.14159265f;
+    float increment = Pitch / static_cast<float>(sampleRate);
+    for (size_t i = 0; i < frames; i++) {
+        // 1.2 s of four syllables a second, then 0.8 s of pause
+        double time = static_cast<double>(produced + i) / sampleRate;
+        double cycle = std::fmod(time, 2.0);
+        float envelope = 0.0f;
+        if (cycle < 1.2) {
+            float syllable = std::sin(static_cast<float>(cycle) * 4.0f * Pi);
+            envelope = syllable * syllable;
+        }
+
+        float buzz = 0.0f;
+        for (int harmonic = 1; harmonic <= 6; harmonic++)
+            buzz += std::sin(2.0f * Pi * phase * static_cast<float>(harmonic)) / static_cast<float>(harmonic);
+        phase += increment;
+        phase -= std::floor(phase);
+
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        float noise = static_cast<float>(random >> 8) * (2.0f / 16777216.0f) - 1.0f;
+
+        output[i] = 0.15f * envelope * buzz + 0.001f * noise;
+    }
+
+    produced += frames;
+    return frames;
+}
+
+AudioCapture::AudioCapture(FMOD::System* system, std::unique_ptr<CaptureDevice> device, const CaptureSettings& settings)
+    : system{system}, device{std::move(device)}, settings{settings} {
+    deviceRate = this->device->getSampleRate();
+    frameSize = std::max<size_t>(static_cast<size_t>(settings.outputRate * settings.frameLength), 1);
+    step = static_cast<float>(deviceRate) / static_cast<float>(settings.outputRate);
+
+    auto result = system->getSoftwareFormat(&mixRate, nullptr, nullptr);
+    FMOD_ERROR_(result);
+
+    if (step > 1.0f) {
+        // Butterworth lowpass a little under the output Nyquist, run twice for a steeper skirt
+        constexpr float Pi = 3.14159265f;
+        float omega = 2.0f * Pi * 0.45f * static_cast<float>(settings.outputRate) / static_cast<float>(deviceRate);
+        float alpha = std::sin(omega) / (2.0f * 0.70710678f);
+        float cosine = std::cos(omega);
+        float a0 = 1.0f + alpha;
+        coefficients[0] = (1.0f - cosine) * 0.5f / a0;
+        coefficients[1] = (1.0f - cosine) / a0;
+        coefficients[2] = coefficients[0];
+        coefficients[3] = -2.0f * cosine / a0;
+        coefficients[4] = (1.0f - alpha) / a0;
+        filtering = true;
+    }
+
+    captured = std::make_unique<SPSCQueue<float, CaptureCapacity>>();
+    loopback = std::make_unique<SPSCQueue<float, LoopbackCapacity>>();
+    polled.resize(CaptureCapacity);
+    scratch.resize(std::max<size_t>(static_cast<size_t>(deviceRate * settings.frameLength), 256));
+    frame.resize(frameSize);
+}
+
+AudioCapture::~AudioCapture() {
+    stop();
+    // Someone may still hold the loopback, it reads silence from here on rather than from us
+    loopbackOpen = false;
+    if (loopbackSound)
+        loopbackSound->setUserData(nullptr);
+    loopbackSound = {};
+}
+
+bool AudioCapture::start() {
+    if (running)
+        return true;
+    if (!device->start())
+        return false;
+
+    startClock = masterClock(system);
+    driftFrames = 0;
+    openFile();
+
+    running = true;
+    if (settings.threaded)
+        thread = std::thread{ &AudioCapture::threadLoop, this };
+    return true;
+}
+
+void AudioCapture::stop() {
+    if (!running)
+        return;
+
+    running = false;
+    if (thread.joinable())
+        thread.join();
+    device->stop();
+    closeFile();
+}
+
+void AudioCapture::update() {
+    if (!running)
+        return;
+
+    size_t count = device->poll(polled.data(), polled.size());
+    size_t pushed = captured->push(polled.data(), count);
+    overruns += count - pushed;
+
+    // Drift is how far the device's frame count runs from the mixer's clock, measured from the first
+    // frames so the record latency does not count, and over seconds so the poll granularity washes out
+    if (count > 0) {
+        unsigned long long clock = masterClock(system);
+        if (driftFrames == 0) {
+            driftClock = clock;
+            driftFrames = capturedFrames + count;
+        } else if (clock - driftClock >= static_cast<unsigned long long>(mixRate)) {
+            double expected = static_cast<double>(clock - driftClock) / mixRate * deviceRate;
+            double actual = static_cast<double>(capturedFrames + count - driftFrames);
+            drift = (actual / expected - 1.0) * 1e6;
+        }
+    }
+    capturedFrames += count;
+
+    if (!settings.threaded)
+        process();
+}
+
+void AudioCapture::threadLoop() {
+    auto interval = std::chrono::duration<float>(settings.frameLength * 0.25f);
+    while (running) {
+        process();
+        std::this_thread::sleep_for(interval);
+    }
+    process();
+}
+
+void AudioCapture::process() {
+    size_t count;
+    while ((count = captured->pop(scratch.data(), scratch.size())) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            float sample = scratch[i];
+            if (filtering) {
+                for (auto& state : lowpass) {
+                    float output = coefficients[0] * sample + state[0];
+                    state[0] = coefficients[1] * sample - coefficients[3] * output + state[1];
+                    state[1] = coefficients[2] * sample - coefficients[4] * output;
+                    sample = output;
+                }
+            }
+
+            // Linear interpolation between the last two device samples, step apart on the output side
+            while (position <= 1.0f) {
+                emit(previous + (sample - previous) * position);
+                position += step;
+            }
+            position -= 1.0f;
+            previous = sample;
+        }
+    }
+}
+
+void AudioCapture::emit(float sample) {
+    frame[fill++] = sample;
+    if (fill == frameSize) {
+        processFrame();
+        fill = 0;
+    }
+}
+
+void AudioCapture::processFrame() {
+    float sum = 0.0f;
+    for (float sample : frame)
+        sum += sample * sample;
+    float rms = std::sqrt(sum / static_cast<float>(frameSize));
+    float decibels = rms > 1e-6f ? 20.0f * std::log10(rms) : -120.0f;
+
+    // The floor follows quiet frames down at once and loud ones up slowly, so speech never becomes floor
+    noiseFloor += (decibels - noiseFloor) * (decibels < noiseFloor ? 0.5f : 0.002f);
+    bool loud = decibels > settings.vadThreshold && decibels > noiseFloor + settings.vadMargin;
+    if (loud)
+        hangover = static_cast<uint32_t>(settings.vadHangover / settings.frameLength);
+    bool speaking = loud || hangover > 0;
+    if (!loud && hangover > 0)
+        hangover--;
+
+    if (onFrame)
+        onFrame(frame.data(), frameSize, speaking);
+
+    if (file.is_open()) {
+        for (float sample : frame)
+            put(file, static_cast<int16_t>(std::clamp(sample, -1.0f, 1.0f) * 32767.0f));
+        fileFrames += frameSize;
+    }
+
+    // A full loopback ring means nobody is playing it, dropping is the right thing then
+    if (loopbackOpen)
+        loopback->push(frame.data(), frameSize);
+
+    processed.fetch_add(frameSize, std::memory_order_relaxed);
+    if (speaking)
+        voiceFrames.fetch_add(1, std::memory_order_relaxed);
+    level.store(decibels, std::memory_order_relaxed);
+    voice.store(speaking, std::memory_order_relaxed);
+}
+
+void AudioCapture::openFile() {
+    if (settings.recordFile.empty())
+        return;
+
+    file.open(settings.recordFile, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") cannot open " << settings.recordFile << std::endl;
+        return;
+    }
+
+    // Sizes are patched in by closeFile()
+    file.write("RIFF", 4);
+    put<uint32_t>(file, 0);
+    file.write("WAVEfmt ", 8);
+    put<uint32_t>(file, 16);
+    put<uint16_t>(file, 1); // PCM
+    put<uint16_t>(file, 1); // mono
+    put<uint32_t>(file, static_cast<uint32_t>(settings.outputRate));
+    put<uint32_t>(file, static_cast<uint32_t>(settings.outputRate * sizeof(int16_t)));
+    put<uint16_t>(file, sizeof(int16_t));
+    put<uint16_t>(file, 16);
+    file.write("data", 4);
+    put<uint32_t>(file, 0);
+    fileFrames = 0;
+}
+
+void AudioCapture::closeFile() {
+    if (!file.is_open())
+        return;
+
+    auto bytes = static_cast<uint32_t>(fileFrames * sizeof(int16_t));
+    file.seekp(4);
+    put<uint32_t>(file, 36 + bytes);
+    file.seekp(40);
+    put<uint32_t>(file, bytes);
+    file.close();
+}
+
+SoundRef AudioCapture::createLoopback(SoundCache& cache, const std::string& key) {
+    if (loopbackSound)
+        return loopbackSound;
+
+    // Decode one frame at a time so the stream thread reads as often as frames arrive
+    FMOD_CREATESOUNDEXINFO exinfo;
+    memset(&exinfo, 0, sizeof(FMOD_CREATESOUNDEXINFO));
+    exinfo.cbsize = sizeof(FMOD_CREATESOUNDEXINFO);
+    exinfo.numchannels = 1;
+    exinfo.format = FMOD_SOUND_FORMAT_PCMFLOAT;
+    exinfo.defaultfrequency = settings.outputRate;
+    exinfo.decodebuffersize = static_cast<unsigned int>(frameSize);
+    exinfo.length = static_cast<unsigned int>(settings.outputRate * sizeof(float) * 3600);
+    exinfo.pcmreadcallback = loopbackCallback;
+    exinfo.userdata = this;
+
+    loopbackScratch.resize(static_cast<size_t>(static_cast<float>(frameSize) * (1.0f + MaxRateCorrection)) + 2);
+
+    FMOD::Sound* sound;
+    auto result = system->createSound(nullptr, FMOD_OPENUSER | FMOD_CREATESTREAM | FMOD_LOOP_NORMAL | FMOD_3D, &exinfo, &sound);
+    FMOD_ERROR_RETURN(result, {});
+
+    loopbackSound = cache.adopt(key, sound);
+    loopbackOpen = true;
+    return loopbackSound;
+}
+
+void AudioCapture::readLoopback(float* output, unsigned int length) {
+    auto target = settings.loopbackLatency * static_cast<float>(settings.outputRate);
+    auto available = static_cast<float>(loopback->size());
+
+    // Wait for the ring to fill to the latency first, playing from an almost empty ring underruns at once
+    if (!primed) {
+        if (available < target) {
+            std::memset(output, 0, length * sizeof(float));
+            return;
+        }
+        primed = true;
+        loopbackFill = available;
+    }
+
+    // Read a little faster or slower to hold the ring at the target, the two clocks never quite agree
+    loopbackFill = 0.97f * loopbackFill + 0.03f * available;
+    float error = (loopbackFill - target) / target;
+    float rate = 1.0f + std::clamp(error * MaxRateCorrection, -MaxRateCorrection, MaxRateCorrection);
+    loopbackRate.store(rate, std::memory_order_relaxed);
+
+    auto chunk = static_cast<unsigned int>(static_cast<float>(loopbackScratch.size() - 2) / (1.0f + MaxRateCorrection));
+    for (unsigned int offset = 0; offset < length; offset += chunk) {
+        unsigned int count = std::min(chunk, length - offset);
+
+        // previous sits at 0, the n-th popped sample at n + 1
+        double end = loopbackPosition + static_cast<double>(count) * rate;
+        auto needed = static_cast<size_t>(end);
+        size_t popped = loopback->pop(loopbackScratch.data(), needed);
+        if (popped < needed) {
+            underruns.fetch_add(1, std::memory_order_relaxed);
+            std::fill(loopbackScratch.begin() + popped, loopbackScratch.begin() + needed, 0.0f);
+            primed = false;
+        }
+
+        for (unsigned int i = 0; i < count; i++) {
+            double at = loopbackPosition + static_cast<double>(i) * rate;
+            auto index = static_cast<size_t>(at);
+            auto fraction = static_cast<float>(at - static_cast<double>(index));
+            float a = index == 0 ? loopbackPrevious : loopbackScratch[index - 1];
+            float b = index < needed ? loopbackScratch[index] : a;
+            output[offset + i] = a + (b - a) * fraction;
+        }
+
+        if (needed > 0)
+            loopbackPrevious = loopbackScratch[needed - 1];
+        loopbackPosition = end - static_cast<double>(needed);
+    }
+}
+
+CaptureStats AudioCapture::getStats() const {
+    CaptureStats stats;
+    stats.captured = capturedFrames;
+    stats.processed = processed.load(std::memory_order_relaxed);
+    stats.overruns = overruns;
+    stats.underruns = underruns.load(std::memory_order_relaxed);
+    stats.driftPpm = drift;
+    stats.loopbackRatePpm = (static_cast<double>(loopbackRate.load(std::memory_order_relaxed)) - 1.0) * 1e6;
+    stats.captureLatencyMs = static_cast<double>(captured->size()) * 1000.0 / deviceRate;
+    stats.loopbackLatencyMs = static_cast<double>(loopback->size()) * 1000.0 / settings.outputRate;
+    stats.level = level.load(std::memory_order_relaxed);
+    auto frames = stats.processed / frameSize;
+    stats.voiceRatio = frames ? static_cast<float>(voiceFrames.load(std::memory_order_relaxed)) / static_cast<float>(frames) : 0.0f;
+    stats.voice = voice.load(std::memory_order_relaxed);
+    return stats;
+}
+
+FMOD_RESULT F_CALLBACK AudioCapture::loopbackCallback(FMOD_SOUND* sound, void* data, unsigned int datalen) {
+    void* userdata = nullptr;
+    reinterpret_cast<FMOD::Sound*>(sound)->getUserData(&userdata);
+    if (!userdata) {
+        std::memset(data, 0, datalen);
+        return FMOD_OK;
+    }
+
+    static_cast<AudioCapture*>(userdata)->readLoopback(static_cast<float*>(data), datalen / sizeof(float));
+    return FMOD_OK;
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "soundcache.hpp"
+#include "spscqueue.hpp"
+
+/// @brief Where captured audio comes from, polled from the game thread
+class CaptureDevice {
+public:
+    virtual ~CaptureDevice() = default;
+
+    virtual bool start() = 0;
+    virtual void stop() = 0;
+    /// @brief Mono frames that arrived since the last poll, at most capacity of them
+    virtual size_t poll(float* output, size_t capacity) = 0;
+    virtual int getSampleRate() const = 0;
+    virtual bool isRecording() const = 0;
+};
+
+/// @brief FMOD record driver, recording into a one second looping sound like FMOD's record example
+class RecordDevice : public CaptureDevice {
+public:
+    RecordDevice(FMOD::System* system, int driver);
+    ~RecordDevice() override;
+
+    bool start() override;
+    void stop() override;
+    size_t poll(float* output, size_t capacity) override;
+    int getSampleRate() const override { return sampleRate; }
+    bool isRecording() const override { return recording; }
+
+private:
+    FMOD::System* system;
+    int driver;
+    int sampleRate{ 0 };
+    int channels{ 0 };
+    FMOD::Sound* sound{ nullptr };
+    unsigned int length{ 0 }; // frames
+    unsigned int position{ 0 }; // record position of the last poll
+    bool recording{ false };
+};
+
+/// @brief Stand-in record device for machines without a microphone
+/// Produces syllable like bursts of a harmonic buzz over a quiet noise floor, paced by the mixer's DSP
+/// clock so it runs at the same speed in realtime and non-realtime output. drift detunes its clock in ppm.
+class FakeRecordDevice : public CaptureDevice {
+public:
+    FakeRecordDevice(FMOD::System* system, int sampleRate = 48000, float drift = 0.0f);
+
+    bool start() override;
+    void stop() override { recording = false; }
+    size_t poll(float* output, size_t capacity) override;
+    int getSampleRate() const override { return sampleRate; }
+    bool isRecording() const override { return recording; }
+
+private:
+    FMOD::System* system;
+    int sampleRate;
+    float drift;
+    int outputRate{ 48000 };
+    unsigned long long startClock{ 0 }; // DSP clock at start()
+    uint64_t produced{ 0 };
+    float phase{ 0.0f };
+    uint32_t random{ 1 };
+    bool recording{ false };
+};
+
+struct CaptureSettings {
+    int outputRate{ 16000 }; // consumer output, what voice codecs take
+    float frameLength{ 0.02f }; // seconds per processed frame
+    float vadThreshold{ -50.0f }; // dBFS, quieter frames are never voice
+    float vadMargin{ 10.0f }; // dB above the tracked noise floor a frame needs to be voice
+    float vadHangover{ 0.3f }; // seconds voice is held after the last loud frame
+    float loopbackLatency{ 0.06f }; // seconds the loopback ring is kept filled to
+    std::string recordFile; // 16 bit WAV of the processed output, empty records nothing
+    bool threaded{ true }; // consumer on its own thread, otherwise update() runs it
+};
+
+struct CaptureStats {
+    uint64_t captured; // device frames
+    uint64_t processed; // output frames
+    uint64_t overruns; // device frames lost to a full capture ring
+    uint64_t underruns; // loopback reads that found the ring empty
+    double driftPpm; // device clock against the mixer clock
+    double loopbackRatePpm; // correction the loopback applies to hold its latency
+    double captureLatencyMs; // waiting in the capture ring
+    double loopbackLatencyMs; // waiting in the loopback ring
+    float level; // dBFS of the last frame
+    float voiceRatio; // frames the VAD called voice
+    bool voice;
+};
+
+/// @brief Capture pipeline: device -> lock-free ring -> consumer thread -> frames, file and loopback
+/// The game thread only moves what the device recorded into the capture ring. The consumer thread
+/// resamples it to the output rate behind an anti-alias lowpass, cuts it into frames, runs a VAD with an
+/// adaptive noise floor, and hands each frame to the frame callback (where an encoder would sit), the
+/// record file and the loopback ring. The loopback is a user created stream that plays the frames as a
+/// 3D emitter, it slightly speeds up or slows down its read to hold the ring at loopbackLatency, which
+/// absorbs the drift between the record and the output clocks the way FMOD's record example does.
+class AudioCapture {
+public:
+    static constexpr size_t CaptureCapacity = 1u << 16; // 1.3 s at 48 kHz
+    static constexpr size_t LoopbackCapacity = 1u << 15; // 2 s at 16 kHz
+    static constexpr float MaxRateCorrection = 0.02f;
+
+    /// @brief Consumer thread: one frame of output rate samples, voice as the VAD judged it
+    using FrameCallback = std::function<void(const float* frame, size_t length, bool voice)>;
+
+    AudioCapture(FMOD::System* system, std::unique_ptr<CaptureDevice> device, const CaptureSettings& settings = {});
+    ~AudioCapture();
+
+    AudioCapture(const AudioCapture&) = delete;
+    AudioCapture& operator=(const AudioCapture&) = delete;
+
+    /// @brief Set before start(), the consumer calls it
+    void setFrameCallback(FrameCallback callback) { onFrame = std::move(callback); }
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running; }
+
+    /// @brief Game thread: move newly recorded frames into the capture ring
+    void update();
+
+    /// @brief Open the loopback stream and hand it to the cache under key, the capture must outlive the reference
+    SoundRef createLoopback(SoundCache& cache, const std::string& key);
+
+    CaptureStats getStats() const;
+    CaptureDevice& getDevice() const { return *device; }
+    const CaptureSettings& getSettings() const { return settings; }
+
+private:
+    FMOD::System* system;
+    std::unique_ptr<CaptureDevice> device;
+    CaptureSettings settings;
+    int deviceRate;
+    size_t frameSize;
+    FrameCallback onFrame;
+
+    std::unique_ptr<SPSCQueue<float, CaptureCapacity>> captured;
+    std::unique_ptr<SPSCQueue<float, LoopbackCapacity>> loopback;
+    std::atomic<bool> loopbackOpen{ false };
+
+    std::thread thread;
+    std::atomic<bool> running{ false };
+
+    // Game thread
+    std::vector<float> polled;
+    uint64_t capturedFrames{ 0 };
+    uint64_t overruns{ 0 };
+    unsigned long long startClock{ 0 };
+    unsigned long long driftClock{ 0 }; // DSP clock at the first recorded frames
+    uint64_t driftFrames{ 0 };
+    int mixRate{ 48000 };
+    double drift{ 0.0 }; // ppm
+    SoundRef loopbackSound;
+
+    // Consumer
+    std::vector<float> scratch;
+    std::vector<float> frame;
+    size_t fill{ 0 };
+    float step; // device samples per output sample
+    float position{ 1.0f }; // of the next output sample, in device samples after previous
+    float previous{ 0.0f };
+    float lowpass[2][2]{}; // two biquad sections, transposed direct form II state
+    float coefficients[5]{}; // b0 b1 b2 a1 a2
+    bool filtering{ false };
+    float noiseFloor{ -60.0f };
+    uint32_t hangover{ 0 }; // frames left
+    std::ofstream file;
+    uint64_t fileFrames{ 0 };
+    std::atomic<uint64_t> processed{ 0 };
+    std::atomic<uint64_t> voiceFrames{ 0 };
+    std::atomic<float> level{ -120.0f };
+    std::atomic<bool> voice{ false };
+
+    // Stream thread
+    std::vector<float> loopbackScratch;
+    double loopbackPosition{ 0.0 };
+    float loopbackPrevious{ 0.0f };
+    float loopbackFill{ 0.0f }; // smoothed ring fill, samples
+    bool primed{ false };
+    std::atomic<float> loopbackRate{ 1.0f };
+    std::atomic<uint64_t> underruns{ 0 };
+
+    void threadLoop();
+    void process();
+    void emit(float sample);
+    void processFrame();
+    void readLoopback(float* output, unsigned int length);
+    void openFile();
+    void closeFile();
+
+    static FMOD_RESULT F_CALLBACK loopbackCallback(FMOD_SOUND* sound, void* data, unsigned int datalen);
+};
@@ -1,5 +1,11 @@
 #pragma once
 
+#include "voicepool.hpp"
+#include "geometrymanager.hpp"
+#include "convolution.hpp"
+#include "synth.hpp"
+#include "variation.hpp"
+
 struct TransformComponent {
     glm::vec3 translation{0.0f};
     glm::quat rotation{1.0f, 0.0f, 0.0f, 0.0f};
@@ -20,4 +26,52 @@ struct MeshComponent {
 
     std::shared_ptr<Mesh>& operator()() { return mesh; }
     const std::shared_ptr<Mesh>& operator()() const { return mesh; }
-};
\ No newline at end of file
+};
+
+struct AudioEmitterComponent {
+    VoiceHandle voice;
+    glm::vec3 position{ 0.0f }; // last frame position, velocity is derived from it
+    glm::vec3 velocity{ 0.0f }; // last velocity pushed to FMOD
+    bool dirty{ true }; // force a push on the next update
+};
+
+struct AudioOccluderComponent {
+    OcclusionMaterial material;
+    bool dynamic{ false }; // moves at runtime, gets its own geometry instead of joining a static chunk
+    bool registered{ false }; // picked up by GeometryManager::update
+    uint32_t geometry{ UINT32_MAX }; // dynamic geometry id, or static owner id
+};
+
+/// @brief Box around the entity's translation, aligned to its rotation, where a response is heard
+struct ReverbZoneComponent {
+    std::shared_ptr<const ImpulseResponse> impulse;
+    glm::vec3 extents{ 5.0f }; // half size, metres
+    float blend{ 2.0f }; // metres outside the box over which the zone fades out
+};
+
+/// @brief Procedural sound of the entity, an AudioEmitterComponent alongside moves its voice
+struct SynthComponent {
+    Synth* synth{ nullptr }; // owned by Audio
+    VoiceHandle voice;
+    FMOD::ChannelGroup* bus{ nullptr }; // nullptr plays on the world sfx bus
+    float frequency{ 440.0f };
+    float tone{ 1.0f };
+    float noise{ 0.0f };
+    float cutoff{ 20000.0f };
+    float amplitude{ 0.5f };
+    bool trigger{ false }; // start the envelope on the next update, cleared by the system
+    bool gate{ false }; // held notes release once it drops
+};
+
+/// @brief Randomized one shots of the entity, at a steady rate or on request
+struct VariationComponent {
+    VariationEngine* engine{ nullptr }; // owned by Audio
+    float rate{ 0.0f }; // triggers per second
+    float gain{ 1.0f };
+    float pitch{ 0.0f }; // semitones on top of the random spread
+    uint32_t triggers{ 0 }; // one shots for the next update, cleared by the system
+    float pending{ 0.0f }; // fraction of a rate trigger carried to the next frame
+    glm::vec3 position{ 0.0f }; // last position pushed to the engine
+    glm::vec3 velocity{ 0.0f };
+    bool dirty{ true };
+};
@@ -0,0 +1,414 @@
+#include "convolution.hpp"
+#include "fmoderror.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    // Shared across instances, FMOD keeps the pointers
+    FMOD_DSP_PARAMETER_DESC wetDesc;
+    FMOD_DSP_PARAMETER_DESC dryDesc;
+    FMOD_DSP_PARAMETER_DESC fadeDesc;
+    FMOD_DSP_PARAMETER_DESC* parameters[ConvolutionReverb::ParameterCount] = { &wetDesc, &dryDesc, &fadeDesc };
+
+    void describe(FMOD_DSP_PARAMETER_DESC& desc, const char* name, const char* label, const char* description, float min, float max, float value) {
+        memset(&desc, 0, sizeof(desc));
+        desc.type = FMOD_DSP_PARAMETER_TYPE_FLOAT;
+        std::strncpy(desc.name, name, sizeof(desc.name) - 1);
+        std::strncpy(desc.label, label, sizeof(desc.label) - 1);
+        desc.description = description;
+        desc.floatdesc.min = min;
+        desc.floatdesc.max = max;
+        desc.floatdesc.defaultval = value;
+        desc.floatdesc.mapping.type = FMOD_DSP_PARAMETER_FLOAT_MAPPING_TYPE_LINEAR;
+    }
+
+    float sampleValue(const uint8_t* data, FMOD_SOUND_FORMAT format) {
+        switch (format) {
+            case FMOD_SOUND_FORMAT_PCM8:
+                return static_cast<float>(static_cast<int8_t>(data[0])) / 128.0f;
+            case FMOD_SOUND_FORMAT_PCM16:
+                return static_cast<float>(static_cast<int16_t>(data[0] | (data[1] << 8))) / 32768.0f;
+            case FMOD_SOUND_FORMAT_PCM24:
+                return static_cast<float>(static_cast<int32_t>((data[0] << 8) | (data[1] << 16) | (data[2] << 24)) >> 8) / 8388608.0f;
+            case FMOD_SOUND_FORMAT_PCM32:
+                return static_cast<float>(static_cast<int32_t>(data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24))) / 2147483648.0f;
+            case FMOD_SOUND_FORMAT_PCMFLOAT: {
+                float value;
+                std::memcpy(&value, data, sizeof(value));
+                return value;
+            }
+            default:
+                return 0.0f;
+        }
+    }
+}
+
+size_t ImpulseResponse::getPartitionCount() const {
+    return partitions.size() / (ConvolutionReverb::FFTSize * 2);
+}
+
+const float* ImpulseResponse::partitionReal(size_t partition) const {
+    return partitions.data() + partition * ConvolutionReverb::FFTSize * 2;
+}
+
+const float* ImpulseResponse::partitionImag(size_t partition) const {
+    return partitionReal(partition) + ConvolutionReverb::FFTSize;
+}
+
+std::shared_ptr<ImpulseResponse> ImpulseResponse::fromSamples(const std::string& name, const std::vector<float>& samples, int sampleRate) {
+    constexpr size_t B = ConvolutionReverb::BlockSize;
+    constexpr size_t N = ConvolutionReverb::FFTSize;
+
+    auto impulse = std::make_shared<ImpulseResponse>();
+    impulse->name = name;
+    impulse->sampleRate = sampleRate;
+    impulse->length = samples.size();
+
+    // Unit energy, so zones recorded at different levels crossfade without a jump
+    double energy = 0.0;
+    for (float sample : samples) {
+        energy += static_cast<double>(sample) * sample;
+    }
+    float scale = energy > 0.0 ? static_cast<float>(1.0 / std::sqrt(energy)) : 0.0f;
+
+    dsp::FFT fft{ N };
+    size_t count = (samples.size() + B - 1) / B;
+    impulse->partitions.assign(count * N * 2, 0.0f);
+    for (size_t p = 0; p < count; p++) {
+        // Each partition is zero padded to the FFT size for overlap-save
+        float* re = impulse->partitions.data() + p * N * 2;
+        float* im = re + N;
+        for (size_t i = 0; i < B && p * B + i < samples.size(); i++) {
+            re[i] = samples[p * B + i] * scale;
+        }
+        fft.forward(re, im);
+    }
+
+    return impulse;
+}
+
+ImpulseResponseCache::ImpulseResponseCache(FMOD::System* system, int sampleRate) : system{system}, sampleRate{sampleRate} {
+}
+
+std::shared_ptr<const ImpulseResponse> ImpulseResponseCache::load(const std::string& path) {
+    auto found = entries.find(path);
+    if (found != entries.end())
+        return found->second;
+
+    // Decode only, the sound is never played
+    FMOD::Sound* sound;
+    auto result = system->createSound(path.c_str(), FMOD_OPENONLY | FMOD_2D, nullptr, &sound);
+    FMOD_ERROR_RETURN(result, nullptr);
+
+    FMOD_SOUND_FORMAT format;
+    int channels;
+    int bits;
+    float frequency;
+    unsigned int bytes;
+    result = sound->getFormat(nullptr, &format, &channels, &bits);
+    if (result == FMOD_OK)
+        result = sound->getDefaults(&frequency, nullptr);
+    if (result == FMOD_OK)
+        result = sound->getLength(&bytes, FMOD_TIMEUNIT_PCMBYTES);
+
+    std::vector<uint8_t> data;
+    if (result == FMOD_OK) {
+        data.resize(bytes);
+        unsigned int read = 0;
+        result = sound->readData(data.data(), bytes, &read);
+        if (result == FMOD_ERR_FILE_EOF)
+            result = FMOD_OK;
+        data.resize(read);
+    }
+    sound->release();
+    FMOD_ERROR_RETURN(result, nullptr);
+
+    size_t frameBytes = static_cast<size_t>(bits / 8) * channels;
+    if (frameBytes == 0 || (format != FMOD_SOUND_FORMAT_PCM8 && format != FMOD_SOUND_FORMAT_PCM16 && format != FMOD_SOUND_FORMAT_PCM24 &&
+                            format != FMOD_SOUND_FORMAT_PCM32 && format != FMOD_SOUND_FORMAT_PCMFLOAT)) {
+        std::cerr << "Unsupported impulse response format " << path << std::endl;
+        return nullptr;
+    }
+
+    std::vector<float> mono(data.size() / frameBytes);
+    for (size_t frame = 0; frame < mono.size(); frame++) {
+        float sum = 0.0f;
+        for (int channel = 0; channel < channels; channel++) {
+            sum += sampleValue(data.data() + frame * frameBytes + channel * (bits / 8), format);
+        }
+        mono[frame] = sum / static_cast<float>(channels);
+    }
+
+    // Linear resampling to the mixer rate, the response is smooth enough at these ratios
+    if (static_cast<int>(frequency) != sampleRate && !mono.empty()) {
+        double ratio = frequency / sampleRate;
+        std::vector<float> resampled(static_cast<size_t>(mono.size() / ratio));
+        for (size_t i = 0; i < resampled.size(); i++) {
+            double position = i * ratio;
+            size_t index = static_cast<size_t>(position);
+            float t = static_cast<float>(position - index);
+            float next = index + 1 < mono.size() ? mono[index + 1] : 0.0f;
+            resampled[i] = mono[index] + (next - mono[index]) * t;
+        }
+        mono = std::move(resampled);
+    }
+
+    auto impulse = ImpulseResponse::fromSamples(path, mono, sampleRate);
+    entries[path] = impulse;
+    return impulse;
+}
+
+std::shared_ptr<const ImpulseResponse> ImpulseResponseCache::generate(const std::string& name, float rt60, uint32_t seed) {
+    auto found = entries.find(name);
+    if (found != entries.end())
+        return found->second;
+
+    // White noise under a -60 dB per rt60 envelope, xorshift so the same seed gives the same room
+    std::vector<float> samples(static_cast<size_t>(rt60 * sampleRate));
+    uint32_t state = seed ? seed : 1;
+    float decay = -6.9078f / (rt60 * sampleRate);
+    for (size_t i = 0; i < samples.size(); i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        float noise = static_cast<float>(state) / 2147483648.0f - 1.0f;
+        samples[i] = noise * std::exp(decay * static_cast<float>(i));
+    }
+
+    auto impulse = ImpulseResponse::fromSamples(name, samples, sampleRate);
+    impulse->rt60 = rt60;
+    impulse->seed = seed;
+    entries[name] = impulse;
+    return impulse;
+}
+
+size_t ImpulseResponseCache::getBytes() const {
+    size_t bytes = 0;
+    for (const auto& [name, impulse] : entries) {
+        bytes += impulse->partitions.size() * sizeof(float);
+    }
+    return bytes;
+}
+
+ConvolutionReverb::ConvolutionReverb(int sampleRate, float maxSeconds) : fft{FFTSize}, sampleRate{sampleRate} {
+    maxPartitions = std::max<size_t>(1, static_cast<size_t>(maxSeconds * sampleRate + BlockSize - 1) / BlockSize);
+
+    // Everything the mixer thread touches is sized here
+    history.assign(maxPartitions * FFTSize * 2, 0.0f);
+    input.assign(FFTSize * 2, 0.0f);
+    re.resize(FFTSize);
+    im.resize(FFTSize);
+    accre.resize(FFTSize);
+    accim.resize(FFTSize);
+    outLeft.assign(BlockSize, 0.0f);
+    outRight.assign(BlockSize, 0.0f);
+    pending.reserve(Slots);
+    requested.reserve(Slots);
+}
+
+FMOD::DSP* ConvolutionReverb::createDSP(FMOD::System* system) {
+    describe(wetDesc, "Wet", "", "Level of the convolved signal", 0.0f, 4.0f, 0.3f);
+    describe(dryDesc, "Dry", "", "Level of the input signal", 0.0f, 1.0f, 1.0f);
+    describe(fadeDesc, "Fade time", "s", "Seconds for a zone to fade fully in or out", 0.01f, 10.0f, 0.5f);
+
+    FMOD_DSP_DESCRIPTION dspdesc;
+    memset(&dspdesc, 0, sizeof(dspdesc));
+    std::strcpy(dspdesc.name, "DSP Convolution");
+
+    dspdesc.numinputbuffers = 1;
+    dspdesc.numoutputbuffers = 1;
+    dspdesc.read = readCallback;
+    dspdesc.numparameters = ParameterCount;
+    dspdesc.paramdesc = parameters;
+    dspdesc.setparameterfloat = setFloatCallback;
+    dspdesc.getparameterfloat = getFloatCallback;
+    dspdesc.userdata = this;
+
+    FMOD::DSP* dsp;
+    auto result = system->createDSP(&dspdesc, &dsp);
+    FMOD_ERROR_RETURN(result, nullptr);
+    return dsp;
+}
+
+ConvolutionReverb* ConvolutionReverb::fromDSP(FMOD::DSP* dsp) {
+    void* userdata = nullptr;
+    if (!dsp || dsp->getUserData(&userdata) != FMOD_OK)
+        return nullptr;
+    return static_cast<ConvolutionReverb*>(userdata);
+}
+
+void ConvolutionReverb::setZones(const std::vector<Zone>& zones) {
+    std::lock_guard<std::mutex> lock{ pendingMutex };
+    pending.clear();
+    for (const auto& zone : zones) {
+        if (pending.size() < Slots && zone.impulse && zone.weight > 0.0f)
+            pending.push_back(zone);
+    }
+    pendingVersion.fetch_add(1, std::memory_order_release);
+}
+
+void ConvolutionReverb::process(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels) {
+    // Never wait on the game thread, a busy lock is retried next callback
+    uint32_t version = pendingVersion.load(std::memory_order_acquire);
+    if (version != appliedVersion) {
+        std::unique_lock<std::mutex> lock{ pendingMutex, std::try_to_lock };
+        if (lock.owns_lock()) {
+            requested = pending;
+            appliedVersion = version;
+        }
+    }
+
+    float wetLevel = wet.load(std::memory_order_relaxed);
+    float dryLevel = dry.load(std::memory_order_relaxed);
+    float* currentRe = input.data() + BlockSize;
+    float* currentIm = input.data() + FFTSize + BlockSize;
+
+    for (unsigned int frame = 0; frame < length; frame++) {
+        const float* in = inbuffer + frame * inchannels;
+        float* out = outbuffer + frame * outchannels;
+
+        currentRe[fill] = in[0];
+        currentIm[fill] = inchannels > 1 ? in[1] : in[0];
+
+        float left = outLeft[fill] * wetLevel;
+        float right = outRight[fill] * wetLevel;
+        for (int channel = 0; channel < outchannels; channel++) {
+            float value = channel < inchannels ? in[channel] * dryLevel : 0.0f;
+            if (outchannels == 1)
+                value += (left + right) * 0.5f;
+            else if (channel == 0)
+                value += left;
+            else if (channel == 1)
+                value += right;
+            out[channel] = value;
+        }
+
+        if (++fill == BlockSize) {
+            processBlock();
+            fill = 0;
+        }
+    }
+}
+
+void ConvolutionReverb::reconcile() {
+    for (auto& slot : slots) {
+        slot.target = 0.0f;
+        for (const auto& zone : requested) {
+            if (zone.impulse == slot.impulse)
+                slot.target = zone.weight;
+        }
+    }
+
+    // New responses take a silent slot, when both are still sounding they wait for one to fade out
+    for (const auto& zone : requested) {
+        bool placed = std::any_of(slots.begin(), slots.end(), [&](const Slot& slot) { return slot.impulse == zone.impulse; });
+        if (placed)
+            continue;
+
+        for (auto& slot : slots) {
+            if (!slot.impulse || (slot.gain == 0.0f && slot.target == 0.0f)) {
+                slot.impulse = zone.impulse;
+                slot.gain = 0.0f;
+                slot.target = zone.weight;
+                break;
+            }
+        }
+    }
+}
+
+void ConvolutionReverb::processBlock() {
+    reconcile();
+
+    // Spectrum of the last two blocks, left in the real part and right in the imaginary part
+    head = (head + 1) % maxPartitions;
+    float* spectrumRe = history.data() + head * FFTSize * 2;
+    float* spectrumIm = spectrumRe + FFTSize;
+    std::copy(input.begin(), input.begin() + FFTSize, spectrumRe);
+    std::copy(input.begin() + FFTSize, input.end(), spectrumIm);
+    fft.forward(spectrumRe, spectrumIm);
+
+    std::copy(input.begin() + BlockSize, input.begin() + FFTSize, input.begin());
+    std::copy(input.begin() + FFTSize + BlockSize, input.end(), input.begin() + FFTSize);
+
+    std::fill(outLeft.begin(), outLeft.end(), 0.0f);
+    std::fill(outRight.begin(), outRight.end(), 0.0f);
+
+    float step = static_cast<float>(BlockSize) / (std::max(fadeTime.load(std::memory_order_relaxed), 0.01f) * sampleRate);
+
+    for (auto& slot : slots) {
+        if (!slot.impulse)
+            continue;
+
+        float from = slot.gain;
+        float to = slot.target > from ? std::min(slot.target, from + step) : std::max(slot.target, from - step);
+        slot.gain = to;
+        if (from == 0.0f && to == 0.0f) {
+            // Faded out, the cache still holds the response so this never frees on the mixer thread
+            slot.impulse.reset();
+            continue;
+        }
+
+        std::fill(accre.begin(), accre.end(), 0.0f);
+        std::fill(accim.begin(), accim.end(), 0.0f);
+        size_t partitions = std::min(slot.impulse->getPartitionCount(), maxPartitions);
+        for (size_t p = 0; p < partitions; p++) {
+            const float* pastRe = history.data() + ((head + maxPartitions - p) % maxPartitions) * FFTSize * 2;
+            dsp::complexMultiplyAccumulate(pastRe, pastRe + FFTSize, slot.impulse->partitionReal(p), slot.impulse->partitionImag(p),
+                                           accre.data(), accim.data(), FFTSize);
+        }
+        fft.inverse(accre.data(), accim.data());
+
+        // The first half wrapped around, the second half is the linear convolution of this block
+        for (size_t i = 0; i < BlockSize; i++) {
+            float gain = from + (to - from) * static_cast<float>(i + 1) / static_cast<float>(BlockSize);
+            outLeft[i] += accre[BlockSize + i] * gain;
+            outRight[i] += accim[BlockSize + i] * gain;
+        }
+    }
+}
+
+FMOD_RESULT F_CALLBACK ConvolutionReverb::readCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels) {
+    auto reverb = fromDSP(static_cast<FMOD::DSP*>(dsp_state->instance));
+    reverb->process(inbuffer, outbuffer, length, inchannels, *outchannels);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK ConvolutionReverb::setFloatCallback(FMOD_DSP_STATE* dsp_state, int index, float value) {
+    auto reverb = fromDSP(static_cast<FMOD::DSP*>(dsp_state->instance));
+    switch (index) {
+        case Wet:
+            reverb->wet.store(value, std::memory_order_relaxed);
+            return FMOD_OK;
+        case Dry:
+            reverb->dry.store(value, std::memory_order_relaxed);
+            return FMOD_OK;
+        case FadeTime:
+            reverb->fadeTime.store(value, std::memory_order_relaxed);
+            return FMOD_OK;
+        default:
+            return FMOD_ERR_INVALID_PARAM;
+    }
+}
+
+FMOD_RESULT F_CALLBACK ConvolutionReverb::getFloatCallback(FMOD_DSP_STATE* dsp_state, int index, float* value, char* valuestr) {
+    auto reverb = fromDSP(static_cast<FMOD::DSP*>(dsp_state->instance));
+    switch (index) {
+        case Wet:
+            *value = reverb->wet.load(std::memory_order_relaxed);
+            break;
+        case Dry:
+            *value = reverb->dry.load(std::memory_order_relaxed);
+            break;
+        case FadeTime:
+            *value = reverb->fadeTime.load(std::memory_order_relaxed);
+            break;
+        default:
+            return FMOD_ERR_INVALID_PARAM;
+    }
+    if (valuestr)
+        snprintf(valuestr, FMOD_DSP_GETPARAM_VALUESTR_LENGTH, "%.2f", *value);
+    return FMOD_OK;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fft.hpp"
+
+/// @brief Mono impulse response cut into spectra of ConvolutionReverb::BlockSize samples each
+/// Immutable once built, so zones and DSPs share one copy across threads.
+struct ImpulseResponse {
+    std::string name;
+    int sampleRate;
+    size_t length; // samples
+    std::vector<float> partitions; // per partition FFTSize real parts, then FFTSize imaginary parts
+    float rt60{ 0.0f }; // generated responses, 0 when loaded from the file in name
+    uint32_t seed{ 0 };
+
+    size_t getPartitionCount() const;
+    const float* partitionReal(size_t partition) const;
+    const float* partitionImag(size_t partition) const;
+
+    static std::shared_ptr<ImpulseResponse> fromSamples(const std::string& name, const std::vector<float>& samples, int sampleRate);
+};
+
+/// @brief Loads every impulse response once, decoded, resampled to the mixer rate and partitioned
+/// Entries stay until clear(), the DSPs never drop the last reference on the mixer thread.
+class ImpulseResponseCache {
+public:
+    ImpulseResponseCache(FMOD::System* system, int sampleRate);
+
+    /// @brief Any format FMOD decodes, channels are averaged to mono
+    std::shared_ptr<const ImpulseResponse> load(const std::string& path);
+    /// @brief Exponentially decaying noise with the given RT60, for rooms without a measured response
+    std::shared_ptr<const ImpulseResponse> generate(const std::string& name, float rt60, uint32_t seed = 1);
+
+    void clear() { entries.clear(); }
+    size_t getCount() const { return entries.size(); }
+    size_t getBytes() const;
+
+private:
+    FMOD::System* system;
+    int sampleRate;
+    std::unordered_map<std::string, std::shared_ptr<const ImpulseResponse>> entries;
+};
+
+/// @brief Uniformly partitioned overlap-save convolution reverb, as an FMOD DSP
+/// Stereo input is packed as left + i * right, so one complex FFT per block convolves both channels
+/// with the mono response. Past input spectra live in one frequency domain delay line shared by two
+/// response slots: switching zones fades one slot out and the other in over the same input history,
+/// the cost only doubles while a fade is running. Output is delayed by one BlockSize.
+/// Slots are published by the game thread and picked up by the mixer at the start of a block.
+class ConvolutionReverb {
+public:
+    static constexpr size_t BlockSize = 512;
+    static constexpr size_t FFTSize = BlockSize * 2;
+    static constexpr size_t Slots = 2;
+    static constexpr float DefaultMaxSeconds = 4.0f;
+
+    struct Zone {
+        std::shared_ptr<const ImpulseResponse> impulse;
+        float weight;
+    };
+
+    enum Parameter { Wet, Dry, FadeTime, ParameterCount };
+
+    ConvolutionReverb(int sampleRate, float maxSeconds = DefaultMaxSeconds);
+
+    /// @brief The DSP reads this object as its userdata, the caller owns the DSP and must release it first
+    FMOD::DSP* createDSP(FMOD::System* system);
+    static ConvolutionReverb* fromDSP(FMOD::DSP* dsp);
+
+    /// @brief Responses to mix and their weights, at most Slots, missing ones fade out
+    void setZones(const std::vector<Zone>& zones);
+
+    void setWet(float value) { wet.store(value, std::memory_order_relaxed); }
+    void setDry(float value) { dry.store(value, std::memory_order_relaxed); }
+
+    /// @brief Mixer thread: convolve interleaved frames, wet result on the first two channels
+    void process(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels);
+
+    size_t getMaxPartitions() const { return maxPartitions; }
+
+private:
+    struct Slot {
+        std::shared_ptr<const ImpulseResponse> impulse;
+        float gain{ 0.0f };
+        float target{ 0.0f };
+    };
+
+    dsp::FFT fft;
+    int sampleRate;
+    size_t maxPartitions;
+
+    std::atomic<float> wet{ 0.3f };
+    std::atomic<float> dry{ 1.0f };
+    std::atomic<float> fadeTime{ 0.5f }; // seconds for a full 0 to 1 change
+
+    // Game thread hand off, the mixer only try_locks
+    std::mutex pendingMutex;
+    std::vector<Zone> pending;
+    std::atomic<uint32_t> pendingVersion{ 0 };
+    uint32_t appliedVersion{ 0 };
+
+    // Mixer thread only
+    std::array<Slot, Slots> slots;
+    std::vector<Zone> requested;
+    std::vector<float> history; // maxPartitions spectra, real then imaginary halves
+    size_t head{ 0 }; // newest spectrum in history
+    std::vector<float> input; // previous and current block, left in re, right in im
+    std::vector<float> re, im; // scratch
+    std::vector<float> accre, accim;
+    std::vector<float> outLeft, outRight; // wet output of the last block
+    size_t fill{ 0 }; // frames of the current block gathered
+
+    void processBlock();
+    void reconcile();
+
+    static FMOD_RESULT F_CALLBACK readCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels);
+    static FMOD_RESULT F_CALLBACK setFloatCallback(FMOD_DSP_STATE* dsp_state, int index, float value);
+    static FMOD_RESULT F_CALLBACK getFloatCallback(FMOD_DSP_STATE* dsp_state, int index, float* value, char* valuestr);
+};
@@ -0,0 +1,300 @@
+#include "dspgain.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DSP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define DSP_TARGET_AVX2
+#else
+#define DSP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    void gainScalar(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels, float gain) {
+        int channels = inchannels < outchannels ? inchannels : outchannels;
+        for (unsigned int samp = 0; samp < length; samp++) {
+            const float* in = inbuffer + samp * inchannels;
+            float* out = outbuffer + samp * outchannels;
+            int chan = 0;
+            for (; chan < channels; chan++) {
+                out[chan] = in[chan] * gain;
+            }
+            for (; chan < outchannels; chan++) {
+                out[chan] = 0.0f;
+            }
+        }
+    }
+
+    void gainFlatScalar(const float* inbuffer, float* outbuffer, unsigned int length, int /*inchannels*/, int outchannels, float gain) {
+        size_t count = static_cast<size_t>(length) * outchannels;
+        for (size_t i = 0; i < count; i++) {
+            outbuffer[i] = inbuffer[i] * gain;
+        }
+    }
+
+    void rampScalar(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels, float from, float to) {
+        int channels = inchannels < outchannels ? inchannels : outchannels;
+        float step = (to - from) / static_cast<float>(length);
+        for (unsigned int samp = 0; samp < length; samp++) {
+            const float* in = inbuffer + samp * inchannels;
+            float* out = outbuffer + samp * outchannels;
+            float gain = from + step * static_cast<float>(samp + 1);
+            int chan = 0;
+            for (; chan < channels; chan++) {
+                out[chan] = in[chan] * gain;
+            }
+            for (; chan < outchannels; chan++) {
+                out[chan] = 0.0f;
+            }
+        }
+    }
+
+    void rampFlatScalar(const float* inbuffer, float* outbuffer, unsigned int length, int /*inchannels*/, int outchannels, float from, float to) {
+        rampScalar(inbuffer, outbuffer, length, outchannels, outchannels, from, to);
+    }
+
+    int gcd(int a, int b) {
+        while (b != 0) {
+            int t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+#ifdef DSP_X86
+    // The interleaved ramp is walked in units of lcm(channels, lanes) floats, so every vector in a unit
+    // sees the same frame offsets per lane and only the base gain moves between units
+
+    void rampFlatSSE(const float* inbuffer, float* outbuffer, unsigned int length, int /*inchannels*/, int outchannels, float from, float to) {
+        constexpr int lanes = 4;
+        const int channels = outchannels;
+        const int vectors = channels / gcd(channels, lanes);
+        const int frames = lanes * vectors / channels;
+        const float step = (to - from) / static_cast<float>(length);
+
+        alignas(16) float offsets[8][lanes];
+        for (int k = 0; k < vectors; k++) {
+            for (int lane = 0; lane < lanes; lane++) {
+                offsets[k][lane] = static_cast<float>((k * lanes + lane) / channels);
+            }
+        }
+
+        __m128 steps = _mm_set1_ps(step);
+        __m128 ramps[8];
+        for (int k = 0; k < vectors; k++) {
+            ramps[k] = _mm_mul_ps(_mm_load_ps(offsets[k]), steps);
+        }
+
+        const size_t unit = static_cast<size_t>(lanes) * vectors;
+        const size_t count = static_cast<size_t>(length) * channels;
+        size_t i = 0;
+        unsigned int frame = 0;
+        for (; i + unit <= count; i += unit, frame += frames) {
+            __m128 base = _mm_set1_ps(from + step * static_cast<float>(frame + 1));
+            for (int k = 0; k < vectors; k++) {
+                __m128 a = _mm_loadu_ps(inbuffer + i + k * lanes);
+                _mm_storeu_ps(outbuffer + i + k * lanes, _mm_mul_ps(a, _mm_add_ps(base, ramps[k])));
+            }
+        }
+        for (; i < count; i++) {
+            outbuffer[i] = inbuffer[i] * (from + step * static_cast<float>(i / channels + 1));
+        }
+    }
+
+    DSP_TARGET_AVX2 void rampFlatAVX2(const float* inbuffer, float* outbuffer, unsigned int length, int /*inchannels*/, int outchannels, float from, float to) {
+        constexpr int lanes = 8;
+        const int channels = outchannels;
+        const int vectors = channels / gcd(channels, lanes);
+        const int frames = lanes * vectors / channels;
+        const float step = (to - from) / static_cast<float>(length);
+
+        alignas(32) float offsets[8][lanes];
+        for (int k = 0; k < vectors; k++) {
+            for (int lane = 0; lane < lanes; lane++) {
+                offsets[k][lane] = static_cast<float>((k * lanes + lane) / channels);
+            }
+        }
+
+        __m256 steps = _mm256_set1_ps(step);
+        __m256 ramps[8];
+        for (int k = 0; k < vectors; k++) {
+            ramps[k] = _mm256_mul_ps(_mm256_load_ps(offsets[k]), steps);
+        }
+
+        const size_t unit = static_cast<size_t>(lanes) * vectors;
+        const size_t count = static_cast<size_t>(length) * channels;
+        size_t i = 0;
+        unsigned int frame = 0;
+        for (; i + unit <= count; i += unit, frame += frames) {
+            __m256 base = _mm256_set1_ps(from + step * static_cast<float>(frame + 1));
+            for (int k = 0; k < vectors; k++) {
+                __m256 a = _mm256_loadu_ps(inbuffer + i + k * lanes);
+                _mm256_storeu_ps(outbuffer + i + k * lanes, _mm256_mul_ps(a, _mm256_add_ps(base, ramps[k])));
+            }
+        }
+        for (; i < count; i++) {
+            outbuffer[i] = inbuffer[i] * (from + step * static_cast<float>(i / channels + 1));
+        }
+        _mm256_zeroupper();
+    }
+
+    void gainFlatSSE(const float* inbuffer, float* outbuffer, unsigned int length, int /*inchannels*/, int outchannels, float gain) {
+        size_t count = static_cast<size_t>(length) * outchannels;
+        size_t i = 0;
+        __m128 g = _mm_set1_ps(gain);
+        for (; i + 8 <= count; i += 8) {
+            __m128 a = _mm_loadu_ps(inbuffer + i);
+            __m128 b = _mm_loadu_ps(inbuffer + i + 4);
+            _mm_storeu_ps(outbuffer + i, _mm_mul_ps(a, g));
+            _mm_storeu_ps(outbuffer + i + 4, _mm_mul_ps(b, g));
+        }
+        for (; i < count; i++) {
+            outbuffer[i] = inbuffer[i] * gain;
+        }
+    }
+
+    DSP_TARGET_AVX2 void gainFlatAVX2(const float* inbuffer, float* outbuffer, unsigned int length, int /*inchannels*/, int outchannels, float gain) {
+        size_t count = static_cast<size_t>(length) * outchannels;
+        size_t i = 0;
+        __m256 g = _mm256_set1_ps(gain);
+        for (; i + 16 <= count; i += 16) {
+            __m256 a = _mm256_loadu_ps(inbuffer + i);
+            __m256 b = _mm256_loadu_ps(inbuffer + i + 8);
+            _mm256_storeu_ps(outbuffer + i, _mm256_mul_ps(a, g));
+            _mm256_storeu_ps(outbuffer + i + 8, _mm256_mul_ps(b, g));
+        }
+        for (; i < count; i++) {
+            outbuffer[i] = inbuffer[i] * gain;
+        }
+        _mm256_zeroupper();
+    }
+
+    dsp::SimdLevel detectSimdLevel() {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] >= 7) {
+            __cpuidex(info, 7, 0);
+            bool avx2 = (info[1] & (1 << 5)) != 0;
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            if (avx2 && osxsave && (_xgetbv(0) & 0x6) == 0x6)
+                return dsp::SimdLevel::AVX2;
+        }
+        return dsp::SimdLevel::SSE;
+#else
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return dsp::SimdLevel::AVX2;
+        if (__builtin_cpu_supports("sse"))
+            return dsp::SimdLevel::SSE;
+        return dsp::SimdLevel::Scalar;
+#endif
+    }
+#else
+    dsp::SimdLevel detectSimdLevel() {
+        return dsp::SimdLevel::Scalar;
+    }
+#endif
+}
+
+namespace dsp {
+    SimdLevel simdLevel() {
+        static const SimdLevel level = detectSimdLevel();
+        return level;
+    }
+
+    const char* simdLevelName(SimdLevel level) {
+        switch (level) {
+            case SimdLevel::AVX2:
+                return "AVX2";
+            case SimdLevel::SSE:
+                return "SSE";
+            default:
+                return "Scalar";
+        }
+    }
+
+    GainKernel gainKernel(int inchannels, int outchannels, SimdLevel level) {
+        if (inchannels != outchannels)
+            return gainScalar;
+
+#ifdef DSP_X86
+        switch (level) {
+            case SimdLevel::AVX2:
+                return gainFlatAVX2;
+            case SimdLevel::SSE:
+                return gainFlatSSE;
+            default:
+                break;
+        }
+#endif
+        return gainFlatScalar;
+    }
+
+    RampKernel rampKernel(int inchannels, int outchannels, SimdLevel level) {
+        // Layouts wider than 8 channels would need more than 8 vectors per unit
+        if (inchannels != outchannels || outchannels > 8)
+            return rampScalar;
+
+#ifdef DSP_X86
+        switch (level) {
+            case SimdLevel::AVX2:
+                return rampFlatAVX2;
+            case SimdLevel::SSE:
+                return rampFlatSSE;
+            default:
+                break;
+        }
+#endif
+        return rampFlatScalar;
+    }
+}
+
+FMOD_RESULT F_CALLBACK DSPCreateCallback(FMOD_DSP_STATE* dsp_state) {
+    auto thisdsp = (FMOD::DSP *)dsp_state->instance;
+
+    void* ud;
+    thisdsp->getUserData(&ud);
+
+    // A new instance starts at the current target instead of ramping up from silence
+    auto dud = static_cast<DSPUserdata*>(ud);
+    dsp_state->plugindata = new DSPGainState{ dud ? dud->volume.load(std::memory_order_relaxed) : 1.0f };
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK DSPReleaseCallback(FMOD_DSP_STATE* dsp_state) {
+    delete static_cast<DSPGainState*>(dsp_state->plugindata);
+    dsp_state->plugindata = nullptr;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK DSPCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels) {
+    auto thisdsp = (FMOD::DSP *)dsp_state->instance;
+
+    void* ud;
+    thisdsp->getUserData(&ud);
+
+    auto dud = static_cast<DSPUserdata*>(ud);
+    auto state = static_cast<DSPGainState*>(dsp_state->plugindata);
+
+    // Read everything through the pointers once, the kernels work on locals only
+    int channels = *outchannels;
+    float from = state->current;
+    float to = dud->volume.load(std::memory_order_relaxed);
+
+    // The only branch is per block: a new target ramps over this block, otherwise plain gain
+    if (from == to) {
+        dsp::gainKernel(inchannels, channels)(inbuffer, outbuffer, length, inchannels, channels, to);
+    } else {
+        dsp::rampKernel(inchannels, channels)(inbuffer, outbuffer, length, inchannels, channels, from, to);
+        state->current = to;
+    }
+
+    return FMOD_OK;
+}
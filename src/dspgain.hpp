@@ -0,0 +1,42 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <atomic>
+
+/// @brief Gain target shared by the game thread and every custom DSP created with it as userdata
+/// The game thread only publishes the target, each instance ramps towards it across one block
+struct DSPUserdata {
+    std::atomic<float> volume;
+
+    explicit DSPUserdata(float volume) : volume{volume} {}
+};
+
+/// @brief Per instance ramp state, the DSP's plugindata, so instances on different buses glide on their own
+struct DSPGainState {
+    float current; // mixer thread only
+};
+
+namespace dsp {
+    enum class SimdLevel { Scalar, SSE, AVX2 };
+
+    using GainKernel = void (*)(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels, float gain);
+    using RampKernel = void (*)(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels, float from, float to);
+
+    /// @brief Highest instruction set supported by the running CPU, detected once
+    SimdLevel simdLevel();
+    const char* simdLevelName(SimdLevel level);
+
+    /// @brief Pick a gain kernel for the channel layout
+    /// in == out (mono, stereo, 5.1, 7.1, ...) is a contiguous block and uses the vectorized path,
+    /// mismatched layouts fall back to the strided scalar loop
+    GainKernel gainKernel(int inchannels, int outchannels, SimdLevel level = simdLevel());
+
+    /// @brief Pick a kernel that ramps the gain linearly over the block, reaching 'to' on the last sample
+    RampKernel rampKernel(int inchannels, int outchannels, SimdLevel level = simdLevel());
+}
+
+/// @brief create and release callbacks of the custom DSP, they own its DSPGainState
+FMOD_RESULT F_CALLBACK DSPCreateCallback(FMOD_DSP_STATE* dsp_state);
+FMOD_RESULT F_CALLBACK DSPReleaseCallback(FMOD_DSP_STATE* dsp_state);
+FMOD_RESULT F_CALLBACK DSPCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels);
@@ -0,0 +1,237 @@
+#include "effectchain.hpp"
+#include "fmoderror.hpp"
+
+namespace {
+    const std::unordered_map<std::string, FMOD_DSP_TYPE> dspTypes{
+        { "oscillator", FMOD_DSP_TYPE_OSCILLATOR },
+        { "lowpass", FMOD_DSP_TYPE_LOWPASS },
+        { "itlowpass", FMOD_DSP_TYPE_ITLOWPASS },
+        { "highpass", FMOD_DSP_TYPE_HIGHPASS },
+        { "echo", FMOD_DSP_TYPE_ECHO },
+        { "fader", FMOD_DSP_TYPE_FADER },
+        { "flange", FMOD_DSP_TYPE_FLANGE },
+        { "distortion", FMOD_DSP_TYPE_DISTORTION },
+        { "normalize", FMOD_DSP_TYPE_NORMALIZE },
+        { "limiter", FMOD_DSP_TYPE_LIMITER },
+        { "parameq", FMOD_DSP_TYPE_PARAMEQ },
+        { "pitchshift", FMOD_DSP_TYPE_PITCHSHIFT },
+        { "chorus", FMOD_DSP_TYPE_CHORUS },
+        { "itecho", FMOD_DSP_TYPE_ITECHO },
+        { "compressor", FMOD_DSP_TYPE_COMPRESSOR },
+        { "sfxreverb", FMOD_DSP_TYPE_SFXREVERB },
+        { "lowpass_simple", FMOD_DSP_TYPE_LOWPASS_SIMPLE },
+        { "delay", FMOD_DSP_TYPE_DELAY },
+        { "tremolo", FMOD_DSP_TYPE_TREMOLO },
+        { "highpass_simple", FMOD_DSP_TYPE_HIGHPASS_SIMPLE },
+        { "pan", FMOD_DSP_TYPE_PAN },
+        { "three_eq", FMOD_DSP_TYPE_THREE_EQ },
+        { "fft", FMOD_DSP_TYPE_FFT },
+        { "loudness_meter", FMOD_DSP_TYPE_LOUDNESS_METER },
+        { "convolutionreverb", FMOD_DSP_TYPE_CONVOLUTIONREVERB },
+        { "channelmix", FMOD_DSP_TYPE_CHANNELMIX },
+        { "multiband_eq", FMOD_DSP_TYPE_MULTIBAND_EQ },
+    };
+
+    // "Center Freq" -> "centerfreq"
+    std::string normalise(const char* name) {
+        std::string result;
+        for (; *name; name++) {
+            if (std::isalnum(static_cast<unsigned char>(*name)))
+                result += static_cast<char>(std::tolower(static_cast<unsigned char>(*name)));
+        }
+        return result;
+    }
+
+    bool setParameter(FMOD::DSP* dsp, const EffectChainDesc::Parameter& parameter) {
+        int count = 0;
+        dsp->getNumParameters(&count);
+
+        int index = -1;
+        FMOD_DSP_PARAMETER_DESC* desc = nullptr;
+        for (int i = 0; i < count && index < 0; i++) {
+            dsp->getParameterInfo(i, &desc);
+            if (normalise(desc->name) == parameter.name || std::to_string(i) == parameter.name)
+                index = i;
+        }
+
+        if (index < 0) {
+            std::cerr << "Unknown DSP parameter " << parameter.name << std::endl;
+            return false;
+        }
+
+        FMOD_RESULT result;
+        switch (desc->type) {
+            case FMOD_DSP_PARAMETER_TYPE_FLOAT:
+                result = dsp->setParameterFloat(index, parameter.value);
+                break;
+            case FMOD_DSP_PARAMETER_TYPE_INT:
+                result = dsp->setParameterInt(index, static_cast<int>(parameter.value));
+                break;
+            case FMOD_DSP_PARAMETER_TYPE_BOOL:
+                result = dsp->setParameterBool(index, parameter.value != 0.0f);
+                break;
+            default:
+                result = FMOD_ERR_INVALID_PARAM;
+                break;
+        }
+        FMOD_ERROR(result);
+        return true;
+    }
+}
+
+std::optional<EffectChainDesc> EffectChainDesc::load(const std::string& path) {
+    std::ifstream file{ path };
+    if (!file) {
+        std::cerr << "Failed to open effect chain " << path << std::endl;
+        return std::nullopt;
+    }
+    return parse(file, path);
+}
+
+std::optional<EffectChainDesc> EffectChainDesc::parse(std::istream& stream, const std::string& source) {
+    EffectChainDesc desc;
+
+    std::string line;
+    for (int number = 1; std::getline(stream, line); number++) {
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream words{ line };
+        Effect effect;
+        if (!(words >> effect.name))
+            continue;
+        if (!(words >> effect.type)) {
+            std::cerr << source << ":" << number << ": missing effect type" << std::endl;
+            return std::nullopt;
+        }
+
+        std::string word;
+        while (words >> word) {
+            if (word == "on") {
+                effect.enabled = true;
+                continue;
+            }
+
+            auto equals = word.find('=');
+            if (equals == std::string::npos) {
+                std::cerr << source << ":" << number << ": expected parameter=value, got " << word << std::endl;
+                return std::nullopt;
+            }
+
+            Parameter parameter;
+            parameter.name = word.substr(0, equals);
+            parameter.value = std::strtof(word.c_str() + equals + 1, nullptr);
+            effect.parameters.push_back(parameter);
+        }
+
+        desc.effects.push_back(effect);
+    }
+
+    return desc;
+}
+
+EffectChain::EffectChain(FMOD::System* system, const EffectChainDesc& desc, const Factory& factory) {
+    for (const auto& effect : desc.effects) {
+        FMOD::DSP* dsp = nullptr;
+
+        auto type = dspTypes.find(effect.type);
+        if (type != dspTypes.end()) {
+            auto result = system->createDSPByType(type->second, &dsp);
+            if (result != FMOD_OK)
+                dsp = nullptr;
+        } else if (factory) {
+            dsp = factory(effect.type);
+        }
+
+        if (!dsp) {
+            std::cerr << "Failed to create effect " << effect.name << " of type " << effect.type << std::endl;
+            continue;
+        }
+
+        for (const auto& parameter : effect.parameters) {
+            setParameter(dsp, parameter);
+        }
+        dsp->setBypass(!effect.enabled);
+
+        effects.push_back({ effect.name, dsp, effect.enabled });
+    }
+}
+
+EffectChain::~EffectChain() {
+    detach();
+    for (auto& effect : effects) {
+        effect.dsp->release();
+    }
+}
+
+bool EffectChain::attach(FMOD::ChannelControl* target) {
+    detach();
+
+    // Each insert at the head pushes the previous effects further up the signal path
+    for (auto& effect : effects) {
+        auto result = target->addDSP(0, effect.dsp);
+        FMOD_ERROR(result);
+    }
+
+    control = target;
+    return true;
+}
+
+void EffectChain::detach() {
+    if (!control)
+        return;
+
+    // A channel that stopped has already dropped its DSPs, the handle is just stale then
+    for (auto& effect : effects) {
+        control->removeDSP(effect.dsp);
+    }
+    control = nullptr;
+}
+
+bool EffectChain::setEnabled(const std::string& name, bool enabled) {
+    auto effect = find(name);
+    if (!effect)
+        return false;
+
+    if (effect->enabled != enabled) {
+        auto result = effect->dsp->setBypass(!enabled);
+        FMOD_ERROR(result);
+        effect->enabled = enabled;
+    }
+    return true;
+}
+
+bool EffectChain::toggle(const std::string& name) {
+    return setEnabled(name, !isEnabled(name));
+}
+
+bool EffectChain::isEnabled(const std::string& name) const {
+    auto effect = find(name);
+    return effect && effect->enabled;
+}
+
+FMOD::DSP* EffectChain::get(const std::string& name) const {
+    auto effect = find(name);
+    return effect ? effect->dsp : nullptr;
+}
+
+std::vector<FMOD::DSP*> EffectChain::getDSPs() const {
+    std::vector<FMOD::DSP*> dsps;
+    dsps.reserve(effects.size());
+    for (const auto& effect : effects) {
+        dsps.push_back(effect.dsp);
+    }
+    return dsps;
+}
+
+EffectChain::Effect* EffectChain::find(const std::string& name) {
+    // A handful of effects, a linear scan beats hashing
+    for (auto& effect : effects) {
+        if (effect.name == name)
+            return &effect;
+    }
+    return nullptr;
+}
+
+const EffectChain::Effect* EffectChain::find(const std::string& name) const {
+    return const_cast<EffectChain*>(this)->find(name);
+}
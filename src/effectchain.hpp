@@ -0,0 +1,67 @@
+#pragma once
+
+#include <fmod.hpp>
+
+/// @brief Effect chain as read from a .chain file, one effect per line in signal order:
+///   <name> <type> [parameter=value ...] [on]
+/// Types are FMOD's built in DSP types in lower case (lowpass, echo, pitchshift, ...) or
+/// anything the factory passed to EffectChain knows. Parameters are named as FMOD names
+/// them, lower case without spaces (echo delay=50, parameq frequencygain=0), or by index.
+/// '#' starts a comment.
+struct EffectChainDesc {
+    struct Parameter {
+        std::string name;
+        float value;
+    };
+
+    struct Effect {
+        std::string name;
+        std::string type;
+        std::vector<Parameter> parameters;
+        bool enabled{ false };
+    };
+
+    std::vector<Effect> effects;
+
+    static std::optional<EffectChainDesc> load(const std::string& path);
+    static std::optional<EffectChainDesc> parse(std::istream& stream, const std::string& source);
+};
+
+/// @brief One instance of a chain description: every DSP is created and inserted once, in order,
+/// and toggled with setBypass so enabling or disabling an effect never changes the DSP graph.
+/// Instantiate the same description as often as needed, an instance follows a single channel or group.
+class EffectChain {
+public:
+    /// @brief Creates the DSP for a type FMOD does not have, nullptr if unknown
+    using Factory = std::function<FMOD::DSP*(const std::string& type)>;
+
+    EffectChain(FMOD::System* system, const EffectChainDesc& desc, const Factory& factory = {});
+    ~EffectChain();
+
+    EffectChain(const EffectChain&) = delete;
+    EffectChain& operator=(const EffectChain&) = delete;
+
+    /// @brief Insert the chain after the fader of a channel or group, moving it off the previous one
+    bool attach(FMOD::ChannelControl* control);
+    void detach();
+
+    bool setEnabled(const std::string& name, bool enabled);
+    bool toggle(const std::string& name);
+    bool isEnabled(const std::string& name) const;
+
+    FMOD::DSP* get(const std::string& name) const;
+    std::vector<FMOD::DSP*> getDSPs() const;
+
+private:
+    struct Effect {
+        std::string name;
+        FMOD::DSP* dsp;
+        bool enabled;
+    };
+
+    std::vector<Effect> effects;
+    FMOD::ChannelControl* control{ nullptr };
+
+    Effect* find(const std::string& name);
+    const Effect* find(const std::string& name) const;
+};
@@ -0,0 +1,82 @@
+#include "fft.hpp"
+
+#include <cmath>
+#include <utility>
+
+namespace dsp {
+    FFT::FFT(size_t size) : size{size}, reversed(size), cosines(size > 1 ? size - 1 : 1), sines(size > 1 ? size - 1 : 1) {
+        int bits = 0;
+        while ((size_t{ 1 } << bits) < size) {
+            bits++;
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            uint32_t r = 0;
+            for (int b = 0; b < bits; b++) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            reversed[i] = r;
+        }
+
+        // Stage of span 2 * half keeps its half twiddles contiguous from half - 1
+        for (size_t half = 1; half < size; half *= 2) {
+            for (size_t k = 0; k < half; k++) {
+                double angle = M_PI * static_cast<double>(k) / static_cast<double>(half);
+                cosines[half - 1 + k] = static_cast<float>(std::cos(angle));
+                sines[half - 1 + k] = static_cast<float>(std::sin(angle));
+            }
+        }
+    }
+
+    void FFT::forward(float* re, float* im) const {
+        transform(re, im, -1.0f);
+    }
+
+    void FFT::inverse(float* re, float* im) const {
+        transform(re, im, 1.0f);
+
+        float scale = 1.0f / static_cast<float>(size);
+        for (size_t i = 0; i < size; i++) {
+            re[i] *= scale;
+            im[i] *= scale;
+        }
+    }
+
+    void FFT::transform(float* re, float* im, float sign) const {
+        for (size_t i = 0; i < size; i++) {
+            size_t j = reversed[i];
+            if (j > i) {
+                std::swap(re[i], re[j]);
+                std::swap(im[i], im[j]);
+            }
+        }
+
+        for (size_t half = 1; half < size; half *= 2) {
+            const float* wre = cosines.data() + half - 1;
+            const float* wim = sines.data() + half - 1;
+            for (size_t start = 0; start < size; start += half * 2) {
+                float* are = re + start;
+                float* aim = im + start;
+                float* bre = are + half;
+                float* bim = aim + half;
+                for (size_t k = 0; k < half; k++) {
+                    float wr = wre[k];
+                    float wi = sign * wim[k];
+                    float tr = bre[k] * wr - bim[k] * wi;
+                    float ti = bre[k] * wi + bim[k] * wr;
+                    bre[k] = are[k] - tr;
+                    bim[k] = aim[k] - ti;
+                    are[k] += tr;
+                    aim[k] += ti;
+                }
+            }
+        }
+    }
+
+    void complexMultiplyAccumulate(const float* are, const float* aim, const float* bre, const float* bim, float* accre, float* accim, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            accre[i] += are[i] * bre[i] - aim[i] * bim[i];
+            accim[i] += are[i] * bim[i] + aim[i] * bre[i];
+        }
+    }
+}
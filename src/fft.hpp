@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dsp {
+    /// @brief In place radix-2 complex FFT on split real and imaginary arrays
+    /// Split arrays keep the butterflies and the spectral multiply-accumulate of callers in plain
+    /// float loops the compiler vectorizes. Tables are built once per size, transforms never allocate.
+    class FFT {
+    public:
+        explicit FFT(size_t size); // power of two
+
+        void forward(float* re, float* im) const;
+        /// @brief Inverse transform including the 1 / size scale
+        void inverse(float* re, float* im) const;
+
+        size_t getSize() const { return size; }
+
+    private:
+        size_t size;
+        std::vector<uint32_t> reversed; // bit reversed index
+        std::vector<float> cosines; // twiddles of every stage back to back, unit stride for the vectorizer
+        std::vector<float> sines;
+
+        void transform(float* re, float* im, float sign) const;
+    };
+
+    /// @brief acc += a * b over split complex arrays
+    void complexMultiplyAccumulate(const float* are, const float* aim, const float* bre, const float* bim, float* accre, float* accim, size_t count);
+}
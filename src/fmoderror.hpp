@@ -0,0 +1,7 @@
+#pragma once
+
+#include <fmod_errors.h>
+
+#define FMOD_ERROR_RETURN(result, value) if (result != FMOD_OK) { std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << FMOD_ErrorString(result) << std::endl; return value; }
+#define FMOD_ERROR_(result) if (result != FMOD_OK) { std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << FMOD_ErrorString(result) << std::endl; return; }
+#define FMOD_ERROR(result) if (result != FMOD_OK) { std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << FMOD_ErrorString(result) << std::endl; return false; }
@@ -3,6 +3,12 @@
 #include "components.hpp"
 #include "texture.hpp"
 #include "geometry.hpp"
+#include "headless.hpp"
+#include "replay.hpp"
+
+namespace {
+    constexpr float TruckIdleRate = 5.0f; // grains per second, about one grain length apart
+}
 
 // Constructor
 Game::Game() : window{ "OpenGL Template", { 1280, 720 }} {
@@ -32,11 +38,19 @@ void Game::init() {
     glm::vec3 cubePosition{ 0.0f, 5.0f, 0.0f };
 
     // Initialise audio and play background music
+    // Both decode on FMOD's async thread while the shaders and textures below load, the callbacks run from the first updates
     //audio.loadEventSound("resources/audio/Horse.wav");
-    audio.loadSound("resources/audio/Monkeys-Spinning-Monkeys.mp3");
-    audio.playSound(cubePosition);
-    audio.loadMusicStream("resources/audio/fsm-team-escp-paradox.wav");
-    audio.playMusicStream();
+    if (std::filesystem::exists("resources/audio.bank"))
+        audio.mountBank("resources/audio.bank");
+    audio.loadSoundAsync("resources/audio/Monkeys-Spinning-Monkeys.mp3", [this, cubePosition](const SoundRef& sound) {
+        auto& emitter = registry.get<AudioEmitterComponent>(cube);
+        emitter.voice = audio.playSound(sound, cubePosition, 1.0f, VoicePool::DefaultPriority, true);
+        emitter.dirty = true;
+    });
+    audio.loadMusicStreamAsync("resources/audio/fsm-team-escp-paradox.wav", [this](const SoundRef& sound) {
+        if (sound)
+            audio.playMusicStream();
+    });
 
     mainShader = std::make_unique<Shader>();
     mainShader->link("resources/shaders/mainShader.vert", "resources/shaders/mainShader.frag");
@@ -75,12 +89,71 @@ void Game::init() {
     registry.emplace<TransformComponent>(entity, glm::vec3{0.0f, 0.0f, -10.0f}, glm::quat{1, 0, 0, 0}, scale);
     registry.emplace<MeshComponent>(entity, geometry::cuboid({ 1.0f, 1.0f, 1.0f }, false, std::make_shared<Texture>("resources/textures/Dirt.png", true, false, glm::vec3{10, 1, 1})));
 
-    audio.createGeometry(scale, glm::vec3{0.0f, 0.0f, -10.0f}, glm::quat{1, 0, 0, 0});
+    registry.emplace<AudioOccluderComponent>(entity);
 
     cube = registry.create();
     registry.emplace<TransformComponent>(cube, cubePosition);
+    registry.emplace<AudioEmitterComponent>(cube);
     registry.emplace<MeshComponent>(cube, geometry::cuboid({ 1.0f, 1.0f, 1.0f }, false, std::make_shared<Texture>(200, 0, 200)));
 
+    // Reverb zones either side of the wall, the responses are built once in the cache and shared
+    entity = registry.create();
+    registry.emplace<TransformComponent>(entity, glm::vec3{ 0.0f, 5.0f, 10.0f });
+    registry.emplace<ReverbZoneComponent>(entity, audio.getImpulseResponses().generate("room", 0.8f), glm::vec3{ 25.0f, 10.0f, 20.0f }, 4.0f);
+
+    entity = registry.create();
+    registry.emplace<TransformComponent>(entity, glm::vec3{ 0.0f, 5.0f, -40.0f });
+    registry.emplace<ReverbZoneComponent>(entity, audio.getImpulseResponses().generate("hall", 2.5f), glm::vec3{ 25.0f, 10.0f, 30.0f }, 4.0f);
+
+    // Generator hum behind the wall, a saw with a breath of noise, rendered instead of loaded
+    SynthPatch hum;
+    hum.waveform = dsp::Waveform::Saw;
+    if (auto synth = audio.createSynth(hum)) {
+        generator = registry.create();
+        registry.emplace<TransformComponent>(generator, glm::vec3{ 15.0f, 1.0f, -20.0f }, glm::quat{ 1, 0, 0, 0 }, glm::vec3{ 2.0f });
+        registry.emplace<AudioEmitterComponent>(generator);
+        registry.emplace<SynthComponent>(generator, synth, VoiceHandle{}, nullptr, 55.0f, 0.6f, 0.15f, 900.0f, 0.4f);
+        registry.emplace<MeshComponent>(generator, geometry::cuboid({ 1.0f, 1.0f, 1.0f }, false, std::make_shared<Texture>(200, 120, 0)));
+    }
+
+    // Overlay toggles click, a one shot envelope on the ui bus
+    SynthPatch click;
+    click.waveform = dsp::Waveform::Square;
+    click.frequency = 1200.0f;
+    click.cutoff = 4000.0f;
+    click.amplitude = 0.2f;
+    click.spatial = false;
+    click.gated = true;
+    click.decay = 0.04f;
+    if (auto synth = audio.createSynth(click)) {
+        uiClick = registry.create();
+        registry.emplace<TransformComponent>(uiClick);
+        registry.emplace<SynthComponent>(uiClick, synth, VoiceHandle{}, audio.getMixer().getGroup("sfx/ui"), 1200.0f, 1.0f, 0.0f, 4000.0f, 0.2f);
+    }
+
+    // Idling truck stitched from six short grains like FMOD's granular example, varied on every trigger
+    VariationSet idle;
+    idle.pitch = 0.5f;
+    idle.gain = 2.0f;
+    for (int i = 1; i <= 6; i++) {
+        auto sample = audio.loadVariationSample("external/fmodstudioapi/core/examples/media/granular/truck_idle_off_0" + std::to_string(i) + ".wav");
+        if (sample != UINT32_MAX)
+            idle.samples.push_back(sample);
+    }
+    glm::vec3 truckPosition{ -15.0f, 1.0f, -20.0f };
+    if (auto engine = audio.createVariations(idle, truckPosition)) {
+        truck = registry.create();
+        registry.emplace<TransformComponent>(truck, truckPosition, glm::quat{ 1, 0, 0, 0 }, glm::vec3{ 3.0f, 2.0f, 2.0f });
+        registry.emplace<VariationComponent>(truck, engine, TruckIdleRate);
+        registry.emplace<MeshComponent>(truck, geometry::cuboid({ 1.0f, 1.0f, 1.0f }, false, std::make_shared<Texture>(60, 90, 160)));
+    }
+
+    // Radio the microphone loopback plays from, silent until capture starts
+    radio = registry.create();
+    registry.emplace<TransformComponent>(radio, glm::vec3{ 5.0f, 0.5f, 5.0f }, glm::quat{ 1, 0, 0, 0 }, glm::vec3{ 1.0f, 0.6f, 0.4f });
+    registry.emplace<AudioEmitterComponent>(radio);
+    registry.emplace<MeshComponent>(radio, geometry::cuboid({ 1.0f, 1.0f, 1.0f }, false, std::make_shared<Texture>(40, 160, 60)));
+
     //////////////////////////////////////////////////////////////
 
     // Create cubemap skybox
@@ -220,6 +293,8 @@ void Game::render() {
     textMesh->render(font, "Press 'NUM -' to decrease Filter filter value", 20, 540, 1);
 
     textMesh->render(font, "Press 'F1' to enable wiremode renderer", 20, 580, 1);
+    textMesh->render(font, "Press 'F3' to toggle audio meters", 20, 560, 1);
+    textMesh->render(font, "Press 'F4' to toggle audio profiler", 20, 480, 1);
     textMesh->render(font, "Press 'TAB' to lock mouse and use camera", 20, 600, 1);
     textMesh->render(font, "Press 'ESC' to exit", 20, 620, 1);
 
@@ -228,11 +303,29 @@ void Game::render() {
     textMesh->render(font, "Press '6' to toggle music", x, 60, 1);
     textMesh->render(font, "Press '7' to toggle 3d sound", x, 40, 1);
     textMesh->render(font, "Press '7' to toggle 3d sound", x, 40, 1);
+    textMesh->render(font, "Hold 'SPACE' to rev the truck", x, 80, 1);
+    textMesh->render(font, "Press 'V' to toggle microphone loopback", x, 100, 1);
 
     textMesh->render(font, "Time: " + std::to_string(glfwGetTime()), window.getWidth() / 2 + 150.0f, 20, 1);
 
+    if (audio.isThreaded()) {
+        auto latency = audio.getCommandLatency();
+        textMesh->render(font, "Audio cmd latency: " + std::to_string(latency.averageMs) + " ms avg, " + std::to_string(latency.maxMs) + " ms max", window.getWidth() / 2 + 150.0f, 40, 1);
+    }
+
+    if (auto capture = audio.getCapture()) {
+        auto stats = capture->getStats();
+        textMesh->render(font, "Capture: " + std::to_string(static_cast<int>(stats.level)) + " dB" + (stats.voice ? " voice" : "") + ", drift "
+                         + std::to_string(static_cast<int>(stats.driftPpm)) + " ppm, latency " + std::to_string(static_cast<int>(stats.captureLatencyMs + stats.loopbackLatencyMs)) + " ms",
+                         window.getWidth() / 2 + 150.0f, 60, 1);
+    }
+
 	// Draw the 2D graphics after the 3D graphics
 	displayFrameRate();
+    if (showMeters)
+        displayMeters();
+    if (audio.getProfiler().isVisible())
+        displayProfiler();
 }
 
 // Update method runs repeatedly with the Render method
@@ -252,9 +345,22 @@ void Game::update() {
     if (Input::GetKeyDown(GLFW_KEY_F1))
         window.toggleWireframe();
 
-    auto& transform = registry.get<TransformComponent>(cube);
+    if (Input::GetKeyDown(GLFW_KEY_F3)) {
+        showMeters = !showMeters;
+        if (registry.valid(uiClick))
+            registry.get<SynthComponent>(uiClick).trigger = true;
+    }
 
-    glm::vec3 lastPos{ transform.translation };
+    if (Input::GetKeyDown(GLFW_KEY_F4)) {
+        audio.getProfiler().setVisible(!audio.getProfiler().isVisible());
+        if (registry.valid(uiClick))
+            registry.get<SynthComponent>(uiClick).trigger = true;
+    }
+
+    if (Input::GetKeyDown(GLFW_KEY_V))
+        toggleCapture();
+
+    auto& transform = registry.get<TransformComponent>(cube);
 
     if (Input::GetKey(GLFW_KEY_UP))
         transform.translation += transform.rotation * vec3::forward * 10.0f * dt;
@@ -265,11 +371,55 @@ void Game::update() {
     if (Input::GetKey(GLFW_KEY_LEFT))
         transform.translation -= transform.rotation * vec3::right * 10.0f * dt;
 
-    audio.setSoundPositionAndVelocity(transform.translation, (transform.translation - lastPos) * dt);
+    // The generator labours as the cube gets close
+    if (registry.valid(generator)) {
+        auto& synth = registry.get<SynthComponent>(generator);
+        float distance = glm::distance(transform.translation, registry.get<TransformComponent>(generator).translation);
+        float load = std::clamp(1.0f - distance / 30.0f, 0.0f, 1.0f);
+        synth.frequency = 55.0f - 8.0f * load;
+        synth.cutoff = 900.0f + 1500.0f * load;
+    }
+
+    // Publish synth parameters, restart any synth that lost its voice
+    synths.update(registry, audio);
+
+    // Revving shortens and raises the grains, the pitch shift speeds up each one as well
+    if (registry.valid(truck)) {
+        auto& engine = registry.get<VariationComponent>(truck);
+        bool rev = Input::GetKey(GLFW_KEY_SPACE);
+        engine.pitch = rev ? 5.0f : 0.0f;
+        engine.rate = rev ? TruckIdleRate * std::exp2(5.0f / 12.0f) : TruckIdleRate;
+    }
+    variations.update(registry, dt);
+
+    // Push moved emitters to FMOD in one pass
+    audioEmitters.update(registry, audio, dt);
+
+    // Merge new occluders into the static chunks, move the dynamic ones
+    audio.getGeometry().update(registry);
+
+    // Fade the convolution reverb between the zones around the listener
+    if (audio.getReverb())
+        reverbZones.update(registry, camera.getPosition(), audio);
 
     audio.update(camera.getPosition(), camera.getPosition(), camera.getForwardVector(), camera.getUpVector());
 }
 
+void Game::toggleCapture() {
+    auto& emitter = registry.get<AudioEmitterComponent>(radio);
+    if (audio.getCapture()) {
+        audio.stopCapture();
+        emitter.voice = {};
+        return;
+    }
+
+    // The default microphone, or a stand-in voice on machines without one
+    if (!audio.startCapture() && !audio.startCapture(std::make_unique<FakeRecordDevice>(audio.getSystem())))
+        return;
+    emitter.voice = audio.playCaptureLoopback(registry.get<TransformComponent>(radio).translation);
+    emitter.dirty = true;
+}
+
 void Game::displayFrameRate() {
     // Increase the elapsed time and frame counter
     frameNumber++;
@@ -291,6 +441,72 @@ void Game::displayFrameRate() {
     }
 }
 
+void Game::displayMeters() {
+    // Text stands in for bars: '#' per 3 dB of RMS above the floor, numbers for peak and hold
+    constexpr float Step = 3.0f;
+    float x = window.getWidth() - 520.0f;
+    float y = window.getHeight() - 30.0f;
+
+    for (const auto& tap : audio.getMeters()) {
+        const auto& meter = tap->getMeter();
+        for (int channel = 0; channel < 2; channel++) {
+            char levels[64];
+            std::snprintf(levels, sizeof(levels), "%s %c %6.1f pk %6.1f hold", tap->getName().c_str(), channel == 0 ? 'L' : 'R', meter.peak[channel], meter.hold[channel]);
+            auto bars = static_cast<size_t>((meter.rms[channel] - AnalysisTap::Floor) / Step);
+            textMesh->render(font, levels, x, y, 1);
+            textMesh->render(font, std::string(bars, '#'), x + 260.0f, y, 1);
+            y -= 20.0f;
+        }
+    }
+
+    // Spectrum of the final mix as columns of '|', one row per 10 dB
+    constexpr int Rows = 8;
+    const float rowStep = -AnalysisTap::Floor / Rows;
+    for (const auto& tap : audio.getMeters()) {
+        if (!tap->hasSpectrum())
+            continue;
+
+        y -= 10.0f;
+        const auto& bands = tap->getSpectrum();
+        for (size_t band = 0; band < AnalysisTap::Bands; band++) {
+            std::string column;
+            for (int row = 0; row < Rows; row++) {
+                column += bands[band] > -rowStep * static_cast<float>(row + 1) ? '|' : ' ';
+                column += '\n';
+            }
+            textMesh->render(font, column, x + static_cast<float>(band) * 12.0f, y, 1);
+        }
+    }
+}
+
+void Game::displayProfiler() {
+    // The last sample, the profiler only reads FMOD at its own rate so this is a few strings a frame
+    const auto& sample = audio.getProfiler().getLatest();
+    float x = window.getWidth() / 3;
+    float y = window.getHeight() - 30.0f;
+    char line[128];
+
+    std::snprintf(line, sizeof(line), "Audio CPU: dsp %.1f%% stream %.1f%% geometry %.1f%% update %.1f%%", sample.cpu.dsp, sample.cpu.stream, sample.cpu.geometry, sample.cpu.update);
+    textMesh->render(font, line, x, y, 1);
+    y -= 20.0f;
+    std::snprintf(line, sizeof(line), "Channels: %d playing, %d real", sample.channels, sample.realChannels);
+    textMesh->render(font, line, x, y, 1);
+    y -= 20.0f;
+    std::snprintf(line, sizeof(line), "Memory: %d KB, %d KB peak", sample.memoryCurrent / 1024, sample.memoryPeak / 1024);
+    textMesh->render(font, line, x, y, 1);
+    y -= 20.0f;
+
+    if (sample.dsps.empty()) {
+        textMesh->render(font, "DSP timings need the profile setting", x, y, 1);
+        return;
+    }
+    for (const auto& cost : sample.dsps) {
+        std::snprintf(line, sizeof(line), "%-24s %6u us %6u us", cost.name.c_str(), cost.exclusive, cost.inclusive);
+        textMesh->render(font, line, x, y, 1);
+        y -= 20.0f;
+    }
+}
+
 // The game loop runs repeatedly until game over
 void Game::run() {
     float currentTime = static_cast<float>(glfwGetTime());
@@ -317,7 +533,30 @@ Game& Game::getInstance() {
 }
 
 int main(int args, char** argv) {
+    // No window or GL context in headless or replay mode, only the audio graph
+    for (int i = 1; i < args; i++) {
+        if (std::strcmp(argv[i], "--headless") == 0)
+            return runHeadless(args, argv);
+        if (std::strcmp(argv[i], "--replay") == 0)
+            return runReplay(args, argv);
+    }
+
     Game& game = Game::getInstance();
+
+    // --audio-thread [rate]: run FMOD updates on a fixed rate audio thread
+    for (int i = 1; i < args; i++) {
+        if (std::strcmp(argv[i], "--audio-thread") == 0) {
+            float rate = i + 1 < args ? static_cast<float>(std::atof(argv[i + 1])) : 0.0f;
+            game.audio.startThread(rate > 0.0f ? rate : 60.0f);
+        }
+        // --profile-log <file>: keep the profiler sampling into a rolling log while hidden
+        if (std::strcmp(argv[i], "--profile-log") == 0 && i + 1 < args)
+            game.audio.getProfiler().startLog(argv[++i]);
+        // --trace <file>: log the audio calls of the session for --replay
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < args)
+            game.audio.startTrace(argv[++i]);
+    }
+
     try {
         game.init();
         game.run();
@@ -8,6 +8,10 @@
 #include "camera.hpp"
 #include "shader.hpp"
 #include "audio.hpp"
+#include "audioemitters.hpp"
+#include "reverbzones.hpp"
+#include "synthsystem.hpp"
+#include "variationsystem.hpp"
 #include "mesh.hpp"
 #include "lights.hpp"
 #include "textmesh.hpp"
@@ -32,6 +36,7 @@ private:
     void run();
     void update();
     void render();
+    void toggleCapture();
 
     Window window;
     uint64_t frameNumber{ 0 };
@@ -39,11 +44,20 @@ private:
     uint32_t framesPerSecond{ 0 };
     float elapsedTime{ 0.0 };
     float dt{ 0.0 };
+    bool showMeters{ true };
 
     entt::registry registry;
     entt::entity cube;
+    entt::entity generator{ entt::null };
+    entt::entity uiClick{ entt::null };
+    entt::entity truck{ entt::null };
+    entt::entity radio{ entt::null };
 
     Audio audio;
+    AudioEmitterSystem audioEmitters;
+    ReverbZoneSystem reverbZones;
+    SynthSystem synths;
+    VariationSystem variations;
     Camera camera;
     Frustum frustum;
 
@@ -57,6 +71,8 @@ private:
     std::unique_ptr<Shader> textShader;
 
 	void displayFrameRate();
+    void displayMeters();
+    void displayProfiler();
 
     friend int ::main(int argc, char** argv);
 
@@ -0,0 +1,373 @@
+#include "geometrymanager.hpp"
+#include "components.hpp"
+#include "common.hpp"
+#include "mesh.hpp"
+#include "fmoderror.hpp"
+#include "audiotrace.hpp"
+
+namespace {
+    float largest(const glm::vec3& v) {
+        return std::max({ std::abs(v.x), std::abs(v.y), std::abs(v.z) });
+    }
+
+    // Pairs of coplanar triangles sharing an edge form a convex quad, half the polygons for FMOD to test
+    bool mergeQuad(const glm::vec3* a, const glm::vec3* b, std::array<glm::vec3, 4>& quad) {
+        int alone = -1; // vertex of a not in b
+        int shared = 0;
+        for (int i = 0; i < 3; i++) {
+            bool found = a[i] == b[0] || a[i] == b[1] || a[i] == b[2];
+            shared += found ? 1 : 0;
+            if (!found)
+                alone = i;
+        }
+        if (shared != 2)
+            return false;
+
+        glm::vec3 extra;
+        for (int i = 0; i < 3; i++) {
+            if (b[i] != a[0] && b[i] != a[1] && b[i] != a[2])
+                extra = b[i];
+        }
+
+        glm::vec3 normal = glm::cross(a[1] - a[0], a[2] - a[0]);
+        float length = glm::length(normal);
+        if (length <= 0.0f)
+            return false;
+        normal /= length;
+        if (std::abs(glm::dot(extra - a[0], normal)) > 1e-4f * (1.0f + glm::length(extra - a[0])))
+            return false;
+
+        // Keep a's winding: alone, next, extra, after next
+        quad = { a[alone], a[(alone + 1) % 3], extra, a[(alone + 2) % 3] };
+
+        for (int i = 0; i < 4; i++) {
+            glm::vec3 turn = glm::cross(quad[(i + 1) % 4] - quad[i], quad[(i + 2) % 4] - quad[(i + 1) % 4]);
+            if (glm::dot(turn, normal) <= 0.0f)
+                return false;
+        }
+        return true;
+    }
+}
+
+GeometryManager::GeometryManager(FMOD::System* system, float chunkSize) : system{system}, chunkSize{chunkSize} {
+}
+
+GeometryManager::~GeometryManager() {
+    for (auto& [key, chunk] : chunks) {
+        if (chunk.geometry)
+            chunk.geometry->release();
+    }
+    for (auto& dynamic : dynamics) {
+        if (dynamic.geometry)
+            dynamic.geometry->release();
+    }
+}
+
+uint32_t GeometryManager::addStatic(const Mesh& mesh, const glm::mat4& transform, const OcclusionMaterial& material) {
+    return addStatic(polygons(mesh, transform, material));
+}
+
+uint32_t GeometryManager::addStatic(std::vector<OccluderPolygon> polygons) {
+    uint32_t owner = nextOwner++;
+    if (trace) {
+        TraceRecord record;
+        record.op = TraceOp::AddStaticGeometry;
+        record.value = owner;
+        record.polygons = polygons;
+        trace->write(record);
+    }
+
+    for (auto& polygon : polygons) {
+        polygon.owner = owner;
+        addPolygon(polygon);
+    }
+    return owner;
+}
+
+void GeometryManager::addStaticPolygon(const glm::vec3* vertices, int count, const OcclusionMaterial& material) {
+    Polygon polygon;
+    polygon.count = std::min(count, 4);
+    polygon.material = material;
+    for (int i = 0; i < polygon.count; i++) {
+        polygon.vertices[i] = vertices[i];
+    }
+    addPolygon(polygon);
+}
+
+void GeometryManager::removeStatic(uint32_t owner) {
+    if (owner == 0)
+        return;
+
+    if (trace) {
+        TraceRecord record;
+        record.op = TraceOp::RemoveStaticGeometry;
+        record.value = owner;
+        trace->write(record);
+    }
+
+    for (auto& [key, chunk] : chunks) {
+        auto removed = std::remove_if(chunk.polygons.begin(), chunk.polygons.end(), [owner](const Polygon& polygon) { return polygon.owner == owner; });
+        if (removed == chunk.polygons.end())
+            continue;
+
+        polygonCount -= static_cast<size_t>(chunk.polygons.end() - removed);
+        chunk.polygons.erase(removed, chunk.polygons.end());
+        chunk.dirty = true;
+        dirty = true;
+    }
+}
+
+void GeometryManager::addPolygon(const Polygon& polygon) {
+    glm::vec3 centre{ 0.0f };
+    for (int i = 0; i < polygon.count; i++) {
+        centre += polygon.vertices[i];
+        extent = std::max(extent, largest(polygon.vertices[i]));
+    }
+    centre /= static_cast<float>(polygon.count);
+
+    auto& chunk = chunks[chunkKey(centre)];
+    chunk.polygons.push_back(polygon);
+    chunk.dirty = true;
+    dirty = true;
+    polygonCount++;
+}
+
+uint32_t GeometryManager::addDynamic(const Mesh& mesh, const OcclusionMaterial& material) {
+    return addDynamic(polygons(mesh, glm::mat4{ 1.0f }, material));
+}
+
+uint32_t GeometryManager::addDynamic(const std::vector<OccluderPolygon>& local) {
+    Dynamic dynamic;
+    dynamic.geometry = createGeometry(local);
+    if (!dynamic.geometry)
+        return UINT32_MAX;
+
+    for (const auto& polygon : local) {
+        for (int i = 0; i < polygon.count; i++) {
+            dynamic.radius = std::max(dynamic.radius, glm::length(polygon.vertices[i]));
+        }
+    }
+
+    uint32_t id;
+    if (!freeDynamics.empty()) {
+        id = freeDynamics.back();
+        freeDynamics.pop_back();
+        dynamics[id] = dynamic;
+    } else {
+        id = static_cast<uint32_t>(dynamics.size());
+        dynamics.push_back(dynamic);
+    }
+
+    if (trace) {
+        TraceRecord record;
+        record.op = TraceOp::AddDynamicGeometry;
+        record.value = id;
+        record.polygons = local;
+        trace->write(record);
+    }
+    return id;
+}
+
+void GeometryManager::setTransform(uint32_t id, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+    if (id >= dynamics.size() || !dynamics[id].geometry)
+        return;
+
+    auto& dynamic = dynamics[id];
+    // Only moves are logged, update() sets every dynamic's transform each frame
+    if (trace && (translation != dynamic.translation || rotation != dynamic.rotation || scale != dynamic.scale)) {
+        TraceRecord record;
+        record.op = TraceOp::SetGeometryTransform;
+        record.value = id;
+        record.vectors[0] = translation;
+        record.vectors[1] = scale;
+        record.rotation = rotation;
+        trace->write(record);
+    }
+    if (translation != dynamic.translation) {
+        dynamic.geometry->setPosition(glm::fmod_vector(translation));
+        dynamic.translation = translation;
+    }
+    if (rotation != dynamic.rotation) {
+        dynamic.geometry->setRotation(glm::fmod_vector(rotation * vec3::forward), glm::fmod_vector(rotation * vec3::up));
+        dynamic.rotation = rotation;
+    }
+    if (scale != dynamic.scale) {
+        dynamic.geometry->setScale(glm::fmod_vector(scale));
+        dynamic.scale = scale;
+    }
+
+    extent = std::max(extent, largest(translation) + dynamic.radius * largest(scale));
+}
+
+void GeometryManager::removeDynamic(uint32_t id) {
+    if (id >= dynamics.size() || !dynamics[id].geometry)
+        return;
+
+    if (trace) {
+        TraceRecord record;
+        record.op = TraceOp::RemoveDynamicGeometry;
+        record.value = id;
+        trace->write(record);
+    }
+
+    dynamics[id].geometry->release();
+    dynamics[id] = {};
+    freeDynamics.push_back(id);
+}
+
+void GeometryManager::update(entt::registry& registry) {
+    // Occluders whose entity or component went away, a component added again is not registered yet
+    for (auto it = occluders.begin(); it != occluders.end();) {
+        auto component = registry.valid(it->first) ? registry.try_get<AudioOccluderComponent>(it->first) : nullptr;
+        if (component && component->registered) {
+            ++it;
+            continue;
+        }
+        if (it->second.dynamic)
+            removeDynamic(it->second.id);
+        else
+            removeStatic(it->second.id);
+        it = occluders.erase(it);
+    }
+
+    auto view = registry.view<AudioOccluderComponent, MeshComponent, TransformComponent>();
+    for (auto entity : view) {
+        auto [occluder, mesh, transform] = view.get<AudioOccluderComponent, MeshComponent, TransformComponent>(entity);
+
+        if (!occluder.registered) {
+            if (occluder.dynamic)
+                occluder.geometry = addDynamic(*mesh(), occluder.material);
+            else
+                occluder.geometry = addStatic(*mesh(), transform, occluder.material);
+            occluder.registered = true;
+            occluders[entity] = { occluder.dynamic, occluder.geometry };
+        }
+
+        if (occluder.dynamic)
+            setTransform(occluder.geometry, transform.translation, transform.rotation, transform.scale);
+    }
+
+    commit();
+}
+
+bool GeometryManager::commit() {
+    // FMOD partitions polygons within the world size, growing it re-sorts everything so do it before the rebuild
+    if (extent > worldSize) {
+        float size = std::max(worldSize, 256.0f);
+        while (size < extent) {
+            size *= 2.0f;
+        }
+        auto result = system->setGeometrySettings(size);
+        FMOD_ERROR(result);
+        worldSize = size;
+    }
+
+    if (!dirty)
+        return true;
+
+    for (auto it = chunks.begin(); it != chunks.end();) {
+        auto& chunk = it->second;
+        if (!chunk.dirty) {
+            ++it;
+            continue;
+        }
+
+        if (chunk.geometry)
+            chunk.geometry->release();
+        // Emptied by removeStatic, FMOD has no use for a geometry without polygons
+        if (chunk.polygons.empty()) {
+            it = chunks.erase(it);
+            continue;
+        }
+        chunk.geometry = createGeometry(chunk.polygons);
+        if (chunk.geometry && !staticActive)
+            chunk.geometry->setActive(false);
+        chunk.dirty = false;
+        ++it;
+    }
+    dirty = false;
+    version++;
+
+    return true;
+}
+
+void GeometryManager::setStaticActive(bool value) {
+    staticActive = value;
+    for (auto& [key, chunk] : chunks) {
+        if (chunk.geometry)
+            chunk.geometry->setActive(staticActive);
+    }
+}
+
+FMOD::Geometry* GeometryManager::createGeometry(const std::vector<Polygon>& polygons) {
+    int vertexCount = 0;
+    for (const auto& polygon : polygons) {
+        vertexCount += polygon.count;
+    }
+
+    FMOD::Geometry* geometry;
+    auto result = system->createGeometry(static_cast<int>(polygons.size()), vertexCount, &geometry);
+    FMOD_ERROR_RETURN(result, nullptr);
+
+    for (const auto& polygon : polygons) {
+        int index;
+        result = geometry->addPolygon(polygon.material.direct, polygon.material.reverb, polygon.material.doubleSided,
+                                      polygon.count, reinterpret_cast<const FMOD_VECTOR*>(polygon.vertices.data()), &index);
+        if (result != FMOD_OK)
+            geometry->release();
+        FMOD_ERROR_RETURN(result, nullptr);
+    }
+
+    return geometry;
+}
+
+uint64_t GeometryManager::chunkKey(const glm::vec3& position) const {
+    // 21 bits per axis, plenty of chunks either side of the origin
+    glm::ivec3 cell{ glm::floor(position / chunkSize) };
+    auto bits = [](int value) { return static_cast<uint64_t>(value + (1 << 20)) & 0x1fffff; };
+    return bits(cell.x) | (bits(cell.y) << 21) | (bits(cell.z) << 42);
+}
+
+std::vector<GeometryManager::Polygon> GeometryManager::polygons(const Mesh& mesh, const glm::mat4& transform, const OcclusionMaterial& material) {
+    const auto& vertices = mesh.getVertices();
+    const auto& indices = mesh.getIndices();
+    size_t count = indices.empty() ? vertices.size() : indices.size();
+    auto position = [&](size_t i) {
+        return glm::vec3{ transform * glm::vec4{ vertices[indices.empty() ? i : indices[i]].position, 1.0f } };
+    };
+
+    // Flatten to a triangle list, other primitive types do not occlude
+    std::vector<glm::vec3> triangles;
+    if (mesh.getMode() == GL_TRIANGLES) {
+        for (size_t i = 0; i + 2 < count; i += 3) {
+            triangles.insert(triangles.end(), { position(i), position(i + 1), position(i + 2) });
+        }
+    } else if (mesh.getMode() == GL_TRIANGLE_STRIP) {
+        for (size_t i = 0; i + 2 < count; i++) {
+            if (i % 2 == 0)
+                triangles.insert(triangles.end(), { position(i), position(i + 1), position(i + 2) });
+            else
+                triangles.insert(triangles.end(), { position(i + 1), position(i), position(i + 2) });
+        }
+    }
+
+    std::vector<Polygon> result;
+    size_t triangleCount = triangles.size() / 3;
+    for (size_t i = 0; i < triangleCount; i++) {
+        const glm::vec3* a = &triangles[i * 3];
+        if (glm::length2(glm::cross(a[1] - a[0], a[2] - a[0])) <= 0.0f)
+            continue; // degenerate, strips are full of them
+
+        Polygon polygon;
+        polygon.material = material;
+        if (i + 1 < triangleCount && mergeQuad(a, &triangles[(i + 1) * 3], polygon.vertices)) {
+            polygon.count = 4;
+            i++;
+        } else {
+            polygon.vertices = { a[0], a[1], a[2], a[2] };
+            polygon.count = 3;
+        }
+        result.push_back(polygon);
+    }
+    return result;
+}
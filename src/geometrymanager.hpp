@@ -0,0 +1,127 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <entt/entity/registry.hpp>
+
+class Mesh;
+class AudioTrace;
+
+struct OcclusionMaterial {
+    float direct{ 1.0f };
+    float reverb{ 1.0f };
+    bool doubleSided{ true };
+};
+
+/// @brief Up to four coplanar vertices, triangles repeat their last one
+struct OccluderPolygon {
+    std::array<glm::vec3, 4> vertices;
+    int count;
+    OcclusionMaterial material;
+    uint32_t owner{ 0 }; // addStatic call it came from, 0 for loose polygons
+};
+
+/// @brief Owns the FMOD occlusion geometry of the scene
+/// Static polygons are bucketed by position into chunks, each chunk is one FMOD::Geometry, so thousands
+/// of walls become a handful of objects for FMOD's raycasts. Coplanar triangle pairs are merged into quads.
+/// Adding or removing static polygons only rebuilds the chunks they land in, on the next commit().
+/// Moving occluders get a geometry of their own in local space and are moved by transform, never rebuilt.
+class GeometryManager {
+public:
+    static constexpr float DefaultChunkSize = 64.0f;
+
+    GeometryManager(FMOD::System* system, float chunkSize = DefaultChunkSize);
+    ~GeometryManager();
+
+    GeometryManager(const GeometryManager&) = delete;
+    GeometryManager& operator=(const GeometryManager&) = delete;
+
+    /// @brief Returns an owner id for removeStatic
+    uint32_t addStatic(const Mesh& mesh, const glm::mat4& transform, const OcclusionMaterial& material = {});
+    /// @brief World space polygons as one owner, what the mesh overload ends up in and what a replay calls
+    uint32_t addStatic(std::vector<OccluderPolygon> polygons);
+    void addStaticPolygon(const glm::vec3* vertices, int count, const OcclusionMaterial& material = {}); // stays for good
+    void removeStatic(uint32_t owner);
+
+    uint32_t addDynamic(const Mesh& mesh, const OcclusionMaterial& material = {});
+    /// @brief Local space polygons, moved by setTransform
+    uint32_t addDynamic(const std::vector<OccluderPolygon>& local);
+    void setTransform(uint32_t id, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+    void removeDynamic(uint32_t id);
+
+    /// @brief Register new AudioOccluderComponent entities, drop the ones destroyed or stripped of the
+    /// component since the last call and move the dynamic ones that changed, then commit
+    void update(entt::registry& registry);
+    /// @brief Rebuild chunks that received polygons and grow FMOD's world size to the scene bounds
+    bool commit();
+
+    /// @brief Log owner and dynamic registrations, transforms and removals for a replay, nullptr stops.
+    /// Loose polygons are left to whoever added them
+    void setTrace(AudioTrace* value) { trace = value; }
+
+    /// @brief Enable or disable FMOD's own raycasts against the static chunks, including ones built later.
+    /// Moving occluders always stay with FMOD, the engine raycaster only covers the static ones
+    void setStaticActive(bool active);
+
+    /// @brief Visit every static polygon as (vertices, count, material)
+    template<typename F>
+    void forEachStaticPolygon(F&& visit) const {
+        for (const auto& [key, chunk] : chunks) {
+            for (const auto& polygon : chunk.polygons) {
+                visit(polygon.vertices.data(), polygon.count, polygon.material);
+            }
+        }
+    }
+
+    /// @brief Incremented whenever commit() rebuilds static chunks
+    uint32_t getVersion() const { return version; }
+    size_t getChunkCount() const { return chunks.size(); }
+    size_t getPolygonCount() const { return polygonCount; }
+    size_t getDynamicCount() const { return dynamics.size() - freeDynamics.size(); }
+
+private:
+    using Polygon = OccluderPolygon;
+
+    struct Chunk {
+        FMOD::Geometry* geometry{ nullptr };
+        std::vector<Polygon> polygons;
+        bool dirty{ false };
+    };
+
+    struct Dynamic {
+        FMOD::Geometry* geometry{ nullptr };
+        glm::vec3 translation{ 0.0f };
+        glm::quat rotation{ 1.0f, 0.0f, 0.0f, 0.0f };
+        glm::vec3 scale{ 1.0f };
+        float radius{ 0.0f }; // local bounds, for the world size
+    };
+
+    FMOD::System* system;
+    float chunkSize;
+    float worldSize{ 0.0f };
+    float extent{ 0.0f }; // largest coordinate seen
+
+    std::unordered_map<uint64_t, Chunk> chunks;
+    size_t polygonCount{ 0 };
+    bool dirty{ false };
+    bool staticActive{ true };
+    uint32_t version{ 0 };
+
+    std::vector<Dynamic> dynamics;
+    std::vector<uint32_t> freeDynamics;
+    uint32_t nextOwner{ 1 };
+
+    struct Occluder {
+        bool dynamic;
+        uint32_t id; // dynamic id or static owner
+    };
+    std::unordered_map<entt::entity, Occluder> occluders; // registered by update()
+
+    AudioTrace* trace{ nullptr };
+
+    void addPolygon(const Polygon& polygon);
+    FMOD::Geometry* createGeometry(const std::vector<Polygon>& polygons);
+    uint64_t chunkKey(const glm::vec3& position) const;
+
+    static std::vector<Polygon> polygons(const Mesh& mesh, const glm::mat4& transform, const OcclusionMaterial& material);
+};
@@ -0,0 +1,356 @@
+#include "headless.hpp"
+#include "audio.hpp"
+#include "random.hpp"
+#include "common.hpp"
+
+#include <chrono>
+#include <iomanip>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace {
+    struct HeadlessOptions {
+        float seconds{ 10.0f };
+        int emitters{ 64 };
+        int synths{ 0 }; // procedural emitters, rendered on FMOD's stream thread
+        float impacts{ 0.0f }; // variation engine triggers per second, shared by a ring of engines
+        bool capture{ false }; // fake record device through the capture pipeline, looped back as an emitter
+        float captureDrift{ 0.0f }; // ppm the fake device's clock is off by
+        std::string captureFile; // WAV of the processed capture
+        float toggleInterval{ 0.5f };
+        float minRealtime{ 0.0f };
+        bool occlusion{ false };
+        bool binaural{ false };
+        bool lod{ true };
+        float reverb{ 0.0f }; // rt60 of a generated zone response, 0 leaves the convolution idle
+        float tempo{ 1.0f }; // music
+        float pitch{ 0.0f }; // music, semitones
+        std::string wavFile;
+        std::string profileLog;
+        std::string traceFile; // log of the scene's audio calls for --replay
+    };
+
+    HeadlessOptions parseOptions(int argc, char** argv) {
+        HeadlessOptions options;
+        for (int i = 1; i < argc; i++) {
+            std::string arg{ argv[i] };
+            bool value = i + 1 < argc;
+            if (arg == "--seconds" && value)
+                options.seconds = static_cast<float>(std::atof(argv[++i]));
+            else if (arg == "--emitters" && value)
+                options.emitters = std::atoi(argv[++i]);
+            else if (arg == "--synths" && value)
+                options.synths = std::atoi(argv[++i]);
+            else if (arg == "--impacts" && value)
+                options.impacts = static_cast<float>(std::atof(argv[++i]));
+            else if (arg == "--capture-drift" && value)
+                options.captureDrift = static_cast<float>(std::atof(argv[++i]));
+            else if (arg == "--capture-wav" && value)
+                options.captureFile = argv[++i];
+            else if (arg == "--wav" && value)
+                options.wavFile = argv[++i];
+            else if (arg == "--min-xrt" && value)
+                options.minRealtime = static_cast<float>(std::atof(argv[++i]));
+            else if (arg == "--reverb" && value)
+                options.reverb = static_cast<float>(std::atof(argv[++i]));
+            else if (arg == "--tempo" && value)
+                options.tempo = static_cast<float>(std::atof(argv[++i]));
+            else if (arg == "--profile-log" && value)
+                options.profileLog = argv[++i];
+            else if (arg == "--trace" && value)
+                options.traceFile = argv[++i];
+            else if (arg == "--pitch" && value)
+                options.pitch = static_cast<float>(std::atof(argv[++i]));
+            else if (arg == "--occlusion")
+                options.occlusion = true;
+            else if (arg == "--binaural")
+                options.binaural = true;
+            else if (arg == "--no-lod")
+                options.lod = false;
+            else if (arg == "--capture")
+                options.capture = true;
+        }
+        return options;
+    }
+
+    // Game assets are not always checked out on build machines, the SDK media always is
+    std::string pickFile(const std::string& preferred, const std::string& fallback) {
+        return std::filesystem::exists(preferred) ? preferred : fallback;
+    }
+
+    long peakResidentKB() {
+#if defined(__APPLE__)
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss / 1024;
+#elif defined(__unix__)
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+#else
+        return -1;
+#endif
+    }
+}
+
+int runHeadless(int argc, char** argv) {
+    auto options = parseOptions(argc, argv);
+
+    AudioSettings settings;
+    settings.output = options.wavFile.empty() ? FMOD_OUTPUTTYPE_NOSOUND_NRT : FMOD_OUTPUTTYPE_WAVWRITER_NRT;
+    settings.outputFile = options.wavFile;
+    settings.profile = true;
+    settings.engineOcclusion = options.occlusion;
+    settings.binaural = options.binaural;
+    settings.lod = options.lod;
+    settings.profileLog = options.profileLog;
+
+    Audio audio{ settings };
+    auto system = audio.getSystem();
+    if (!options.traceFile.empty() && !audio.startTrace(options.traceFile))
+        return EXIT_FAILURE;
+
+    // Scene: the game's music and emitter sound, a ring of moving emitters and a few occluding walls
+    if (!audio.loadSound(pickFile("resources/audio/Monkeys-Spinning-Monkeys.mp3", "external/fmodstudioapi/core/examples/media/drumloop.wav")))
+        return EXIT_FAILURE;
+    if (!audio.loadMusicStream(pickFile("resources/audio/fsm-team-escp-paradox.wav", "external/fmodstudioapi/core/examples/media/wave.mp3")))
+        return EXIT_FAILURE;
+    audio.playMusicStream();
+    if (options.tempo != 1.0f)
+        audio.setMusicTempo(options.tempo);
+    if (options.pitch != 0.0f)
+        audio.setMusicPitch(options.pitch);
+
+    struct Emitter {
+        VoiceHandle voice;
+        float radius;
+        float speed;
+        float phase;
+        float height;
+    };
+
+    std::vector<Emitter> emitters;
+    for (int i = 0; i < options.emitters; i++) {
+        Emitter emitter;
+        emitter.radius = Random::FloatRange(2.0f, 50.0f);
+        emitter.speed = Random::FloatRange(-2.0f, 2.0f);
+        emitter.phase = Random::FloatRange(0.0f, 2.0f * static_cast<float>(M_PI));
+        emitter.height = Random::FloatRange(0.0f, 10.0f);
+        emitter.voice = audio.playSound({ emitter.radius * std::cos(emitter.phase), emitter.height, emitter.radius * std::sin(emitter.phase) }, Random::FloatRange(0.2f, 1.0f));
+        emitters.push_back(emitter);
+    }
+
+    // Synths ride the same ring, their pitch wanders so every block publishes new parameters
+    std::vector<Synth*> synths;
+    for (int i = 0; i < options.synths; i++) {
+        SynthPatch patch;
+        patch.waveform = static_cast<dsp::Waveform>(i % 4);
+        patch.frequency = Random::FloatRange(80.0f, 800.0f);
+        patch.noise = 0.1f;
+        patch.cutoff = 3000.0f;
+        auto synth = audio.createSynth(patch);
+        if (!synth)
+            return EXIT_FAILURE;
+
+        Emitter emitter;
+        emitter.radius = Random::FloatRange(2.0f, 50.0f);
+        emitter.speed = Random::FloatRange(-2.0f, 2.0f);
+        emitter.phase = Random::FloatRange(0.0f, 2.0f * static_cast<float>(M_PI));
+        emitter.height = Random::FloatRange(0.0f, 10.0f);
+        emitter.voice = audio.playSynth(*synth, { emitter.radius * std::cos(emitter.phase), emitter.height, emitter.radius * std::sin(emitter.phase) }, 0.5f);
+        emitters.push_back(emitter);
+        synths.push_back(synth);
+    }
+
+    // Impacts: short grains from the SDK media, eight engines taking turns
+    std::vector<VariationEngine*> engines;
+    if (options.impacts > 0.0f) {
+        VariationSet set;
+        set.offset = 0.5f;
+        set.minLength = 0.02f;
+        set.maxLength = 0.1f;
+        for (int i = 1; i <= 6; i++) {
+            auto sample = audio.loadVariationSample("external/fmodstudioapi/core/examples/media/granular/truck_idle_off_0" + std::to_string(i) + ".wav");
+            if (sample != UINT32_MAX)
+                set.samples.push_back(sample);
+        }
+        for (int i = 0; i < 8; i++) {
+            float angle = static_cast<float>(i) * static_cast<float>(M_PI) * 0.25f;
+            if (auto engine = audio.createVariations(set, { 15.0f * std::cos(angle), 1.0f, 15.0f * std::sin(angle) }))
+                engines.push_back(engine);
+        }
+    }
+
+    // Capture: the consumer runs inside update() so every run cuts the same frames
+    if (options.capture || !options.captureFile.empty()) {
+        CaptureSettings capture;
+        capture.threaded = false;
+        capture.recordFile = options.captureFile;
+        if (!audio.startCapture(std::make_unique<FakeRecordDevice>(system, 48000, options.captureDrift), capture))
+            return EXIT_FAILURE;
+        audio.playCaptureLoopback({ 0.0f, 1.0f, 5.0f });
+    }
+
+    for (int i = 0; i < 4; i++) {
+        float angle = static_cast<float>(i) * static_cast<float>(M_PI) * 0.5f;
+        glm::vec3 position{ 20.0f * std::cos(angle), 0.0f, 20.0f * std::sin(angle) };
+        audio.createGeometry({ 10.0f, 5.0f }, position, glm::angleAxis(angle, vec3::up));
+    }
+
+    if (audio.getReverb() && options.reverb > 0.0f)
+        audio.setReverbZones({ { audio.getImpulseResponses().generate("headless", options.reverb), 1.0f } });
+
+    unsigned int blockLength;
+    int numBuffers;
+    system->getDSPBufferSize(&blockLength, &numBuffers);
+    int sampleRate;
+    system->getSoftwareFormat(&sampleRate, nullptr, nullptr);
+
+    const float dt = static_cast<float>(blockLength) / static_cast<float>(sampleRate);
+    const std::array<AudioFilter, 8> filters{
+        AudioFilter::Lowpass, AudioFilter::Highpass, AudioFilter::Echo, AudioFilter::Flange,
+        AudioFilter::Distortion, AudioFilter::Chorus, AudioFilter::Parameq, AudioFilter::Custom
+    };
+
+    std::vector<EmitterUpdate> updates;
+    updates.reserve(emitters.size());
+
+    float time = 0.0f;
+    float pendingImpacts = 0.0f;
+    size_t impact = 0;
+    float nextToggle = options.toggleInterval;
+    size_t toggle = 0;
+    uint64_t blocks = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Every update mixes exactly one block on a non-realtime output
+    while (time < options.seconds) {
+        time += dt;
+
+        if (time >= nextToggle) {
+            audio.toggleFilter(filters[toggle++ % filters.size()]);
+            nextToggle += options.toggleInterval;
+        }
+
+        updates.clear();
+        for (const auto& emitter : emitters) {
+            float angle = emitter.phase + emitter.speed * time;
+            glm::vec3 position{ emitter.radius * std::cos(angle), emitter.height, emitter.radius * std::sin(angle) };
+            glm::vec3 velocity{ -emitter.radius * emitter.speed * std::sin(angle), 0.0f, emitter.radius * emitter.speed * std::cos(angle) };
+            updates.push_back({ emitter.voice, position, velocity });
+        }
+        audio.setSoundPositionsAndVelocities(updates);
+
+        if (!engines.empty()) {
+            for (pendingImpacts += options.impacts * dt; pendingImpacts >= 1.0f; pendingImpacts -= 1.0f) {
+                engines[impact++ % engines.size()]->trigger();
+            }
+        }
+
+        for (auto synth : synths) {
+            synth->setFrequency(synth->getPatch().frequency * (1.0f + 0.05f * std::sin(time * 3.0f)));
+        }
+
+        float yaw = time * 0.3f;
+        audio.update(vec3::zero, vec3::zero, { std::sin(yaw), 0.0f, std::cos(yaw) }, vec3::up);
+        blocks++;
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double mixed = static_cast<double>(blocks) * blockLength / sampleRate;
+    double realtime = wall > 0.0 ? mixed / wall : 0.0;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Mixed " << mixed << " s in " << wall << " s (" << realtime << "x realtime), "
+              << blocks << " blocks of " << blockLength << " @ " << sampleRate << " Hz, " << emitters.size() << " emitters" << std::endl;
+
+    FMOD_CPU_USAGE usage;
+    if (system->getCPUUsage(&usage) == FMOD_OK) {
+        std::cout << "CPU: dsp " << usage.dsp << "% stream " << usage.stream << "% geometry " << usage.geometry
+                  << "% update " << usage.update << "%" << std::endl;
+    }
+
+    std::cout << std::left << std::setw(24) << "DSP" << std::right << std::setw(14) << "exclusive us" << std::setw(14) << "inclusive us" << std::endl;
+    for (auto dsp : audio.getDSPs()) {
+        char name[32];
+        unsigned int exclusive = 0;
+        unsigned int inclusive = 0;
+        dsp->getInfo(name, nullptr, nullptr, nullptr, nullptr);
+        dsp->getCPUUsage(&exclusive, &inclusive);
+        std::cout << std::left << std::setw(24) << name << std::right << std::setw(14) << exclusive << std::setw(14) << inclusive << std::endl;
+    }
+
+    // Per file reads through the read-ahead layer, latency buckets from 0.1 ms to over 50 ms
+    for (const auto& stats : audio.getStreamStats()) {
+        std::cout << "IO " << std::filesystem::path{ stats.name }.filename().string() << ": " << stats.requests << " reads, "
+                  << stats.bytesRead / 1024 << " KB read, " << stats.diskBytes / 1024 << " KB from disk, " << stats.stalls << " stalls, latency";
+        for (auto count : stats.latency) {
+            std::cout << " " << count;
+        }
+        std::cout << std::endl;
+    }
+
+    if (auto occlusion = audio.getOcclusion()) {
+        auto stats = occlusion->getStats();
+        std::cout << "Occlusion: " << occlusion->getBVH().getPolygonCount() << " polygons, " << stats.casts << " casts, "
+                  << stats.cached << " cached, " << stats.deferred << " deferred, last update " << stats.lastUpdateMs << " ms" << std::endl;
+    }
+
+    if (auto binaural = audio.getBinaural()) {
+        std::cout << "Binaural: " << binaural->getSourceCount() << " sources, " << binaural->getActiveDirections() << " directions filtered" << std::endl;
+    }
+
+    if (auto lod = audio.getLOD()) {
+        auto stats = lod->getStats();
+        std::cout << "LOD: " << stats.full << " full, " << stats.far << " far, " << stats.clustered << " clustered, "
+                  << stats.virtualized << " virtual, last update " << stats.lastUpdateMs << " ms" << std::endl;
+    }
+
+    if (!engines.empty()) {
+        uint64_t triggers = 0;
+        uint64_t dropped = 0;
+        for (auto engine : engines) {
+            auto stats = engine->getStats();
+            triggers += stats.triggers;
+            dropped += stats.dropped;
+        }
+        std::cout << "Variations: " << engines.size() << " engines, " << triggers << " triggers, " << dropped << " dropped, pool "
+                  << audio.getSamplePool().getUsed() * sizeof(float) / 1024 << " KB" << std::endl;
+    }
+
+    if (auto capture = audio.getCapture()) {
+        auto stats = capture->getStats();
+        std::cout << "Capture: " << stats.captured << " frames in, " << stats.processed << " out, " << stats.overruns << " overruns, "
+                  << stats.underruns << " underruns, drift " << stats.driftPpm << " ppm, loopback rate " << stats.loopbackRatePpm << " ppm, latency "
+                  << stats.captureLatencyMs << " + " << stats.loopbackLatencyMs << " ms, voice " << stats.voiceRatio * 100.0f << "%" << std::endl;
+        audio.stopCapture();
+    }
+
+    auto& music = audio.getMusic();
+    std::cout << "Music: track " << music.getTrack() << ", " << music.getTransitions() << " transitions, " << music.getLateTransitions() << " late" << std::endl;
+
+    for (const auto& tap : audio.getMeters()) {
+        const auto& meter = tap->getMeter();
+        std::cout << "Meters: " << tap->getName() << " peak " << meter.peak[0] << "/" << meter.peak[1] << " dB, rms " << meter.rms[0] << "/" << meter.rms[1] << " dB, " << tap->getOverruns() << " frames overrun" << std::endl;
+    }
+
+    if (auto trace = audio.getTrace()) {
+        std::cout << "Trace: " << trace->getRecords() << " records, " << trace->getBytes() / 1024 << " KB" << std::endl;
+        audio.stopTrace();
+    }
+
+    int current = 0;
+    int peak = 0;
+    FMOD::Memory_GetStats(&current, &peak);
+    std::cout << "Memory: FMOD " << current / 1024 << " KB current, " << peak / 1024 << " KB peak, process peak RSS " << peakResidentKB() << " KB" << std::endl;
+
+    if (options.minRealtime > 0.0f && realtime < options.minRealtime) {
+        std::cerr << "Throughput " << realtime << "x is below the required " << options.minRealtime << "x" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+/// @brief Run a scripted audio scene on a non-realtime FMOD output without a window and report
+/// mix throughput, cpu and memory usage
+/// Usage: --headless [--seconds N] [--emitters N] [--wav file.wav] [--min-xrt factor]
+int runHeadless(int argc, char** argv);
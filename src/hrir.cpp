@@ -0,0 +1,156 @@
+#include "hrir.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+    constexpr float HeadRadius = 0.0875f; // metres
+    constexpr float SpeedOfSound = 343.0f;
+    constexpr float HalfPi = 1.57079633f;
+    constexpr float Radians = 0.0174532925f;
+
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t sampleRate;
+        uint32_t taps;
+        float minElevation;
+        float elevationStep;
+        uint32_t elevationCount;
+        uint32_t azimuthCount;
+    };
+
+    // Linear resampling of a short response, gain compensated so the level stays the same
+    std::vector<float> resample(const float* samples, int taps, double ratio) {
+        std::vector<float> result(std::max(1, static_cast<int>(std::lround(taps * ratio))));
+        for (size_t i = 0; i < result.size(); i++) {
+            double position = i / ratio;
+            size_t index = static_cast<size_t>(position);
+            float t = static_cast<float>(position - index);
+            float a = index < static_cast<size_t>(taps) ? samples[index] : 0.0f;
+            float b = index + 1 < static_cast<size_t>(taps) ? samples[index + 1] : 0.0f;
+            result[i] = (a + (b - a) * t) / static_cast<float>(ratio);
+        }
+        return result;
+    }
+}
+
+std::shared_ptr<HRIRSet> HRIRSet::synthesize(int sampleRate, int taps, float elevationStep, int azimuthCount) {
+    auto set = std::make_shared<HRIRSet>();
+    set->sampleRate = sampleRate;
+    set->taps = taps;
+    set->minElevation = -45.0f;
+    set->elevationStep = elevationStep;
+    set->elevationCount = static_cast<int>((90.0f - set->minElevation) / elevationStep) + 1;
+    set->azimuthCount = azimuthCount;
+    set->filters.assign(static_cast<size_t>(set->getDirectionCount()) * 2 * taps, 0.0f);
+    set->delays.assign(static_cast<size_t>(set->getDirectionCount()) * 2, 0.0f);
+
+    const float fs = static_cast<float>(sampleRate);
+    const float w0 = SpeedOfSound / HeadRadius;
+    const float k = 2.0f * fs; // bilinear transform
+    std::vector<float> impulse(taps);
+
+    for (int e = 0; e < set->elevationCount; e++) {
+        float elevation = (set->minElevation + e * elevationStep) * Radians;
+        for (int a = 0; a < azimuthCount; a++) {
+            float azimuth = 360.0f * a / azimuthCount * Radians;
+            float lateral = std::cos(elevation) * std::sin(azimuth); // towards the right ear
+            int index = e * azimuthCount + a;
+
+            for (int ear = 0; ear < 2; ear++) {
+                // Angle between the source and the ear axis, left ear first
+                float angle = std::acos(std::clamp(ear == 0 ? -lateral : lateral, -1.0f, 1.0f));
+
+                // Woodworth: straight line to the near ear, around the sphere to the far one
+                float path = angle < HalfPi ? -std::cos(angle) : angle - HalfPi;
+                set->delays[index * 2 + ear] = (path + 1.0f) * HeadRadius / SpeedOfSound * fs;
+
+                // Head shadow, +6 dB treble facing the ear down to -20 dB at 150 degrees away
+                float alpha = 1.05f + 0.95f * std::cos(angle * 1.2f);
+                float b0 = (2.0f * w0 + alpha * k) / (2.0f * w0 + k);
+                float b1 = (2.0f * w0 - alpha * k) / (2.0f * w0 + k);
+                float a1 = (2.0f * w0 - k) / (2.0f * w0 + k);
+                float x1 = 0.0f;
+                float y1 = 0.0f;
+                for (int i = 0; i < taps; i++) {
+                    float x = i == 0 ? 1.0f : 0.0f;
+                    float y = b0 * x + b1 * x1 - a1 * y1;
+                    impulse[i] = y;
+                    x1 = x;
+                    y1 = y;
+                }
+
+                // Pinna reflection, its delay shrinks as the source rises, at 44.1 kHz scale
+                float pinna = (std::cos(azimuth * 0.5f) * std::sin(HalfPi - elevation) + 2.0f) * fs / 44100.0f;
+                int whole = static_cast<int>(pinna);
+                float fraction = pinna - whole;
+                float* filter = set->filters.data() + (static_cast<size_t>(index) * 2 + ear) * taps;
+                for (int i = 0; i < taps; i++) {
+                    float reflected = 0.0f;
+                    if (i - whole >= 0)
+                        reflected += impulse[i - whole] * (1.0f - fraction);
+                    if (i - whole - 1 >= 0)
+                        reflected += impulse[i - whole - 1] * fraction;
+                    filter[taps - 1 - i] = impulse[i] + 0.5f * reflected;
+                }
+            }
+        }
+    }
+
+    return set;
+}
+
+std::shared_ptr<HRIRSet> HRIRSet::load(const std::string& path, int sampleRate) {
+    std::ifstream file{ path, std::ios::binary };
+    if (!file) {
+        std::cerr << "Failed to open HRIR set " << path << std::endl;
+        return nullptr;
+    }
+
+    FileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, "HRIR", 4) != 0 || header.version != 1 ||
+        header.taps == 0 || header.elevationCount == 0 || header.azimuthCount == 0) {
+        std::cerr << "Invalid HRIR set " << path << std::endl;
+        return nullptr;
+    }
+
+    double ratio = static_cast<double>(sampleRate) / header.sampleRate;
+    int directions = static_cast<int>(header.elevationCount * header.azimuthCount);
+
+    auto set = std::make_shared<HRIRSet>();
+    set->sampleRate = sampleRate;
+    set->minElevation = header.minElevation;
+    set->elevationStep = header.elevationStep;
+    set->elevationCount = static_cast<int>(header.elevationCount);
+    set->azimuthCount = static_cast<int>(header.azimuthCount);
+    set->delays.resize(static_cast<size_t>(directions) * 2);
+
+    std::vector<float> filter(header.taps);
+    for (int direction = 0; direction < directions; direction++) {
+        float delays[2];
+        file.read(reinterpret_cast<char*>(delays), sizeof(delays));
+        for (int ear = 0; ear < 2; ear++) {
+            set->delays[direction * 2 + ear] = static_cast<float>(delays[ear] * ratio);
+
+            file.read(reinterpret_cast<char*>(filter.data()), filter.size() * sizeof(float));
+            auto samples = ratio == 1.0 ? filter : resample(filter.data(), static_cast<int>(header.taps), ratio);
+            if (set->taps == 0) {
+                set->taps = static_cast<int>(samples.size());
+                set->filters.resize(static_cast<size_t>(directions) * 2 * set->taps);
+            }
+            std::reverse_copy(samples.begin(), samples.end(), set->filters.begin() + (static_cast<size_t>(direction) * 2 + ear) * set->taps);
+        }
+    }
+
+    if (!file) {
+        std::cerr << "Truncated HRIR set " << path << std::endl;
+        return nullptr;
+    }
+
+    return set;
+}
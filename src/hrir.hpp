@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// @brief Head related impulse responses on a regular direction grid
+/// Rings of equal elevation from minElevation in elevationStep degrees, each with azimuthCount
+/// directions from straight ahead clockwise seen from above. Interaural delay is kept apart from the
+/// filters so neighbouring responses can be mixed without comb filtering, the filters of one direction
+/// are stored next to each other, left then right, time reversed for the FIR kernel.
+///
+/// .hrir files are little endian: "HRIR", uint32 version 1, uint32 sampleRate, uint32 taps,
+/// float minElevation, float elevationStep, uint32 elevationCount, uint32 azimuthCount, then per
+/// direction (elevation major) float delays[2] in samples and float filters[2][taps] in time order.
+struct HRIRSet {
+    int sampleRate{ 0 };
+    int taps{ 0 };
+    float minElevation{ 0.0f };
+    float elevationStep{ 0.0f };
+    int elevationCount{ 0 };
+    int azimuthCount{ 0 };
+    std::vector<float> filters; // [direction][ear][taps], reversed
+    std::vector<float> delays; // [direction][ear], samples
+
+    int getDirectionCount() const { return elevationCount * azimuthCount; }
+    const float* filter(int direction, int ear) const { return filters.data() + (static_cast<size_t>(direction) * 2 + ear) * taps; }
+    float delay(int direction, int ear) const { return delays[static_cast<size_t>(direction) * 2 + ear]; }
+
+    /// @brief Spherical head model: Woodworth delay, Brown-Duda head shadow and one pinna reflection
+    static std::shared_ptr<HRIRSet> synthesize(int sampleRate, int taps = 32, float elevationStep = 15.0f, int azimuthCount = 24);
+    /// @brief Read a .hrir file, filters and delays are resampled to sampleRate
+    static std::shared_ptr<HRIRSet> load(const std::string& path, int sampleRate);
+};
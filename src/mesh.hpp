@@ -17,6 +17,10 @@ public:
     void render(const std::unique_ptr<Shader>& shader) const;
     void render() const; // no textures
 
+    const std::vector<Vertex>& getVertices() const { return vertices; }
+    const std::vector<GLuint>& getIndices() const { return indices; }
+    GLenum getMode() const { return mode; }
+
 private:
     GLuint vao, vbo, ebo;
     GLenum mode;
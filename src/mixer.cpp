@@ -0,0 +1,142 @@
+#include "mixer.hpp"
+#include "fmoderror.hpp"
+
+Mixer::Mixer(FMOD::System* system, EffectChain::Factory factory) : system{system}, factory{std::move(factory)} {
+    auto master = std::make_unique<Bus>();
+    master->name = "master";
+    auto result = system->getMasterChannelGroup(&master->group);
+    FMOD_ERROR_(result);
+    buses.push_back(std::move(master));
+}
+
+Mixer::~Mixer() {
+    // Children first, the master group belongs to the system
+    for (auto bus = buses.rbegin(); bus != buses.rend(); ++bus) {
+        (*bus)->effects.reset();
+        if ((*bus)->parent)
+            (*bus)->group->release();
+    }
+}
+
+bool Mixer::load(const std::string& path) {
+    std::ifstream file{ path };
+    if (!file) {
+        std::cerr << "Failed to open mixer buses " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream words{ line };
+        std::string name;
+        std::string parent;
+        if (!(words >> name))
+            continue;
+        if (!(words >> parent)) {
+            std::cerr << path << ":" << number << ": missing parent bus" << std::endl;
+            return false;
+        }
+
+        float volume = 1.0f;
+        std::string effects;
+        std::string word;
+        while (words >> word) {
+            if (word.rfind("volume=", 0) == 0) {
+                volume = std::strtof(word.c_str() + 7, nullptr);
+            } else if (word.rfind("effects=", 0) == 0) {
+                effects = word.substr(8);
+            } else {
+                std::cerr << path << ":" << number << ": unknown option " << word << std::endl;
+                return false;
+            }
+        }
+
+        if (!add(name, parent, volume))
+            return false;
+
+        if (!effects.empty()) {
+            auto desc = EffectChainDesc::load(effects);
+            if (!desc || !setEffects(name, *desc))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+Mixer::Bus* Mixer::add(const std::string& name, const std::string& parentName, float volume) {
+    auto parent = find(parentName);
+    if (!parent) {
+        std::cerr << "Unknown parent bus " << parentName << " for " << name << std::endl;
+        return nullptr;
+    }
+    if (find(name)) {
+        std::cerr << "Duplicate bus " << name << std::endl;
+        return nullptr;
+    }
+
+    auto bus = std::make_unique<Bus>();
+    bus->name = name;
+    bus->parent = parent;
+
+    auto result = system->createChannelGroup(name.c_str(), &bus->group);
+    FMOD_ERROR_RETURN(result, nullptr);
+    result = parent->group->addGroup(bus->group);
+    if (result == FMOD_OK)
+        result = bus->group->setVolume(volume);
+    if (result != FMOD_OK)
+        bus->group->release();
+    FMOD_ERROR_RETURN(result, nullptr);
+
+    buses.push_back(std::move(bus));
+    return buses.back().get();
+}
+
+bool Mixer::setEffects(const std::string& name, const EffectChainDesc& desc) {
+    auto bus = find(name);
+    if (!bus)
+        return false;
+
+    bus->effects = std::make_unique<EffectChain>(system, desc, factory);
+    return bus->effects->attach(bus->group);
+}
+
+Mixer::Bus* Mixer::find(const std::string& name) const {
+    for (const auto& bus : buses) {
+        if (bus->name == name)
+            return bus.get();
+    }
+    return nullptr;
+}
+
+FMOD::ChannelGroup* Mixer::getGroup(const std::string& name) const {
+    auto bus = find(name);
+    return bus ? bus->group : buses.front()->group;
+}
+
+EffectChain* Mixer::getEffects(const std::string& name) const {
+    auto bus = find(name);
+    return bus ? bus->effects.get() : nullptr;
+}
+
+bool Mixer::setVolume(const std::string& name, float volume) {
+    auto bus = find(name);
+    if (!bus)
+        return false;
+
+    auto result = bus->group->setVolume(volume);
+    FMOD_ERROR(result);
+    return true;
+}
+
+bool Mixer::setMute(const std::string& name, bool mute) {
+    auto bus = find(name);
+    if (!bus)
+        return false;
+
+    auto result = bus->group->setMute(mute);
+    FMOD_ERROR(result);
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include "effectchain.hpp"
+
+/// @brief Tree of mixing buses on top of FMOD channel groups
+/// Bus files list one bus per line, parents before children:
+///   <name> <parent> [volume=value] [effects=path to a .chain file]
+/// "master" is FMOD's master channel group and always exists. A bus's effect chain is inserted
+/// once on its group and processes the submix of everything below it.
+class Mixer {
+public:
+    struct Bus {
+        std::string name;
+        FMOD::ChannelGroup* group{ nullptr };
+        Bus* parent{ nullptr };
+        std::unique_ptr<EffectChain> effects;
+    };
+
+    Mixer(FMOD::System* system, EffectChain::Factory factory = {});
+    ~Mixer();
+
+    Mixer(const Mixer&) = delete;
+    Mixer& operator=(const Mixer&) = delete;
+
+    bool load(const std::string& path);
+    Bus* add(const std::string& name, const std::string& parent, float volume = 1.0f);
+    bool setEffects(const std::string& name, const EffectChainDesc& desc);
+
+    Bus* find(const std::string& name) const;
+    /// @brief Group of a bus, the master group for unknown names
+    FMOD::ChannelGroup* getGroup(const std::string& name) const;
+    EffectChain* getEffects(const std::string& name) const;
+
+    bool setVolume(const std::string& name, float volume);
+    bool setMute(const std::string& name, bool mute);
+
+    const std::vector<std::unique_ptr<Bus>>& getBuses() const { return buses; }
+
+private:
+    FMOD::System* system;
+    EffectChain::Factory factory;
+    std::vector<std::unique_ptr<Bus>> buses; // parents before children, buses[0] is master
+};
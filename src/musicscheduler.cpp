@@ -0,0 +1,309 @@
+#include "musicscheduler.hpp"
+#include "fmoderror.hpp"
+
+#include <climits>
+#include <cmath>
+
+namespace {
+    // Segments of the equal-power curves, FMOD ramps linearly between fade points
+    constexpr int FadeSteps = 16;
+}
+
+MusicScheduler::MusicScheduler(FMOD::System* system, SoundCache& sounds, FMOD::ChannelGroup* bus, size_t openStreams)
+    : system{system}, sounds{sounds}, bus{bus}, openStreams{std::max<size_t>(openStreams, 2)} {
+    auto result = system->getSoftwareFormat(&outputRate, nullptr, nullptr);
+    FMOD_ERROR_(result);
+
+    // A delay has to be set before the mixer reaches it, two blocks covers the update that carries it
+    unsigned int blockLength;
+    result = system->getDSPBufferSize(&blockLength, nullptr);
+    FMOD_ERROR_(result);
+    margin = 2ull * blockLength;
+}
+
+MusicScheduler::~MusicScheduler() {
+    stop();
+}
+
+void MusicScheduler::setPlaylist(std::vector<MusicTrack> playlist, bool loop) {
+    stop();
+    tracks = std::move(playlist);
+    repeat = loop;
+}
+
+void MusicScheduler::add(MusicTrack track) {
+    tracks.push_back(std::move(track));
+}
+
+bool MusicScheduler::play() {
+    if (playing)
+        return true;
+
+    prefetch();
+    while (!opened.empty() && opened.front().sound.hasFailed()) {
+        opened.pop_front();
+        prefetch();
+    }
+    if (opened.empty() || !opened.front().sound.isReady())
+        return false;
+
+    if (!start(current, opened.front(), clock() + margin))
+        return false;
+    opened.pop_front();
+    playing = true;
+    paused = false;
+    return true;
+}
+
+void MusicScheduler::stop() {
+    release(current);
+    release(next);
+    release(outgoing);
+    opened.clear();
+    last = SIZE_MAX;
+    playing = false;
+    paused = false;
+}
+
+bool MusicScheduler::skip() {
+    if (!current.channel)
+        return false;
+
+    auto now = clock();
+    reanchor(now);
+
+    // Cut the current track where the next one would be fully in
+    unsigned long long fade = 0;
+    if (!opened.empty()) {
+        const auto& track = tracks[opened.front().track];
+        if (track.transition == MusicTransition::Crossfade)
+            fade = static_cast<unsigned long long>(track.fade * static_cast<float>(outputRate));
+    }
+    current.end = now + margin + fade;
+    auto result = current.channel->setDelay(current.start, current.end, true);
+    FMOD_ERROR(result);
+    return true;
+}
+
+void MusicScheduler::setPaused(bool pause) {
+    if (pause == paused || !playing)
+        return;
+
+    // Scheduled clocks keep running while paused, drop them and derive them again from the position
+    paused = pause;
+    reanchor(clock());
+    if (current.channel)
+        current.channel->setPaused(paused);
+}
+
+void MusicScheduler::setTempo(float value) {
+    tempo = value;
+    for (auto voice : { &current, &next, &outgoing }) {
+        if (voice->channel)
+            voice->channel->setFrequency(voice->frequency * tempo);
+    }
+    if (playing)
+        reanchor(clock());
+}
+
+void MusicScheduler::update() {
+    prefetch();
+    if (!playing || paused)
+        return;
+
+    schedule(clock());
+}
+
+unsigned long long MusicScheduler::clock() const {
+    // Channels on the bus are delayed against its clock
+    unsigned long long value = 0;
+    bus->getDSPClock(&value, nullptr);
+    return value;
+}
+
+size_t MusicScheduler::following(size_t track) const {
+    if (tracks.empty())
+        return SIZE_MAX;
+    if (track == SIZE_MAX)
+        return 0;
+    if (track + 1 < tracks.size())
+        return track + 1;
+    return repeat ? 0 : SIZE_MAX;
+}
+
+bool MusicScheduler::isOpen(const std::string& path) const {
+    // The same file is the same cached stream, and a stream can only play once at a time
+    for (auto voice : { &current, &next, &outgoing }) {
+        if (voice->sound && tracks[voice->track].path == path)
+            return true;
+    }
+    for (const auto& open : opened) {
+        if (tracks[open.track].path == path)
+            return true;
+    }
+    return false;
+}
+
+void MusicScheduler::prefetch() {
+    size_t held = opened.size() + (current.sound ? 1 : 0) + (next.sound ? 1 : 0) + (outgoing.sound ? 1 : 0);
+    for (size_t tries = 0; held < openStreams && tries < tracks.size(); tries++) {
+        auto track = following(last);
+        if (track == SIZE_MAX || isOpen(tracks[track].path))
+            return;
+
+        // Opens on FMOD's async thread, update() schedules it once it is ready
+        last = track;
+        auto sound = sounds.loadAsync(tracks[track].path, Mode);
+        if (!sound)
+            continue;
+        opened.push_back({ track, std::move(sound) });
+        held++;
+    }
+}
+
+bool MusicScheduler::start(Voice& voice, Open& open, unsigned long long at) {
+    // Paused until the delay is in place, so it cannot start a block early
+    FMOD::Channel* channel;
+    auto result = system->playSound(open.sound.get(), bus, true, &channel);
+    FMOD_ERROR(result);
+
+    float frequency;
+    result = open.sound->getDefaults(&frequency, nullptr);
+    FMOD_ERROR(result);
+    result = channel->setFrequency(frequency * tempo);
+    FMOD_ERROR(result);
+    result = channel->setDelay(at, 0, false);
+    FMOD_ERROR(result);
+    result = channel->setPaused(false);
+    FMOD_ERROR(result);
+
+    unsigned int length;
+    result = open.sound->getLength(&length, FMOD_TIMEUNIT_PCM);
+    FMOD_ERROR(result);
+
+    voice.channel = channel;
+    voice.sound = std::move(open.sound);
+    voice.track = open.track;
+    voice.frequency = frequency;
+    voice.start = at;
+    voice.end = at + static_cast<unsigned long long>(std::ceil(static_cast<double>(length) * outputRate / (frequency * tempo)));
+    return true;
+}
+
+void MusicScheduler::schedule(unsigned long long now) {
+    // The next track has begun, the previous one finishes its fade on its own
+    if (next.channel && now >= next.start) {
+        release(outgoing);
+        outgoing = std::move(current);
+        current = std::move(next);
+        next = {};
+        transitions++;
+    }
+
+    if (outgoing.channel && now >= outgoing.end)
+        release(outgoing);
+
+    // Ran out with nothing scheduled: the playlist ended or the next stream was not open in time
+    if (current.channel && current.end && now >= current.end) {
+        if (!opened.empty())
+            late++;
+        release(outgoing);
+        outgoing = std::move(current);
+        current = {};
+    }
+
+    while (!opened.empty() && opened.front().sound.hasFailed()) {
+        opened.pop_front();
+    }
+
+    if (!current.channel) {
+        // Late, start as soon as the stream is there
+        if (!opened.empty() && opened.front().sound.isReady() && start(current, opened.front(), now + margin))
+            opened.pop_front();
+        return;
+    }
+
+    if (next.channel)
+        return;
+
+    if (opened.empty()) {
+        // A lone repeating track loops in place, its stream cannot be started a second time
+        if (current.end && following(current.track) == current.track) {
+            current.channel->setMode(FMOD_LOOP_NORMAL);
+            current.channel->setLoopCount(-1);
+            current.end = 0;
+        }
+        return;
+    }
+
+    auto& upcoming = opened.front();
+    if (!upcoming.sound.isReady())
+        return;
+
+    // Tracks were added to a looping one, let this pass be its last
+    if (!current.end) {
+        current.channel->setLoopCount(0);
+        current.end = now + remaining(current);
+    }
+
+    if (current.end > now + static_cast<unsigned long long>(Lookahead * static_cast<float>(outputRate)))
+        return;
+
+    const auto& track = tracks[upcoming.track];
+    bool crossfade = track.transition == MusicTransition::Crossfade && track.fade > 0.0f;
+    auto fade = crossfade ? static_cast<unsigned long long>(track.fade * static_cast<float>(outputRate)) : 0ull;
+    auto at = current.end - std::min(fade, current.end - now);
+    at = std::max(at, now + margin);
+    if (!start(next, upcoming, at))
+        return;
+    opened.pop_front();
+
+    if (!crossfade || at >= current.end)
+        return;
+
+    // Equal power: the summed power stays constant through the overlap
+    for (int i = 0; i <= FadeSteps; i++) {
+        float t = static_cast<float>(i) / FadeSteps;
+        auto point = at + static_cast<unsigned long long>(static_cast<double>(current.end - at) * t);
+        next.channel->addFadePoint(point, std::sin(t * static_cast<float>(M_PI) * 0.5f));
+        current.channel->addFadePoint(point, std::cos(t * static_cast<float>(M_PI) * 0.5f));
+    }
+    auto result = current.channel->setDelay(current.start, current.end, true);
+    FMOD_ERROR_(result);
+}
+
+void MusicScheduler::reanchor(unsigned long long now) {
+    // Put a scheduled track back in line, it is scheduled again from the new end
+    if (next.channel) {
+        next.channel->stop();
+        next.channel = nullptr;
+        opened.push_front({ next.track, std::move(next.sound) });
+        next = {};
+    }
+    release(outgoing);
+
+    if (!current.channel)
+        return;
+
+    current.channel->removeFadePoints(0, ULLONG_MAX);
+    current.channel->setDelay(current.start, 0, false);
+    if (current.end)
+        current.end = now + remaining(current);
+}
+
+void MusicScheduler::release(Voice& voice) {
+    // Stopping a voice that already ended just reports an invalid handle
+    if (voice.channel)
+        voice.channel->stop();
+    voice = {};
+}
+
+unsigned long long MusicScheduler::remaining(const Voice& voice) const {
+    unsigned int length = 0;
+    unsigned int position = 0;
+    voice.sound->getLength(&length, FMOD_TIMEUNIT_PCM);
+    voice.channel->getPosition(&position, FMOD_TIMEUNIT_PCM);
+
+    double left = static_cast<double>(length > position ? length - position : 0);
+    return static_cast<unsigned long long>(std::ceil(left * outputRate / (voice.frequency * tempo)));
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include "soundcache.hpp"
+
+enum class MusicTransition : uint8_t { Gapless, Crossfade };
+
+struct MusicTrack {
+    std::string path;
+    MusicTransition transition{ MusicTransition::Gapless }; // from the previous track into this one
+    float fade{ 2.0f }; // crossfade seconds
+};
+
+/// @brief Plays a playlist of streams back to back on the music bus
+/// Upcoming tracks are opened ahead of time through the sound cache, non-blocking, so a switch never waits on I/O.
+/// Each transition is scheduled with setDelay on the bus DSP clock: a gapless start lands on the exact sample the
+/// previous track ends, a crossfade overlaps the two with equal-power fade points. At most openStreams streams
+/// are held at once, the one playing included. Game thread only.
+class MusicScheduler {
+public:
+    static constexpr FMOD_MODE Mode = FMOD_LOOP_OFF | FMOD_CREATESTREAM;
+    static constexpr size_t DefaultOpenStreams = 3; // playing, next and one more being opened
+    static constexpr float Lookahead = 1.0f; // seconds before a boundary the next track is committed to the mixer
+
+    MusicScheduler(FMOD::System* system, SoundCache& sounds, FMOD::ChannelGroup* bus, size_t openStreams = DefaultOpenStreams);
+    ~MusicScheduler();
+
+    MusicScheduler(const MusicScheduler&) = delete;
+    MusicScheduler& operator=(const MusicScheduler&) = delete;
+
+    /// @brief Replace the playlist and stop, a lone track with repeat loops seamlessly
+    void setPlaylist(std::vector<MusicTrack> tracks, bool repeat = true);
+    void add(MusicTrack track);
+    /// @brief Start the first track, false until it has opened
+    bool play();
+    void stop();
+    /// @brief Leave the current track now, with the transition of the next one
+    bool skip();
+    void setPaused(bool paused);
+    bool isPaused() const { return paused; }
+    /// @brief Playback speed of every track, the boundaries are rescheduled for it
+    void setTempo(float tempo);
+
+    /// @brief Open ahead and schedule the next boundary, once per tick
+    void update();
+
+    /// @brief Channel of the track playing, nullptr before play() or between tracks
+    FMOD::Channel* getChannel() const { return current.channel; }
+    size_t getTrack() const { return current.track; }
+    uint64_t getTransitions() const { return transitions; }
+    uint64_t getLateTransitions() const { return late; } // the next stream was not open in time
+
+private:
+    struct Open {
+        size_t track;
+        SoundRef sound;
+    };
+
+    struct Voice {
+        FMOD::Channel* channel{ nullptr };
+        SoundRef sound;
+        size_t track{ SIZE_MAX };
+        float frequency{ 0.0f }; // at tempo 1
+        unsigned long long start{ 0 }; // bus clock
+        unsigned long long end{ 0 }; // bus clock, 0 while looping
+    };
+
+    FMOD::System* system;
+    SoundCache& sounds;
+    FMOD::ChannelGroup* bus;
+    size_t openStreams;
+
+    int outputRate{ 48000 };
+    unsigned long long margin{ 0 }; // clocks a delayed start needs to reach the mixer in time
+
+    std::vector<MusicTrack> tracks;
+    bool repeat{ true };
+    size_t last{ SIZE_MAX }; // last track opened
+    bool playing{ false };
+    bool paused{ false };
+    float tempo{ 1.0f };
+
+    std::deque<Open> opened; // upcoming tracks in play order
+    Voice current;
+    Voice next; // scheduled, not started yet
+    Voice outgoing; // fading out or finishing its last block
+
+    uint64_t transitions{ 0 };
+    uint64_t late{ 0 };
+
+    unsigned long long clock() const;
+    size_t following(size_t track) const;
+    bool isOpen(const std::string& path) const;
+    void prefetch();
+    bool start(Voice& voice, Open& open, unsigned long long at);
+    void schedule(unsigned long long now);
+    void reanchor(unsigned long long now);
+    void release(Voice& voice);
+    unsigned long long remaining(const Voice& voice) const;
+};
@@ -0,0 +1,97 @@
+#include "occlusion.hpp"
+#include "geometrymanager.hpp"
+#include "fmoderror.hpp"
+
+#include <chrono>
+
+OcclusionRaycaster::OcclusionRaycaster(float threshold, double budgetMs) : threshold{threshold}, budgetMs{budgetMs} {
+}
+
+void OcclusionRaycaster::build(const GeometryManager& geometry) {
+    std::vector<PolygonBVH::Polygon> polygons;
+    polygons.reserve(geometry.getPolygonCount());
+    geometry.forEachStaticPolygon([&](const glm::vec3* vertices, int count, const OcclusionMaterial& material) {
+        PolygonBVH::Polygon polygon;
+        std::copy(vertices, vertices + count, polygon.vertices.begin());
+        polygon.count = count;
+        polygon.direct = material.direct;
+        polygon.reverb = material.reverb;
+        polygon.doubleSided = material.doubleSided;
+        polygons.push_back(polygon);
+    });
+    bvh.build(std::move(polygons));
+
+    // Walls moved, every cached ray is stale
+    for (auto& entry : entries) {
+        entry.valid = false;
+    }
+}
+
+void OcclusionRaycaster::update(const glm::vec3& listener, VoicePool& voices) {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(budgetMs));
+    float threshold2 = threshold * threshold;
+
+    uint32_t firstDeferred = UINT32_MAX;
+    bool cast = false;
+
+    for (uint32_t n = 0; n < VoicePool::MaxVoices; n++) {
+        uint32_t index = (cursor + n) % VoicePool::MaxVoices;
+        auto handle = voices.handleAt(index);
+        auto channel = voices.get(handle);
+        if (!channel)
+            continue;
+
+        auto& entry = entries[index];
+        bool fresh = entry.generation != handle.generation;
+        if (fresh) {
+            entry = {};
+            entry.generation = handle.generation;
+        }
+
+        glm::vec3 emitter = voices.getPosition(handle);
+        bool moved = glm::distance2(listener, entry.listener) > threshold2 || glm::distance2(emitter, entry.emitter) > threshold2;
+
+        if (!entry.valid || moved) {
+            // At least one ray per frame, so a tiny budget still makes progress
+            if (cast && std::chrono::steady_clock::now() >= deadline) {
+                if (firstDeferred == UINT32_MAX)
+                    firstDeferred = index;
+                stats.deferred++;
+                continue;
+            }
+
+            entry.target = bvh.occlusion(listener, emitter);
+            entry.listener = listener;
+            entry.emitter = emitter;
+            entry.valid = true;
+            cast = true;
+            stats.casts++;
+        } else {
+            stats.cached++;
+        }
+
+        // New voices start at their result, the rest glide so re-casts do not step audibly
+        auto previous = entry.current;
+        auto glide = [&](float current, float target) {
+            float next = current + (target - current) * smoothing;
+            return fresh || std::abs(target - next) < 1e-3f ? target : next;
+        };
+        entry.current.direct = glide(entry.current.direct, entry.target.direct);
+        entry.current.reverb = glide(entry.current.reverb, entry.target.reverb);
+
+        if (!fresh && entry.current.direct == previous.direct && entry.current.reverb == previous.reverb)
+            continue;
+
+        auto result = channel->set3DOcclusion(entry.current.direct, entry.current.reverb);
+        // The voice may have ended since the pool last looked
+        if (result == FMOD_ERR_INVALID_HANDLE || result == FMOD_ERR_CHANNEL_STOLEN)
+            continue;
+        FMOD_ERROR_(result);
+    }
+
+    if (firstDeferred != UINT32_MAX)
+        cursor = firstDeferred;
+
+    stats.lastUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
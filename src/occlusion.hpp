@@ -0,0 +1,62 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include "bvh.hpp"
+#include "voicepool.hpp"
+
+class GeometryManager;
+
+struct OcclusionStats {
+    uint64_t casts; // rays traced
+    uint64_t cached; // voices served from their last result
+    uint64_t deferred; // voices that needed a ray but ran out of budget
+    double lastUpdateMs;
+};
+
+/// @brief Engine side occlusion, an alternative to FMOD's geometry raycasts
+/// Listener to emitter segments are traced against a BVH of the static occluders, moving occluders
+/// keep their FMOD geometry and FMOD's occlusion stacks with this one. Results are kept
+/// per voice and only re-cast once the listener or the emitter has moved past a threshold, and the
+/// rays that are due are spread over frames under a time budget, so the cost follows movement
+/// instead of voice count. The result goes through Channel::set3DOcclusion, which attenuates and,
+/// with FMOD_INIT_CHANNEL_LOWPASS, also lowpasses the direct path.
+class OcclusionRaycaster {
+public:
+    static constexpr float DefaultThreshold = 0.25f; // metres
+    static constexpr double DefaultBudgetMs = 0.2;
+
+    OcclusionRaycaster(float threshold = DefaultThreshold, double budgetMs = DefaultBudgetMs);
+
+    /// @brief Rebuild the BVH from the static polygons, cached results are re-cast
+    void build(const GeometryManager& geometry);
+
+    void update(const glm::vec3& listener, VoicePool& voices);
+
+    /// @brief Fraction of the way to the new result applied per update, 1 snaps
+    void setSmoothing(float value) { smoothing = value; }
+
+    const PolygonBVH& getBVH() const { return bvh; }
+    OcclusionStats getStats() const { return stats; }
+    void resetStats() { stats = {}; }
+
+private:
+    struct Entry {
+        uint32_t generation{ UINT32_MAX }; // voice the entry was cast for
+        glm::vec3 listener{ 0.0f };
+        glm::vec3 emitter{ 0.0f };
+        PolygonBVH::Occlusion target;
+        PolygonBVH::Occlusion current;
+        bool valid{ false };
+    };
+
+    PolygonBVH bvh;
+    std::array<Entry, VoicePool::MaxVoices> entries;
+    uint32_t cursor{ 0 }; // round robin start, so deferred voices go first next frame
+
+    float threshold;
+    double budgetMs;
+    float smoothing{ 0.25f };
+
+    OcclusionStats stats{};
+};
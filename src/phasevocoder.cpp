@@ -0,0 +1,383 @@
+#include "phasevocoder.hpp"
+#include "fmoderror.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    // Shared across instances, FMOD keeps the pointers
+    FMOD_DSP_PARAMETER_DESC pitchDesc;
+    FMOD_DSP_PARAMETER_DESC glideDesc;
+    FMOD_DSP_PARAMETER_DESC* parameters[PhaseVocoder::ParameterCount] = { &pitchDesc, &glideDesc };
+
+    void describe(FMOD_DSP_PARAMETER_DESC& desc, const char* name, const char* label, const char* description, float min, float max, float value) {
+        memset(&desc, 0, sizeof(desc));
+        desc.type = FMOD_DSP_PARAMETER_TYPE_FLOAT;
+        std::strncpy(desc.name, name, sizeof(desc.name) - 1);
+        std::strncpy(desc.label, label, sizeof(desc.label) - 1);
+        desc.description = description;
+        desc.floatdesc.min = min;
+        desc.floatdesc.max = max;
+        desc.floatdesc.defaultval = value;
+        desc.floatdesc.mapping.type = FMOD_DSP_PARAMETER_FLOAT_MAPPING_TYPE_LINEAR;
+    }
+
+    constexpr float TwoPi = 6.28318531f;
+
+    constexpr float Pi = 3.14159265f;
+    constexpr float HalfPi = 1.57079633f;
+
+    // Into [-pi, pi], phases are kept small so float precision does not wear off over a long song
+    float wrap(float phase) {
+        return phase - TwoPi * std::nearbyint(phase / TwoPi);
+    }
+
+    // Branch free polynomial versions, about 1e-5 rad and 1e-6 off, several times cheaper than libm
+    // on the thousands of bins a hop converts
+    float fastAtan2(float y, float x) {
+        float ax = std::abs(x);
+        float ay = std::abs(y);
+        float a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+        float s = a * a;
+        float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+        r = ay > ax ? HalfPi - r : r;
+        r = x < 0.0f ? Pi - r : r;
+        return y < 0.0f ? -r : r;
+    }
+
+    // phase in [-pi, pi]
+    void fastSinCos(float phase, float& sine, float& cosine) {
+        // Fold into [-pi / 2, pi / 2] where the polynomials are accurate, cosine flips sign with the fold
+        float folded = phase > HalfPi ? Pi - phase : (phase < -HalfPi ? -Pi - phase : phase);
+        float sign = folded != phase ? -1.0f : 1.0f;
+        float s = folded * folded;
+        sine = folded * (1.0f + s * (-0.166666546f + s * (0.00833216076f + s * -0.000195152959f)));
+        cosine = sign * (1.0f + s * (-0.5f + s * (0.0416666418f + s * (-0.00138867637f + s * 0.0000244332f))));
+    }
+}
+
+PhaseVocoder::PhaseVocoder(int sampleRate) : fft{FFTSize}, sampleRate{sampleRate} {
+    // Everything the mixer thread touches is sized here
+    window.resize(FFTSize);
+    for (size_t n = 0; n < FFTSize; n++) {
+        window[n] = 0.5f - 0.5f * std::cos(TwoPi * static_cast<float>(n) / static_cast<float>(FFTSize));
+    }
+    inputLeft.assign(FFTSize, 0.0f);
+    inputRight.assign(FFTSize, 0.0f);
+    outputLeft.assign(FFTSize, 0.0f);
+    outputRight.assign(FFTSize, 0.0f);
+    readyLeft.assign(Hop, 0.0f);
+    readyRight.assign(Hop, 0.0f);
+    re.resize(FFTSize);
+    im.resize(FFTSize);
+    peaks.reserve(Bins);
+    surround.assign(FFTSize * (MaxChannels - 2), 0.0f);
+    for (auto& channel : channels) {
+        channel.magnitude.assign(Bins, 0.0f);
+        channel.phase.assign(Bins, 0.0f);
+        channel.lastPhase.assign(Bins, 0.0f);
+        channel.advance.assign(Bins, 0.0f);
+        channel.shiftedMagnitude.assign(Bins, 0.0f);
+        channel.shiftedAdvance.assign(Bins, 0.0f);
+        channel.source.assign(Bins, -1);
+        channel.synthesisPhase.assign(Bins, 0.0f);
+    }
+}
+
+FMOD::DSP* PhaseVocoder::createDSP(FMOD::System* system) {
+    describe(pitchDesc, "Pitch", "st", "Pitch shift in semitones", -24.0f, 24.0f, 0.0f);
+    describe(glideDesc, "Glide", "s", "Seconds to close most of a pitch change", 0.001f, 2.0f, 0.05f);
+
+    FMOD_DSP_DESCRIPTION dspdesc;
+    memset(&dspdesc, 0, sizeof(dspdesc));
+    std::strcpy(dspdesc.name, "DSP Phase Vocoder");
+
+    dspdesc.numinputbuffers = 1;
+    dspdesc.numoutputbuffers = 1;
+    dspdesc.read = readCallback;
+    dspdesc.reset = resetCallback;
+    dspdesc.numparameters = ParameterCount;
+    dspdesc.paramdesc = parameters;
+    dspdesc.setparameterfloat = setFloatCallback;
+    dspdesc.getparameterfloat = getFloatCallback;
+    dspdesc.userdata = this;
+
+    FMOD::DSP* dsp;
+    auto result = system->createDSP(&dspdesc, &dsp);
+    FMOD_ERROR_RETURN(result, nullptr);
+    return dsp;
+}
+
+PhaseVocoder* PhaseVocoder::fromDSP(FMOD::DSP* dsp) {
+    void* userdata = nullptr;
+    if (!dsp || dsp->getUserData(&userdata) != FMOD_OK)
+        return nullptr;
+    return static_cast<PhaseVocoder*>(userdata);
+}
+
+void PhaseVocoder::reset() {
+    std::fill(inputLeft.begin(), inputLeft.end(), 0.0f);
+    std::fill(inputRight.begin(), inputRight.end(), 0.0f);
+    std::fill(outputLeft.begin(), outputLeft.end(), 0.0f);
+    std::fill(outputRight.begin(), outputRight.end(), 0.0f);
+    std::fill(readyLeft.begin(), readyLeft.end(), 0.0f);
+    std::fill(readyRight.begin(), readyRight.end(), 0.0f);
+    std::fill(surround.begin(), surround.end(), 0.0f);
+    for (auto& channel : channels) {
+        std::fill(channel.lastPhase.begin(), channel.lastPhase.end(), 0.0f);
+        std::fill(channel.synthesisPhase.begin(), channel.synthesisPhase.end(), 0.0f);
+    }
+    fill = 0;
+    surroundPosition = 0;
+    current = 0.0f; // a shift set after the reset glides in
+    shifting.store(current, std::memory_order_relaxed);
+}
+
+void PhaseVocoder::process(const float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels) {
+    float* newestLeft = inputLeft.data() + FFTSize - Hop;
+    float* newestRight = inputRight.data() + FFTSize - Hop;
+
+    for (unsigned int frame = 0; frame < length; frame++) {
+        const float* in = inbuffer + frame * inchannels;
+        float* out = outbuffer + frame * outchannels;
+
+        newestLeft[fill] = in[0];
+        newestRight[fill] = inchannels > 1 ? in[1] : in[0];
+
+        float left = readyLeft[fill];
+        float right = readyRight[fill];
+        if (outchannels == 1) {
+            out[0] = (left + right) * 0.5f;
+        } else {
+            out[0] = left;
+            out[1] = right;
+        }
+
+        // Centre, LFE and surrounds are not shifted, only held back as long as the pair
+        float* held = surround.data() + surroundPosition * (MaxChannels - 2);
+        for (int channel = 2; channel < outchannels; channel++) {
+            if (channel >= MaxChannels) {
+                out[channel] = 0.0f;
+                continue;
+            }
+            out[channel] = held[channel - 2];
+            held[channel - 2] = channel < inchannels ? in[channel] : 0.0f;
+        }
+        surroundPosition = surroundPosition + 1 == FFTSize ? 0 : surroundPosition + 1;
+
+        if (++fill == Hop) {
+            processHop();
+            fill = 0;
+        }
+    }
+}
+
+void PhaseVocoder::processHop() {
+    // Frame rotated by half so its centre is at time 0, a partial's bins are then in phase with each
+    // other and keep that relation however far the shift spreads or squeezes them
+    constexpr size_t Half = FFTSize / 2;
+    for (size_t n = 0; n < FFTSize; n++) {
+        size_t from = (n + Half) & (FFTSize - 1);
+        re[n] = inputLeft[from] * window[from];
+        im[n] = inputRight[from] * window[from];
+    }
+    fft.forward(re.data(), im.data());
+
+    // Both real spectra out of the packed one: L = (Z[k] + conj Z[N - k]) / 2, R = (Z[k] - conj Z[N - k]) / 2i
+    auto& left = channels[0];
+    auto& right = channels[1];
+    for (size_t k = 0; k < Bins; k++) {
+        size_t mirror = (FFTSize - k) & (FFTSize - 1);
+        float lre = 0.5f * (re[k] + re[mirror]);
+        float lim = 0.5f * (im[k] - im[mirror]);
+        float rre = 0.5f * (im[k] + im[mirror]);
+        float rim = 0.5f * (re[mirror] - re[k]);
+        left.magnitude[k] = std::sqrt(lre * lre + lim * lim);
+        left.phase[k] = fastAtan2(lim, lre);
+        right.magnitude[k] = std::sqrt(rre * rre + rim * rim);
+        right.phase[k] = fastAtan2(rim, rre);
+    }
+    analyse(left);
+    analyse(right);
+
+    // Glide in semitones, snapping once close enough that the rest is inaudible
+    float target = pitch.load(std::memory_order_relaxed);
+    float seconds = std::max(glide.load(std::memory_order_relaxed), 0.001f);
+    current += (target - current) * (1.0f - std::exp(-static_cast<float>(Hop) / (seconds * static_cast<float>(sampleRate))));
+    if (std::abs(target - current) < 0.01f)
+        current = target;
+    shifting.store(current, std::memory_order_relaxed);
+
+    // Hann analysis and synthesis at 4x overlap sum to 1.5
+    constexpr float Scale = 1.0f / 1.5f;
+
+    if (current == 0.0f) {
+        // Unshifted the resynthesis is the windowed input itself, skip it and start any later shift from these phases
+        std::copy(left.phase.begin(), left.phase.end(), left.synthesisPhase.begin());
+        std::copy(right.phase.begin(), right.phase.end(), right.synthesisPhase.begin());
+        for (size_t n = 0; n < FFTSize; n++) {
+            float weight = window[n] * window[n] * Scale;
+            outputLeft[n] += inputLeft[n] * weight;
+            outputRight[n] += inputRight[n] * weight;
+        }
+    } else {
+        float ratio = std::exp2(current / 12.0f);
+        shift(left, ratio);
+        shift(right, ratio);
+
+        // Hermitian spectra packed back as L + i * R, the inverse then gives left in re and right in im
+        for (size_t k = 0; k < Bins; k++) {
+            float lcos, lsin, rcos, rsin;
+            fastSinCos(left.synthesisPhase[k], lsin, lcos);
+            fastSinCos(right.synthesisPhase[k], rsin, rcos);
+            float a = left.shiftedMagnitude[k] * lcos;
+            float b = left.shiftedMagnitude[k] * lsin;
+            float c = right.shiftedMagnitude[k] * rcos;
+            float d = right.shiftedMagnitude[k] * rsin;
+            if (k == 0 || k == Half) {
+                re[k] = a;
+                im[k] = c;
+                continue;
+            }
+            re[k] = a - d;
+            im[k] = b + c;
+            re[FFTSize - k] = a + d;
+            im[FFTSize - k] = c - b;
+        }
+        fft.inverse(re.data(), im.data());
+
+        for (size_t n = 0; n < FFTSize; n++) {
+            size_t from = (n + Half) & (FFTSize - 1);
+            outputLeft[n] += re[from] * window[n] * Scale;
+            outputRight[n] += im[from] * window[n] * Scale;
+        }
+    }
+
+    std::copy(outputLeft.begin(), outputLeft.begin() + Hop, readyLeft.begin());
+    std::copy(outputRight.begin(), outputRight.begin() + Hop, readyRight.begin());
+    std::copy(outputLeft.begin() + Hop, outputLeft.end(), outputLeft.begin());
+    std::copy(outputRight.begin() + Hop, outputRight.end(), outputRight.begin());
+    std::fill(outputLeft.end() - Hop, outputLeft.end(), 0.0f);
+    std::fill(outputRight.end() - Hop, outputRight.end(), 0.0f);
+
+    std::copy(inputLeft.begin() + Hop, inputLeft.end(), inputLeft.begin());
+    std::copy(inputRight.begin() + Hop, inputRight.end(), inputRight.begin());
+}
+
+void PhaseVocoder::analyse(Channel& channel) {
+    // True frequency as the phase advance per hop, the expected advance of the bin plus the wrapped deviation
+    const float expected = TwoPi * static_cast<float>(Hop) / static_cast<float>(FFTSize);
+    for (size_t k = 0; k < Bins; k++) {
+        float bin = expected * static_cast<float>(k);
+        channel.advance[k] = bin + wrap(channel.phase[k] - channel.lastPhase[k] - bin);
+        channel.lastPhase[k] = channel.phase[k];
+    }
+}
+
+void PhaseVocoder::shift(Channel& channel, float ratio) {
+    std::fill(channel.shiftedMagnitude.begin(), channel.shiftedMagnitude.end(), 0.0f);
+    std::fill(channel.source.begin(), channel.source.end(), -1);
+
+    if (ratio > 1.0f) {
+        // Upwards every shifted bin reads back from frequency / ratio, so the stretched spectrum has no holes
+        for (size_t j = 0; j < Bins; j++) {
+            float position = static_cast<float>(j) / ratio;
+            size_t k = static_cast<size_t>(position);
+            float t = position - static_cast<float>(k);
+            size_t above = std::min(k + 1, Bins - 1);
+            int nearest = static_cast<int>(t < 0.5f ? k : above);
+            channel.shiftedMagnitude[j] = channel.magnitude[k] + (channel.magnitude[above] - channel.magnitude[k]) * t;
+            channel.source[j] = nearest;
+            channel.shiftedAdvance[j] = channel.advance[nearest] * ratio;
+        }
+    } else {
+        // Downwards bins fold together, the loudest contributor owns the phase
+        for (size_t k = 0; k < Bins; k++) {
+            size_t target = static_cast<size_t>(std::lround(static_cast<float>(k) * ratio));
+            channel.shiftedMagnitude[target] += channel.magnitude[k];
+            int owner = channel.source[target];
+            if (owner < 0 || channel.magnitude[k] > channel.magnitude[owner]) {
+                channel.source[target] = static_cast<int>(k);
+                channel.shiftedAdvance[target] = channel.advance[k] * ratio;
+            }
+        }
+    }
+
+    // Peaks advance at their own frequency
+    peaks.clear();
+    const auto& magnitude = channel.shiftedMagnitude;
+    for (size_t j = 0; j < Bins; j++) {
+        float value = magnitude[j];
+        if (value <= 0.0f)
+            continue;
+        bool peak = true;
+        for (size_t n = j >= 2 ? j - 2 : 0; n <= std::min(j + 2, Bins - 1) && peak; n++) {
+            peak = n == j || magnitude[n] < value || (magnitude[n] == value && n > j);
+        }
+        if (peak) {
+            peaks.push_back(static_cast<int>(j));
+            channel.synthesisPhase[j] = wrap(channel.synthesisPhase[j] + channel.shiftedAdvance[j]);
+        }
+    }
+
+    // The rest keep the analysis phase relation to the peak of their region, boundaries halfway between peaks
+    size_t next = 0;
+    for (size_t j = 0; j < Bins; j++) {
+        if (peaks.empty() || channel.source[j] < 0) {
+            channel.synthesisPhase[j] = wrap(channel.synthesisPhase[j] + channel.shiftedAdvance[j]);
+            continue;
+        }
+        while (next + 1 < peaks.size() && static_cast<int>(j) * 2 > peaks[next] + peaks[next + 1]) {
+            next++;
+        }
+        int peak = peaks[next];
+        if (peak == static_cast<int>(j))
+            continue;
+        channel.synthesisPhase[j] = wrap(channel.synthesisPhase[peak] + channel.phase[channel.source[j]] - channel.phase[channel.source[peak]]);
+    }
+}
+
+FMOD_RESULT F_CALLBACK PhaseVocoder::resetCallback(FMOD_DSP_STATE* dsp_state) {
+    if (auto vocoder = fromDSP(static_cast<FMOD::DSP*>(dsp_state->instance)))
+        vocoder->reset();
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK PhaseVocoder::readCallback(FMOD_DSP_STATE* dsp_state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int* outchannels) {
+    auto vocoder = fromDSP(static_cast<FMOD::DSP*>(dsp_state->instance));
+    vocoder->process(inbuffer, outbuffer, length, inchannels, *outchannels);
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK PhaseVocoder::setFloatCallback(FMOD_DSP_STATE* dsp_state, int index, float value) {
+    auto vocoder = fromDSP(static_cast<FMOD::DSP*>(dsp_state->instance));
+    switch (index) {
+        case Pitch:
+            vocoder->pitch.store(value, std::memory_order_relaxed);
+            return FMOD_OK;
+        case Glide:
+            vocoder->glide.store(value, std::memory_order_relaxed);
+            return FMOD_OK;
+        default:
+            return FMOD_ERR_INVALID_PARAM;
+    }
+}
+
+FMOD_RESULT F_CALLBACK PhaseVocoder::getFloatCallback(FMOD_DSP_STATE* dsp_state, int index, float* value, char* valuestr) {
+    auto vocoder = fromDSP(static_cast<FMOD::DSP*>(dsp_state->instance));
+    switch (index) {
+        case Pitch:
+            *value = vocoder->pitch.load(std::memory_order_relaxed);
+            break;
+        case Glide:
+            *value = vocoder->glide.load(std::memory_order_relaxed);
+            break;
+        default:
+            return FMOD_ERR_INVALID_PARAM;
+    }
+    if (valuestr)
+        snprintf(valuestr, FMOD_DSP_GETPARAM_VALUESTR_LENGTH, "%.2f", *value);
+    return FMOD_OK;
+}
@@ -0,0 +1,363 @@
+#include "replay.hpp"
+#include "audio.hpp"
+
+#include <chrono>
+#include <iomanip>
+
+namespace {
+    struct ReplayOptions {
+        std::string traceFile;
+        std::string wavFile;
+        std::string profileLog;
+        uint64_t records{ UINT64_MAX }; // stop after this many, halve it to bisect a spike
+        size_t spikes{ 10 }; // slowest steps reported
+        std::array<bool, static_cast<size_t>(TraceOp::Count)> skip{}; // ops left out of the replay
+    };
+
+    ReplayOptions parseOptions(int argc, char** argv) {
+        ReplayOptions options;
+        for (int i = 1; i < argc; i++) {
+            std::string arg{ argv[i] };
+            bool value = i + 1 < argc;
+            if (arg == "--replay" && value)
+                options.traceFile = argv[++i];
+            else if (arg == "--wav" && value)
+                options.wavFile = argv[++i];
+            else if (arg == "--profile-log" && value)
+                options.profileLog = argv[++i];
+            else if (arg == "--records" && value)
+                options.records = std::strtoull(argv[++i], nullptr, 10);
+            else if (arg == "--spikes" && value)
+                options.spikes = static_cast<size_t>(std::atoi(argv[++i]));
+            else if (arg == "--skip" && value) {
+                std::string name{ argv[++i] };
+                for (size_t op = 1; op < options.skip.size(); op++) {
+                    if (name == toString(static_cast<TraceOp>(op)))
+                        options.skip[op] = true;
+                }
+            }
+        }
+        return options;
+    }
+
+    /// @brief One timed step of the replay, a call or a block mixed between calls
+    struct ReplayStep {
+        double ms;
+        uint64_t record; // index of the record applied, or about to be
+        uint64_t time; // trace microseconds
+        TraceOp op;
+        bool mix; // a block mixed to catch up with the trace clock
+    };
+
+    struct OpCost {
+        uint64_t count{ 0 };
+        double totalMs{ 0.0 };
+        double maxMs{ 0.0 };
+    };
+
+    uint64_t voiceKey(VoiceHandle voice) {
+        return static_cast<uint64_t>(voice.generation) << 32 | voice.index;
+    }
+}
+
+int runReplay(int argc, char** argv) {
+    auto options = parseOptions(argc, argv);
+
+    AudioTraceReader reader;
+    TraceHeader header;
+    if (options.traceFile.empty() || !reader.open(options.traceFile, header))
+        return EXIT_FAILURE;
+
+    AudioSettings settings;
+    settings.output = options.wavFile.empty() ? FMOD_OUTPUTTYPE_NOSOUND_NRT : FMOD_OUTPUTTYPE_WAVWRITER_NRT;
+    settings.outputFile = options.wavFile;
+    settings.profile = true;
+    settings.profileLog = options.profileLog;
+    settings.engineOcclusion = header.engineOcclusion;
+    settings.binaural = header.binaural;
+    settings.hrirFile = header.hrirFile;
+    settings.meters = header.meters;
+    settings.lod = header.lod;
+    settings.soundBudget = header.soundBudget;
+    settings.readAhead = header.readAhead;
+    settings.samplePool = header.samplePool;
+    settings.sampleRate = header.sampleRate;
+    settings.blockLength = header.blockLength;
+
+    Audio audio{ settings };
+    auto system = audio.getSystem();
+
+    FMOD::ChannelGroup* master;
+    system->getMasterChannelGroup(&master);
+    auto clock = [master]() {
+        unsigned long long value = 0;
+        master->getDSPClock(&value, nullptr);
+        return static_cast<uint64_t>(value);
+    };
+
+    unsigned int blockLength;
+    system->getDSPBufferSize(&blockLength, nullptr);
+    int sampleRate;
+    system->getSoftwareFormat(&sampleRate, nullptr, nullptr);
+    if (sampleRate != header.sampleRate || blockLength != header.blockLength) {
+        std::cerr << "Recorded at " << header.sampleRate << " Hz in blocks of " << header.blockLength << ", replaying at "
+                  << sampleRate << " Hz in blocks of " << blockLength << ", timings will not line up" << std::endl;
+    }
+
+    // Top spikes in a min heap, the cheapest of them is the one to replace
+    auto slower = [](const ReplayStep& a, const ReplayStep& b) { return a.ms > b.ms; };
+    std::vector<ReplayStep> spikes;
+    auto measure = [&](const ReplayStep& step) {
+        if (options.spikes == 0)
+            return;
+        if (spikes.size() < options.spikes) {
+            spikes.push_back(step);
+            std::push_heap(spikes.begin(), spikes.end(), slower);
+        } else if (step.ms > spikes.front().ms) {
+            std::pop_heap(spikes.begin(), spikes.end(), slower);
+            spikes.back() = step;
+            std::push_heap(spikes.begin(), spikes.end(), slower);
+        }
+    };
+    auto elapsedMs = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    };
+
+    std::array<OpCost, static_cast<size_t>(TraceOp::Count)> costs{};
+    OpCost mixing;
+    std::unordered_map<uint64_t, VoiceHandle> voices; // recorded handle -> replayed handle
+    std::unordered_map<uint32_t, uint32_t> owners; // recorded static owner -> replayed one
+    std::unordered_map<uint32_t, uint32_t> dynamics; // recorded dynamic id -> replayed one
+    std::vector<ConvolutionReverb::Zone> zones;
+    std::vector<EmitterUpdate> updates;
+    uint64_t unresolved = 0; // plays of sounds the replay cannot open, synths and captures among them
+    uint64_t folded = 0; // updates whose block was already mixed
+    uint64_t skipped = 0;
+    uint64_t records = 0;
+    uint64_t lastTime = 0;
+    uint64_t base = UINT64_MAX; // first recorded clock
+    uint64_t origin = clock();
+
+    auto mapVoice = [&voices](VoiceHandle recorded) {
+        auto it = voices.find(voiceKey(recorded));
+        return it != voices.end() ? it->second : VoiceHandle{};
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    TraceRecord record;
+    while (records < options.records && reader.next(record)) {
+        if (base == UINT64_MAX)
+            base = record.clock;
+        uint64_t target = origin + (record.clock - base);
+        lastTime = record.time;
+
+        if (options.skip[static_cast<size_t>(record.op)]) {
+            skipped++;
+            records++;
+            continue;
+        }
+
+        // Blocks the recording mixed before this call, without a game update in between
+        while (clock() + blockLength <= target) {
+            auto begin = std::chrono::steady_clock::now();
+            system->update();
+            double ms = elapsedMs(begin);
+            mixing.count++;
+            mixing.totalMs += ms;
+            mixing.maxMs = std::max(mixing.maxMs, ms);
+            measure({ ms, records, record.time, record.op, true });
+        }
+
+        // Every update mixes a block on a non-realtime output, one the replay is already past
+        // would run the mix ahead of the trace, its listener is picked up by the next update instead
+        if (record.op == TraceOp::Update && clock() > target) {
+            folded++;
+            records++;
+            continue;
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        switch (record.op) {
+            case TraceOp::Update:
+                audio.update(record.vectors[0], record.vectors[1], record.vectors[2], record.vectors[3]);
+                break;
+            case TraceOp::MountBank:
+                audio.mountBank(record.name);
+                break;
+            case TraceOp::LoadSound:
+                audio.loadSound(record.name, record.value);
+                break;
+            case TraceOp::LoadSoundAsync:
+                audio.loadSoundAsync(record.name, {}, record.value);
+                break;
+            case TraceOp::PlaySound: {
+                // Cache keys are path|mode, anything else was adopted from a generator the replay does not have
+                auto split = record.name.rfind('|');
+                if (split == std::string::npos) {
+                    unresolved++;
+                    break;
+                }
+                auto mode = static_cast<FMOD_MODE>(std::strtoul(record.name.c_str() + split + 1, nullptr, 10));
+                auto sound = audio.getSoundCache().load(record.name.substr(0, split), mode);
+                if (!sound.isReady()) {
+                    unresolved++;
+                    break;
+                }
+                auto bus = record.bus.empty() ? nullptr : audio.getMixer().getGroup(record.bus);
+                auto voice = audio.playSound(sound, record.vectors[0], record.scalar, record.index, record.flag, bus);
+                voices[voiceKey(record.voice)] = voice;
+                break;
+            }
+            case TraceOp::StopSound:
+                audio.stopSound(mapVoice(record.voice));
+                break;
+            case TraceOp::ToggleSound:
+                audio.toggleSound(mapVoice(record.voice));
+                break;
+            case TraceOp::SetEmitter:
+                audio.setSoundPositionAndVelocity(mapVoice(record.voice), record.vectors[0], record.vectors[1]);
+                break;
+            case TraceOp::SetEmitters:
+                updates.clear();
+                for (const auto& update : record.emitters) {
+                    updates.push_back({ mapVoice(update.voice), update.position, update.velocity });
+                }
+                audio.setSoundPositionsAndVelocities(updates);
+                break;
+            case TraceOp::LoadMusicStream:
+                audio.loadMusicStream(record.name);
+                break;
+            case TraceOp::LoadMusicStreamAsync:
+                audio.loadMusicStreamAsync(record.name, {});
+                break;
+            case TraceOp::PlayMusicStream:
+                audio.playMusicStream();
+                break;
+            case TraceOp::ToggleMusicStream:
+                audio.toggleMusicStream();
+                break;
+            case TraceOp::SetMusicTempo:
+                audio.setMusicTempo(record.scalar);
+                break;
+            case TraceOp::SetMusicPitch:
+                audio.setMusicPitch(record.scalar);
+                break;
+            case TraceOp::MusicKey:
+                audio.applyMusicKey(static_cast<int>(record.value));
+                break;
+            case TraceOp::ToggleFilter:
+                audio.toggleFilter(static_cast<AudioFilter>(record.value));
+                break;
+            case TraceOp::CreateGeometry:
+                audio.createGeometry({ record.vectors[1].x, record.vectors[1].y }, record.vectors[0], record.rotation);
+                break;
+            case TraceOp::SetDSPParameter: {
+                auto dsps = audio.getDSPs();
+                if (record.value < dsps.size())
+                    audio.setDSPParameter(dsps[record.value], record.index, record.scalar);
+                break;
+            }
+            case TraceOp::AddStaticGeometry:
+                owners[record.value] = audio.getGeometry().addStatic(record.polygons);
+                break;
+            case TraceOp::AddDynamicGeometry:
+                dynamics[record.value] = audio.getGeometry().addDynamic(record.polygons);
+                break;
+            case TraceOp::SetGeometryTransform: {
+                auto it = dynamics.find(record.value);
+                if (it != dynamics.end())
+                    audio.getGeometry().setTransform(it->second, record.vectors[0], record.rotation, record.vectors[1]);
+                break;
+            }
+            case TraceOp::RemoveStaticGeometry: {
+                auto it = owners.find(record.value);
+                if (it != owners.end()) {
+                    audio.getGeometry().removeStatic(it->second);
+                    owners.erase(it);
+                }
+                break;
+            }
+            case TraceOp::RemoveDynamicGeometry: {
+                auto it = dynamics.find(record.value);
+                if (it != dynamics.end()) {
+                    audio.getGeometry().removeDynamic(it->second);
+                    dynamics.erase(it);
+                }
+                break;
+            }
+            case TraceOp::SetReverbZones: {
+                // Generated responses come back from their seed, the rest from their file
+                zones.clear();
+                auto& impulses = audio.getImpulseResponses();
+                for (const auto& zone : record.zones) {
+                    auto impulse = zone.rt60 > 0.0f ? impulses.generate(zone.name, zone.rt60, zone.seed) : impulses.load(zone.name);
+                    if (impulse)
+                        zones.push_back({ impulse, zone.weight });
+                }
+                audio.setReverbZones(zones);
+                break;
+            }
+            default:
+                break;
+        }
+        double ms = elapsedMs(begin);
+        auto& cost = costs[static_cast<size_t>(record.op)];
+        cost.count++;
+        cost.totalMs += ms;
+        cost.maxMs = std::max(cost.maxMs, ms);
+        measure({ ms, records, record.time, record.op, false });
+        records++;
+    }
+
+    // A trace cut short by a crash still replays up to the crash, which is usually the part of interest
+    if (reader.failed())
+        std::cerr << "Trace damaged after record " << records << ", replayed what came before it" << std::endl;
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double mixed = static_cast<double>(clock() - origin) / sampleRate;
+    double realtime = wall > 0.0 ? mixed / wall : 0.0;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Replayed " << records << " records, " << static_cast<double>(lastTime) * 1e-6 << " s of trace, mixed " << mixed << " s in " << wall
+              << " s (" << realtime << "x realtime), " << folded << " updates folded, " << skipped << " skipped, " << unresolved << " unresolved plays" << std::endl;
+
+    FMOD_CPU_USAGE usage;
+    if (system->getCPUUsage(&usage) == FMOD_OK) {
+        std::cout << "CPU: dsp " << usage.dsp << "% stream " << usage.stream << "% geometry " << usage.geometry
+                  << "% update " << usage.update << "%" << std::endl;
+    }
+
+    // Where the time went per call, the updates carry the mix of their block
+    std::cout << std::left << std::setw(24) << "Op" << std::right << std::setw(10) << "count" << std::setw(14) << "total ms" << std::setw(12) << "max ms" << std::endl;
+    for (size_t op = 1; op < costs.size(); op++) {
+        if (!costs[op].count)
+            continue;
+        std::cout << std::left << std::setw(24) << toString(static_cast<TraceOp>(op)) << std::right << std::setw(10) << costs[op].count
+                  << std::setw(14) << costs[op].totalMs << std::setw(12) << costs[op].maxMs << std::endl;
+    }
+    if (mixing.count) {
+        std::cout << std::left << std::setw(24) << "(mix between calls)" << std::right << std::setw(10) << mixing.count
+                  << std::setw(14) << mixing.totalMs << std::setw(12) << mixing.maxMs << std::endl;
+    }
+
+    // Slowest first, replay with --records just past one to stop there
+    std::sort(spikes.begin(), spikes.end(), [](const ReplayStep& a, const ReplayStep& b) { return a.ms > b.ms; });
+    for (const auto& spike : spikes) {
+        std::cout << "Spike: " << std::setprecision(3) << spike.ms << " ms " << (spike.mix ? "mixing before " : "in ") << toString(spike.op)
+                  << ", record " << spike.record << " at " << static_cast<double>(spike.time) * 1e-6 << " s" << std::endl;
+    }
+    std::cout << std::setprecision(2);
+
+    std::cout << std::left << std::setw(24) << "DSP" << std::right << std::setw(14) << "exclusive us" << std::setw(14) << "inclusive us" << std::endl;
+    for (auto dsp : audio.getDSPs()) {
+        char name[32];
+        unsigned int exclusive = 0;
+        unsigned int inclusive = 0;
+        dsp->getInfo(name, nullptr, nullptr, nullptr, nullptr);
+        dsp->getCPUUsage(&exclusive, &inclusive);
+        std::cout << std::left << std::setw(24) << name << std::right << std::setw(14) << exclusive << std::setw(14) << inclusive << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+/// @brief Drive a non-realtime FMOD output from an Audio trace and report where the time went
+/// The graph is rebuilt with the recorded settings and block size, calls are applied on the recorded
+/// DSP clock, so a CPU spike captured in the field shows up on the same block offline.
+/// Usage: --replay trace.bin [--wav file.wav] [--records N] [--skip op] [--spikes N] [--profile-log file]
+int runReplay(int argc, char** argv);
@@ -0,0 +1,52 @@
+#include "reverbzones.hpp"
+#include "components.hpp"
+#include "audio.hpp"
+
+void ReverbZoneSystem::update(entt::registry& registry, const glm::vec3& listener, Audio& audio) {
+    zones.clear();
+
+    auto view = registry.view<ReverbZoneComponent, TransformComponent>();
+    for (auto entity : view) {
+        auto [zone, transform] = view.get<ReverbZoneComponent, TransformComponent>(entity);
+        if (!zone.impulse)
+            continue;
+
+        glm::vec3 local = glm::inverse(transform.rotation) * (listener - transform.translation);
+        float outside = glm::length(glm::max(glm::abs(local) - zone.extents, glm::vec3{ 0.0f }));
+        float weight = zone.blend > 0.0f ? 1.0f - outside / zone.blend : (outside > 0.0f ? 0.0f : 1.0f);
+        if (weight <= 0.0f)
+            continue;
+
+        // Zones sharing a response add up instead of taking both slots
+        auto same = std::find_if(zones.begin(), zones.end(), [&](const auto& other) { return other.impulse == zone.impulse; });
+        if (same != zones.end())
+            same->weight = std::min(1.0f, same->weight + weight);
+        else
+            zones.push_back({ zone.impulse, weight });
+    }
+
+    std::sort(zones.begin(), zones.end(), [](const auto& a, const auto& b) { return a.weight > b.weight; });
+    if (zones.size() > ConvolutionReverb::Slots)
+        zones.resize(ConvolutionReverb::Slots);
+
+    float total = 0.0f;
+    for (const auto& zone : zones) {
+        total += zone.weight;
+    }
+    if (total > 1.0f) {
+        for (auto& zone : zones) {
+            zone.weight /= total;
+        }
+    }
+
+    // Most frames the listener stands still, skip the hand off
+    bool changed = zones.size() != published.size();
+    for (size_t i = 0; !changed && i < zones.size(); i++) {
+        changed = zones[i].impulse != published[i].impulse || std::abs(zones[i].weight - published[i].weight) > 1e-3f;
+    }
+    if (!changed)
+        return;
+
+    audio.setReverbZones(zones);
+    published = zones;
+}
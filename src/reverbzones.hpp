@@ -0,0 +1,19 @@
+#pragma once
+
+#include <entt/entity/registry.hpp>
+
+#include "convolution.hpp"
+
+class Audio;
+
+/// @brief Weighs reverb zones by listener position and hands the two strongest to the convolution DSP
+/// Weights are 1 inside a zone and fall off linearly over its blend distance, overlapping zones
+/// share the weight, so walking from one room to the next crossfades their responses.
+class ReverbZoneSystem {
+public:
+    void update(entt::registry& registry, const glm::vec3& listener, Audio& audio);
+
+private:
+    std::vector<ConvolutionReverb::Zone> zones;
+    std::vector<ConvolutionReverb::Zone> published;
+};
@@ -0,0 +1,137 @@
+#include "soundbank.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bank {
+    uint64_t hash(std::string_view name) {
+        uint64_t value = 0xcbf29ce484222325ull;
+        for (char c : name) {
+            value ^= static_cast<uint8_t>(c == '\\' ? '/' : c);
+            value *= 0x100000001b3ull;
+        }
+        return value;
+    }
+
+    Codec codecFromExtension(std::string_view path) {
+        auto dot = path.rfind('.');
+        if (dot == std::string_view::npos)
+            return Codec::Unknown;
+
+        std::string extension{ path.substr(dot + 1) };
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        if (extension == "wav")
+            return Codec::Wav;
+        if (extension == "mp3")
+            return Codec::Mp3;
+        if (extension == "ogg")
+            return Codec::Ogg;
+        if (extension == "flac")
+            return Codec::Flac;
+        if (extension == "aif" || extension == "aiff")
+            return Codec::Aiff;
+        return Codec::Unknown;
+    }
+}
+
+std::unique_ptr<SoundBank> SoundBank::mount(const std::string& path) {
+    std::unique_ptr<SoundBank> soundBank{ new SoundBank };
+    soundBank->path = path;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Failed to open sound bank " << path << std::endl;
+        return nullptr;
+    }
+    soundBank->file = file;
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    soundBank->size = static_cast<size_t>(size.QuadPart);
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        std::cerr << "Failed to map sound bank " << path << std::endl;
+        return nullptr;
+    }
+    soundBank->mapping = mapping;
+    soundBank->base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open sound bank " << path << std::endl;
+        return nullptr;
+    }
+
+    struct stat info{};
+    fstat(fd, &info);
+    soundBank->size = static_cast<size_t>(info.st_size);
+
+    // The mapping keeps the file alive, the descriptor is not needed afterwards
+    void* memory = soundBank->size ? mmap(nullptr, soundBank->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (memory != MAP_FAILED)
+        soundBank->base = static_cast<const uint8_t*>(memory);
+#endif
+
+    if (!soundBank->base) {
+        std::cerr << "Failed to map sound bank " << path << std::endl;
+        return nullptr;
+    }
+
+    // Validate the header and index before handing out pointers into the mapping
+    auto header = reinterpret_cast<const bank::Header*>(soundBank->base);
+    if (soundBank->size < sizeof(bank::Header) || header->magic != bank::Magic || header->version != bank::Version
+        || soundBank->size < sizeof(bank::Header) + static_cast<size_t>(header->count) * sizeof(bank::Entry)) {
+        std::cerr << "Invalid sound bank " << path << std::endl;
+        return nullptr;
+    }
+
+    soundBank->entries = reinterpret_cast<const bank::Entry*>(header + 1);
+    soundBank->count = header->count;
+
+    for (uint32_t i = 0; i < soundBank->count; i++) {
+        const auto& entry = soundBank->entries[i];
+        if (entry.offset > soundBank->size || entry.length > soundBank->size - entry.offset) {
+            std::cerr << "Invalid sound bank entry " << i << " in " << path << std::endl;
+            return nullptr;
+        }
+    }
+
+    return soundBank;
+}
+
+SoundBank::~SoundBank() {
+#ifdef _WIN32
+    if (base)
+        UnmapViewOfFile(base);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+#else
+    if (base)
+        munmap(const_cast<uint8_t*>(base), size);
+#endif
+}
+
+const bank::Entry* SoundBank::find(std::string_view name) const {
+    uint64_t hash = bank::hash(name);
+    auto end = entries + count;
+    auto it = std::lower_bound(entries, end, hash, [](const bank::Entry& entry, uint64_t value) { return entry.hash < value; });
+    return it != end && it->hash == hash ? it : nullptr;
+}
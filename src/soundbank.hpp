@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/// Packed sound bank layout, little endian:
+///   Header
+///   Entry[count], sorted by hash
+///   entry data, each blob starting on an Alignment boundary
+namespace bank {
+    constexpr uint32_t Magic = 0x4b4e4253; // "SBNK"
+    constexpr uint32_t Version = 1;
+    constexpr uint64_t Alignment = 64;
+
+    enum class Codec : uint32_t {
+        Unknown,
+        Wav,
+        Mp3,
+        Ogg,
+        Flac,
+        Aiff,
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    struct Entry {
+        uint64_t hash;
+        uint64_t offset; // from the start of the file
+        uint64_t length;
+        Codec codec;
+        uint32_t reserved;
+    };
+
+    static_assert(sizeof(Header) == 16 && sizeof(Entry) == 32, "bank layout changed");
+
+    /// @brief 64 bit FNV-1a of an entry name, names are paths with forward slashes as the game passes them to loadSound
+    uint64_t hash(std::string_view name);
+    Codec codecFromExtension(std::string_view path);
+}
+
+/// @brief Read-only memory mapping of a packed bank
+/// Entries point straight into the mapping, which stays valid until the bank is destroyed.
+class SoundBank {
+public:
+    static std::unique_ptr<SoundBank> mount(const std::string& path);
+    ~SoundBank();
+
+    SoundBank(const SoundBank&) = delete;
+    SoundBank& operator=(const SoundBank&) = delete;
+
+    const bank::Entry* find(std::string_view name) const;
+    const void* data(const bank::Entry& entry) const { return base + entry.offset; }
+
+    const std::string& getPath() const { return path; }
+    uint32_t getCount() const { return count; }
+    size_t getSize() const { return size; }
+
+private:
+    SoundBank() = default;
+
+    std::string path;
+    const uint8_t* base{ nullptr };
+    size_t size{ 0 };
+    const bank::Entry* entries{ nullptr };
+    uint32_t count{ 0 };
+
+#ifdef _WIN32
+    void* file{ nullptr };
+    void* mapping{ nullptr };
+#endif
+};
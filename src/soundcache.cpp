@@ -0,0 +1,314 @@
+#include "soundcache.hpp"
+#include "fmoderror.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+SoundRef::SoundRef(Entry* entry) : entry{entry} {
+    if (entry)
+        entry->cache->acquire(entry);
+}
+
+SoundRef::SoundRef(const SoundRef& other) : SoundRef{other.entry} {
+}
+
+SoundRef::SoundRef(SoundRef&& other) noexcept : entry{other.entry} {
+    other.entry = nullptr;
+}
+
+SoundRef::~SoundRef() {
+    if (entry)
+        entry->cache->release(entry);
+}
+
+SoundRef& SoundRef::operator=(const SoundRef& other) {
+    if (entry != other.entry) {
+        SoundRef copy{ other };
+        std::swap(entry, copy.entry);
+    }
+    return *this;
+}
+
+SoundRef& SoundRef::operator=(SoundRef&& other) noexcept {
+    if (this != &other) {
+        SoundRef moved{ std::move(other) };
+        std::swap(entry, moved.entry);
+    }
+    return *this;
+}
+
+FMOD::Sound* SoundRef::get() const {
+    return entry ? entry->sound : nullptr;
+}
+
+bool SoundRef::isReady() const {
+    return entry && !entry->loading && !entry->failed;
+}
+
+bool SoundRef::hasFailed() const {
+    return entry && entry->failed;
+}
+
+const std::string& SoundRef::getKey() const {
+    static const std::string none;
+    return entry && entry->key ? *entry->key : none;
+}
+
+namespace {
+    FMOD_SOUND_TYPE soundType(bank::Codec codec) {
+        switch (codec) {
+        case bank::Codec::Wav: return FMOD_SOUND_TYPE_WAV;
+        case bank::Codec::Mp3: return FMOD_SOUND_TYPE_MPEG;
+        case bank::Codec::Ogg: return FMOD_SOUND_TYPE_OGGVORBIS;
+        case bank::Codec::Flac: return FMOD_SOUND_TYPE_FLAC;
+        case bank::Codec::Aiff: return FMOD_SOUND_TYPE_AIFF;
+        default: return FMOD_SOUND_TYPE_UNKNOWN;
+        }
+    }
+}
+
+SoundCache::SoundCache(FMOD::System* system, uint64_t budget) : system{system}, budget{budget} {
+}
+
+SoundCache::~SoundCache() {
+    // In flight loads hold references, dropping them idles or evicts their entries like any other
+    pending.clear();
+    purge();
+
+    // Anything left is still referenced from outside, those references must not outlive the cache
+    assert(entries.empty() && "Sound references outlive the cache");
+    for (auto& [key, entry] : entries) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << key << ": " << entry.refs << " references outlive the cache" << std::endl;
+        entry.sound->release();
+    }
+}
+
+SoundRef SoundCache::load(const std::string& path, FMOD_MODE mode) {
+    auto sound = open(path, mode & ~FMOD_NONBLOCKING);
+    if (sound)
+        wait(sound.entry);
+    return sound;
+}
+
+SoundRef SoundCache::loadAsync(const std::string& path, FMOD_MODE mode, Callback onReady) {
+    // A load that fails to start resolves from the next update() as well, empty, like one failing later
+    auto sound = open(path, mode | FMOD_NONBLOCKING);
+    pending.push_back({ sound, std::move(onReady) });
+    return sound;
+}
+
+SoundRef SoundCache::adopt(const std::string& key, FMOD::Sound* sound) {
+    auto [it, inserted] = entries.emplace(key, SoundRef::Entry{});
+    if (!inserted) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << key << ": already cached" << std::endl;
+        sound->release();
+        return {};
+    }
+
+    auto& entry = it->second;
+    entry.cache = this;
+    entry.sound = sound;
+    entry.key = &it->first;
+    entry.adopted = true;
+    return SoundRef{ &entry };
+}
+
+bool SoundCache::mount(const std::string& path) {
+    auto soundBank = SoundBank::mount(path);
+    if (!soundBank)
+        return false;
+
+    banks.push_back(std::move(soundBank));
+    return true;
+}
+
+void SoundCache::update() {
+    // Callbacks may start new loads, run them after the sweep
+    std::vector<Pending> finished;
+    for (size_t i = 0; i < pending.size();) {
+        if (!pending[i].sound || poll(pending[i].sound.entry)) {
+            finished.push_back(std::move(pending[i]));
+            pending[i] = std::move(pending.back());
+            pending.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    for (auto& load : finished) {
+        if (load.sound && load.sound.entry->failed)
+            load.sound = {};
+        if (load.onReady)
+            load.onReady(load.sound);
+    }
+}
+
+SoundRef SoundCache::open(const std::string& path, FMOD_MODE mode) {
+    // Blocking and non-blocking loads of the same file share an entry
+    std::string key = path + '|' + std::to_string(mode & ~FMOD_NONBLOCKING);
+
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        hits++;
+        return SoundRef{ &it->second };
+    }
+
+    misses++;
+
+    // Banked sounds are read from the mapping: streams decode straight out of it, FMOD only accepts pointed-to
+    // memory for PCM samples so samples decode from a transient copy, either way without a file open
+    const char* source = path.c_str();
+    FMOD_CREATESOUNDEXINFO info;
+    FMOD_CREATESOUNDEXINFO* exinfo = nullptr;
+    for (auto bank = banks.rbegin(); bank != banks.rend(); ++bank) {
+        if (auto found = (*bank)->find(path)) {
+            memset(&info, 0, sizeof(info));
+            info.cbsize = sizeof(info);
+            info.length = static_cast<unsigned int>(found->length);
+            info.suggestedsoundtype = soundType(found->codec);
+            source = static_cast<const char*>((*bank)->data(*found));
+            exinfo = &info;
+            mode |= (mode & FMOD_CREATESTREAM) ? FMOD_OPENMEMORY_POINT : FMOD_OPENMEMORY;
+            break;
+        }
+    }
+
+    FMOD::Sound* sound;
+    auto result = system->createSound(source, mode, exinfo, &sound);
+    FMOD_ERROR_RETURN(result, {});
+
+    it = entries.emplace(std::move(key), SoundRef::Entry{}).first;
+    auto& entry = it->second;
+    entry.cache = this;
+    entry.sound = sound;
+    entry.key = &it->first;
+    entry.loading = true;
+    entry.stream = (mode & FMOD_CREATESTREAM) != 0;
+
+    SoundRef ref{ &entry };
+    poll(&entry);
+    return ref;
+}
+
+bool SoundCache::poll(SoundRef::Entry* entry) {
+    if (!entry->loading)
+        return true;
+
+    FMOD_OPENSTATE state;
+    auto result = entry->sound->getOpenState(&state, nullptr, nullptr, nullptr);
+    if (state == FMOD_OPENSTATE_LOADING || state == FMOD_OPENSTATE_CONNECTING)
+        return false;
+
+    entry->loading = false;
+    if (result != FMOD_OK || state == FMOD_OPENSTATE_ERROR) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") " << *entry->key << ": " << FMOD_ErrorString(result) << std::endl;
+        entry->failed = true;
+        return true;
+    }
+
+    // Streams decode on the fly, only samples hold their PCM in memory
+    if (!entry->stream) {
+        unsigned int length = 0;
+        entry->sound->getLength(&length, FMOD_TIMEUNIT_PCMBYTES);
+        entry->bytes = length;
+        bytes += length;
+        trim();
+    }
+    return true;
+}
+
+void SoundCache::wait(SoundRef::Entry* entry) {
+    while (!poll(entry)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void SoundCache::trim() {
+    while (bytes > budget && idleTail) {
+        evict(idleTail);
+    }
+
+    // Oldest streams first, samples in between stay
+    for (auto entry = idleTail; entry && idleStreams > idleStreamLimit;) {
+        auto prev = entry->prev;
+        if (entry->stream)
+            evict(entry);
+        entry = prev;
+    }
+}
+
+void SoundCache::purge() {
+    while (idleTail) {
+        evict(idleTail);
+    }
+}
+
+void SoundCache::setBudget(uint64_t value) {
+    budget = value;
+    trim();
+}
+
+void SoundCache::setIdleStreamLimit(size_t count) {
+    idleStreamLimit = count;
+    trim();
+}
+
+void SoundCache::acquire(SoundRef::Entry* entry) {
+    if (entry->refs++ == 0)
+        unlink(entry);
+}
+
+void SoundCache::release(SoundRef::Entry* entry) {
+    if (--entry->refs == 0) {
+        // A failed load is never worth keeping, the next request retries it, an adopted sound cannot be reopened by key
+        if (entry->failed || entry->adopted) {
+            evict(entry);
+            return;
+        }
+        link(entry);
+        trim();
+    }
+}
+
+void SoundCache::evict(SoundRef::Entry* entry) {
+    unlink(entry);
+    bytes -= entry->bytes;
+    entry->sound->release();
+
+    std::string key = *entry->key;
+    entries.erase(key);
+}
+
+void SoundCache::link(SoundRef::Entry* entry) {
+    entry->prev = nullptr;
+    entry->next = idleHead;
+    if (idleHead)
+        idleHead->prev = entry;
+    idleHead = entry;
+    if (!idleTail)
+        idleTail = entry;
+    if (entry->stream)
+        idleStreams++;
+}
+
+void SoundCache::unlink(SoundRef::Entry* entry) {
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else if (idleHead == entry)
+        idleHead = entry->next;
+    else
+        return; // not linked
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        idleTail = entry->prev;
+
+    entry->prev = nullptr;
+    entry->next = nullptr;
+    if (entry->stream)
+        idleStreams--;
+}
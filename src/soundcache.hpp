@@ -0,0 +1,138 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "soundbank.hpp"
+
+class SoundCache;
+
+/// @brief Ref-counted reference to a cached sound
+/// While any reference exists the sound stays loaded, the last one hands it to the LRU
+class SoundRef {
+public:
+    SoundRef() = default;
+    SoundRef(const SoundRef& other);
+    SoundRef(SoundRef&& other) noexcept;
+    ~SoundRef();
+
+    SoundRef& operator=(const SoundRef& other);
+    SoundRef& operator=(SoundRef&& other) noexcept;
+
+    FMOD::Sound* get() const;
+    /// @brief False while a non-blocking load is still decoding or after it failed
+    bool isReady() const;
+    /// @brief True once a load finished with an error, the sound will never become ready
+    bool hasFailed() const;
+    /// @brief Path and mode flags the cache knows it by, or the key it was adopted under
+    const std::string& getKey() const;
+    FMOD::Sound* operator->() const { return get(); }
+    explicit operator bool() const { return entry != nullptr; }
+    bool operator==(const SoundRef& other) const { return entry == other.entry; }
+    bool operator!=(const SoundRef& other) const { return entry != other.entry; }
+
+private:
+    struct Entry;
+    Entry* entry{ nullptr };
+
+    explicit SoundRef(Entry* entry);
+
+    friend class SoundCache;
+};
+
+struct SoundRef::Entry {
+    SoundCache* cache{ nullptr };
+    FMOD::Sound* sound{ nullptr };
+    const std::string* key{ nullptr };
+    uint64_t bytes{ 0 };
+    uint32_t refs{ 0 };
+    bool loading{ false };
+    bool failed{ false };
+    bool stream{ false }; // holds a file handle and decode buffers instead of counting bytes
+    bool adopted{ false }; // created outside the cache, released as soon as nothing references it
+    Entry* prev{ nullptr };
+    Entry* next{ nullptr };
+};
+
+/// @brief Sounds keyed by path and mode flags
+/// Decoded samples count against a byte budget, unreferenced ones are released least recently used first.
+/// Streams cost no sample bytes but keep a file open, at most a few unreferenced ones are kept.
+/// Game thread only, the cache must outlive every SoundRef it hands out.
+class SoundCache {
+public:
+    /// @brief Called from update() once a non-blocking load finished, with an empty reference if it failed
+    using Callback = std::function<void(const SoundRef&)>;
+
+    static constexpr size_t DefaultIdleStreams = 2;
+
+    SoundCache(FMOD::System* system, uint64_t budget);
+    ~SoundCache();
+
+    /// @brief Load and wait, a hit on a sound still loading asynchronously waits for it
+    SoundRef load(const std::string& path, FMOD_MODE mode);
+    /// @brief Start a non-blocking load on FMOD's async thread and return at once
+    /// onReady runs exactly once from a later update(), with an empty reference if the load failed
+    SoundRef loadAsync(const std::string& path, FMOD_MODE mode, Callback onReady = {});
+
+    /// @brief Take ownership of a sound created elsewhere, such as a user created stream, so voices can hold it
+    /// The key must be unused, the sound is released with its last reference instead of idling in the LRU
+    SoundRef adopt(const std::string& key, FMOD::Sound* sound);
+
+    /// @brief Map a packed bank, its entries are opened in place instead of from their file paths
+    /// Later banks take precedence, banks stay mapped for the lifetime of the cache
+    bool mount(const std::string& path);
+
+    /// @brief Poll pending loads and run their callbacks, once per tick
+    void update();
+
+    /// @brief Release unreferenced sounds until the cache fits its budget
+    void trim();
+    /// @brief Release every unreferenced sound
+    void purge();
+
+    void setBudget(uint64_t bytes);
+    /// @brief Unreferenced streams kept open for a quick replay, older ones are released
+    void setIdleStreamLimit(size_t count);
+    uint64_t getBudget() const { return budget; }
+    uint64_t getBytes() const { return bytes; }
+    size_t getCount() const { return entries.size(); }
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+    size_t getPendingCount() const { return pending.size(); }
+
+private:
+    FMOD::System* system;
+    std::unordered_map<std::string, SoundRef::Entry> entries;
+    std::vector<std::unique_ptr<SoundBank>> banks;
+
+    // Intrusive list of unreferenced entries, most recently used at the head
+    SoundRef::Entry* idleHead{ nullptr };
+    SoundRef::Entry* idleTail{ nullptr };
+
+    struct Pending {
+        SoundRef sound;
+        Callback onReady;
+    };
+    std::vector<Pending> pending;
+
+    uint64_t budget;
+    uint64_t bytes{ 0 };
+    size_t idleStreams{ 0 };
+    size_t idleStreamLimit{ DefaultIdleStreams };
+    uint64_t hits{ 0 };
+    uint64_t misses{ 0 };
+
+    SoundRef open(const std::string& path, FMOD_MODE mode);
+    bool poll(SoundRef::Entry* entry);
+    void wait(SoundRef::Entry* entry);
+    void acquire(SoundRef::Entry* entry);
+    void release(SoundRef::Entry* entry);
+    void evict(SoundRef::Entry* entry);
+    void link(SoundRef::Entry* entry);
+    void unlink(SoundRef::Entry* entry);
+
+    friend class SoundRef;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/// @brief Bounded lock-free queue for exactly one producer thread and one consumer thread
+/// Each side caches the other's index and only touches the shared atomic when the cache says full/empty
+template<typename T, size_t Capacity>
+class SPSCQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool push(const T& item) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head - cachedTail == Capacity) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (head - cachedTail == Capacity)
+                return false;
+        }
+        buffer[head & (Capacity - 1)] = item;
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail == cachedHead) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (tail == cachedHead)
+                return false;
+        }
+        item = buffer[tail & (Capacity - 1)];
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Push as many of count items as fit, returns how many did
+    size_t push(const T* items, size_t count) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (Capacity - (head - cachedTail) < count)
+            cachedTail = tail.load(std::memory_order_acquire);
+        count = std::min(count, Capacity - (head - cachedTail));
+
+        size_t index = head & (Capacity - 1);
+        size_t first = std::min(count, Capacity - index);
+        std::copy(items, items + first, buffer.begin() + index);
+        std::copy(items + first, items + count, buffer.begin());
+        this->head.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    /// @brief Pop up to count items, returns how many there were
+    size_t pop(T* items, size_t count) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (cachedHead - tail < count)
+            cachedHead = head.load(std::memory_order_acquire);
+        count = std::min(count, cachedHead - tail);
+
+        size_t index = tail & (Capacity - 1);
+        size_t first = std::min(count, Capacity - index);
+        std::copy(buffer.begin() + index, buffer.begin() + index + first, items);
+        std::copy(buffer.begin(), buffer.begin() + (count - first), items + first);
+        this->tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    alignas(64) std::atomic<size_t> head{ 0 };
+    size_t cachedTail{ 0 }; // producer only
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    size_t cachedHead{ 0 }; // consumer only
+    alignas(64) std::array<T, Capacity> buffer;
+};
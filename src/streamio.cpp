@@ -0,0 +1,231 @@
+#include "streamio.hpp"
+#include "fmoderror.hpp"
+
+StreamIO* StreamIO::instance = nullptr;
+
+StreamIO::StreamIO(size_t bufferSize) : bufferSize{(bufferSize + Alignment - 1) & ~(Alignment - 1)} {
+    thread = std::thread{ &StreamIO::threadLoop, this };
+}
+
+StreamIO::~StreamIO() {
+    {
+        std::lock_guard lock{ mutex };
+        running = false;
+    }
+    wake.notify_all();
+    thread.join();
+
+    if (instance == this)
+        instance = nullptr;
+}
+
+bool StreamIO::attach(FMOD::System* system) {
+    if (instance && instance != this)
+        return false;
+    instance = this;
+
+    // Only the async callbacks are given, FMOD then never reads on its own threads
+    auto result = system->setFileSystem(openCallback, closeCallback, nullptr, nullptr, readCallback, cancelCallback, 2048);
+    FMOD_ERROR(result);
+
+    return true;
+}
+
+std::vector<StreamIOStats> StreamIO::getStats() const {
+    std::lock_guard lock{ mutex };
+
+    std::vector<StreamIOStats> result;
+    result.reserve(stats.size());
+    for (const auto& [name, stat] : stats) {
+        result.push_back(stat);
+    }
+    return result;
+}
+
+FMOD_RESULT F_CALLBACK StreamIO::openCallback(const char* name, unsigned int* filesize, void** handle, void* /*userdata*/) {
+    auto file = std::make_unique<File>();
+    file->stream.open(name, std::ios::binary);
+    if (!file->stream)
+        return FMOD_ERR_FILE_NOTFOUND;
+
+    std::error_code error;
+    file->size = std::filesystem::file_size(name, error);
+    if (error)
+        return FMOD_ERR_FILE_BAD;
+
+    for (auto& buffer : file->buffers) {
+        buffer.data = static_cast<uint8_t*>(::operator new(instance->bufferSize, std::align_val_t{ Alignment }));
+    }
+
+    {
+        std::lock_guard lock{ instance->mutex };
+        auto& stat = instance->stats[name];
+        stat.name = name;
+        stat.openCount++;
+        file->stats = &stat;
+    }
+
+    *filesize = static_cast<unsigned int>(file->size);
+    *handle = file.release();
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK StreamIO::closeCallback(void* handle, void* /*userdata*/) {
+    auto file = static_cast<File*>(handle);
+
+    {
+        // FMOD cancels its own reads before closing, only a queued read-ahead can still refer to the file
+        std::unique_lock lock{ instance->mutex };
+        auto& prefetches = instance->prefetches;
+        prefetches.erase(std::remove(prefetches.begin(), prefetches.end(), file), prefetches.end());
+        instance->idle.wait(lock, [&]() { return instance->busy != file; });
+        file->stats->openCount--;
+    }
+
+    for (auto& buffer : file->buffers) {
+        ::operator delete(buffer.data, std::align_val_t{ Alignment });
+    }
+    delete file;
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK StreamIO::readCallback(FMOD_ASYNCREADINFO* info, void* /*userdata*/) {
+    {
+        std::lock_guard lock{ instance->mutex };
+        instance->queue.push_back({ info, std::chrono::steady_clock::now() });
+    }
+    instance->wake.notify_one();
+    return FMOD_OK;
+}
+
+FMOD_RESULT F_CALLBACK StreamIO::cancelCallback(FMOD_ASYNCREADINFO* info, void* /*userdata*/) {
+    std::unique_lock lock{ instance->mutex };
+
+    // A queued read is simply dropped, one in flight has to finish before FMOD may free it
+    auto& queue = instance->queue;
+    auto it = std::find_if(queue.begin(), queue.end(), [&](const Request& request) { return request.info == info; });
+    if (it != queue.end()) {
+        queue.erase(it);
+        return FMOD_OK;
+    }
+
+    instance->idle.wait(lock, [&]() { return instance->active != info; });
+    return FMOD_OK;
+}
+
+void StreamIO::threadLoop() {
+    std::unique_lock lock{ mutex };
+    while (true) {
+        wake.wait(lock, [&]() { return !running || !queue.empty() || !prefetches.empty(); });
+        if (!running)
+            break;
+
+        if (!queue.empty()) {
+            // Streams ask with priority 100, sample loads with 0, feed the streams first
+            auto it = std::max_element(queue.begin(), queue.end(), [](const Request& a, const Request& b) { return a.info->priority < b.info->priority; });
+            Request request = *it;
+            queue.erase(it);
+
+            auto file = static_cast<File*>(request.info->handle);
+            active = request.info;
+            busy = file;
+            lock.unlock();
+
+            uint64_t diskBytes = 0;
+            bool stalled = false;
+            auto result = serve(*file, *request.info, diskBytes, stalled);
+            uint64_t bytesRead = request.info->bytesread;
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - request.queued).count();
+
+            // FMOD may free the info as soon as it is done, cancel waits for active to clear first
+            request.info->done(request.info, result);
+
+            // Queue a refill of the buffer the next sequential request will need
+            Buffer& current = file->buffers[file->current];
+            Buffer& other = file->buffers[file->current ^ 1];
+            uint64_t next = current.offset + current.fill;
+            bool prefetch = next < file->size && !(other.fill && other.offset == next);
+
+            lock.lock();
+            auto& stat = *file->stats;
+            stat.requests++;
+            stat.bytesRead += bytesRead;
+            stat.diskBytes += diskBytes;
+            stat.stalls += stalled ? 1 : 0;
+            auto bucket = std::lower_bound(StreamIOStats::LatencyBoundsMs.begin(), StreamIOStats::LatencyBoundsMs.end(), ms);
+            stat.latency[bucket - StreamIOStats::LatencyBoundsMs.begin()]++;
+
+            if (prefetch && !file->prefetchQueued) {
+                file->prefetchQueued = true;
+                prefetches.push_back(file);
+            }
+
+            active = nullptr;
+            busy = nullptr;
+            idle.notify_all();
+        } else {
+            File* file = prefetches.back();
+            prefetches.pop_back();
+            file->prefetchQueued = false;
+            busy = file;
+            lock.unlock();
+
+            Buffer& current = file->buffers[file->current];
+            uint64_t next = current.offset + current.fill;
+            size_t read = fill(*file, file->buffers[file->current ^ 1], next);
+
+            lock.lock();
+            file->stats->diskBytes += read;
+            busy = nullptr;
+            idle.notify_all();
+        }
+    }
+}
+
+FMOD_RESULT StreamIO::serve(File& file, FMOD_ASYNCREADINFO& info, uint64_t& diskBytes, bool& stalled) {
+    auto destination = static_cast<uint8_t*>(info.buffer);
+    uint64_t offset = info.offset;
+    size_t copied = 0;
+
+    while (copied < info.sizebytes && offset < file.size) {
+        uint32_t index = UINT32_MAX;
+        for (uint32_t i = 0; i < file.buffers.size(); i++) {
+            const auto& buffer = file.buffers[i];
+            if (offset >= buffer.offset && offset < buffer.offset + buffer.fill)
+                index = i;
+        }
+
+        // Missed the read-ahead, fill the older buffer now and let the other follow it
+        if (index == UINT32_MAX) {
+            stalled = true;
+            index = file.current ^ 1;
+            size_t read = fill(file, file.buffers[index], offset & ~static_cast<uint64_t>(Alignment - 1));
+            diskBytes += read;
+            if (read == 0)
+                break;
+        }
+
+        const auto& buffer = file.buffers[index];
+        size_t count = std::min<size_t>(info.sizebytes - copied, buffer.offset + buffer.fill - offset);
+        std::memcpy(destination + copied, buffer.data + (offset - buffer.offset), count);
+        copied += count;
+        offset += count;
+        file.current = index;
+    }
+
+    info.bytesread = static_cast<unsigned int>(copied);
+    return copied < info.sizebytes ? FMOD_ERR_FILE_EOF : FMOD_OK;
+}
+
+size_t StreamIO::fill(File& file, Buffer& buffer, uint64_t offset) {
+    buffer.offset = offset;
+    buffer.fill = 0;
+    if (offset >= file.size)
+        return 0;
+
+    file.stream.clear();
+    file.stream.seekg(static_cast<std::streamoff>(offset));
+    file.stream.read(reinterpret_cast<char*>(buffer.data), static_cast<std::streamsize>(std::min<uint64_t>(bufferSize, file.size - offset)));
+    buffer.fill = static_cast<size_t>(file.stream.gcount());
+    return buffer.fill;
+}
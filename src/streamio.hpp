@@ -0,0 +1,86 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/// @brief I/O counters for one file name, kept across opens
+struct StreamIOStats {
+    static constexpr std::array<double, 8> LatencyBoundsMs{ 0.1, 0.5, 1.0, 2.0, 5.0, 10.0, 20.0, 50.0 };
+
+    std::string name;
+    uint32_t openCount{ 0 };  // handles currently open
+    uint64_t requests{ 0 };
+    uint64_t bytesRead{ 0 };  // handed to FMOD
+    uint64_t diskBytes{ 0 };  // read from disk, read-ahead included
+    uint64_t stalls{ 0 };     // requests that missed the read-ahead and waited on the disk
+    std::array<uint64_t, LatencyBoundsMs.size() + 1> latency{}; // queue to done, last bucket is everything above 50 ms
+};
+
+/// @brief FMOD file system replacement serving FMOD's async reads from a dedicated reader thread
+/// Every open file gets two aligned read-ahead buffers: requests are copied from the one covering them
+/// while the reader thread refills the other with the data that follows, sequential streams never wait
+/// on the disk. Random access falls back to a blocking fill and counts as a stall.
+/// FMOD's callbacks carry no system userdata, so only one instance can be attached at a time.
+class StreamIO {
+public:
+    static constexpr size_t DefaultBufferSize = 256 * 1024;
+    static constexpr size_t Alignment = 4096;
+
+    explicit StreamIO(size_t bufferSize = DefaultBufferSize);
+    ~StreamIO();
+
+    /// @brief Route the system's file access through this instance, call before System::init
+    bool attach(FMOD::System* system);
+
+    std::vector<StreamIOStats> getStats() const;
+
+private:
+    struct Buffer {
+        uint8_t* data{ nullptr };
+        uint64_t offset{ 0 };
+        size_t fill{ 0 };
+    };
+
+    struct File {
+        std::ifstream stream;
+        uint64_t size{ 0 };
+        std::array<Buffer, 2> buffers;
+        uint32_t current{ 0 };          // buffer that served the last request
+        bool prefetchQueued{ false };
+        StreamIOStats* stats{ nullptr };
+    };
+
+    struct Request {
+        FMOD_ASYNCREADINFO* info;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    static StreamIO* instance;
+
+    size_t bufferSize;
+
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool running{ true };
+
+    std::deque<Request> queue;
+    std::vector<File*> prefetches;
+    FMOD_ASYNCREADINFO* active{ nullptr };
+    File* busy{ nullptr };
+
+    std::unordered_map<std::string, StreamIOStats> stats;
+
+    static FMOD_RESULT F_CALLBACK openCallback(const char* name, unsigned int* filesize, void** handle, void* userdata);
+    static FMOD_RESULT F_CALLBACK closeCallback(void* handle, void* userdata);
+    static FMOD_RESULT F_CALLBACK readCallback(FMOD_ASYNCREADINFO* info, void* userdata);
+    static FMOD_RESULT F_CALLBACK cancelCallback(FMOD_ASYNCREADINFO* info, void* userdata);
+
+    void threadLoop();
+    FMOD_RESULT serve(File& file, FMOD_ASYNCREADINFO& info, uint64_t& diskBytes, bool& stalled);
+    size_t fill(File& file, Buffer& buffer, uint64_t offset);
+};
@@ -0,0 +1,395 @@
+#include "synth.hpp"
+#include "fmoderror.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DSP_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define DSP_TARGET_AVX2
+#else
+#define DSP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    using dsp::Waveform;
+
+    // Phase in cycles, [0, 1). Sine is a parabola with one correction step, within 0.1% of sin,
+    // the other shapes are naive and meant to go through the lowpass
+    template<Waveform W>
+    float wave(float p) {
+        if constexpr (W == Waveform::Sine) {
+            float x = 2.0f * p - 1.0f;
+            float y = 4.0f * x * (1.0f - std::abs(x));
+            return -(0.225f * (y * std::abs(y) - y) + y);
+        } else if constexpr (W == Waveform::Saw) {
+            return 2.0f * p - 1.0f;
+        } else if constexpr (W == Waveform::Square) {
+            return p < 0.5f ? 1.0f : -1.0f;
+        } else {
+            return 4.0f * std::abs(p - 0.5f) - 1.0f;
+        }
+    }
+
+    float wrap(float p) {
+        return p - static_cast<float>(static_cast<int>(p));
+    }
+
+    template<Waveform W>
+    float oscillatorScalar(float* output, unsigned int length, float phase, float increment, float level) {
+        for (unsigned int n = 0; n < length; n++) {
+            output[n] = level * wave<W>(phase);
+            phase = wrap(phase + increment);
+        }
+        return phase;
+    }
+
+    uint32_t xorshift(uint32_t& x) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+
+    float unit(uint32_t bits) {
+        // 23 random mantissa bits under the exponent of 1.0 give [1, 2)
+        uint32_t word = (bits >> 9) | 0x3f800000u;
+        float value;
+        std::memcpy(&value, &word, sizeof(value));
+        return 2.0f * value - 3.0f;
+    }
+
+    void noiseScalar(float* output, unsigned int length, uint32_t* state, float level) {
+        for (unsigned int n = 0; n < length; n++) {
+            output[n] += level * unit(xorshift(state[0]));
+        }
+    }
+
+#ifdef DSP_X86
+    // Each vector holds consecutive samples, lane i at phase + i * increment. The base phase is wrapped
+    // after every vector so the offsets never grow past a few cycles and float precision holds
+
+    template<Waveform W>
+    __m128 waveSSE(__m128 p) {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        if constexpr (W == Waveform::Sine) {
+            __m128 x = _mm_sub_ps(_mm_add_ps(p, p), one);
+            __m128 y = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), x), _mm_sub_ps(one, _mm_and_ps(x, absMask)));
+            __m128 correction = _mm_mul_ps(_mm_set1_ps(0.225f), _mm_sub_ps(_mm_mul_ps(y, _mm_and_ps(y, absMask)), y));
+            return _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(correction, y));
+        } else if constexpr (W == Waveform::Saw) {
+            return _mm_sub_ps(_mm_add_ps(p, p), one);
+        } else if constexpr (W == Waveform::Square) {
+            __m128 high = _mm_cmplt_ps(p, _mm_set1_ps(0.5f));
+            return _mm_or_ps(_mm_and_ps(high, one), _mm_andnot_ps(high, _mm_set1_ps(-1.0f)));
+        } else {
+            __m128 centred = _mm_and_ps(_mm_sub_ps(p, _mm_set1_ps(0.5f)), absMask);
+            return _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(4.0f), centred), one);
+        }
+    }
+
+    template<Waveform W>
+    float oscillatorSSE(float* output, unsigned int length, float phase, float increment, float level) {
+        constexpr int lanes = 4;
+        const __m128 offsets = _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(increment));
+        const __m128 gain = _mm_set1_ps(level);
+        const float step = increment * lanes;
+
+        unsigned int n = 0;
+        for (; n + lanes <= length; n += lanes) {
+            __m128 p = _mm_add_ps(_mm_set1_ps(phase), offsets);
+            p = _mm_sub_ps(p, _mm_cvtepi32_ps(_mm_cvttps_epi32(p)));
+            _mm_storeu_ps(output + n, _mm_mul_ps(gain, waveSSE<W>(p)));
+            phase = wrap(phase + step);
+        }
+        return oscillatorScalar<W>(output + n, length - n, phase, increment, level);
+    }
+
+    template<Waveform W>
+    DSP_TARGET_AVX2 __m256 waveAVX2(__m256 p) {
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        if constexpr (W == Waveform::Sine) {
+            __m256 x = _mm256_sub_ps(_mm256_add_ps(p, p), one);
+            __m256 y = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), x), _mm256_sub_ps(one, _mm256_and_ps(x, absMask)));
+            __m256 correction = _mm256_mul_ps(_mm256_set1_ps(0.225f), _mm256_sub_ps(_mm256_mul_ps(y, _mm256_and_ps(y, absMask)), y));
+            return _mm256_sub_ps(_mm256_setzero_ps(), _mm256_add_ps(correction, y));
+        } else if constexpr (W == Waveform::Saw) {
+            return _mm256_sub_ps(_mm256_add_ps(p, p), one);
+        } else if constexpr (W == Waveform::Square) {
+            __m256 high = _mm256_cmp_ps(p, _mm256_set1_ps(0.5f), _CMP_LT_OQ);
+            return _mm256_blendv_ps(_mm256_set1_ps(-1.0f), one, high);
+        } else {
+            __m256 centred = _mm256_and_ps(_mm256_sub_ps(p, _mm256_set1_ps(0.5f)), absMask);
+            return _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), centred), one);
+        }
+    }
+
+    template<Waveform W>
+    DSP_TARGET_AVX2 float oscillatorAVX2(float* output, unsigned int length, float phase, float increment, float level) {
+        constexpr int lanes = 8;
+        const __m256 offsets = _mm256_mul_ps(_mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f), _mm256_set1_ps(increment));
+        const __m256 gain = _mm256_set1_ps(level);
+        const float step = increment * lanes;
+
+        unsigned int n = 0;
+        for (; n + lanes <= length; n += lanes) {
+            __m256 p = _mm256_add_ps(_mm256_set1_ps(phase), offsets);
+            p = _mm256_sub_ps(p, _mm256_round_ps(p, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+            _mm256_storeu_ps(output + n, _mm256_mul_ps(gain, waveAVX2<W>(p)));
+            phase = wrap(phase + step);
+        }
+        _mm256_zeroupper();
+        return oscillatorScalar<W>(output + n, length - n, phase, increment, level);
+    }
+
+    void noiseSSE(float* output, unsigned int length, uint32_t* state, float level) {
+        __m128i x = _mm_load_si128(reinterpret_cast<const __m128i*>(state));
+        const __m128i exponent = _mm_set1_epi32(0x3f800000);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 three = _mm_set1_ps(3.0f);
+        const __m128 gain = _mm_set1_ps(level);
+
+        unsigned int n = 0;
+        for (; n + 4 <= length; n += 4) {
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+            x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+            x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+            __m128 value = _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(x, 9), exponent));
+            value = _mm_sub_ps(_mm_mul_ps(two, value), three);
+            _mm_storeu_ps(output + n, _mm_add_ps(_mm_loadu_ps(output + n), _mm_mul_ps(gain, value)));
+        }
+        _mm_store_si128(reinterpret_cast<__m128i*>(state), x);
+        noiseScalar(output + n, length - n, state, level);
+    }
+
+    DSP_TARGET_AVX2 void noiseAVX2(float* output, unsigned int length, uint32_t* state, float level) {
+        __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i*>(state));
+        const __m256i exponent = _mm256_set1_epi32(0x3f800000);
+        const __m256 two = _mm256_set1_ps(2.0f);
+        const __m256 three = _mm256_set1_ps(3.0f);
+        const __m256 gain = _mm256_set1_ps(level);
+
+        unsigned int n = 0;
+        for (; n + 8 <= length; n += 8) {
+            x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+            x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+            x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+            __m256 value = _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(x, 9), exponent));
+            value = _mm256_sub_ps(_mm256_mul_ps(two, value), three);
+            _mm256_storeu_ps(output + n, _mm256_add_ps(_mm256_loadu_ps(output + n), _mm256_mul_ps(gain, value)));
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(state), x);
+        _mm256_zeroupper();
+        noiseScalar(output + n, length - n, state, level);
+    }
+#endif
+
+    template<Waveform W>
+    dsp::OscillatorKernel oscillatorFor(dsp::SimdLevel level) {
+#ifdef DSP_X86
+        switch (level) {
+            case dsp::SimdLevel::AVX2:
+                return oscillatorAVX2<W>;
+            case dsp::SimdLevel::SSE:
+                return oscillatorSSE<W>;
+            default:
+                break;
+        }
+#endif
+        return oscillatorScalar<W>;
+    }
+}
+
+namespace dsp {
+    OscillatorKernel oscillatorKernel(Waveform waveform, SimdLevel level) {
+        switch (waveform) {
+            case Waveform::Saw:
+                return oscillatorFor<Waveform::Saw>(level);
+            case Waveform::Square:
+                return oscillatorFor<Waveform::Square>(level);
+            case Waveform::Triangle:
+                return oscillatorFor<Waveform::Triangle>(level);
+            default:
+                return oscillatorFor<Waveform::Sine>(level);
+        }
+    }
+
+    NoiseKernel noiseKernel(SimdLevel level) {
+#ifdef DSP_X86
+        switch (level) {
+            case SimdLevel::AVX2:
+                return noiseAVX2;
+            case SimdLevel::SSE:
+                return noiseSSE;
+            default:
+                break;
+        }
+#endif
+        return noiseScalar;
+    }
+}
+
+Synth::Synth(const SynthPatch& patch, int sampleRate)
+    : patch{patch}, sampleRate{static_cast<float>(sampleRate)}, frequency{patch.frequency}, tone{patch.tone},
+      noise{patch.noise}, cutoff{patch.cutoff}, amplitude{patch.amplitude},
+      oscillator{dsp::oscillatorKernel(patch.waveform)}, noiseSource{dsp::noiseKernel()}, ramp{dsp::rampKernel(1, 1)},
+      level{patch.amplitude} {
+    // Distinct non-zero seeds per lane, xorshift never leaves zero
+    uint32_t seed = 0x9e3779b9u ^ static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this));
+    for (auto& lane : noiseState) {
+        lane = xorshift(seed) | 1u;
+    }
+}
+
+Synth::~Synth() {
+    // Closes the stream, the read callback is done with this once the sound is released
+    sound = {};
+}
+
+SoundRef Synth::createSound(FMOD::System* system, SoundCache& cache, const std::string& key) {
+    FMOD_CREATESOUNDEXINFO exinfo;
+    memset(&exinfo, 0, sizeof(exinfo));
+    exinfo.cbsize = sizeof(exinfo);
+    exinfo.numchannels = 1;
+    exinfo.defaultfrequency = static_cast<int>(sampleRate);
+    exinfo.format = FMOD_SOUND_FORMAT_PCMFLOAT;
+    exinfo.decodebuffersize = BlockLength;
+    // Loops over an hour of nothing stored, the length only has to be longer than a read
+    exinfo.length = static_cast<unsigned int>(sampleRate) * sizeof(float) * 3600;
+    exinfo.pcmreadcallback = readCallback;
+    exinfo.userdata = this;
+
+    FMOD_MODE mode = FMOD_OPENUSER | FMOD_CREATESTREAM | FMOD_LOOP_NORMAL | (patch.spatial ? FMOD_3D : FMOD_2D);
+    FMOD::Sound* created;
+    auto result = system->createSound(nullptr, mode, &exinfo, &created);
+    FMOD_ERROR_RETURN(result, {});
+
+    sound = cache.adopt(key, created);
+    return sound;
+}
+
+void Synth::trigger() {
+    gate.store(true, std::memory_order_relaxed);
+    triggers.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Synth::render(float* output, unsigned int length) {
+    float target = amplitude.load(std::memory_order_relaxed);
+
+    if (patch.gated) {
+        uint32_t count = triggers.load(std::memory_order_relaxed);
+        if (count != seenTriggers) {
+            seenTriggers = count;
+            stage = Stage::Attack;
+        }
+        if (!gate.load(std::memory_order_relaxed) && stage != Stage::Idle && stage != Stage::Release)
+            stage = Stage::Release;
+
+        // A finished envelope renders nothing, only the lowpass is let down
+        if (stage == Stage::Idle || (stage == Stage::Sustain && patch.sustain <= 0.0f)) {
+            std::memset(output, 0, length * sizeof(float));
+            filtered = 0.0f;
+            level = target;
+            return;
+        }
+    }
+
+    // Frequency holds for the block, BlockLength keeps the steps short
+    float increment = std::clamp(frequency.load(std::memory_order_relaxed) / sampleRate, 0.0f, 0.5f);
+    float toneLevel = tone.load(std::memory_order_relaxed);
+    if (toneLevel > 0.0f)
+        phase = oscillator(output, length, phase, increment, toneLevel);
+    else
+        std::memset(output, 0, length * sizeof(float));
+
+    float noiseLevel = noise.load(std::memory_order_relaxed);
+    if (noiseLevel > 0.0f)
+        noiseSource(output, length, noiseState, noiseLevel);
+
+    float corner = cutoff.load(std::memory_order_relaxed);
+    if (corner < 0.45f * sampleRate) {
+        float a = 1.0f - std::exp(-2.0f * static_cast<float>(M_PI) * corner / sampleRate);
+        float y = filtered;
+        for (unsigned int n = 0; n < length; n++) {
+            y += a * (output[n] - y);
+            output[n] = y;
+        }
+        filtered = y;
+    } else {
+        filtered = output[length - 1];
+    }
+
+    if (!patch.gated) {
+        ramp(output, output, length, 1, 1, level, target);
+        level = target;
+        return;
+    }
+
+    // The envelope is piecewise linear, one ramp per stage the block crosses
+    auto amplitudeAt = [&](unsigned int n) {
+        return level + (target - level) * static_cast<float>(n) / static_cast<float>(length);
+    };
+    unsigned int done = 0;
+    while (done < length) {
+        float from = amplitudeAt(done) * envelope;
+        float next;
+        unsigned int count = advance(next, length - done);
+        if (count > 0)
+            ramp(output + done, output + done, count, 1, 1, from, amplitudeAt(done + count) * next);
+        envelope = next;
+        done += count;
+    }
+    level = target;
+}
+
+unsigned int Synth::advance(float& target, unsigned int count) {
+    // Rates are per sample, a stage ends early in the block when it reaches its level
+    auto segment = [&](float to, float rate, Stage following) {
+        float distance = std::abs(to - envelope);
+        auto remaining = static_cast<unsigned int>(std::ceil(distance / std::max(rate, 1e-9f)));
+        if (remaining > count) {
+            target = envelope + (to > envelope ? rate : -rate) * static_cast<float>(count);
+            return count;
+        }
+        target = to;
+        stage = following;
+        return remaining;
+    };
+    auto perSample = [&](float seconds) {
+        return 1.0f / std::max(seconds * sampleRate, 1.0f);
+    };
+
+    switch (stage) {
+        case Stage::Attack:
+            return segment(1.0f, perSample(patch.attack), Stage::Decay);
+        case Stage::Decay:
+            return segment(patch.sustain, (1.0f - patch.sustain) * perSample(patch.decay), Stage::Sustain);
+        case Stage::Release:
+            return segment(0.0f, perSample(patch.release), Stage::Idle);
+        case Stage::Sustain:
+            target = patch.sustain;
+            return count;
+        default:
+            target = 0.0f;
+            return count;
+    }
+}
+
+FMOD_RESULT F_CALLBACK Synth::readCallback(FMOD_SOUND* sound, void* data, unsigned int datalen) {
+    void* userdata = nullptr;
+    reinterpret_cast<FMOD::Sound*>(sound)->getUserData(&userdata);
+    if (!userdata) {
+        std::memset(data, 0, datalen);
+        return FMOD_OK;
+    }
+
+    static_cast<Synth*>(userdata)->render(static_cast<float*>(data), datalen / sizeof(float));
+    return FMOD_OK;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "dspgain.hpp"
+#include "soundcache.hpp"
+
+namespace dsp {
+    enum class Waveform : uint8_t { Sine, Saw, Square, Triangle };
+
+    /// @brief output[n] = level * wave(phase + n * increment), phase in cycles, returns the phase after the block
+    using OscillatorKernel = float (*)(float* output, unsigned int length, float phase, float increment, float level);
+    /// @brief output[n] += level * white noise in [-1, 1), state holds one xorshift32 generator per lane (8)
+    using NoiseKernel = void (*)(float* output, unsigned int length, uint32_t* state, float level);
+
+    OscillatorKernel oscillatorKernel(Waveform waveform, SimdLevel level = simdLevel());
+    NoiseKernel noiseKernel(SimdLevel level = simdLevel());
+}
+
+struct SynthPatch {
+    dsp::Waveform waveform{ dsp::Waveform::Sine };
+    float frequency{ 440.0f }; // Hz
+    float tone{ 1.0f }; // oscillator level
+    float noise{ 0.0f }; // white noise level
+    float cutoff{ 20000.0f }; // Hz, one-pole lowpass on oscillator and noise
+    float amplitude{ 0.5f };
+    bool spatial{ true }; // 3D, otherwise a 2D sound for UI
+
+    // Envelope in seconds, without a gate the sound holds at full level
+    bool gated{ false };
+    float attack{ 0.005f };
+    float decay{ 0.1f };
+    float sustain{ 0.0f }; // level, 0 makes every trigger a one shot blip
+    float release{ 0.05f };
+};
+
+/// @brief Procedural sound rendered by FMOD's stream thread through a user created stream
+/// An oscillator, a noise source and a one-pole lowpass feed an optional ADSR envelope. The game
+/// thread publishes parameters through atomics, the read callback picks them up once per block of
+/// BlockLength samples and ramps the level across it, so nothing is shared beyond the atomics and
+/// nothing is read from disk or held as PCM. One synth is one stream and plays on one voice at a time.
+class Synth {
+public:
+    static constexpr unsigned int BlockLength = 256; // decode buffer, also the latency of a parameter change
+
+    Synth(const SynthPatch& patch, int sampleRate);
+    ~Synth();
+
+    Synth(const Synth&) = delete;
+    Synth& operator=(const Synth&) = delete;
+
+    /// @brief Open the stream and hand it to the cache under key, the synth must outlive the reference
+    SoundRef createSound(FMOD::System* system, SoundCache& cache, const std::string& key);
+    const SoundRef& getSound() const { return sound; }
+
+    void setFrequency(float value) { frequency.store(value, std::memory_order_relaxed); }
+    void setTone(float value) { tone.store(value, std::memory_order_relaxed); }
+    void setNoise(float value) { noise.store(value, std::memory_order_relaxed); }
+    void setCutoff(float value) { cutoff.store(value, std::memory_order_relaxed); }
+    void setAmplitude(float value) { amplitude.store(value, std::memory_order_relaxed); }
+    /// @brief Start the envelope from its attack, gated patches only
+    void trigger();
+    /// @brief Let a triggered envelope fall through its release
+    void releaseGate() { gate.store(false, std::memory_order_relaxed); }
+
+    /// @brief Stream thread: render one mono block, public for offline use
+    void render(float* output, unsigned int length);
+
+    const SynthPatch& getPatch() const { return patch; }
+
+private:
+    enum class Stage : uint8_t { Idle, Attack, Decay, Sustain, Release };
+
+    SynthPatch patch;
+    float sampleRate;
+    SoundRef sound;
+
+    // Published by the game thread
+    std::atomic<float> frequency;
+    std::atomic<float> tone;
+    std::atomic<float> noise;
+    std::atomic<float> cutoff;
+    std::atomic<float> amplitude;
+    std::atomic<uint32_t> triggers{ 0 };
+    std::atomic<bool> gate{ false };
+
+    // Stream thread only
+    dsp::OscillatorKernel oscillator;
+    dsp::NoiseKernel noiseSource;
+    dsp::RampKernel ramp;
+    float phase{ 0.0f };
+    float filtered{ 0.0f }; // lowpass state
+    float level{ 1.0f }; // amplitude at the end of the last block
+    float envelope{ 0.0f };
+    Stage stage{ Stage::Idle };
+    uint32_t seenTriggers{ 0 };
+    alignas(32) uint32_t noiseState[8];
+
+    /// @brief Envelope over count samples from the current stage, applied with the level ramp
+    unsigned int advance(float& target, unsigned int count);
+
+    static FMOD_RESULT F_CALLBACK readCallback(FMOD_SOUND* sound, void* data, unsigned int datalen);
+};
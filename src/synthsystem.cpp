@@ -0,0 +1,37 @@
+#include "synthsystem.hpp"
+#include "audio.hpp"
+#include "components.hpp"
+
+void SynthSystem::update(entt::registry& registry, Audio& audio) {
+    auto view = registry.view<SynthComponent, TransformComponent>();
+    for (auto entity : view) {
+        auto [component, transform] = view.get<SynthComponent, TransformComponent>(entity);
+        auto synth = component.synth;
+        if (!synth)
+            continue;
+
+        // Relaxed stores, the stream thread picks them up on its next block
+        synth->setFrequency(component.frequency);
+        synth->setTone(component.tone);
+        synth->setNoise(component.noise);
+        synth->setCutoff(component.cutoff);
+        synth->setAmplitude(component.amplitude);
+
+        if (component.trigger) {
+            synth->trigger();
+            component.trigger = false;
+            component.gate = true;
+        } else if (!component.gate) {
+            synth->releaseGate();
+        }
+
+        if (audio.isPlaying(component.voice))
+            continue;
+
+        component.voice = audio.playSynth(*synth, transform.translation, 1.0f, component.bus);
+        if (auto emitter = registry.try_get<AudioEmitterComponent>(entity)) {
+            emitter->voice = component.voice;
+            emitter->dirty = true;
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <entt/entity/registry.hpp>
+
+class Audio;
+
+/// @brief Publishes synth parameters from their components and keeps a voice playing each synth
+/// Parameters go through the synth's atomics, nothing waits on the stream thread. A synth whose
+/// voice was stolen or never started gets a new one at the entity's position.
+class SynthSystem {
+public:
+    void update(entt::registry& registry, Audio& audio);
+};
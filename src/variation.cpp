@@ -0,0 +1,297 @@
+#include "variation.hpp"
+#include "fmoderror.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+    // Interleaved PCM of any of FMOD's sample formats to mono float
+    bool decode(const void* data, FMOD_SOUND_FORMAT format, int channels, uint32_t frames, float* output) {
+        float scale = 1.0f / static_cast<float>(channels);
+        for (uint32_t frame = 0; frame < frames; frame++) {
+            float sum = 0.0f;
+            for (int channel = 0; channel < channels; channel++) {
+                size_t index = static_cast<size_t>(frame) * channels + channel;
+                switch (format) {
+                    case FMOD_SOUND_FORMAT_PCM8:
+                        sum += static_cast<const int8_t*>(data)[index] * (1.0f / 128.0f);
+                        break;
+                    case FMOD_SOUND_FORMAT_PCM16:
+                        sum += static_cast<const int16_t*>(data)[index] * (1.0f / 32768.0f);
+                        break;
+                    case FMOD_SOUND_FORMAT_PCM24: {
+                        auto bytes = static_cast<const uint8_t*>(data) + index * 3;
+                        int32_t value = static_cast<int32_t>(static_cast<uint32_t>(bytes[0]) << 8 | static_cast<uint32_t>(bytes[1]) << 16 | static_cast<uint32_t>(bytes[2]) << 24);
+                        sum += static_cast<float>(value >> 8) * (1.0f / 8388608.0f);
+                        break;
+                    }
+                    case FMOD_SOUND_FORMAT_PCM32:
+                        sum += static_cast<float>(static_cast<const int32_t*>(data)[index]) * (1.0f / 2147483648.0f);
+                        break;
+                    case FMOD_SOUND_FORMAT_PCMFLOAT:
+                        sum += static_cast<const float*>(data)[index];
+                        break;
+                    default:
+                        return false;
+                }
+            }
+            output[frame] = sum * scale;
+        }
+        return true;
+    }
+}
+
+SamplePool::SamplePool(size_t capacity) : arena{std::make_unique<float[]>(capacity)}, capacity{capacity} {
+}
+
+float* SamplePool::allocate(uint32_t length) {
+    if (length > capacity - used) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") sample pool full, " << length << " samples do not fit" << std::endl;
+        return nullptr;
+    }
+    return arena.get() + used;
+}
+
+uint32_t SamplePool::add(FMOD::Sound* sound) {
+    FMOD_SOUND_FORMAT format;
+    int channels;
+    auto result = sound->getFormat(nullptr, &format, &channels, nullptr);
+    FMOD_ERROR_RETURN(result, UINT32_MAX);
+
+    float frequency;
+    result = sound->getDefaults(&frequency, nullptr);
+    FMOD_ERROR_RETURN(result, UINT32_MAX);
+
+    unsigned int frames;
+    unsigned int bytes;
+    result = sound->getLength(&frames, FMOD_TIMEUNIT_PCM);
+    FMOD_ERROR_RETURN(result, UINT32_MAX);
+    result = sound->getLength(&bytes, FMOD_TIMEUNIT_PCMBYTES);
+    FMOD_ERROR_RETURN(result, UINT32_MAX);
+
+    float* output = allocate(frames);
+    if (!output)
+        return UINT32_MAX;
+
+    // Decoded samples are in memory already, lock hands out the whole of it
+    void* data;
+    void* wrapped;
+    unsigned int length;
+    unsigned int wrappedLength;
+    result = sound->lock(0, bytes, &data, &wrapped, &length, &wrappedLength);
+    FMOD_ERROR_RETURN(result, UINT32_MAX);
+    bool decoded = decode(data, format, channels, frames, output);
+    sound->unlock(data, wrapped, length, wrappedLength);
+    if (!decoded) {
+        std::cerr << "***ERROR*** (" << __FILE__ << ": " << __LINE__ << ") unsupported sample format " << format << std::endl;
+        return UINT32_MAX;
+    }
+
+    used += frames;
+    samples.push_back({ output, frames, frequency });
+    return static_cast<uint32_t>(samples.size() - 1);
+}
+
+uint32_t SamplePool::add(const float* data, uint32_t length, float frequency) {
+    float* output = allocate(length);
+    if (!output)
+        return UINT32_MAX;
+
+    std::copy(data, data + length, output);
+    used += length;
+    samples.push_back({ output, length, frequency });
+    return static_cast<uint32_t>(samples.size() - 1);
+}
+
+VariationEngine::VariationEngine(FMOD::System* system, const SamplePool& pool, const VariationSet& set, int sampleRate, uint32_t seed)
+    : system{system}, pool{pool}, set{set}, sampleRate{static_cast<float>(sampleRate)}, random{seed ? seed : 1} {
+    queue = std::make_unique<SPSCQueue<Grain, TriggerCapacity>>();
+
+    if (system) {
+        FMOD_DSP_DESCRIPTION dspdesc;
+        memset(&dspdesc, 0, sizeof(dspdesc));
+        std::strcpy(dspdesc.name, "DSP Variation Engine");
+        dspdesc.numinputbuffers = 0;
+        dspdesc.numoutputbuffers = 1;
+        dspdesc.process = processCallback;
+        dspdesc.userdata = this;
+
+        auto result = system->createDSP(&dspdesc, &dsp);
+        FMOD_ERROR_(result);
+    }
+}
+
+VariationEngine::~VariationEngine() {
+    stop();
+    if (dsp)
+        dsp->release();
+}
+
+bool VariationEngine::play(FMOD::ChannelGroup* bus, const glm::vec3& position) {
+    if (!dsp)
+        return false;
+
+    stop();
+
+    auto result = system->playDSP(dsp, bus, true, &channel);
+    FMOD_ERROR(result);
+    result = channel->setMode(FMOD_3D);
+    FMOD_ERROR(result);
+    FMOD_VECTOR at{ position.x, position.y, position.z };
+    FMOD_VECTOR velocity{ 0.0f, 0.0f, 0.0f };
+    result = channel->set3DAttributes(&at, &velocity);
+    FMOD_ERROR(result);
+    result = channel->setPaused(false);
+    FMOD_ERROR(result);
+    return true;
+}
+
+void VariationEngine::stop() {
+    if (channel)
+        channel->stop();
+    channel = nullptr;
+}
+
+bool VariationEngine::setPosition(const glm::vec3& position, const glm::vec3& velocity) {
+    if (!channel)
+        return false;
+
+    FMOD_VECTOR at{ position.x, position.y, position.z };
+    FMOD_VECTOR speed{ velocity.x, velocity.y, velocity.z };
+    auto result = channel->set3DAttributes(&at, &speed);
+    FMOD_ERROR(result);
+    return true;
+}
+
+float VariationEngine::uniform() {
+    // xorshift32, seeded per engine so a replay varies the same way
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return static_cast<float>(random >> 8) * (1.0f / 16777216.0f);
+}
+
+bool VariationEngine::trigger(float gain, float pitch) {
+    if (set.samples.empty())
+        return false;
+    triggers++;
+
+    // Any sample but the last one, a repeat is what the engine is here to hide
+    auto choices = static_cast<uint32_t>(set.samples.size());
+    uint32_t pick = 0;
+    if (choices > 1) {
+        pick = std::min(static_cast<uint32_t>(uniform() * static_cast<float>(choices - 1)), choices - 2);
+        if (last != UINT32_MAX && pick >= last)
+            pick++;
+    }
+    last = pick;
+
+    const auto& sample = pool.get(set.samples[pick]);
+    if (sample.length < 2) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    auto start = std::min(static_cast<uint32_t>(uniform() * set.offset * static_cast<float>(sample.length)), sample.length - 2);
+    uint32_t slice = sample.length - start;
+    if (set.maxLength > 0.0f) {
+        float seconds = set.minLength + uniform() * (set.maxLength - set.minLength);
+        slice = std::clamp(static_cast<uint32_t>(seconds * sample.frequency), 2u, slice);
+    }
+
+    float semitones = pitch + (2.0f * uniform() - 1.0f) * set.pitch;
+    float decibels = -uniform() * set.gain;
+
+    Grain grain;
+    grain.data = sample.data + start;
+    grain.length = slice;
+    grain.rate = sample.frequency / sampleRate * std::exp2(semitones / 12.0f);
+    grain.duration = std::max(static_cast<uint32_t>(static_cast<float>(slice - 1) / grain.rate), 1u);
+    grain.age = 0;
+    grain.delay = 0;
+    grain.attack = std::max(static_cast<uint32_t>(set.attack * sampleRate), 1u);
+    grain.release = std::max(static_cast<uint32_t>(set.release * sampleRate), 1u);
+    grain.gain = gain * std::pow(10.0f, decibels / 20.0f);
+    grain.position = 0.0;
+
+    if (!queue->push(grain)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool VariationEngine::isIdle() const {
+    return count == 0 && queue->size() == 0;
+}
+
+void VariationEngine::process(float* output, unsigned int length) {
+    std::memset(output, 0, length * sizeof(float));
+
+    // Grains queued during one block start spread across the next, not all on its first sample
+    auto fresh = static_cast<uint32_t>(queue->pop(started.data(), started.size()));
+    for (uint32_t i = 0; i < fresh; i++) {
+        if (count == MaxGrains) {
+            dropped.fetch_add(fresh - i, std::memory_order_relaxed);
+            break;
+        }
+        grains[count] = started[i];
+        grains[count].delay = i * length / fresh;
+        count++;
+    }
+
+    for (uint32_t i = 0; i < count;) {
+        auto& grain = grains[i];
+
+        unsigned int first = grain.delay;
+        grain.delay = 0;
+        unsigned int frames = std::min<unsigned int>(length - first, grain.duration - grain.age);
+
+        float invAttack = 1.0f / static_cast<float>(grain.attack);
+        float invRelease = 1.0f / static_cast<float>(grain.release);
+        const float* data = grain.data;
+        uint32_t end = grain.length - 1;
+        for (unsigned int n = 0; n < frames; n++) {
+            auto index = static_cast<uint32_t>(grain.position);
+            float fraction = static_cast<float>(grain.position - index);
+            float a = data[index];
+            float b = data[std::min(index + 1, end)];
+            float envelope = std::min({ 1.0f, static_cast<float>(grain.age + 1) * invAttack, static_cast<float>(grain.duration - grain.age) * invRelease });
+            output[first + n] += grain.gain * envelope * (a + (b - a) * fraction);
+            grain.position += grain.rate;
+            grain.age++;
+        }
+
+        if (grain.age >= grain.duration)
+            grains[i] = grains[--count];
+        else
+            i++;
+    }
+
+    active.store(count, std::memory_order_relaxed);
+}
+
+VariationStats VariationEngine::getStats() const {
+    return { triggers, dropped.load(std::memory_order_relaxed), active.load(std::memory_order_relaxed) };
+}
+
+FMOD_RESULT F_CALLBACK VariationEngine::processCallback(FMOD_DSP_STATE* dsp_state, unsigned int length, const FMOD_DSP_BUFFER_ARRAY* inbufferarray, FMOD_DSP_BUFFER_ARRAY* outbufferarray, FMOD_BOOL inputsidle, FMOD_DSP_PROCESS_OPERATION op) {
+    void* userdata;
+    static_cast<FMOD::DSP*>(dsp_state->instance)->getUserData(&userdata);
+    auto engine = static_cast<VariationEngine*>(userdata);
+
+    if (op == FMOD_DSP_PROCESS_QUERY) {
+        // A mono generator, the channel's panner places it
+        if (outbufferarray) {
+            outbufferarray->speakermode = FMOD_SPEAKERMODE_MONO;
+            outbufferarray->buffernumchannels[0] = 1;
+            outbufferarray->bufferchannelmask[0] = 0;
+        }
+        return engine->isIdle() ? FMOD_ERR_DSP_SILENCE : FMOD_OK;
+    }
+
+    engine->process(outbufferarray->buffers[0], length);
+    return FMOD_OK;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "spscqueue.hpp"
+
+/// @brief Append only arena of pre-decoded mono PCM for short samples
+/// Samples are decoded once into one fixed block and never move, so the mixer reads them through plain
+/// pointers with no lock and no reference counting. The arena does not grow: an add that does not fit fails.
+class SamplePool {
+public:
+    static constexpr size_t DefaultCapacity = 4u << 20; // samples, 16 MB
+
+    struct Sample {
+        const float* data;
+        uint32_t length;
+        float frequency; // Hz the sample was recorded at
+    };
+
+    explicit SamplePool(size_t capacity = DefaultCapacity);
+
+    /// @brief Decode a sound created with FMOD_CREATESAMPLE, channels are averaged, UINT32_MAX if it fails
+    uint32_t add(FMOD::Sound* sound);
+    uint32_t add(const float* data, uint32_t length, float frequency);
+
+    const Sample& get(uint32_t index) const { return samples[index]; }
+    size_t size() const { return samples.size(); }
+    size_t getUsed() const { return used; }
+    size_t getCapacity() const { return capacity; }
+
+private:
+    std::unique_ptr<float[]> arena;
+    size_t capacity;
+    size_t used{ 0 };
+    std::vector<Sample> samples;
+
+    float* allocate(uint32_t length);
+};
+
+/// @brief How the triggers of one engine vary
+struct VariationSet {
+    std::vector<uint32_t> samples; // SamplePool indices, picked at random, never the same one twice in a row
+    float pitch{ 1.0f }; // semitones either way
+    float gain{ 3.0f }; // dB of random attenuation
+    float offset{ 0.0f }; // fraction of the sample a slice may start into
+    float minLength{ 0.0f }; // seconds of source per slice, 0 plays to the end
+    float maxLength{ 0.0f };
+    float attack{ 0.002f }; // seconds
+    float release{ 0.01f }; // seconds, also fades slices cut before the end
+};
+
+struct VariationStats {
+    uint64_t triggers; // queued by trigger()
+    uint64_t dropped; // ring full or every grain busy
+    uint32_t active; // grains in the last block
+};
+
+/// @brief Randomized one shot variations of short samples, mixed by a generator DSP
+/// Each trigger picks a sample, a slice of it, a pitch, a gain and a fade, and queues that grain on a
+/// lock-free ring. The DSP starts queued grains spread across its next block and mixes up to MaxGrains
+/// of them with linear interpolation, straight from the SamplePool. A trigger allocates nothing and
+/// opens nothing, and one engine plays on one 3D channel, so a burst of impacts is one voice to the
+/// mixer rather than one each. Idle engines report silence and cost no mixer time.
+class VariationEngine {
+public:
+    static constexpr uint32_t MaxGrains = 64; // overlapping per engine
+    static constexpr size_t TriggerCapacity = 256; // queued per block
+
+    /// @brief system may be nullptr for offline use through process(), the pool must outlive the engine
+    VariationEngine(FMOD::System* system, const SamplePool& pool, const VariationSet& set, int sampleRate, uint32_t seed = 1);
+    ~VariationEngine();
+
+    VariationEngine(const VariationEngine&) = delete;
+    VariationEngine& operator=(const VariationEngine&) = delete;
+
+    /// @brief Start the engine's channel on a bus, positioned in 3D
+    bool play(FMOD::ChannelGroup* bus, const glm::vec3& position);
+    void stop();
+    bool setPosition(const glm::vec3& position, const glm::vec3& velocity);
+
+    /// @brief Game thread: queue one variant, gain and pitch (semitones) scale the random ones
+    bool trigger(float gain = 1.0f, float pitch = 0.0f);
+
+    /// @brief Mixer thread: mix the active grains into a mono block
+    void process(float* output, unsigned int length);
+    /// @brief Mixer thread: nothing playing and nothing queued
+    bool isIdle() const;
+
+    FMOD::DSP* getDSP() const { return dsp; }
+    FMOD::Channel* getChannel() const { return channel; }
+    const VariationSet& getSet() const { return set; }
+    VariationStats getStats() const;
+
+private:
+    struct Grain {
+        const float* data;
+        uint32_t length; // source samples of the slice
+        uint32_t duration; // output samples
+        uint32_t age; // output samples played
+        uint32_t delay; // output samples into its first block
+        uint32_t attack;
+        uint32_t release;
+        float rate; // source samples per output sample
+        float gain;
+        double position;
+    };
+
+    FMOD::System* system;
+    const SamplePool& pool;
+    VariationSet set;
+    float sampleRate;
+    FMOD::DSP* dsp{ nullptr };
+    FMOD::Channel* channel{ nullptr };
+
+    // Game thread
+    uint32_t random;
+    uint32_t last{ UINT32_MAX }; // index into set.samples
+    uint64_t triggers{ 0 };
+
+    std::unique_ptr<SPSCQueue<Grain, TriggerCapacity>> queue;
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<uint32_t> active{ 0 };
+
+    // Mixer thread
+    std::array<Grain, MaxGrains> grains;
+    uint32_t count{ 0 };
+    std::array<Grain, TriggerCapacity> started;
+
+    float uniform(); // [0, 1)
+
+    static FMOD_RESULT F_CALLBACK processCallback(FMOD_DSP_STATE* dsp_state, unsigned int length, const FMOD_DSP_BUFFER_ARRAY* inbufferarray, FMOD_DSP_BUFFER_ARRAY* outbufferarray, FMOD_BOOL inputsidle, FMOD_DSP_PROCESS_OPERATION op);
+};
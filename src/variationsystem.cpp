@@ -0,0 +1,33 @@
+#include "variationsystem.hpp"
+#include "components.hpp"
+#include "common.hpp"
+
+void VariationSystem::update(entt::registry& registry, float dt) {
+    float invDt = dt > 0.0f ? 1.0f / dt : 0.0f;
+
+    auto view = registry.view<VariationComponent, TransformComponent>();
+    for (auto entity : view) {
+        auto [component, transform] = view.get<VariationComponent, TransformComponent>(entity);
+        auto engine = component.engine;
+        if (!engine)
+            continue;
+
+        // Same rule as the emitters: a still engine costs a compare
+        bool moved = transform.translation != component.position;
+        glm::vec3 velocity = moved && !component.dirty ? (transform.translation - component.position) * invDt : vec3::zero;
+        if (component.dirty || moved || velocity != component.velocity) {
+            engine->setPosition(transform.translation, velocity);
+            component.position = transform.translation;
+            component.velocity = velocity;
+            component.dirty = false;
+        }
+
+        component.pending += component.rate * dt;
+        for (; component.pending >= 1.0f; component.pending -= 1.0f) {
+            engine->trigger(component.gain, component.pitch);
+        }
+        for (; component.triggers > 0; component.triggers--) {
+            engine->trigger(component.gain, component.pitch);
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <entt/entity/registry.hpp>
+
+/// @brief Moves variation engines with their entities and fires their triggers
+/// A rate turns into whole triggers as time accumulates, so an engine idling at a few triggers per
+/// second stays in step with the frame rate instead of firing once per frame.
+class VariationSystem {
+public:
+    void update(entt::registry& registry, float dt);
+};
@@ -0,0 +1,186 @@
+#include "voicepool.hpp"
+#include "fmoderror.hpp"
+
+VoicePool::VoicePool(FMOD::System* system) : system{system} {
+    // Thread every slot onto the free list
+    for (uint32_t i = 0; i < MaxVoices; i++) {
+        voices[i].next = i + 1 < MaxVoices ? i + 1 : UINT32_MAX;
+    }
+}
+
+VoicePool::~VoicePool() {
+    for (auto& voice : voices) {
+        if (voice.active)
+            voice.channel->stop();
+    }
+}
+
+VoiceHandle VoicePool::play(const SoundRef& sound, FMOD::ChannelGroup* group, const FMOD_VECTOR* position, float volume, int priority, bool paused) {
+    uint32_t index = allocate(priority);
+    if (index == UINT32_MAX)
+        return {};
+
+    auto& voice = voices[index];
+
+    // Start paused so every property is applied before the first mix
+    FMOD::Channel* channel;
+    auto result = system->playSound(sound.get(), group, true, &channel);
+    if (result != FMOD_OK)
+        release(index);
+    FMOD_ERROR_RETURN(result, {});
+
+    voice.channel = channel;
+    voice.sound = sound;
+    voice.priority = priority;
+    voice.audibility = volume;
+    voice.volume = volume;
+    voice.position = position ? glm::vec3{ position->x, position->y, position->z } : glm::vec3{ 0.0f };
+    VoiceHandle handle{ index, voice.generation };
+
+    FMOD_MODE mode;
+    result = sound->getMode(&mode);
+    if (result == FMOD_OK)
+        result = channel->setPriority(priority);
+    if (result == FMOD_OK)
+        result = channel->setVolumeRamp(false);
+    if (result == FMOD_OK)
+        result = channel->setVolume(volume);
+    if (result == FMOD_OK && position && (mode & FMOD_3D)) {
+        FMOD_VECTOR velocity{ 0.0f, 0.0f, 0.0f };
+        result = channel->set3DAttributes(position, &velocity);
+    }
+    if (result == FMOD_OK)
+        result = channel->setPaused(paused);
+    if (result != FMOD_OK)
+        stop(handle);
+    FMOD_ERROR_RETURN(result, {});
+
+    return handle;
+}
+
+void VoicePool::stop(VoiceHandle handle) {
+    if (auto channel = get(handle)) {
+        channel->stop();
+        release(handle.index);
+    }
+}
+
+FMOD::Channel* VoicePool::get(VoiceHandle handle) const {
+    if (handle.index >= MaxVoices)
+        return nullptr;
+
+    const auto& voice = voices[handle.index];
+    if (!voice.active || voice.generation != handle.generation)
+        return nullptr;
+
+    return voice.channel;
+}
+
+void VoicePool::setPosition(VoiceHandle handle, const glm::vec3& position) {
+    if (get(handle))
+        voices[handle.index].position = position;
+}
+
+glm::vec3 VoicePool::getPosition(VoiceHandle handle) const {
+    return get(handle) ? voices[handle.index].position : glm::vec3{ 0.0f };
+}
+
+void VoicePool::setGain(VoiceHandle handle, float gain) {
+    if (auto channel = get(handle))
+        channel->setVolume(voices[handle.index].volume * gain);
+}
+
+float VoicePool::getVolume(VoiceHandle handle) const {
+    return get(handle) ? voices[handle.index].volume : 0.0f;
+}
+
+FMOD::Sound* VoicePool::getSound(VoiceHandle handle) const {
+    return get(handle) ? voices[handle.index].sound.get() : nullptr;
+}
+
+VoiceHandle VoicePool::handleAt(uint32_t index) const {
+    if (index >= MaxVoices || !voices[index].active)
+        return {};
+    return { index, voices[index].generation };
+}
+
+void VoicePool::update() {
+    victimCount = 0;
+    victimCursor = 0;
+
+    for (uint32_t i = 0; i < MaxVoices; i++) {
+        auto& voice = voices[i];
+        if (!voice.active)
+            continue;
+
+        // Channels that ended or were stolen by FMOD return an invalid handle error
+        bool playing = false;
+        if (voice.channel->isPlaying(&playing) != FMOD_OK || !playing) {
+            release(i);
+            continue;
+        }
+
+        // Audibility includes volume, distance rolloff and occlusion
+        voice.channel->getAudibility(&voice.audibility);
+
+        victims[victimCount++] = { i, voice.generation };
+    }
+
+    std::sort(victims.begin(), victims.begin() + victimCount, [this](const VoiceHandle& a, const VoiceHandle& b) {
+        const auto& va = voices[a.index];
+        const auto& vb = voices[b.index];
+        if (va.priority != vb.priority)
+            return va.priority > vb.priority;
+        return va.audibility < vb.audibility;
+    });
+}
+
+uint32_t VoicePool::allocate(int priority) {
+    if (freeHead == UINT32_MAX) {
+        // Pool is full, take the next candidate from the steal order
+        while (victimCursor < victimCount) {
+            auto victim = victims[victimCursor];
+            auto& voice = voices[victim.index];
+            if (!voice.active || voice.generation != victim.generation) {
+                victimCursor++;
+                continue;
+            }
+
+            // The order is sorted, nothing behind this one is less important
+            if (voice.priority < priority)
+                return UINT32_MAX;
+
+            victimCursor++;
+            voice.channel->stop();
+            release(victim.index);
+            stolenCount++;
+            break;
+        }
+
+        if (freeHead == UINT32_MAX)
+            return UINT32_MAX;
+    }
+
+    uint32_t index = freeHead;
+    auto& voice = voices[index];
+    freeHead = voice.next;
+    voice.next = UINT32_MAX;
+    voice.active = true;
+    activeCount++;
+
+    return index;
+}
+
+void VoicePool::release(uint32_t index) {
+    auto& voice = voices[index];
+    if (!voice.active)
+        return;
+
+    voice.active = false;
+    voice.channel = nullptr;
+    voice.sound = {};
+    voice.generation++;
+    voice.next = freeHead;
+    freeHead = index;
+    activeCount--;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <fmod.hpp>
+
+#include "soundcache.hpp"
+
+/// @brief Generation checked reference to a pooled voice
+/// A handle outlives its voice safely: once the slot is reused the generation no longer matches
+struct VoiceHandle {
+    uint32_t index{ UINT32_MAX };
+    uint32_t generation{ 0 };
+
+    explicit operator bool() const { return index != UINT32_MAX; }
+    bool operator==(const VoiceHandle& other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(const VoiceHandle& other) const { return !(*this == other); }
+};
+
+/// @brief Fixed capacity pool of FMOD channels addressed by handles
+/// Priorities follow FMOD: 0 is the most important, 256 the least.
+/// FMOD virtualizes the quietest voices beyond the real channel count on its own,
+/// the pool only steals when every slot is taken: least important first, then least audible.
+class VoicePool {
+public:
+    static constexpr uint32_t MaxVoices = 512;
+    static constexpr int DefaultPriority = 128;
+
+    explicit VoicePool(FMOD::System* system);
+    ~VoicePool();
+
+    VoiceHandle play(const SoundRef& sound, FMOD::ChannelGroup* group, const FMOD_VECTOR* position, float volume, int priority, bool paused);
+    void stop(VoiceHandle handle);
+
+    /// @brief Resolve a handle, nullptr if the voice has finished or was stolen
+    FMOD::Channel* get(VoiceHandle handle) const;
+
+    /// @brief Last emitter position given to the voice, for engine side queries such as occlusion
+    void setPosition(VoiceHandle handle, const glm::vec3& position);
+    glm::vec3 getPosition(VoiceHandle handle) const;
+    /// @brief Scale the volume the voice was started with, for engine side mixing such as LOD clusters
+    void setGain(VoiceHandle handle, float gain);
+    float getVolume(VoiceHandle handle) const;
+    FMOD::Sound* getSound(VoiceHandle handle) const;
+    /// @brief Handle of the voice in a slot, empty if the slot is free
+    VoiceHandle handleAt(uint32_t index) const;
+
+    /// @brief Reclaim finished voices and refresh the steal order, once per tick
+    void update();
+
+    uint32_t getActiveCount() const { return activeCount; }
+    uint32_t getStolenCount() const { return stolenCount; }
+
+private:
+    struct Voice {
+        FMOD::Channel* channel{ nullptr };
+        SoundRef sound; // keeps the sound out of the cache LRU while it plays
+        glm::vec3 position{ 0.0f };
+        float volume{ 1.0f }; // as started, before setGain
+        uint32_t generation{ 0 };
+        uint32_t next{ UINT32_MAX };
+        int priority{ DefaultPriority };
+        float audibility{ 0.0f };
+        bool active{ false };
+    };
+
+    FMOD::System* system;
+
+    std::array<Voice, MaxVoices> voices;
+    uint32_t freeHead{ 0 };
+    uint32_t activeCount{ 0 };
+    uint32_t stolenCount{ 0 };
+
+    // Steal order built in update(), least important and quietest first
+    std::array<VoiceHandle, MaxVoices> victims;
+    uint32_t victimCount{ 0 };
+    uint32_t victimCursor{ 0 };
+
+    uint32_t allocate(int priority);
+    void release(uint32_t index);
+};
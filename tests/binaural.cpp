@@ -0,0 +1,68 @@
+#include "binaural.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// Sources at +-90 degrees azimuth, where the synthesized near ear delay is 0 samples, rendered in
+// blocks as long as the renderer was sized for. Both the steady and the gliding delay paths read the
+// sample after each output sample, run under a sanitizer to catch reads past the source history.
+// Usage: binauralTest
+
+namespace {
+    constexpr unsigned int Length = 1024; // maxBlock, the longest block the renderer takes
+    constexpr int Channels = 2;
+    constexpr int Blocks = 8;
+
+    /// @brief Renders one source held at position, then gliding to the side, returns false on a bad mix
+    bool renderSide(const std::shared_ptr<const HRIRSet>& hrirs, float side) {
+        BinauralRenderer renderer{ nullptr, hrirs, Length };
+        uint32_t source = renderer.addSource();
+
+        std::vector<float> mono(Length);
+        for (unsigned int i = 0; i < Length; i++) {
+            mono[i] = std::sin(static_cast<float>(i) * 0.05f);
+        }
+        std::vector<float> bus(Length * Channels, 0.0f);
+        std::vector<float> outbuffer(Length * Channels);
+
+        // Half the blocks held at the side, then swinging in front and back out
+        double energy[2] = { 0.0, 0.0 };
+        for (int block = 0; block < Blocks * 2; block++) {
+            float x = block < Blocks || block % 2 ? 3.0f * side : 0.0f;
+            float z = block < Blocks || block % 2 ? 0.0f : 3.0f;
+            renderer.setSourcePosition(source, { x, 0.0f, z });
+            renderer.send(source, mono.data(), Length, 1);
+            renderer.render(bus.data(), outbuffer.data(), Length, Channels, Channels);
+
+            for (unsigned int i = 0; i < Length; i++) {
+                for (int ear = 0; ear < Channels; ear++) {
+                    float sample = outbuffer[i * Channels + ear];
+                    if (!std::isfinite(sample)) {
+                        std::cerr << "Non finite sample " << i << " of block " << block << " at side " << side << std::endl;
+                        return false;
+                    }
+                    if (block < Blocks)
+                        energy[ear] += static_cast<double>(sample) * sample;
+                }
+            }
+        }
+
+        // x is to the right of the default listener, the near ear has to carry more of the source
+        int near = side > 0.0f ? 1 : 0;
+        if (energy[near] <= energy[1 - near]) {
+            std::cerr << "Near ear quieter than the far one at side " << side << ": " << energy[near] << " vs " << energy[1 - near] << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+int main() {
+    auto hrirs = HRIRSet::synthesize(48000);
+
+    bool passed = renderSide(hrirs, 1.0f) && renderSide(hrirs, -1.0f);
+    std::cout << (passed ? "binaural: passed" : "binaural: failed") << std::endl;
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,120 @@
+#include "soundbank.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Packs every audio file below a directory into one bank for SoundCache::mount
+// Usage: soundPack <directory> <output.bank>
+// Entries are named by their path as walked from the given directory, so run it from the directory the game runs from
+// (soundPack resources/audio resources/audio.bank) and the names match the paths passed to loadSound.
+
+namespace {
+    struct Input {
+        std::filesystem::path file;
+        std::string name;
+        bank::Entry entry;
+    };
+
+    uint64_t align(uint64_t value) {
+        return (value + bank::Alignment - 1) & ~(bank::Alignment - 1);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <directory> <output.bank>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::filesystem::path directory{ argv[1] };
+    std::filesystem::path output{ argv[2] };
+
+    std::error_code error;
+    std::vector<Input> inputs;
+    for (const auto& item : std::filesystem::recursive_directory_iterator(directory, error)) {
+        if (!item.is_regular_file())
+            continue;
+
+        auto name = item.path().generic_string();
+        auto codec = bank::codecFromExtension(name);
+        if (codec == bank::Codec::Unknown)
+            continue;
+
+        Input input;
+        input.file = item.path();
+        input.name = name;
+        input.entry = {};
+        input.entry.hash = bank::hash(name);
+        input.entry.length = item.file_size();
+        input.entry.codec = codec;
+        inputs.push_back(input);
+    }
+
+    if (error) {
+        std::cerr << "Failed to read " << directory << ": " << error.message() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::sort(inputs.begin(), inputs.end(), [](const Input& a, const Input& b) { return a.entry.hash < b.entry.hash; });
+
+    for (size_t i = 1; i < inputs.size(); i++) {
+        if (inputs[i].entry.hash == inputs[i - 1].entry.hash) {
+            std::cerr << "Hash collision between " << inputs[i - 1].name << " and " << inputs[i].name << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Lay out the blobs after the index
+    uint64_t offset = align(sizeof(bank::Header) + inputs.size() * sizeof(bank::Entry));
+    for (auto& input : inputs) {
+        input.entry.offset = offset;
+        offset = align(offset + input.entry.length);
+    }
+
+    std::ofstream file{ output, std::ios::binary | std::ios::trunc };
+    if (!file) {
+        std::cerr << "Failed to create " << output << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    bank::Header header{};
+    header.magic = bank::Magic;
+    header.version = bank::Version;
+    header.count = static_cast<uint32_t>(inputs.size());
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    for (const auto& input : inputs) {
+        file.write(reinterpret_cast<const char*>(&input.entry), sizeof(input.entry));
+    }
+
+    std::vector<char> buffer;
+    for (const auto& input : inputs) {
+        std::ifstream source{ input.file, std::ios::binary };
+        buffer.resize(input.entry.length);
+        if (!source.read(buffer.data(), static_cast<std::streamsize>(buffer.size()))) {
+            std::cerr << "Failed to read " << input.file << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // Zero padding up to the entry's aligned offset
+        auto position = static_cast<uint64_t>(file.tellp());
+        std::vector<char> padding(input.entry.offset - position, 0);
+        file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+
+        std::cout << input.name << " (" << input.entry.length << " bytes)" << std::endl;
+    }
+
+    if (!file) {
+        std::cerr << "Failed to write " << output << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Packed " << inputs.size() << " sounds into " << output << " (" << file.tellp() << " bytes)" << std::endl;
+    return EXIT_SUCCESS;
+}